@@ -0,0 +1,207 @@
+#include "BlockCache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+
+
+bool BlockCache::Key::operator==(const Key& other) const noexcept {
+  return namespaceId == other.namespaceId && blockIndex == other.blockIndex && filenameKey == other.filenameKey;
+}
+
+
+std::size_t BlockCache::KeyHash::operator()(const Key& key) const noexcept {
+  std::size_t hash = std::hash<std::wstring>()(key.filenameKey);
+  hash ^= std::hash<std::uint64_t>()(key.namespaceId) + 0x9E3779B9 + (hash << 6) + (hash >> 2);
+  hash ^= std::hash<ULONGLONG>()(key.blockIndex) + 0x9E3779B9 + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+
+
+BlockCache::BlockCache(std::size_t maxBytes, std::size_t blockSize) :
+  mBlockSize(blockSize),
+  mShardMaxBytes(maxBytes / NumShards),
+  mShardInMaxBytes(maxBytes / NumShards / 4),
+  // 2Q keeps as many ghost keys as half of the blocks that fit in the cache
+  mShardMaxGhosts(blockSize ? std::max<std::size_t>(maxBytes / NumShards / blockSize / 2, 1) : 0),
+  mShards(),
+  mNextNamespaceId(1),
+  mHits(0),
+  mMisses(0)
+{}
+
+
+BlockCache::Shard& BlockCache::GetShard(const Key& key) {
+  // consecutive blocks of a file differ only in the lower bits of the hash, so mix them before picking a shard
+  std::uint64_t hash = KeyHash()(key);
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDull;
+  hash ^= hash >> 33;
+  return mShards[hash % NumShards];
+}
+
+
+// shard.mutex must be held
+void BlockCache::EraseEntryL(Shard& shard, std::unordered_map<Key, Entry, KeyHash>::iterator itr) {
+  const std::size_t size = itr->second.block->size();
+  if (itr->second.queue == Queue::In) {
+    shard.inBytes -= size;
+    shard.inQueue.erase(itr->second.queueItr);
+  } else {
+    shard.mainBytes -= size;
+    shard.mainQueue.erase(itr->second.queueItr);
+  }
+  shard.entryMap.erase(itr);
+}
+
+
+// shard.mutex must be held
+void BlockCache::RememberGhostL(Shard& shard, Key key) {
+  if (shard.ghostMap.count(key)) {
+    return;
+  }
+  shard.ghostQueue.push_front(key);
+  shard.ghostMap.emplace(std::move(key), shard.ghostQueue.begin());
+  while (shard.ghostQueue.size() > mShardMaxGhosts) {
+    shard.ghostMap.erase(shard.ghostQueue.back());
+    shard.ghostQueue.pop_back();
+  }
+}
+
+
+// shard.mutex must be held
+// evicts from A1in while it exceeds its share so that blocks read only once leave first, otherwise from the tail of Am
+void BlockCache::EvictL(Shard& shard) {
+  while (shard.inBytes + shard.mainBytes > mShardMaxBytes) {
+    if (!shard.inQueue.empty() && (shard.inBytes > mShardInMaxBytes || shard.mainQueue.empty())) {
+      Key key = shard.inQueue.back();
+      EraseEntryL(shard, shard.entryMap.find(key));
+      RememberGhostL(shard, std::move(key));
+    } else if (!shard.mainQueue.empty()) {
+      EraseEntryL(shard, shard.entryMap.find(shard.mainQueue.back()));
+    } else {
+      break;
+    }
+  }
+}
+
+
+bool BlockCache::IsEnabled() const {
+  return mBlockSize && mShardMaxBytes >= mBlockSize;
+}
+
+
+std::size_t BlockCache::GetBlockSize() const {
+  return mBlockSize;
+}
+
+
+std::uint64_t BlockCache::NewNamespace() {
+  return mNextNamespaceId++;
+}
+
+
+void BlockCache::RemoveNamespace(std::uint64_t namespaceId) {
+  for (auto& shard : mShards) {
+    std::lock_guard lock(shard.mutex);
+    for (auto itr = shard.entryMap.begin(); itr != shard.entryMap.end(); ) {
+      if (itr->first.namespaceId == namespaceId) {
+        const auto eraseItr = itr++;
+        EraseEntryL(shard, eraseItr);
+      } else {
+        itr++;
+      }
+    }
+    for (auto itr = shard.ghostQueue.begin(); itr != shard.ghostQueue.end(); ) {
+      if (itr->namespaceId == namespaceId) {
+        shard.ghostMap.erase(*itr);
+        itr = shard.ghostQueue.erase(itr);
+      } else {
+        itr++;
+      }
+    }
+  }
+}
+
+
+std::shared_ptr<const BlockCache::Block> BlockCache::Get(std::uint64_t namespaceId, std::wstring_view filenameKey, ULONGLONG blockIndex) {
+  const Key key{namespaceId, std::wstring(filenameKey), blockIndex};
+  auto& shard = GetShard(key);
+  std::lock_guard lock(shard.mutex);
+  const auto itr = shard.entryMap.find(key);
+  if (itr == shard.entryMap.end()) {
+    mMisses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  mHits.fetch_add(1, std::memory_order_relaxed);
+  // a hit in A1in is not a proof of reuse (it is likely to be the same scan), so only Am is reordered
+  if (itr->second.queue == Queue::Main) {
+    shard.mainQueue.splice(shard.mainQueue.begin(), shard.mainQueue, itr->second.queueItr);
+  }
+  return itr->second.block;
+}
+
+
+// does not count as an access
+bool BlockCache::Contains(std::uint64_t namespaceId, std::wstring_view filenameKey, ULONGLONG blockIndex) {
+  const Key key{namespaceId, std::wstring(filenameKey), blockIndex};
+  auto& shard = GetShard(key);
+  std::lock_guard lock(shard.mutex);
+  return shard.entryMap.count(key);
+}
+
+
+void BlockCache::Set(std::uint64_t namespaceId, std::wstring_view filenameKey, ULONGLONG blockIndex, std::shared_ptr<const Block> block) {
+  if (!IsEnabled() || !block || block->empty() || block->size() > mBlockSize) {
+    return;
+  }
+
+  Key key{namespaceId, std::wstring(filenameKey), blockIndex};
+  auto& shard = GetShard(key);
+  std::lock_guard lock(shard.mutex);
+  if (shard.entryMap.count(key)) {
+    // sources are immutable, so the cached block is as good as the new one
+    return;
+  }
+
+  const std::size_t size = block->size();
+  if (const auto ghostItr = shard.ghostMap.find(key); ghostItr != shard.ghostMap.end()) {
+    // requested again after leaving A1in; this block is worth keeping
+    shard.ghostQueue.erase(ghostItr->second);
+    shard.ghostMap.erase(ghostItr);
+    shard.mainQueue.push_front(key);
+    shard.mainBytes += size;
+    shard.entryMap.emplace(std::move(key), Entry{std::move(block), Queue::Main, shard.mainQueue.begin()});
+  } else {
+    shard.inQueue.push_front(key);
+    shard.inBytes += size;
+    shard.entryMap.emplace(std::move(key), Entry{std::move(block), Queue::In, shard.inQueue.begin()});
+  }
+  EvictL(shard);
+}
+
+
+BlockCache::Statistics BlockCache::GetStatistics() {
+  Statistics statistics{
+    mHits.load(std::memory_order_relaxed),
+    mMisses.load(std::memory_order_relaxed),
+    0,
+    0,
+  };
+  for (auto& shard : mShards) {
+    std::lock_guard lock(shard.mutex);
+    statistics.numBlocks += shard.entryMap.size();
+    statistics.usedBytes += shard.inBytes + shard.mainBytes;
+  }
+  return statistics;
+}
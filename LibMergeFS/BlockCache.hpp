@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+
+// caches fixed-size blocks of file data read from immutable (SOURCE_INFO::cacheable) sources, shared by all mounts
+// blocks are keyed by (namespace, FilenameToKey(resolvedFilename), block index); each mount source gets its own namespace
+// eviction follows 2Q so that a single sequential scan does not flush the blocks which are read repeatedly:
+// a new block enters the A1in FIFO, and only a block which is requested again after falling out of A1in
+// (its key is remembered in the A1out ghost queue) is promoted to the Am LRU queue
+class BlockCache {
+public:
+  using Block = std::vector<char>;    // shorter than the block size if it contains the end of the file
+
+  struct Statistics {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::size_t numBlocks;
+    std::size_t usedBytes;
+  };
+
+private:
+  static constexpr std::size_t NumShards = 16;
+
+  struct Key {
+    std::uint64_t namespaceId;
+    std::wstring filenameKey;
+    ULONGLONG blockIndex;
+
+    bool operator==(const Key& other) const noexcept;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const noexcept;
+  };
+
+  enum class Queue {
+    In,     // A1in
+    Main,   // Am
+  };
+
+  struct Entry {
+    std::shared_ptr<const Block> block;
+    Queue queue;
+    std::list<Key>::iterator queueItr;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<Key, Entry, KeyHash> entryMap;
+    std::list<Key> inQueue;       // front is the newest
+    std::list<Key> mainQueue;     // front is the most recently used
+    std::unordered_map<Key, std::list<Key>::iterator, KeyHash> ghostMap;
+    std::list<Key> ghostQueue;    // front is the most recently evicted from A1in
+    std::size_t inBytes = 0;
+    std::size_t mainBytes = 0;
+  };
+
+  const std::size_t mBlockSize;
+  const std::size_t mShardMaxBytes;
+  const std::size_t mShardInMaxBytes;
+  const std::size_t mShardMaxGhosts;
+  std::array<Shard, NumShards> mShards;
+  std::atomic<std::uint64_t> mNextNamespaceId;
+  std::atomic<std::uint64_t> mHits;
+  std::atomic<std::uint64_t> mMisses;
+
+  Shard& GetShard(const Key& key);
+  void EraseEntryL(Shard& shard, std::unordered_map<Key, Entry, KeyHash>::iterator itr);
+  void RememberGhostL(Shard& shard, Key key);
+  void EvictL(Shard& shard);
+
+public:
+  BlockCache(const BlockCache&) = delete;
+
+  BlockCache(std::size_t maxBytes, std::size_t blockSize);
+
+  bool IsEnabled() const;
+  std::size_t GetBlockSize() const;
+  std::uint64_t NewNamespace();
+  void RemoveNamespace(std::uint64_t namespaceId);
+  std::shared_ptr<const Block> Get(std::uint64_t namespaceId, std::wstring_view filenameKey, ULONGLONG blockIndex);
+  bool Contains(std::uint64_t namespaceId, std::wstring_view filenameKey, ULONGLONG blockIndex);
+  void Set(std::uint64_t namespaceId, std::wstring_view filenameKey, ULONGLONG blockIndex, std::shared_ptr<const Block> block);
+  Statistics GetStatistics();
+};
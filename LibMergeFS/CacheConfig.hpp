@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+
+namespace CacheConfig {
+  // Mount::GetMountSourceIndexR; set LookupCacheMaxEntries or LookupCacheTtl to 0 to disable
+  constexpr std::size_t LookupCacheMaxEntries = 65536;
+  // changes made through the mount invalidate the entries at once; this bounds how long a change made directly to a
+  // source (outside of the mount) stays unnoticed
+  constexpr std::chrono::milliseconds LookupCacheTtl = std::chrono::milliseconds(5000);
+  // invalidations are counted per bucket of hashed paths, so that a change only keeps the lookups of the paths under it
+  // (and of the paths sharing their buckets) which were running meanwhile from being cached
+  constexpr std::size_t LookupCacheGenerationBuckets = 1024;
+
+  // Mount::DFindFiles; set ListingCacheMaxBytes or ListingCacheTtl to 0 to disable
+  constexpr std::size_t ListingCacheMaxBytes = 64 * 1024 * 1024;
+  // lower-layer sources may change underneath us, so cached listings expire after this period
+  constexpr std::chrono::milliseconds ListingCacheTtl = std::chrono::milliseconds(5000);
+
+  // Mount::ReadSourceR; shared by all mounts and used only for sources with SOURCE_INFO::cacheable; set BlockCacheMaxBytes to 0 to disable
+  constexpr std::size_t BlockCacheMaxBytes = 256 * 1024 * 1024;
+  constexpr std::size_t BlockCacheBlockSize = 64 * 1024;
+}
@@ -0,0 +1,168 @@
+#include "ConcurrencyLimiter.hpp"
+#include "DokanConfig.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+
+
+ConcurrencyLimiter::Permit::Permit() noexcept :
+  mLimiter(nullptr),
+  mBegin()
+{}
+
+
+ConcurrencyLimiter::Permit::Permit(ConcurrencyLimiter& limiter, Clock::time_point begin) noexcept :
+  mLimiter(&limiter),
+  mBegin(begin)
+{}
+
+
+ConcurrencyLimiter::Permit::Permit(Permit&& other) noexcept :
+  mLimiter(other.mLimiter),
+  mBegin(other.mBegin)
+{
+  other.mLimiter = nullptr;
+}
+
+
+ConcurrencyLimiter::Permit::~Permit() {
+  if (mLimiter) {
+    mLimiter->Release(mBegin);
+  }
+}
+
+
+
+ConcurrencyLimiter::ConcurrencyLimiter(bool enabled, std::size_t minLimit, std::size_t maxLimit) :
+  mEnabled(enabled),
+  mMinLimit(std::max<std::size_t>(minLimit, 1)),
+  mMaxLimit(std::max(mMinLimit, maxLimit)),
+  mMutex(),
+  mCv(),
+  mLimit(static_cast<double>(mMinLimit)),
+  mInFlight(0),
+  mWaits(0),
+  mNumSamples(0),
+  mSampleSum(Clock::duration::zero()),
+  mSaturated(false),
+  mNoLoadLatency(0.0),
+  mRecentLatency(0.0),
+  mNumUpdates(0),
+  mProbing(false),
+  mProbeBegin(),
+  mLimitBeforeProbe(0.0)
+{
+  // the first update measures the no-load latency
+  StartProbeL();
+}
+
+
+// mMutex must be held
+void ConcurrencyLimiter::StartProbeL() {
+  mProbing = true;
+  mProbeBegin = Clock::now();
+  mLimitBeforeProbe = mLimit;
+  mLimit = static_cast<double>(mMinLimit);
+  mNumSamples = 0;
+  mSampleSum = Clock::duration::zero();
+}
+
+
+// mMutex must be held
+void ConcurrencyLimiter::UpdateL() {
+  mRecentLatency = std::chrono::duration<double, std::nano>(mSampleSum).count() / mNumSamples;
+  mNumSamples = 0;
+  mSampleSum = Clock::duration::zero();
+
+  if (mProbing) {
+    mNoLoadLatency = mRecentLatency;
+    mLimit = mLimitBeforeProbe;
+    mProbing = false;
+    mSaturated = false;
+    return;
+  }
+
+  // a window may still be faster than the last probe, e.g. when the workload changes to smaller requests
+  mNoLoadLatency = std::min(mNoLoadLatency, mRecentLatency);
+
+  const double gradient = mRecentLatency > 0.0 ? std::clamp(DokanConfig::ConcurrencyTolerance * mNoLoadLatency / mRecentLatency, 0.5, 1.0) : 1.0;
+  double newLimit = mLimit * gradient;
+  if (mSaturated) {
+    newLimit += std::sqrt(mLimit);
+  }
+  mLimit = std::clamp(mLimit * (1.0 - DokanConfig::ConcurrencySmoothing) + newLimit * DokanConfig::ConcurrencySmoothing, static_cast<double>(mMinLimit), static_cast<double>(mMaxLimit));
+  mSaturated = false;
+
+  if (++mNumUpdates % DokanConfig::ConcurrencyProbeInterval == 0) {
+    StartProbeL();
+  }
+}
+
+
+void ConcurrencyLimiter::Release(Clock::time_point begin) noexcept {
+  const auto latency = Clock::now() - begin;
+  bool updated = false;
+  {
+    std::lock_guard lock(mMutex);
+    mInFlight--;
+    // callbacks admitted before a probe ran under the previous limit and do not count for it
+    if (!mProbing || begin >= mProbeBegin) {
+      mNumSamples++;
+      mSampleSum += latency;
+      if (mNumSamples >= DokanConfig::ConcurrencyUpdateSamples) {
+        UpdateL();
+        updated = true;
+      }
+    }
+  }
+  // the limit may have grown by more than one
+  if (updated) {
+    mCv.notify_all();
+  } else {
+    mCv.notify_one();
+  }
+}
+
+
+bool ConcurrencyLimiter::IsEnabled() const noexcept {
+  return mEnabled;
+}
+
+
+ConcurrencyLimiter::Permit ConcurrencyLimiter::Acquire() {
+  if (!mEnabled) {
+    return Permit();
+  }
+
+  std::unique_lock lock(mMutex);
+  const auto hasSlot = [this]() {
+    return mInFlight < static_cast<std::size_t>(mLimit);
+  };
+  if (!hasSlot()) {
+    mWaits++;
+    mSaturated = true;
+    mCv.wait(lock, hasSlot);
+  }
+  mInFlight++;
+  if (!hasSlot()) {
+    mSaturated = true;
+  }
+  return Permit(*this, Clock::now());
+}
+
+
+ConcurrencyLimiter::Statistics ConcurrencyLimiter::GetStatistics() const {
+  std::lock_guard lock(mMutex);
+  return Statistics{
+    static_cast<std::size_t>(mLimit),
+    mInFlight,
+    mWaits,
+    static_cast<std::uint64_t>(mNoLoadLatency / 1000.0),
+    static_cast<std::uint64_t>(mRecentLatency / 1000.0),
+  };
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+
+// limits the number of Dokan callbacks of a mount which run at the same time
+// the Dokan thread count is fixed once DokanMain starts, so the limit is applied in front of the callbacks instead
+// the limit follows the gradient between the no-load latency and the recent latency of the admitted callbacks:
+// it shrinks while the sources queue requests internally (e.g. a spinning disk seeking between concurrent reads)
+// and grows by about its square root per update while the latency stays near the no-load latency and the limit is reached
+// the no-load latency is re-measured periodically by admitting only mMinLimit callbacks for one update
+class ConcurrencyLimiter {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // releases the slot on destruction
+  class Permit {
+    ConcurrencyLimiter* mLimiter;
+    Clock::time_point mBegin;
+
+  public:
+    Permit(const Permit&) = delete;
+    Permit& operator=(const Permit&) = delete;
+
+    Permit() noexcept;
+    Permit(ConcurrencyLimiter& limiter, Clock::time_point begin) noexcept;
+    Permit(Permit&& other) noexcept;
+    ~Permit();
+  };
+
+  struct Statistics {
+    std::size_t limit;
+    std::size_t inFlight;
+    std::uint64_t waits;              // admissions which had to wait for a slot
+    std::uint64_t noLoadMicroseconds;
+    std::uint64_t recentMicroseconds;
+  };
+
+private:
+  const bool mEnabled;
+  const std::size_t mMinLimit;
+  const std::size_t mMaxLimit;
+  mutable std::mutex mMutex;
+  std::condition_variable mCv;
+  double mLimit;
+  std::size_t mInFlight;
+  std::uint64_t mWaits;
+  // samples since the last update
+  unsigned int mNumSamples;
+  Clock::duration mSampleSum;
+  bool mSaturated;          // the limit was reached since the last update; growing is pointless otherwise
+  // latencies in nanoseconds
+  double mNoLoadLatency;
+  double mRecentLatency;
+  unsigned int mNumUpdates;
+  bool mProbing;            // measuring mNoLoadLatency; mLimit is mMinLimit meanwhile
+  Clock::time_point mProbeBegin;
+  double mLimitBeforeProbe;
+
+  void StartProbeL();
+  void Release(Clock::time_point begin) noexcept;
+  void UpdateL();
+
+public:
+  ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+
+  // limiting is disabled if !enabled; the limit starts at minLimit
+  ConcurrencyLimiter(bool enabled, std::size_t minLimit, std::size_t maxLimit);
+
+  bool IsEnabled() const noexcept;
+  // returns an empty permit without waiting if disabled
+  Permit Acquire();
+  Statistics GetStatistics() const;
+};
@@ -2,12 +2,30 @@
 
 #include "../dokan/dokan/dokan.h"
 
+#include <cstddef>
+
 
 namespace DokanConfig {
   constexpr USHORT Version = DOKAN_VERSION;
-  constexpr USHORT ThreadCount = 0;   // default
   constexpr ULONG Options = DOKAN_OPTION_ALT_STREAM;
+
+  // defaults of DOKAN_TUNING_OPTIONS (per mount); 0 lets Dokan decide
+  constexpr USHORT ThreadCount = 0;
   constexpr ULONG Timeout = 0;
   constexpr ULONG AllocationUnitSize = 0;
   constexpr ULONG SectorSize = 0;
+
+  // Dokan 1.x starts this many threads if ThreadCount is 0, and refuses more than MaxThreadCount
+  constexpr std::size_t DokanDefaultThreadCount = 5;
+  constexpr std::size_t MaxThreadCount = 63;
+
+  // ConcurrencyLimiter; the limit is recomputed after this many callbacks
+  constexpr unsigned int ConcurrencyUpdateSamples = 64;
+  // recent latency up to this factor of the no-load latency does not shrink the limit
+  constexpr double ConcurrencyTolerance = 1.5;
+  // weight of a newly computed limit against the current one
+  constexpr double ConcurrencySmoothing = 0.2;
+  // the no-load latency is re-measured after this many updates
+  constexpr unsigned int ConcurrencyProbeInterval = 250;
+  constexpr std::size_t DefaultMinConcurrency = 1;
 }
@@ -3,6 +3,8 @@
 #include "DokanOperations.hpp"
 #include "Mount.hpp"
 
+#include <utility>
+
 
 
 ULONG64 GetGlobalContextFromMount(Mount* mount) {
@@ -17,104 +19,161 @@ namespace {
   }
 
 
+  // callbacks which do I/O on the sources; the others are either cheap or must not wait (Cleanup and CloseFile release resources)
+  bool IsThrottled(MountOperation operation) noexcept {
+    switch (operation) {
+      case MountOperation::ZwCreateFile:
+      case MountOperation::ReadFile:
+      case MountOperation::WriteFile:
+      case MountOperation::FlushFileBuffers:
+      case MountOperation::FindFiles:
+      case MountOperation::FindFilesWithPattern:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+
+  // records the callback in the statistics of the mount and, while tracing, in its trace
+  // the trace includes the time spent waiting for the concurrency limiter of the mount, the statistics do not
+  template<typename F>
+  auto Measure(Mount& mount, MountOperation operation, LPCWSTR FileName, F&& function) {
+    return mount.GetTraceRecorder().Trace(TraceCategory::Mount, OperationStatistics::GetName(operation), TraceRecorder::NoSourceIndex, FileName, [&]() {
+      auto& concurrencyLimiter = mount.GetConcurrencyLimiter();
+      const auto permit = concurrencyLimiter.IsEnabled() && IsThrottled(operation) ? concurrencyLimiter.Acquire() : ConcurrencyLimiter::Permit();
+      return mount.GetOperationStatistics().Measure(operation, std::forward<F>(function));
+    });
+  }
+
+
 
   NTSTATUS DOKAN_CALLBACK DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DZwCreateFile(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo);
+    return Measure(mount, MountOperation::ZwCreateFile, FileName, [&]() {
+      return mount.DZwCreateFile(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo);
+    });
   }
 
 
   void DOKAN_CALLBACK DCleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DCleanup(FileName, DokanFileInfo);
+    return Measure(mount, MountOperation::Cleanup, FileName, [&]() {
+      return mount.DCleanup(FileName, DokanFileInfo);
+    });
   }
 
 
   void DOKAN_CALLBACK DCloseFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DCloseFile(FileName, DokanFileInfo);
+    return Measure(mount, MountOperation::CloseFile, FileName, [&]() {
+      return mount.DCloseFile(FileName, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DReadFile(LPCWSTR FileName, LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DReadFile(FileName, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo);
+    return Measure(mount, MountOperation::ReadFile, FileName, [&]() {
+      return mount.DReadFile(FileName, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DWriteFile(LPCWSTR FileName, LPCVOID Buffer, DWORD NumberOfBytesToWrite, LPDWORD NumberOfBytesWritten, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DWriteFile(FileName, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo);
+    return Measure(mount, MountOperation::WriteFile, FileName, [&]() {
+      return mount.DWriteFile(FileName, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DFlushFileBuffers(FileName, DokanFileInfo);
+    return Measure(mount, MountOperation::FlushFileBuffers, FileName, [&]() {
+      return mount.DFlushFileBuffers(FileName, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DGetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION Buffer, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DGetFileInformation(FileName, Buffer, DokanFileInfo);
+    return Measure(mount, MountOperation::GetFileInformation, FileName, [&]() {
+      return mount.DGetFileInformation(FileName, Buffer, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DFindFiles(FileName, FillFindData, DokanFileInfo);
+    return Measure(mount, MountOperation::FindFiles, FileName, [&]() {
+      return mount.DFindFiles(FileName, FillFindData, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DFindFilesWithPattern(LPCWSTR PathName, LPCWSTR SearchPattern, PFillFindData FillFindData, PDOKAN_FILE_INFO DokanFileInfo) {
-    /*
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DFindFilesWithPattern(PathName, SearchPattern, FillFindData, DokanFileInfo);
-    /*/
-    return STATUS_NOT_IMPLEMENTED;
-    //*/
+    return Measure(mount, MountOperation::FindFilesWithPattern, PathName, [&]() {
+      return mount.DFindFilesWithPattern(PathName, SearchPattern, FillFindData, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DSetFileAttributes(LPCWSTR FileName, DWORD FileAttributes, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DSetFileAttributes(FileName, FileAttributes, DokanFileInfo);
+    return Measure(mount, MountOperation::SetFileAttributes, FileName, [&]() {
+      return mount.DSetFileAttributes(FileName, FileAttributes, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DSetFileTime(LPCWSTR FileName, CONST FILETIME *CreationTime, CONST FILETIME *LastAccessTime, CONST FILETIME *LastWriteTime, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DSetFileTime(FileName, CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo);
+    return Measure(mount, MountOperation::SetFileTime, FileName, [&]() {
+      return mount.DSetFileTime(FileName, CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DDeleteFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DDeleteFile(FileName, DokanFileInfo);
+    return Measure(mount, MountOperation::DeleteFile, FileName, [&]() {
+      return mount.DDeleteFile(FileName, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DDeleteDirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DDeleteDirectory(FileName, DokanFileInfo);
+    return Measure(mount, MountOperation::DeleteDirectory, FileName, [&]() {
+      return mount.DDeleteDirectory(FileName, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfExisting, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DMoveFile(FileName, NewFileName, ReplaceIfExisting, DokanFileInfo);
+    return Measure(mount, MountOperation::MoveFile, FileName, [&]() {
+      return mount.DMoveFile(FileName, NewFileName, ReplaceIfExisting, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DSetEndOfFile(LPCWSTR FileName, LONGLONG ByteOffset, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DSetEndOfFile(FileName, ByteOffset, DokanFileInfo);
+    return Measure(mount, MountOperation::SetEndOfFile, FileName, [&]() {
+      return mount.DSetEndOfFile(FileName, ByteOffset, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DSetAllocationSize(LPCWSTR FileName, LONGLONG AllocSize, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DSetAllocationSize(FileName, AllocSize, DokanFileInfo);
+    return Measure(mount, MountOperation::SetAllocationSize, FileName, [&]() {
+      return mount.DSetAllocationSize(FileName, AllocSize, DokanFileInfo);
+    });
   }
 
 
@@ -140,43 +199,57 @@ namespace {
 
   NTSTATUS DOKAN_CALLBACK DGetDiskFreeSpace(PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes, PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DGetDiskFreeSpace(FreeBytesAvailable, TotalNumberOfBytes, TotalNumberOfFreeBytes, DokanFileInfo);
+    return Measure(mount, MountOperation::GetDiskFreeSpace, nullptr, [&]() {
+      return mount.DGetDiskFreeSpace(FreeBytesAvailable, TotalNumberOfBytes, TotalNumberOfFreeBytes, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber, LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DGetVolumeInformation(VolumeNameBuffer, VolumeNameSize, VolumeSerialNumber, MaximumComponentLength, FileSystemFlags, FileSystemNameBuffer, FileSystemNameSize, DokanFileInfo);
+    return Measure(mount, MountOperation::GetVolumeInformation, nullptr, [&]() {
+      return mount.DGetVolumeInformation(VolumeNameBuffer, VolumeNameSize, VolumeSerialNumber, MaximumComponentLength, FileSystemFlags, FileSystemNameBuffer, FileSystemNameSize, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DMounted(PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DMounted(DokanFileInfo);
+    return Measure(mount, MountOperation::Mounted, nullptr, [&]() {
+      return mount.DMounted(DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DUnmounted(PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DUnmounted(DokanFileInfo);
+    return Measure(mount, MountOperation::Unmounted, nullptr, [&]() {
+      return mount.DUnmounted(DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DGetFileSecurity(LPCWSTR FileName, PSECURITY_INFORMATION SecurityInformation, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG BufferLength, PULONG LengthNeeded, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DGetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, LengthNeeded, DokanFileInfo);
+    return Measure(mount, MountOperation::GetFileSecurity, FileName, [&]() {
+      return mount.DGetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, LengthNeeded, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DSetFileSecurity(LPCWSTR FileName, PSECURITY_INFORMATION SecurityInformation, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG BufferLength, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DSetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, DokanFileInfo);
+    return Measure(mount, MountOperation::SetFileSecurity, FileName, [&]() {
+      return mount.DSetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, DokanFileInfo);
+    });
   }
 
 
   NTSTATUS DOKAN_CALLBACK DFindStreams(LPCWSTR FileName, PFillFindStreamData FillFindStreamData, PDOKAN_FILE_INFO DokanFileInfo) {
     auto& mount = GetMountFromFileInfo(DokanFileInfo);
-    return mount.DFindStreams(FileName, FillFindStreamData, DokanFileInfo);
+    return Measure(mount, MountOperation::FindStreams, FileName, [&]() {
+      return mount.DFindStreams(FileName, FillFindStreamData, DokanFileInfo);
+    });
   }
 }
 
@@ -191,7 +264,7 @@ const DOKAN_OPERATIONS gDokanOperations = {
   DFlushFileBuffers,
   DGetFileInformation,
   DFindFiles,
-  nullptr,  //DFindFilesWithPattern,
+  DFindFilesWithPattern,
   DSetFileAttributes,
   DSetFileTime,
   DDeleteFile,
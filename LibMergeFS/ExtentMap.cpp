@@ -0,0 +1,179 @@
+#define NOMINMAX
+
+#include "ExtentMap.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+
+
+ExtentMap::ExtentMap(ULONGLONG baseSize) :
+  mExtents(),
+  mFileSize(baseSize),
+  mBaseSize(baseSize),
+  mDataSize(0)
+{}
+
+
+ExtentMap::ExtentMap(ULONGLONG fileSize, ULONGLONG baseSize, ULONGLONG dataSize, std::map<ULONGLONG, Extent>&& extents) :
+  mExtents(std::move(extents)),
+  mFileSize(fileSize),
+  mBaseSize(baseSize),
+  mDataSize(dataSize)
+{}
+
+
+ULONGLONG ExtentMap::GetFileSize() const {
+  return mFileSize;
+}
+
+
+ULONGLONG ExtentMap::GetBaseSize() const {
+  return mBaseSize;
+}
+
+
+ULONGLONG ExtentMap::GetDataSize() const {
+  return mDataSize;
+}
+
+
+const std::map<ULONGLONG, ExtentMap::Extent>& ExtentMap::GetExtents() const {
+  return mExtents;
+}
+
+
+// removes [offset, offset + length) from the map, splitting extents which cross the boundaries
+void ExtentMap::Punch(ULONGLONG offset, ULONGLONG length) {
+  const ULONGLONG end = offset + length;
+
+  auto itr = mExtents.upper_bound(offset);
+  if (itr != mExtents.begin()) {
+    const auto prev = std::prev(itr);
+    const ULONGLONG prevEnd = prev->first + prev->second.length;
+    if (prevEnd > offset) {
+      if (prevEnd > end) {
+        // the range is in the middle of the extent
+        mExtents.emplace(end, Extent{prevEnd - end, prev->second.dataOffset + (end - prev->first)});
+      }
+      prev->second.length = offset - prev->first;
+      if (!prev->second.length) {
+        mExtents.erase(prev);
+      }
+    }
+  }
+
+  itr = mExtents.lower_bound(offset);
+  while (itr != mExtents.end() && itr->first < end) {
+    const ULONGLONG itrEnd = itr->first + itr->second.length;
+    if (itrEnd > end) {
+      const Extent rest{itrEnd - end, itr->second.dataOffset + (end - itr->first)};
+      itr = mExtents.erase(itr);
+      mExtents.emplace_hint(itr, end, rest);
+      break;
+    }
+    itr = mExtents.erase(itr);
+  }
+}
+
+
+// returns the data file offset if [offset, offset + length) lies in a single extent, so that it can be overwritten in place
+std::optional<ULONGLONG> ExtentMap::FindInPlace(ULONGLONG offset, ULONGLONG length) const {
+  auto itr = mExtents.upper_bound(offset);
+  if (itr == mExtents.begin()) {
+    return std::nullopt;
+  }
+  itr = std::prev(itr);
+  if (itr->first + itr->second.length < offset + length) {
+    return std::nullopt;
+  }
+  return itr->second.dataOffset + (offset - itr->first);
+}
+
+
+// records that [offset, offset + length) has been written to the data file at dataOffset
+void ExtentMap::Insert(ULONGLONG offset, ULONGLONG length, ULONGLONG dataOffset) {
+  if (!length) {
+    return;
+  }
+
+  Punch(offset, length);
+
+  // sequential writes are appended to the data file sequentially; merge them into one extent
+  auto itr = mExtents.lower_bound(offset);
+  if (itr != mExtents.begin()) {
+    auto& [prevOffset, prevExtent] = *std::prev(itr);
+    if (prevOffset + prevExtent.length == offset && prevExtent.dataOffset + prevExtent.length == dataOffset) {
+      prevExtent.length += length;
+    } else {
+      mExtents.emplace_hint(itr, offset, Extent{length, dataOffset});
+    }
+  } else {
+    mExtents.emplace_hint(itr, offset, Extent{length, dataOffset});
+  }
+
+  mFileSize = std::max(mFileSize, offset + length);
+  mDataSize = std::max(mDataSize, dataOffset + length);
+}
+
+
+void ExtentMap::Truncate(ULONGLONG size) {
+  if (size < mFileSize) {
+    Punch(size, mFileSize - size);
+  }
+  mFileSize = size;
+  mBaseSize = std::min(mBaseSize, size);
+}
+
+
+// splits [offset, offset + length) (clamped to the file size) into ranges to be read from each place
+std::vector<ExtentMap::Segment> ExtentMap::Map(ULONGLONG offset, ULONGLONG length) const {
+  std::vector<Segment> segments;
+
+  if (offset >= mFileSize) {
+    return segments;
+  }
+  const ULONGLONG end = std::min(mFileSize, offset + length);
+
+  // a gap between extents is lower layer data below mBaseSize and zero above it
+  const auto addGap = [this, &segments](ULONGLONG gapOffset, ULONGLONG gapEnd) {
+    if (gapOffset < mBaseSize) {
+      const ULONGLONG lowerEnd = std::min(gapEnd, mBaseSize);
+      segments.push_back(Segment{SegmentType::Lower, gapOffset, lowerEnd - gapOffset, 0});
+      gapOffset = lowerEnd;
+    }
+    if (gapOffset < gapEnd) {
+      segments.push_back(Segment{SegmentType::Zero, gapOffset, gapEnd - gapOffset, 0});
+    }
+  };
+
+  ULONGLONG current = offset;
+  auto itr = mExtents.upper_bound(offset);
+  if (itr != mExtents.begin()) {
+    itr = std::prev(itr);
+  }
+  for (; itr != mExtents.end() && itr->first < end; ++itr) {
+    const ULONGLONG extentEnd = itr->first + itr->second.length;
+    if (extentEnd <= current) {
+      continue;
+    }
+    if (itr->first > current) {
+      addGap(current, itr->first);
+      current = itr->first;
+    }
+    const ULONGLONG segmentEnd = std::min(extentEnd, end);
+    segments.push_back(Segment{SegmentType::Overlay, current, segmentEnd - current, itr->second.dataOffset + (current - itr->first)});
+    current = segmentEnd;
+  }
+  if (current < end) {
+    addGap(current, end);
+  }
+
+  return segments;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <map>
+#include <optional>
+#include <vector>
+
+#include <Windows.h>
+
+
+// maps byte ranges of an overlaid file to its overlay data file
+// ranges which are not in the map are read from the lower layer below baseSize and are zero-filled above it
+class ExtentMap {
+public:
+  struct Extent {
+    ULONGLONG length;
+    ULONGLONG dataOffset;   // offset in the overlay data file
+  };
+
+  enum class SegmentType {
+    Lower,
+    Overlay,
+    Zero,
+  };
+
+  struct Segment {
+    SegmentType type;
+    ULONGLONG offset;
+    ULONGLONG length;
+    ULONGLONG dataOffset;   // only for SegmentType::Overlay
+  };
+
+private:
+  std::map<ULONGLONG, Extent> mExtents;   // keyed by file offset; extents never overlap
+  ULONGLONG mFileSize = 0;
+  ULONGLONG mBaseSize = 0;    // lower layer data beyond this has been truncated away
+  ULONGLONG mDataSize = 0;    // size of the overlay data file
+
+  void Punch(ULONGLONG offset, ULONGLONG length);
+
+public:
+  ExtentMap() = default;
+  explicit ExtentMap(ULONGLONG baseSize);
+  ExtentMap(ULONGLONG fileSize, ULONGLONG baseSize, ULONGLONG dataSize, std::map<ULONGLONG, Extent>&& extents);
+
+  ULONGLONG GetFileSize() const;
+  ULONGLONG GetBaseSize() const;
+  ULONGLONG GetDataSize() const;
+  const std::map<ULONGLONG, Extent>& GetExtents() const;
+
+  std::optional<ULONGLONG> FindInPlace(ULONGLONG offset, ULONGLONG length) const;
+  void Insert(ULONGLONG offset, ULONGLONG length, ULONGLONG dataOffset);
+  void Truncate(ULONGLONG size);
+  std::vector<Segment> Map(ULONGLONG offset, ULONGLONG length) const;
+};
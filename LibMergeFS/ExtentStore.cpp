@@ -0,0 +1,372 @@
+#include "ExtentStore.hpp"
+#include "ExtentMap.hpp"
+#include "Util.hpp"
+#include "NsError.hpp"
+
+#include "../Util/Common.hpp"
+
+#include <malloc.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <Windows.h>
+
+using namespace std::literals;
+
+
+namespace {
+  template<typename T, std::size_t Alignment>
+  auto make_unique_aligned(std::size_t size) {
+    struct aligned_deleter {
+      void operator()(T* ptr) const {
+        _aligned_free(ptr);
+      }
+    };
+
+    auto ptr = _aligned_malloc(sizeof(T) * size, Alignment);
+    if (!ptr) {
+      throw std::bad_alloc();
+    }
+    return std::unique_ptr<T[], aligned_deleter>(reinterpret_cast<T*>(ptr), aligned_deleter());
+  }
+}
+
+
+namespace ExtentFileV1 {
+  constexpr std::uint32_t Signature = 0x5845464D;   // "MFEX"
+  constexpr std::uint32_t Version   = 0x00010000;
+
+  constexpr unsigned int Alignment = 16;
+
+  template<typename T>
+  constexpr T Align(T size) {
+    return (size + (Alignment - 1)) & ~static_cast<T>(Alignment - 1);
+  }
+
+  struct Header {
+    std::uint32_t signature;
+    std::uint32_t version;
+    std::uint64_t dataSize;
+    std::uint64_t entryCount;
+    std::uint64_t nextOverlayId;
+  };
+  static_assert(sizeof(Header) == 16 * 2);
+
+  struct EntryHeader {
+    std::uint64_t blockSize;
+    std::uint64_t overlayId;
+    std::uint64_t fileSize;
+    std::uint64_t baseSize;
+    std::uint64_t dataSize;
+    std::uint64_t extentCount;
+    std::uint32_t filenameSize;
+    std::uint32_t reserved1;
+    std::uint64_t reserved2;
+  };
+  static_assert(sizeof(EntryHeader) == 16 * 4);
+
+  struct ExtentEntry {
+    std::uint64_t offset;
+    std::uint64_t length;
+    std::uint64_t dataOffset;
+    std::uint64_t reserved;
+  };
+  static_assert(sizeof(ExtentEntry) == 16 * 2);
+}
+
+
+
+ExtentStore::ExtentStore(std::wstring_view storeFileName, bool caseSensitive) :
+  mCaseSensitive(caseSensitive)
+{
+  if (storeFileName.empty()) {
+    return;
+  }
+
+  const std::wstring sStoreFilename(storeFileName);
+  mHFile = CreateFileW(sStoreFilename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (!mHFile || mHFile == INVALID_HANDLE_VALUE) {
+    throw W32Error(GetLastError());
+  }
+
+  try {
+    LoadFromFile();
+  } catch (...) {
+    CloseHandle(mHFile);
+    mHFile = NULL;
+    throw;
+  }
+}
+
+
+ExtentStore::~ExtentStore() {
+  if (util::IsValidHandle(mHFile)) {
+    try {
+      SaveToFile();
+    } catch (...) {}
+    CloseHandle(mHFile);
+    mHFile = NULL;
+  }
+}
+
+
+std::wstring ExtentStore::FilenameToKey(std::wstring_view filename) const {
+  return ::FilenameToKey(filename, mCaseSensitive);
+}
+
+
+void ExtentStore::LoadFromFile() {
+  using namespace ExtentFileV1;
+
+  if (!util::IsValidHandle(mHFile)) {
+    throw W32Error(ERROR_INVALID_HANDLE);
+  }
+
+  mEntryMap.clear();
+  if (SetFilePointer(mHFile, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    throw W32Error();
+  }
+
+  LARGE_INTEGER liFileSize;
+  if (!GetFileSizeEx(mHFile, &liFileSize)) {
+    throw W32Error();
+  }
+  const std::uint_fast64_t fileSize = liFileSize.QuadPart;
+  if (fileSize == 0) {
+    // the first time
+    SaveToFile();
+    return;
+  }
+
+  if (fileSize % Alignment != 0 || fileSize < sizeof(Header)) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  DWORD read = 0;
+  auto fileData = make_unique_aligned<std::byte, Alignment>(fileSize);
+  if (!ReadFile(mHFile, fileData.get(), static_cast<DWORD>(fileSize), &read, NULL) || read != fileSize) {
+    throw W32Error();
+  }
+
+  const auto& header = *reinterpret_cast<const Header*>(fileData.get());
+  if (header.signature != Signature || header.version != Version || header.dataSize != fileSize) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+  mNextOverlayId = header.nextOverlayId;
+
+  const auto endPtr = const_cast<const std::byte*>(fileData.get()) + fileSize;
+  auto checkPtr = [endPtr] (const std::byte* ptr) {
+    if (ptr > endPtr) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+  };
+
+  auto ptr = const_cast<const std::byte*>(fileData.get()) + sizeof(Header);
+  for (std::uint_fast64_t i = 0; i < header.entryCount; i++) {
+    checkPtr(ptr + sizeof(EntryHeader));
+    const auto& entryHeader = *reinterpret_cast<const EntryHeader*>(ptr);
+    const auto nextPtr = ptr + entryHeader.blockSize;
+    checkPtr(nextPtr);
+    ptr += sizeof(EntryHeader);
+
+    std::wstring filename(reinterpret_cast<const wchar_t*>(ptr), entryHeader.filenameSize);
+    ptr += Align(entryHeader.filenameSize * sizeof(char16_t));
+    checkPtr(ptr + entryHeader.extentCount * sizeof(ExtentEntry));
+
+    std::map<ULONGLONG, ExtentMap::Extent> extents;
+    for (std::uint_fast64_t j = 0; j < entryHeader.extentCount; j++) {
+      const auto& extentEntry = *reinterpret_cast<const ExtentEntry*>(ptr);
+      ptr += sizeof(ExtentEntry);
+      extents.emplace_hint(extents.end(), extentEntry.offset, ExtentMap::Extent{extentEntry.length, extentEntry.dataOffset});
+    }
+    assert(ptr == nextPtr);
+
+    auto key = FilenameToKey(filename);
+    mEntryMap.insert_or_assign(std::move(key), StoredEntry{
+      std::move(filename),
+      Entry{
+        entryHeader.overlayId,
+        ExtentMap(entryHeader.fileSize, entryHeader.baseSize, entryHeader.dataSize, std::move(extents)),
+      },
+    });
+
+    ptr = nextPtr;
+  }
+
+  assert(ptr == endPtr);
+}
+
+
+void ExtentStore::SaveToFile() {
+  using namespace ExtentFileV1;
+
+  if (!util::IsValidHandle(mHFile)) {
+    throw W32Error(ERROR_INVALID_HANDLE);
+  }
+
+  // calculate fileSize
+  std::size_t fileSize = sizeof(Header);
+  for (const auto& [key, storedEntry] : mEntryMap) {
+    fileSize += sizeof(EntryHeader);
+    fileSize += Align(storedEntry.resolvedFilename.size() * sizeof(char16_t));
+    fileSize += storedEntry.entry.extentMap.GetExtents().size() * sizeof(ExtentEntry);
+  }
+
+  assert(fileSize % Alignment == 0);
+
+  auto fileData = make_unique_aligned<std::byte, Alignment>(fileSize);
+  std::memset(fileData.get(), 0, fileSize);
+
+  auto ptr = fileData.get();
+
+  auto& header = *reinterpret_cast<Header*>(ptr);
+  ptr += sizeof(Header);
+  header = Header{
+    Signature,
+    Version,
+    static_cast<std::uint64_t>(fileSize),
+    static_cast<std::uint64_t>(mEntryMap.size()),
+    static_cast<std::uint64_t>(mNextOverlayId),
+  };
+
+  for (const auto& [key, storedEntry] : mEntryMap) {
+    const auto prevPtr = ptr;
+    const auto& filename = storedEntry.resolvedFilename;
+    const auto& extentMap = storedEntry.entry.extentMap;
+
+    auto& entryHeader = *reinterpret_cast<EntryHeader*>(ptr);
+    ptr += sizeof(EntryHeader);
+    entryHeader = EntryHeader{
+      0,    // filled later
+      static_cast<std::uint64_t>(storedEntry.entry.overlayId),
+      static_cast<std::uint64_t>(extentMap.GetFileSize()),
+      static_cast<std::uint64_t>(extentMap.GetBaseSize()),
+      static_cast<std::uint64_t>(extentMap.GetDataSize()),
+      static_cast<std::uint64_t>(extentMap.GetExtents().size()),
+      static_cast<std::uint32_t>(filename.size()),
+      0,
+      0,
+    };
+
+    std::memcpy(ptr, filename.c_str(), filename.size() * sizeof(char16_t));
+    ptr += Align(filename.size() * sizeof(char16_t));
+
+    for (const auto& [offset, extent] : extentMap.GetExtents()) {
+      auto& extentEntry = *reinterpret_cast<ExtentEntry*>(ptr);
+      ptr += sizeof(ExtentEntry);
+      extentEntry = ExtentEntry{
+        static_cast<std::uint64_t>(offset),
+        static_cast<std::uint64_t>(extent.length),
+        static_cast<std::uint64_t>(extent.dataOffset),
+        0,
+      };
+    }
+
+    entryHeader.blockSize = static_cast<std::uint64_t>(ptr - prevPtr);
+  }
+
+  if (SetFilePointer(mHFile, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    throw W32Error();
+  }
+  if (!SetEndOfFile(mHFile)) {
+    throw W32Error();
+  }
+
+  DWORD written = 0;
+  if (!WriteFile(mHFile, fileData.get(), static_cast<DWORD>(fileSize), &written, NULL) || written != fileSize) {
+    throw W32Error();
+  }
+
+  mDirty = false;
+}
+
+
+std::wstring ExtentStore::GetOverlayFilename(ULONGLONG overlayId) {
+  wchar_t buffer[17];
+  swprintf_s(buffer, L"%016llX", overlayId);
+  return OverlayDirectory + L"\\"s + buffer;
+}
+
+
+bool ExtentStore::IsEnabled() const {
+  return util::IsValidHandle(mHFile);
+}
+
+
+std::optional<ExtentStore::Entry> ExtentStore::GetR(std::wstring_view resolvedFilename) const {
+  if (!util::IsValidHandle(mHFile)) {
+    return std::nullopt;
+  }
+  const auto itr = mEntryMap.find(FilenameToKey(resolvedFilename));
+  if (itr == mEntryMap.end()) {
+    return std::nullopt;
+  }
+  return itr->second.entry;
+}
+
+
+std::optional<ULONGLONG> ExtentStore::GetFileSizeR(std::wstring_view resolvedFilename) const {
+  if (!util::IsValidHandle(mHFile)) {
+    return std::nullopt;
+  }
+  const auto itr = mEntryMap.find(FilenameToKey(resolvedFilename));
+  if (itr == mEntryMap.end()) {
+    return std::nullopt;
+  }
+  return itr->second.entry.extentMap.GetFileSize();
+}
+
+
+void ExtentStore::SetR(std::wstring_view resolvedFilename, const Entry& entry) {
+  if (!util::IsValidHandle(mHFile)) {
+    return;
+  }
+  mEntryMap.insert_or_assign(FilenameToKey(resolvedFilename), StoredEntry{std::wstring(resolvedFilename), entry});
+  mDirty = true;
+}
+
+
+// returns the overlay ID of the removed entry so that the caller can delete its data file
+std::optional<ULONGLONG> ExtentStore::RemoveR(std::wstring_view resolvedFilename) {
+  if (!util::IsValidHandle(mHFile)) {
+    return std::nullopt;
+  }
+  const auto itr = mEntryMap.find(FilenameToKey(resolvedFilename));
+  if (itr == mEntryMap.end()) {
+    return std::nullopt;
+  }
+  const auto overlayId = itr->second.entry.overlayId;
+  mEntryMap.erase(itr);
+  mDirty = true;
+  return overlayId;
+}
+
+
+ULONGLONG ExtentStore::NewOverlayId() {
+  if (!util::IsValidHandle(mHFile)) {
+    throw W32Error(ERROR_INVALID_HANDLE);
+  }
+  // persist the counter before the ID is used so that a data file name is never reused
+  const auto overlayId = mNextOverlayId++;
+  SaveToFile();
+  return overlayId;
+}
+
+
+void ExtentStore::Save() {
+  if (!util::IsValidHandle(mHFile) || !mDirty) {
+    return;
+  }
+  SaveToFile();
+}
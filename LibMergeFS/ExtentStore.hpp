@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ExtentMap.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <Windows.h>
+
+
+// persistent store of the extent maps of overlaid files, saved next to the metadata file
+// overlay data files are stored in the top source as OverlayDirectory\<overlay ID in hex>
+class ExtentStore {
+public:
+  static constexpr auto OverlayDirectory = L"\\$MergeFSSystemData\\Overlay";
+
+  struct Entry {
+    ULONGLONG overlayId;
+    ExtentMap extentMap;
+  };
+
+private:
+  struct StoredEntry {
+    std::wstring resolvedFilename;
+    Entry entry;
+  };
+
+  const bool mCaseSensitive;
+  HANDLE mHFile = NULL;
+  bool mDirty = false;
+  ULONGLONG mNextOverlayId = 1;
+  std::unordered_map<std::wstring, StoredEntry> mEntryMap;
+
+  std::wstring FilenameToKey(std::wstring_view filename) const;
+  void LoadFromFile();
+  void SaveToFile();
+
+public:
+  ExtentStore(const ExtentStore&) = delete;
+
+  ExtentStore(std::wstring_view storeFileName, bool caseSensitive);
+  ~ExtentStore();
+
+  static std::wstring GetOverlayFilename(ULONGLONG overlayId);
+
+  bool IsEnabled() const;
+  std::optional<Entry> GetR(std::wstring_view resolvedFilename) const;
+  std::optional<ULONGLONG> GetFileSizeR(std::wstring_view resolvedFilename) const;
+  void SetR(std::wstring_view resolvedFilename, const Entry& entry);
+  std::optional<ULONGLONG> RemoveR(std::wstring_view resolvedFilename);
+  ULONGLONG NewOverlayId();
+  void Save();
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "NsError.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+
+// sharded slot table which assigns FILE_CONTEXT_IDs and owns the file contexts
+// an ID is made of (generation, slot index, shard index); a released slot is reused with a new generation,
+// so a stale ID does not refer to the next context stored in the same slot
+// each thread allocates from its own shard, so opens and closes on different Dokan threads rarely contend
+template<typename Ptr>
+class FileContextTable {
+public:
+  using Id = DWORD;
+
+  static constexpr unsigned int ShardBits = 6;
+  static constexpr unsigned int SlotBits = 16;
+  static constexpr unsigned int GenerationBits = sizeof(Id) * 8 - ShardBits - SlotBits;
+  static constexpr std::size_t NumShards = std::size_t(1) << ShardBits;
+  static constexpr std::size_t MaxSlotsPerShard = std::size_t(1) << SlotBits;
+  // the generation is never 0, so IDs in [1, MinId) are never assigned and can be used for handles outside of the table
+  static constexpr Id MinId = Id(1) << (SlotBits + ShardBits);
+
+private:
+  static constexpr std::uint32_t GenerationMask = (std::uint32_t(1) << GenerationBits) - 1;
+
+  struct Slot {
+    std::uint32_t generation;   // never 0, so a valid ID is never FILE_CONTEXT_ID_NULL
+    Ptr ptr;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    std::vector<std::uint32_t> freeSlots;   // LIFO
+  };
+
+  std::array<Shard, NumShards> mShards;
+
+  static Id MakeId(std::size_t shardIndex, std::size_t slotIndex, std::uint32_t generation) noexcept {
+    return static_cast<Id>((generation << (SlotBits + ShardBits)) | (slotIndex << ShardBits) | shardIndex);
+  }
+
+  static std::size_t GetShardIndex(Id id) noexcept {
+    return id & (NumShards - 1);
+  }
+
+  static std::size_t GetSlotIndex(Id id) noexcept {
+    return (id >> ShardBits) & (MaxSlotsPerShard - 1);
+  }
+
+  static std::uint32_t GetGeneration(Id id) noexcept {
+    return (id >> (SlotBits + ShardBits)) & GenerationMask;
+  }
+
+  static std::uint32_t NextGeneration(std::uint32_t generation) noexcept {
+    generation = (generation + 1) & GenerationMask;
+    return generation ? generation : 1;
+  }
+
+  static std::size_t GetHomeShardIndex() noexcept {
+    static thread_local const std::size_t homeShardIndex = std::hash<std::thread::id>()(std::this_thread::get_id()) & (NumShards - 1);
+    return homeShardIndex;
+  }
+
+  // Shard::mutex must be held
+  static Slot* GetSlotL(Shard& shard, Id id) noexcept {
+    const auto slotIndex = GetSlotIndex(id);
+    if (slotIndex >= shard.slots.size()) {
+      return nullptr;
+    }
+    auto& slot = shard.slots[slotIndex];
+    if (slot.generation != GetGeneration(id) || !slot.ptr) {
+      return nullptr;
+    }
+    return &slot;
+  }
+
+public:
+  FileContextTable(const FileContextTable&) = delete;
+  FileContextTable& operator=(const FileContextTable&) = delete;
+
+  FileContextTable() = default;
+
+  // makeContext is called with the new ID while the shard is locked and must return the context to store
+  template<typename F>
+  Id Insert(F&& makeContext) {
+    const auto homeShardIndex = GetHomeShardIndex();
+    for (std::size_t i = 0; i < NumShards; i++) {
+      const auto shardIndex = (homeShardIndex + i) & (NumShards - 1);
+      auto& shard = mShards[shardIndex];
+      std::lock_guard lock(shard.mutex);
+
+      std::size_t slotIndex;
+      if (!shard.freeSlots.empty()) {
+        slotIndex = shard.freeSlots.back();
+        shard.freeSlots.pop_back();
+      } else if (shard.slots.size() < MaxSlotsPerShard) {
+        // keep enough capacity so that Remove never allocates
+        shard.freeSlots.reserve(shard.slots.size() + 1);
+        shard.slots.push_back(Slot{1, nullptr});
+        slotIndex = shard.slots.size() - 1;
+      } else {
+        continue;
+      }
+
+      auto& slot = shard.slots[slotIndex];
+      const auto id = MakeId(shardIndex, slotIndex, slot.generation);
+      try {
+        slot.ptr = makeContext(id);
+      } catch (...) {
+        shard.freeSlots.push_back(static_cast<std::uint32_t>(slotIndex));
+        throw;
+      }
+      return id;
+    }
+    throw NsError(STATUS_TOO_MANY_OPENED_FILES);
+  }
+
+  // returns the removed context (nullptr if the ID is not in use) so that it is destroyed outside of the lock
+  Ptr Remove(Id id) noexcept {
+    auto& shard = mShards[GetShardIndex(id)];
+    std::lock_guard lock(shard.mutex);
+    const auto ptrSlot = GetSlotL(shard, id);
+    if (!ptrSlot) {
+      return nullptr;
+    }
+    Ptr ptr = std::move(ptrSlot->ptr);
+    ptrSlot->ptr = nullptr;
+    ptrSlot->generation = NextGeneration(ptrSlot->generation);
+    shard.freeSlots.push_back(static_cast<std::uint32_t>(GetSlotIndex(id)));
+    return ptr;
+  }
+
+  // calls func with the stored context while the shard is locked; returns false if the ID is not in use
+  template<typename F>
+  bool With(Id id, F&& func) {
+    auto& shard = mShards[GetShardIndex(id)];
+    std::lock_guard lock(shard.mutex);
+    const auto ptrSlot = GetSlotL(shard, id);
+    if (!ptrSlot) {
+      return false;
+    }
+    func(ptrSlot->ptr);
+    return true;
+  }
+};
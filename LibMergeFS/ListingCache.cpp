@@ -0,0 +1,175 @@
+#include "ListingCache.hpp"
+#include "Util.hpp"
+
+#include "../Util/VirtualFs.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace std::literals;
+
+
+
+std::wstring ListingCache::FilenameToKey(std::wstring_view filename) const {
+  return ::FilenameToKey(filename, mCaseSensitive);
+}
+
+
+void ListingCache::EraseEntry(std::unordered_map<std::wstring, Entry>::iterator itr) {
+  mUsedBytes -= itr->second.size;
+  mLruList.erase(itr->second.lruItr);
+  mEntryMap.erase(itr);
+}
+
+
+ListingCache::ListingCache(bool caseSensitive, std::size_t maxBytes, std::chrono::milliseconds ttl) :
+  mCaseSensitive(caseSensitive),
+  mMaxBytes(maxBytes),
+  mTtl(ttl),
+  mMutex(),
+  mEntryMap(),
+  mLruList(),
+  mUsedBytes(0),
+  mGeneration(0),
+  mHits(0),
+  mMisses(0),
+  mInvalidations(0)
+{}
+
+
+bool ListingCache::IsEnabled() const {
+  return mMaxBytes != 0 && mTtl.count() > 0;
+}
+
+
+std::uint64_t ListingCache::GetGeneration() const {
+  std::lock_guard lock(mMutex);
+  return mGeneration;
+}
+
+
+std::shared_ptr<const ListingCache::Listing> ListingCache::Get(std::wstring_view directory, std::wstring_view resolvedDirectory) {
+  if (!IsEnabled()) {
+    return nullptr;
+  }
+
+  const auto key = FilenameToKey(directory);
+  std::lock_guard lock(mMutex);
+  const auto itr = mEntryMap.find(key);
+  if (itr == mEntryMap.end()) {
+    mMisses++;
+    return nullptr;
+  }
+  auto& entry = itr->second;
+  // 期限切れ、または実パスが変わっている（リネームされた）場合は使えない
+  if (Clock::now() >= entry.expiresAt || entry.resolvedDirectory != resolvedDirectory) {
+    EraseEntry(itr);
+    mMisses++;
+    return nullptr;
+  }
+  mLruList.splice(mLruList.begin(), mLruList, entry.lruItr);
+  mHits++;
+  return entry.listing;
+}
+
+
+void ListingCache::Set(std::wstring_view directory, std::wstring_view resolvedDirectory, std::shared_ptr<const Listing> listing, std::uint64_t generation) {
+  if (!IsEnabled() || !listing) {
+    return;
+  }
+
+  auto key = FilenameToKey(directory);
+  const std::size_t size = sizeof(Entry) + (key.size() + resolvedDirectory.size()) * sizeof(wchar_t) + listing->size() * sizeof(WIN32_FIND_DATAW);
+  if (size > mMaxBytes) {
+    return;
+  }
+
+  std::lock_guard lock(mMutex);
+  // 列挙中に無効化が行われていた場合、結果が古い可能性があるので登録しない
+  if (mGeneration != generation) {
+    return;
+  }
+  if (const auto itr = mEntryMap.find(key); itr != mEntryMap.end()) {
+    EraseEntry(itr);
+  }
+  // 上限を超える分は古いものから捨てる
+  while (!mLruList.empty() && mUsedBytes + size > mMaxBytes) {
+    EraseEntry(mEntryMap.find(mLruList.back()));
+  }
+  mLruList.push_front(key);
+  mEntryMap.emplace(std::move(key), Entry{
+    std::wstring(resolvedDirectory),
+    std::move(listing),
+    Clock::now() + mTtl,
+    size,
+    mLruList.begin(),
+  });
+  mUsedBytes += size;
+}
+
+
+void ListingCache::Invalidate(std::wstring_view directory, bool recursive) {
+  if (!IsEnabled()) {
+    return;
+  }
+
+  const auto key = FilenameToKey(directory);
+  std::lock_guard lock(mMutex);
+  mGeneration++;
+  mInvalidations++;
+
+  if (const auto itr = mEntryMap.find(key); itr != mEntryMap.end()) {
+    EraseEntry(itr);
+  }
+  if (!recursive) {
+    return;
+  }
+
+  const auto prefix = util::vfs::IsRootDirectory(key) ? key : key + L"\\"s;
+  for (auto itr = mEntryMap.begin(); itr != mEntryMap.end(); ) {
+    if (itr->first.compare(0, prefix.size(), prefix) == 0) {
+      const auto nextItr = std::next(itr);
+      EraseEntry(itr);
+      itr = nextItr;
+    } else {
+      ++itr;
+    }
+  }
+}
+
+
+void ListingCache::InvalidateParent(std::wstring_view filename) {
+  if (util::vfs::IsRootDirectory(filename)) {
+    return;
+  }
+  Invalidate(util::vfs::GetParentPath(filename), false);
+}
+
+
+void ListingCache::Clear() {
+  std::lock_guard lock(mMutex);
+  mGeneration++;
+  mInvalidations++;
+  mEntryMap.clear();
+  mLruList.clear();
+  mUsedBytes = 0;
+}
+
+
+ListingCache::Statistics ListingCache::GetStatistics() const {
+  std::lock_guard lock(mMutex);
+  return Statistics{
+    mHits,
+    mMisses,
+    mInvalidations,
+    mEntryMap.size(),
+    mUsedBytes,
+  };
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+
+// caches the merged result of Mount::DFindFiles per directory
+// entries are keyed by FilenameToKey(directory) where directory is the path seen by Dokan (not resolved),
+// because the listing also depends on the rename entries registered for that path
+class ListingCache {
+public:
+  using Listing = std::vector<WIN32_FIND_DATAW>;
+
+  struct Statistics {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t invalidations;
+    std::size_t numEntries;
+    std::size_t usedBytes;
+  };
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::wstring resolvedDirectory;
+    std::shared_ptr<const Listing> listing;
+    Clock::time_point expiresAt;
+    std::size_t size;
+    std::list<std::wstring>::iterator lruItr;
+  };
+
+  const bool mCaseSensitive;
+  const std::size_t mMaxBytes;
+  const std::chrono::milliseconds mTtl;
+  mutable std::mutex mMutex;
+  std::unordered_map<std::wstring, Entry> mEntryMap;
+  std::list<std::wstring> mLruList;     // front is the most recently used
+  std::size_t mUsedBytes;
+  std::uint64_t mGeneration;
+  std::uint64_t mHits;
+  std::uint64_t mMisses;
+  std::uint64_t mInvalidations;
+
+  std::wstring FilenameToKey(std::wstring_view filename) const;
+  void EraseEntry(std::unordered_map<std::wstring, Entry>::iterator itr);
+
+public:
+  ListingCache(bool caseSensitive, std::size_t maxBytes, std::chrono::milliseconds ttl);
+
+  bool IsEnabled() const;
+  std::uint64_t GetGeneration() const;
+  std::shared_ptr<const Listing> Get(std::wstring_view directory, std::wstring_view resolvedDirectory);
+  void Set(std::wstring_view directory, std::wstring_view resolvedDirectory, std::shared_ptr<const Listing> listing, std::uint64_t generation);
+  void Invalidate(std::wstring_view directory, bool recursive);
+  void InvalidateParent(std::wstring_view filename);
+  void Clear();
+  Statistics GetStatistics() const;
+};
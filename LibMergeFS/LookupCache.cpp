@@ -0,0 +1,206 @@
+#include "LookupCache.hpp"
+#include "Util.hpp"
+
+#include "../Util/VirtualFs.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace std::literals;
+
+
+
+std::wstring LookupCache::FilenameToKey(std::wstring_view filename) const {
+  return ::FilenameToKey(filename, mCaseSensitive);
+}
+
+
+std::atomic<std::uint64_t>& LookupCache::GetBucketGeneration(std::wstring_view key) {
+  return mBucketGenerations[std::hash<std::wstring_view>()(key) % mBucketGenerations.size()];
+}
+
+
+// sums the generations of the buckets of key and of its ancestors; as they only grow, the sum changes whenever one of
+// them is bumped
+std::uint64_t LookupCache::GetGenerationOfKey(std::wstring_view key, std::memory_order order) const {
+  std::uint64_t generation = mGeneration.load(order);
+  for (auto path = key; !util::vfs::IsRootDirectory(path); path = util::vfs::GetParentPath(path)) {
+    generation += mBucketGenerations[std::hash<std::wstring_view>()(path) % mBucketGenerations.size()].load(order);
+  }
+  return generation;
+}
+
+
+LookupCache::Node::Node(const Entry& entry, Clock::time_point expiresAt, std::list<std::wstring>::iterator clockItr) :
+  entry(entry),
+  expiresAt(expiresAt),
+  clockItr(clockItr),
+  referenced(false)
+{}
+
+
+// mMutex must be held exclusively
+void LookupCache::EraseEntryL(std::unordered_map<std::wstring, Node>::iterator itr) {
+  mClockList.erase(itr->second.clockItr);
+  mEntryMap.erase(itr);
+}
+
+
+// mMutex must be held exclusively; the cache must not be empty
+void LookupCache::EvictEntryL() {
+  const auto now = Clock::now();
+  while (true) {
+    const auto itr = mEntryMap.find(mClockList.front());
+    auto& node = itr->second;
+    // 参照された（かつ期限内の）エントリは一度だけ見逃して末尾に回す
+    if (node.referenced.exchange(false, std::memory_order_relaxed) && now < node.expiresAt) {
+      mClockList.splice(mClockList.end(), mClockList, node.clockItr);
+      continue;
+    }
+    EraseEntryL(itr);
+    mEvictions++;
+    return;
+  }
+}
+
+
+LookupCache::LookupCache(bool caseSensitive, std::size_t maxEntries, std::chrono::milliseconds ttl) :
+  mCaseSensitive(caseSensitive),
+  mMaxEntries(maxEntries),
+  mTtl(ttl),
+  mMutex(),
+  mEntryMap(),
+  mClockList(),
+  mGeneration(0),
+  mHits(0),
+  mMisses(0),
+  mInvalidations(0),
+  mEvictions(0)
+{}
+
+
+bool LookupCache::IsEnabled() const {
+  return mMaxEntries != 0 && mTtl.count() > 0;
+}
+
+
+// taken before looking resolvedFilename up and passed to Set, which drops the result if the path or one of its ancestors
+// has been invalidated in between
+std::uint64_t LookupCache::GetGeneration(std::wstring_view resolvedFilename) const {
+  return GetGenerationOfKey(FilenameToKey(resolvedFilename), std::memory_order_acquire);
+}
+
+
+std::optional<LookupCache::Entry> LookupCache::Get(std::wstring_view resolvedFilename) const {
+  if (!IsEnabled()) {
+    return std::nullopt;
+  }
+
+  const auto key = FilenameToKey(resolvedFilename);
+  std::shared_lock lock(mMutex);
+  // 期限切れのエントリは次のSetで上書きされるか、追い出される
+  if (const auto itr = mEntryMap.find(key); itr != mEntryMap.end() && Clock::now() < itr->second.expiresAt) {
+    const auto& node = itr->second;
+    if (!node.referenced.load(std::memory_order_relaxed)) {
+      node.referenced.store(true, std::memory_order_relaxed);
+    }
+    mHits.fetch_add(1, std::memory_order_relaxed);
+    return node.entry;
+  }
+  mMisses.fetch_add(1, std::memory_order_relaxed);
+  return std::nullopt;
+}
+
+
+void LookupCache::Set(std::wstring_view resolvedFilename, const Entry& entry, std::uint64_t generation) {
+  if (!IsEnabled()) {
+    return;
+  }
+
+  auto key = FilenameToKey(resolvedFilename);
+  std::lock_guard lock(mMutex);
+  // 問い合わせ中に無効化が行われていた場合、結果が古い可能性があるので登録しない
+  if (GetGenerationOfKey(key, std::memory_order_relaxed) != generation) {
+    return;
+  }
+  const auto expiresAt = Clock::now() + mTtl;
+  if (const auto itr = mEntryMap.find(key); itr != mEntryMap.end()) {
+    itr->second.entry = entry;
+    itr->second.expiresAt = expiresAt;
+    return;
+  }
+  if (mEntryMap.size() >= mMaxEntries) {
+    EvictEntryL();
+  }
+  mClockList.push_back(key);
+  try {
+    mEntryMap.try_emplace(std::move(key), entry, expiresAt, std::prev(mClockList.end()));
+  } catch (...) {
+    mClockList.pop_back();
+    throw;
+  }
+}
+
+
+void LookupCache::Invalidate(std::wstring_view resolvedFilename, bool recursive) {
+  const auto key = FilenameToKey(resolvedFilename);
+  std::lock_guard lock(mMutex);
+  // the lookups of the descendants depend on the path as well, so bumping its bucket drops theirs too
+  (util::vfs::IsRootDirectory(key) ? mGeneration : GetBucketGeneration(key)).fetch_add(1, std::memory_order_release);
+  mInvalidations.fetch_add(1, std::memory_order_relaxed);
+
+  if (const auto itr = mEntryMap.find(key); itr != mEntryMap.end()) {
+    EraseEntryL(itr);
+  }
+  if (!recursive) {
+    return;
+  }
+
+  if (util::vfs::IsRootDirectory(key)) {
+    mEntryMap.clear();
+    mClockList.clear();
+    return;
+  }
+
+  const auto prefix = key + L"\\"s;
+  for (auto itr = mEntryMap.begin(); itr != mEntryMap.end(); ) {
+    if (itr->first.compare(0, prefix.size(), prefix) == 0) {
+      mClockList.erase(itr->second.clockItr);
+      itr = mEntryMap.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+}
+
+
+void LookupCache::Clear() {
+  std::lock_guard lock(mMutex);
+  mGeneration.fetch_add(1, std::memory_order_release);
+  mInvalidations.fetch_add(1, std::memory_order_relaxed);
+  mEntryMap.clear();
+  mClockList.clear();
+}
+
+
+LookupCache::Statistics LookupCache::GetStatistics() const {
+  std::shared_lock lock(mMutex);
+  return Statistics{
+    mHits.load(std::memory_order_relaxed),
+    mMisses.load(std::memory_order_relaxed),
+    mInvalidations.load(std::memory_order_relaxed),
+    mEvictions,
+    mEntryMap.size(),
+  };
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "CacheConfig.hpp"
+#include "MountSource.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <list>
+#include <string_view>
+#include <unordered_map>
+
+
+// caches the result of Mount::GetMountSourceIndexR (resolved path -> source index and file type)
+// both positive and negative results are stored; entries are keyed by FilenameToKey(resolvedFilename)
+// sources may change underneath the mount, so entries expire after the TTL; when the cache is full, an entry is evicted
+// by CLOCK (second chance), which lets hits only set a flag under the shared lock
+class LookupCache {
+public:
+  using FileType = MountSource::FileType;
+
+  struct Entry {
+    std::optional<std::size_t> sourceIndex;   // std::nullopt for inexistent objects
+    FileType fileType;
+  };
+
+  struct Statistics {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t invalidations;
+    std::uint64_t evictions;
+    std::size_t numEntries;
+  };
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Node {
+    Entry entry;
+    Clock::time_point expiresAt;
+    std::list<std::wstring>::iterator clockItr;
+    mutable std::atomic<bool> referenced;   // set by hits, cleared when the clock hand passes
+
+    Node(const Entry& entry, Clock::time_point expiresAt, std::list<std::wstring>::iterator clockItr);
+  };
+
+  const bool mCaseSensitive;
+  const std::size_t mMaxEntries;
+  const std::chrono::milliseconds mTtl;
+  mutable std::shared_mutex mMutex;
+  std::unordered_map<std::wstring, Node> mEntryMap;
+  std::list<std::wstring> mClockList;   // front is where the clock hand points
+  // bumped by Clear and by invalidations of the root directory
+  std::atomic<std::uint64_t> mGeneration;
+  // bumped by invalidations of the paths hashed to each bucket; a lookup depends on the path and all of its ancestors
+  std::array<std::atomic<std::uint64_t>, CacheConfig::LookupCacheGenerationBuckets> mBucketGenerations{};
+  mutable std::atomic<std::uint64_t> mHits;
+  mutable std::atomic<std::uint64_t> mMisses;
+  std::atomic<std::uint64_t> mInvalidations;
+  std::uint64_t mEvictions;
+
+  std::wstring FilenameToKey(std::wstring_view filename) const;
+  std::atomic<std::uint64_t>& GetBucketGeneration(std::wstring_view key);
+  std::uint64_t GetGenerationOfKey(std::wstring_view key, std::memory_order order) const;
+  void EraseEntryL(std::unordered_map<std::wstring, Node>::iterator itr);
+  void EvictEntryL();
+
+public:
+  LookupCache(bool caseSensitive, std::size_t maxEntries, std::chrono::milliseconds ttl);
+
+  bool IsEnabled() const;
+  std::uint64_t GetGeneration(std::wstring_view resolvedFilename) const;
+  std::optional<Entry> Get(std::wstring_view resolvedFilename) const;
+  void Set(std::wstring_view resolvedFilename, const Entry& entry, std::uint64_t generation);
+  void Invalidate(std::wstring_view resolvedFilename, bool recursive);
+  void Clear();
+  Statistics GetStatistics() const;
+};
@@ -7,7 +7,13 @@
 
 #include "../SDK/LibMergeFS.h"
 
+#include "DokanConfig.hpp"
+#include "MetadataFileBackend.hpp"
 #include "MountStore.hpp"
+#include "NsError.hpp"
+#include "ReadAheadConfig.hpp"
+#include "ReplayConfig.hpp"
+#include "TransportConfig.hpp"
 
 #include <Windows.h>
 
@@ -85,6 +91,8 @@ namespace {
       SetMergeFSError(error);
     } catch (Mount::DokanMainError& dokanMainError) {
       SetDokanMainError(dokanMainError.GetError());
+    } catch (W32Error& w32Error) {
+      SetWindowsError(w32Error.GetError());
     } catch (std::invalid_argument&) {
       SetWindowsError(ERROR_INVALID_PARAMETER);
     } catch (std::domain_error&) {
@@ -376,7 +384,33 @@ namespace Exports {
         volumeInfoOverride.TotalNumberOfFreeBytes.emplace(mountInitializeInfo->volumeInfoOverride.TotalNumberOfFreeBytes);
       }
 
-      const auto mountId = mountStore.Mount(mountInitializeInfo->mountPoint, mountInitializeInfo->writable, mountInitializeInfo->metadataFileName, mountInitializeInfo->deferCopyEnabled, mountInitializeInfo->caseSensitive, volumeInfoOverride, sources, [callback](MOUNT_ID mountId, const MOUNT_INFO* ptrMountInfo, int dokanMainResult) {
+      const auto& readAheadOptionsInfo = mountInitializeInfo->readAheadOptions;
+      const ReadAheadOptions readAheadOptions{
+        !readAheadOptionsInfo.disabled,
+        readAheadOptionsInfo.maxWindowSize ? static_cast<std::size_t>(readAheadOptionsInfo.maxWindowSize) : ReadAheadConfig::DefaultMaxWindowSize,
+        readAheadOptionsInfo.memoryBudget ? static_cast<std::size_t>(readAheadOptionsInfo.memoryBudget) : ReadAheadConfig::DefaultMemoryBudget,
+      };
+
+      const auto& dokanTuningOptionsInfo = mountInitializeInfo->dokanTuningOptions;
+      if (dokanTuningOptionsInfo.threadCount > DokanConfig::MaxThreadCount) {
+        return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+      if (dokanTuningOptionsInfo.minConcurrency && dokanTuningOptionsInfo.maxConcurrency && dokanTuningOptionsInfo.minConcurrency > dokanTuningOptionsInfo.maxConcurrency) {
+        return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+      const USHORT threadCount = dokanTuningOptionsInfo.threadCount ? static_cast<USHORT>(dokanTuningOptionsInfo.threadCount) : DokanConfig::ThreadCount;
+      const DokanTuningOptions dokanTuningOptions{
+        threadCount,
+        dokanTuningOptionsInfo.timeout ? static_cast<ULONG>(dokanTuningOptionsInfo.timeout) : DokanConfig::Timeout,
+        dokanTuningOptionsInfo.allocationUnitSize ? static_cast<ULONG>(dokanTuningOptionsInfo.allocationUnitSize) : DokanConfig::AllocationUnitSize,
+        dokanTuningOptionsInfo.sectorSize ? static_cast<ULONG>(dokanTuningOptionsInfo.sectorSize) : DokanConfig::SectorSize,
+        dokanTuningOptionsInfo.autoConcurrency != FALSE,
+        dokanTuningOptionsInfo.minConcurrency ? static_cast<std::size_t>(dokanTuningOptionsInfo.minConcurrency) : DokanConfig::DefaultMinConcurrency,
+        // more than the Dokan threads could never run at once
+        dokanTuningOptionsInfo.maxConcurrency ? static_cast<std::size_t>(dokanTuningOptionsInfo.maxConcurrency) : threadCount ? static_cast<std::size_t>(threadCount) : DokanConfig::DokanDefaultThreadCount,
+      };
+
+      const auto mountId = mountStore.Mount(mountInitializeInfo->mountPoint, mountInitializeInfo->writable, mountInitializeInfo->metadataFileName, mountInitializeInfo->deferCopyEnabled, mountInitializeInfo->caseSensitive, volumeInfoOverride, readAheadOptions, dokanTuningOptions, mountInitializeInfo->headless, sources, [callback](MOUNT_ID mountId, const MOUNT_INFO* ptrMountInfo, int dokanMainResult) {
         callback(mountId, ptrMountInfo, dokanMainResult);
       });
 
@@ -446,6 +480,312 @@ namespace Exports {
   }
 
 
+  BOOL WINAPI LMF_GetCopyUpStatus(MOUNT_ID mountId, COPY_UP_STATUS* outCopyUpStatus) MFNOEXCEPT {
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      if (outCopyUpStatus) {
+        const auto statistics = mountStore.GetCopyUpStatistics(mountId);
+        *outCopyUpStatus = COPY_UP_STATUS{
+          static_cast<DWORD>(statistics.numActive),
+          static_cast<DWORD>(statistics.numCompleted),
+          static_cast<DWORD>(statistics.numCancelled),
+          static_cast<DWORD>(statistics.numFailed),
+          statistics.activeCopiedBytes,
+          statistics.activeTotalBytes,
+          statistics.completedBytes,
+          statistics.completedMicroseconds,
+        };
+      }
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  BOOL WINAPI LMF_GetMountStatistics(MOUNT_ID mountId, DWORD sourceIndex, DWORD* outNumOperations, OPERATION_STATISTICS* outStatistics, DWORD maxOperations) MFNOEXCEPT {
+    static_assert(OperationStatistics::NumBuckets == MERGEFS_NUM_LATENCY_BUCKETS);
+
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      if (sourceIndex != MERGEFS_STATISTICS_MOUNT && sourceIndex >= mountStore.GetMountInfo(mountId).numSources) {
+        return MERGEFS_ERROR_INEXISTENT_SOURCE;
+      }
+
+      const auto entries = mountStore.GetOperationStatistics(mountId, sourceIndex == MERGEFS_STATISTICS_MOUNT ? std::nullopt : std::make_optional<std::size_t>(sourceIndex));
+
+      if (outNumOperations) {
+        *outNumOperations = static_cast<DWORD>(entries.size());
+      }
+
+      if (outStatistics) {
+        const std::size_t maxEntries = std::min<std::size_t>(entries.size(), maxOperations);
+        for (std::size_t i = 0; i < maxEntries; i++) {
+          const auto& entry = entries[i];
+          auto& statistics = outStatistics[i];
+          statistics.operationName = entry.name;
+          statistics.count = entry.count;
+          statistics.failures = entry.failures;
+          statistics.totalNanoseconds = entry.totalNanoseconds;
+          statistics.maxNanoseconds = entry.maxNanoseconds;
+          std::copy(entry.buckets.cbegin(), entry.buckets.cend(), statistics.latencyBuckets);
+        }
+
+        if (maxOperations < entries.size()) {
+          return MERGEFS_ERROR_MORE_DATA;
+        }
+      }
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  BOOL WINAPI LMF_GetPresenceFilterStatistics(MOUNT_ID mountId, DWORD sourceIndex, PRESENCE_FILTER_STATISTICS* outStatistics) MFNOEXCEPT {
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      if (sourceIndex >= mountStore.GetMountInfo(mountId).numSources) {
+        return MERGEFS_ERROR_INEXISTENT_SOURCE;
+      }
+
+      const auto statistics = mountStore.GetPresenceFilterStatistics(mountId, sourceIndex);
+
+      if (outStatistics) {
+        outStatistics->ready = statistics.ready ? TRUE : FALSE;
+        outStatistics->numDirectories = static_cast<DWORD>(std::min<std::size_t>(statistics.numDirectories, MAXDWORD));
+        outStatistics->numBytes = statistics.numBytes;
+        outStatistics->falsePositivesPerMillion = static_cast<ULONGLONG>(statistics.estimatedFalsePositiveRate * 1000000.0 + 0.5);
+        outStatistics->queries = statistics.queries;
+        outStatistics->negatives = statistics.negatives;
+        outStatistics->passedInexistent = statistics.passedInexistent;
+      }
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  // maxEvents == 0 selects the default size of the ring buffer; a running trace is restarted
+  BOOL WINAPI LMF_StartMountTrace(MOUNT_ID mountId, DWORD maxEvents) MFNOEXCEPT {
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      mountStore.StartTrace(mountId, maxEvents);
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  BOOL WINAPI LMF_StopMountTrace(MOUNT_ID mountId) MFNOEXCEPT {
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      mountStore.StopTrace(mountId);
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  // writes the events recorded since the last LMF_StartMountTrace as a Chrome trace (JSON), whether or not the trace is still running
+  BOOL WINAPI LMF_SaveMountTrace(MOUNT_ID mountId, LPCWSTR filepath) MFNOEXCEPT {
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      if (!filepath) {
+        return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      mountStore.SaveTrace(mountId, filepath);
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  // blocks until the whole workload has been replayed; the Dokan callbacks it makes show up in LMF_GetMountStatistics as usual
+  BOOL WINAPI LMF_ReplayOperations(MOUNT_ID mountId, const REPLAY_OPTIONS* replayOptions, REPLAY_RESULT* outReplayResult) MFNOEXCEPT {
+    static_assert(static_cast<std::size_t>(ReplayRequest::NumRequests) == MERGEFS_NUM_REPLAY_REQUESTS);
+
+    return WrapException([=]() -> DWORD {
+      std::shared_lock lock(gMutex);
+
+      if (!gMountStoreN) {
+        return MERGEFS_ERROR_NOT_INITIALIZED;
+      }
+
+      if (!replayOptions) {
+        return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+
+      ReplayWorkload workload;
+      switch (replayOptions->workload) {
+        case MERGEFS_REPLAY_TREE_WALK:
+          workload = ReplayWorkload::TreeWalk;
+          break;
+
+        case MERGEFS_REPLAY_MEDIA_SCAN:
+          workload = ReplayWorkload::MediaScan;
+          break;
+
+        case MERGEFS_REPLAY_RANDOM_WRITES:
+          workload = ReplayWorkload::RandomWrites;
+          break;
+
+        case MERGEFS_REPLAY_TOUCH:
+          workload = ReplayWorkload::Touch;
+          break;
+
+        case MERGEFS_REPLAY_HANDLE_READS:
+          workload = ReplayWorkload::HandleReads;
+          break;
+
+        case MERGEFS_REPLAY_COPY_UPS:
+          workload = ReplayWorkload::CopyUps;
+          break;
+
+        case MERGEFS_REPLAY_TRACE_FILE:
+          if (!replayOptions->traceFilename || replayOptions->traceFilename[0] == L'\0') {
+            return MERGEFS_ERROR_INVALID_PARAMETER;
+          }
+          workload = ReplayWorkload::TraceFile;
+          break;
+
+        default:
+          return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+
+      if (replayOptions->numThreads > ReplayConfig::MaxThreads) {
+        return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+
+      auto& mountStore = gMountStoreN.value();
+
+      if (!mountStore.HasMount(mountId)) {
+        return MERGEFS_ERROR_INVALID_MOUNT_ID;
+      }
+
+      const auto result = mountStore.ReplayOperations(mountId, ReplayOptions{
+        workload,
+        workload == ReplayWorkload::TraceFile ? std::wstring(replayOptions->traceFilename) : std::wstring(),
+        replayOptions->numThreads ? static_cast<std::size_t>(replayOptions->numThreads) : 1,
+        replayOptions->iterations ? static_cast<std::size_t>(replayOptions->iterations) : 1,
+        replayOptions->seed,
+        replayOptions->numOperations ? static_cast<std::size_t>(replayOptions->numOperations) : ReplayConfig::DefaultNumOperations,
+        Mount::TransportOptions{
+          replayOptions->transferSize ? replayOptions->transferSize : TransportConfig::BufferSize,
+          replayOptions->nativeCopy != FALSE,
+        },
+      });
+
+      if (outReplayResult) {
+        outReplayResult->elapsedNanoseconds = result.elapsedNanoseconds;
+        outReplayResult->numRequests = result.numRequests;
+        outReplayResult->numFailures = result.numFailures;
+        outReplayResult->numBytes = result.numBytes;
+        for (std::size_t i = 0; i < MERGEFS_NUM_REPLAY_REQUESTS; i++) {
+          const auto& entry = result.requestStatistics[i];
+          auto& statistics = outReplayResult->requests[i];
+          statistics.operationName = entry.name;
+          statistics.count = entry.count;
+          statistics.failures = entry.failures;
+          statistics.totalNanoseconds = entry.totalNanoseconds;
+          statistics.maxNanoseconds = entry.maxNanoseconds;
+          std::copy(entry.buckets.cbegin(), entry.buckets.cend(), statistics.latencyBuckets);
+        }
+      }
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
+  // writes a temporary metadata file of numEntries synthetic entries in directory; needs no LMF_Init
+  BOOL WINAPI LMF_BenchmarkMetadataFormats(LPCWSTR directory, DWORD numEntries, METADATA_BENCHMARK_RESULT* outResult) MFNOEXCEPT {
+    return WrapException([=]() -> DWORD {
+      if (!directory || directory[0] == L'\0' || numEntries == 0 || !outResult) {
+        return MERGEFS_ERROR_INVALID_PARAMETER;
+      }
+
+      const auto result = MetadataFileBackend::BenchmarkFormats(directory, numEntries);
+      const auto copyFormat = [](const MetadataFileBackend::FormatBenchmarkResult::Format& format, METADATA_FORMAT_STATISTICS& statistics) {
+        statistics.fileBytes = format.fileBytes;
+        statistics.loadNanoseconds = format.loadNanoseconds;
+        statistics.hitNanoseconds = format.hitNanoseconds;
+        statistics.missNanoseconds = format.missNanoseconds;
+      };
+      copyFormat(result.v2, outResult->v2);
+      copyFormat(result.v4, outResult->v4);
+      outResult->migrationNanoseconds = result.migrationNanoseconds;
+
+      return MERGEFS_ERROR_SUCCESS;
+    });
+  }
+
+
   BOOL WINAPI LMF_SafeUnmount(MOUNT_ID mountId) MFNOEXCEPT {
     return WrapException([=]() -> DWORD {
       std::lock_guard lock(gMutex);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Metadata.hpp"
+#include "RenameStore.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+// storage of a MetadataStore; metadata keys are made by FilenameToKey from resolved filenames
+// the rename entries are given by their paths and behave like a RenameStore, whose member functions of the same names
+// define their semantics; the backend decides whether it keeps them in memory
+// like MetadataStore, a backend is externally synchronized: const member functions may be called concurrently
+class MetadataBackend {
+public:
+  virtual ~MetadataBackend() = default;
+
+  virtual bool Contains(const std::wstring& key) const = 0;
+  virtual std::optional<Metadata> Find(const std::wstring& key) const = 0;
+  virtual void Put(const std::wstring& key, const Metadata& metadata) = 0;
+  // returns whether the entry existed
+  virtual bool Erase(const std::wstring& key) = 0;
+  virtual std::optional<std::wstring> Resolve(std::wstring_view filename) const = 0;
+  virtual std::optional<bool> Exists(std::wstring_view filename) const = 0;
+  virtual std::vector<std::pair<std::wstring, std::wstring>> ListChildrenInForwardLookupTree(std::wstring_view filename) const = 0;
+  virtual std::vector<std::pair<std::wstring, std::wstring>> ListChildrenInReverseLookupTree(std::wstring_view filename) const = 0;
+  virtual RenameStore::Result Rename(std::wstring_view srcFilename, std::wstring_view destFilename) = 0;
+  // returns whether the entry existed
+  virtual bool RemoveRename(std::wstring_view filename) = 0;
+  // writes the whole store to storeFilename and continues with it
+  virtual void MoveTo(std::wstring_view storeFilename) = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace MetadataConfig {
+  enum class Durability {
+    None,       // appendix records are written by the background writer but never flushed explicitly
+    Interval,   // the store file is flushed at most FlushInterval after a batch was written
+    Batch,      // the store file is flushed after every batch
+  };
+
+  // MetadataLogWriter; callers never wait for their records, so a crash may lose the records of the last batches
+  // (or of the last FlushInterval) but never leaves a torn record behind (see MetadataStore::ApplyAppendix)
+  constexpr Durability LogDurability = Durability::Interval;
+  constexpr std::chrono::milliseconds FlushInterval = std::chrono::milliseconds(1000);
+
+  // records queued while a batch is being written are written together in the next batch, up to this size per WriteFile
+  constexpr std::size_t MaxBatchBytes = 4 * 1024 * 1024;
+
+  // MetadataStore::MaybeCompact; the appendix section is merged into a new store file in the background once it has
+  // reached CompactionAppendixPercent of the rest of the file and MinCompactionAppendixBytes
+  // set CompactionEnabled to false to merge it only at unmount
+  constexpr bool CompactionEnabled = true;
+  constexpr std::uint64_t CompactionAppendixPercent = 50;
+  constexpr std::uint64_t MinCompactionAppendixBytes = 4 * 1024 * 1024;
+
+  enum class Backend {
+    File,       // MetadataFileBackend; the MFMD format of metadata.md
+    Sqlite,     // MetadataSqliteBackend; needs LibMergeFS to be built with MERGEFS_SQLITE
+  };
+
+  // MetadataStore; the backend of a new (missing or empty) store file, whereas an existing one is opened with the
+  // backend of its format
+#ifdef MERGEFS_SQLITE
+  constexpr Backend NewStoreBackend = Backend::Sqlite;
+#else
+  constexpr Backend NewStoreBackend = Backend::File;
+#endif
+
+  // MetadataSqliteBackend; page cache per store, which bounds the memory however many entries the store has
+  constexpr std::size_t SqliteCacheBytes = 16 * 1024 * 1024;
+  // changes are committed in batches of up to this many statements (unless LogDurability is Batch), and at the latest
+  // FlushInterval after the first change of the batch
+  constexpr std::size_t SqliteMaxBatchStatements = 4096;
+}
@@ -0,0 +1,2325 @@
+#include "MetadataFileBackend.hpp"
+#include "Metadata.hpp"
+#include "MetadataConfig.hpp"
+#include "MetadataLogWriter.hpp"
+#include "RenameStore.hpp"
+#include "Util.hpp"
+#include "NsError.hpp"
+
+#include "../Util/Common.hpp"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+using namespace std::literals;
+
+
+namespace {
+  template<typename T, std::size_t Alignment>
+  auto make_unique_aligned(std::size_t size) {
+    struct aligned_deleter {
+      void operator()(T* ptr) const {
+        _aligned_free(ptr);
+      }
+    };
+
+    auto ptr = _aligned_malloc(sizeof(T) * size, Alignment);
+    if (!ptr) {
+      throw std::bad_alloc();
+    }
+    return std::unique_ptr<T[], aligned_deleter>(reinterpret_cast<T*>(ptr), aligned_deleter());
+  }
+}
+
+
+namespace MetadataFileV1 {
+  constexpr std::uint32_t Signature = 0x00000001;
+
+  /*
+  EntryCount
+  {
+    EntrySize
+    EntryFlag
+    KeyNameCount
+    WCHAR[KeyNameCount]
+    ?FileAttributes
+    ?CreationTime
+    ?LastAccessTime
+    ?LastWriteTime
+    ?SecurityCount
+    ?CHAR[SecurityCount]
+  }[EntryCount]
+  */
+
+  using EntryCount = std::uint64_t;
+  using EntrySize = std::uint32_t;
+  using EntryFlag = std::uint16_t;
+  using DeletedFlag = std::uint8_t;
+  using KeyNameCount = std::uint32_t;
+  using SecurityCount = std::uint32_t;
+
+  namespace EntryFlags {
+    // 1 << 0 is reserved
+    constexpr EntryFlag HasAttributes     = 1 << 1;
+    constexpr EntryFlag HasCreationTime   = 1 << 2;
+    constexpr EntryFlag HasLastAccessTime = 1 << 3;
+    constexpr EntryFlag HasLastWriteTime  = 1 << 4;
+    constexpr EntryFlag HasSecurity       = 1 << 5;
+  }
+}
+
+
+namespace MetadataFileV2 {
+  constexpr std::uint32_t Signature = 0x444D464D;   // "MFMD"
+  constexpr std::uint32_t Version   = 0x00020000;
+
+  constexpr unsigned int Alignment = 16;
+
+  constexpr std::uint64_t ReadFILETIME(const FILETIME& filetime) {
+    return static_cast<std::uint64_t>(filetime.dwLowDateTime) | (static_cast<std::uint64_t>(filetime.dwHighDateTime) << 32);
+  }
+
+  constexpr FILETIME ToFILETIME(std::uint64_t filetime) {
+    return FILETIME{
+      filetime & 0xFFFFFFFF,
+      (filetime >> 32) & 0xFFFFFFFF,
+    };
+  }
+
+  template<typename T>
+  constexpr T Align(T size) {
+    return (size + (Alignment - 1)) & ~static_cast<T>(Alignment - 1);
+  }
+
+  struct Header {
+    std::uint32_t signature;
+    std::uint32_t version;
+    std::uint64_t dataSize;
+    std::uint64_t renameSectionOffset;
+    std::uint64_t renameSectionSize;
+    std::uint64_t renameSectionCount;
+    std::uint64_t reserved1;
+    std::uint64_t metadataSectionOffset;
+    std::uint64_t metadataSectionSize;
+    std::uint64_t metadataSectionCount;
+    std::uint64_t reserved2;
+  };
+  static_assert(sizeof(Header) == 16 * 5);
+
+  struct RenameEntryHeader {
+    std::uint32_t blockSize;
+    std::uint32_t reserved1;
+    std::uint32_t aSize;
+    std::uint32_t bSize;
+  };
+  static_assert(sizeof(RenameEntryHeader) == 16 * 1);
+
+  struct RenameEntry : RenameEntryHeader {
+    std::wstring a;
+    std::wstring b;
+
+    RenameEntry(const RenameEntryHeader& header, const std::wstring& a, const std::wstring& b) :
+      RenameEntryHeader(header),
+      a(a),
+      b(b)
+    {}
+
+    static RenameEntry Parse(const std::byte* data, std::function<void(const std::byte* ptr)> checkPtr, std::size_t& size) {
+      auto ptr = data;
+
+      checkPtr(ptr + sizeof(RenameEntryHeader));
+      const auto& header = *reinterpret_cast<const RenameEntryHeader*>(ptr);
+      const auto nextPtr = ptr + header.blockSize;
+      checkPtr(nextPtr);
+      ptr += sizeof(RenameEntryHeader);
+
+      static_assert(sizeof(wchar_t) == sizeof(char16_t));
+
+      const auto alignedASize = Align(header.aSize * sizeof(char16_t));
+      auto aStrPtr = reinterpret_cast<const wchar_t*>(ptr);
+      const std::wstring a(aStrPtr, aStrPtr + header.aSize);
+      ptr += alignedASize;
+
+      const auto alignedBSize = Align(header.bSize * sizeof(char16_t));
+      auto bStrPtr = reinterpret_cast<const wchar_t*>(ptr);
+      const std::wstring b(bStrPtr, bStrPtr + header.bSize);
+      ptr += alignedBSize;
+
+      assert(ptr == nextPtr);
+
+      size = nextPtr - data;
+
+      return RenameEntry(header, a, b);
+    }
+  };
+
+  namespace EntryFlags {
+    // 1 << 0 is reserved
+    constexpr std::uint32_t HasAttributes = 1 << 1;
+    constexpr std::uint32_t HasCreationTime = 1 << 2;
+    constexpr std::uint32_t HasLastAccessTime = 1 << 3;
+    constexpr std::uint32_t HasLastWriteTime = 1 << 4;
+    constexpr std::uint32_t HasSecurity = 1 << 5;
+  }
+
+  struct MetadataEntryHeader {
+    std::uint32_t blockSize;
+    std::uint32_t reserved1;
+    std::uint32_t filenameSize;
+    std::uint32_t securitySize;
+    std::uint32_t flags;
+    std::uint32_t attributes;
+    std::uint64_t creationTime;
+    std::uint64_t lastAccessTime;
+    std::uint64_t lastWriteTime;
+  };
+  static_assert(sizeof(MetadataEntryHeader) == 16 * 3);
+
+  struct MetadataEntry : MetadataEntryHeader {
+    std::wstring filename;
+    std::string security;
+
+    MetadataEntry(const MetadataEntryHeader& header, const std::wstring& filename, const std::string& security) :
+      MetadataEntryHeader(header),
+      filename(filename),
+      security(security)
+    {}
+
+    operator Metadata() const {
+      using namespace MetadataFileV2;
+
+      Metadata metadata;
+
+      if (flags & EntryFlags::HasAttributes) {
+        metadata.fileAttributes.emplace(attributes);
+      }
+      if (flags & EntryFlags::HasCreationTime) {
+        metadata.creationTime.emplace(ToFILETIME(creationTime));
+      }
+      if (flags & EntryFlags::HasLastAccessTime) {
+        metadata.lastAccessTime.emplace(ToFILETIME(lastAccessTime));
+      }
+      if (flags & EntryFlags::HasLastWriteTime) {
+        metadata.lastWriteTime.emplace(ToFILETIME(lastWriteTime));
+      }
+      if (flags & EntryFlags::HasSecurity) {
+        metadata.security.emplace(security);
+      }
+
+      return metadata;
+    }
+
+    static MetadataEntry Parse(const std::byte* data, std::function<void(const std::byte * ptr)> checkPtr, std::size_t& size) {
+      auto ptr = data;
+
+      checkPtr(ptr + sizeof(MetadataEntryHeader));
+      const auto& header = *reinterpret_cast<const MetadataEntryHeader*>(ptr);
+      const auto nextPtr = ptr + header.blockSize;
+      checkPtr(nextPtr);
+      ptr += sizeof(MetadataEntryHeader);
+
+      static_assert(sizeof(wchar_t) == sizeof(char16_t));
+
+      const auto alignedFilenameSize = Align(header.filenameSize * sizeof(char16_t));
+      auto filenameStrPtr = reinterpret_cast<const wchar_t*>(ptr);
+      const std::wstring filename(filenameStrPtr, filenameStrPtr + header.filenameSize);
+      ptr += alignedFilenameSize;
+
+      const auto alignedSecuritySize = Align(header.securitySize);
+      auto securityStrPtr = reinterpret_cast<const char*>(ptr);
+      const std::string security(securityStrPtr, securityStrPtr + header.securitySize);
+      ptr += alignedSecuritySize;
+
+      assert(ptr == nextPtr);
+
+      size = nextPtr - data;
+
+      return MetadataEntry(header, filename, security);
+    }
+  };
+
+  enum class AppendixDataType : std::uint32_t {
+    Rename          = 0x00000001,
+    Metadata        = 0x00000002,
+    // V4 and later; the data is encoded like the entries of a V4 file
+    CompactRename   = 0x00000003,
+    CompactMetadata = 0x00000004,
+  };
+
+  struct AppendixEntryHeader {
+    std::uint32_t blockSize;
+    std::uint32_t reserved1;
+    AppendixDataType dataType;
+    std::uint32_t reserved2;
+  };
+  static_assert(sizeof(AppendixEntryHeader) == 16 * 1);
+}
+
+
+// V2と同じエントリ形式で、メタデータエントリ部をキーの順に並べ、パス部とハッシュ索引部を加えたもの
+// 起動時に全て読み込んでV4に変換する（索引部はV4でも同じものを使う）
+namespace MetadataFileV3 {
+  using MetadataFileV2::Alignment;
+  using MetadataFileV2::Align;
+  using MetadataFileV2::EntryFlags::HasAttributes;
+  using MetadataFileV2::EntryFlags::HasCreationTime;
+  using MetadataFileV2::EntryFlags::HasLastAccessTime;
+  using MetadataFileV2::EntryFlags::HasLastWriteTime;
+  using MetadataFileV2::EntryFlags::HasSecurity;
+  using MetadataFileV2::MetadataEntryHeader;
+  using MetadataFileV2::ReadFILETIME;
+  using MetadataFileV2::RenameEntryHeader;
+  using MetadataFileV2::ToFILETIME;
+
+  constexpr std::uint32_t Signature = MetadataFileV2::Signature;
+  constexpr std::uint32_t Version   = 0x00030000;
+
+  constexpr std::uint64_t MinIndexBucketCount = 16;
+
+  struct Header {
+    std::uint32_t signature;
+    std::uint32_t version;
+    std::uint64_t dataSize;
+    std::uint64_t renameSectionOffset;
+    std::uint64_t renameSectionSize;
+    std::uint64_t renameSectionCount;
+    std::uint64_t reserved1;
+    std::uint64_t metadataSectionOffset;
+    std::uint64_t metadataSectionSize;
+    std::uint64_t metadataSectionCount;
+    std::uint64_t reserved2;
+    std::uint64_t pathSectionOffset;
+    std::uint64_t indexSectionOffset;
+    std::uint64_t indexBucketCount;
+    std::uint64_t reserved3;
+  };
+  static_assert(sizeof(Header) == 16 * 7);
+
+  struct IndexBucket {
+    std::uint32_t tag;        // upper 32 bits of the hash of the key
+    std::uint32_t ordinal;    // 1-based position in the path section; 0 if the bucket is empty
+  };
+  static_assert(sizeof(IndexBucket) == 8);
+
+  // FNV-1a over the UTF-16 code units of the key, finalized with splitmix64 so that the low bits select buckets well
+  constexpr std::uint64_t Hash(std::wstring_view key) noexcept {
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+    for (const auto c : key) {
+      hash ^= static_cast<std::uint16_t>(c);
+      hash *= 0x00000100000001B3ull;
+    }
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+  }
+
+  // keeps the load factor at or below 1/2
+  constexpr std::uint64_t GetIndexBucketCount(std::uint64_t numEntries) noexcept {
+    std::uint64_t count = MinIndexBucketCount;
+    while (count < numEntries * 2) {
+      count <<= 1;
+    }
+    return count;
+  }
+
+  constexpr bool IsInRange(std::uint64_t offset, std::uint64_t size, std::uint64_t totalSize) noexcept {
+    return offset <= totalSize && size <= totalSize - offset;
+  }
+
+  const Header& GetHeader(const std::byte* data) noexcept {
+    return *reinterpret_cast<const Header*>(data);
+  }
+
+  // checks everything but the entries, which are checked when they are read
+  void Validate(const std::byte* data, std::uint64_t size) {
+    if (size < sizeof(Header)) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    const auto& header = GetHeader(data);
+    if (header.signature != Signature || header.version != Version || header.dataSize != size) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    if (header.renameSectionOffset % Alignment != 0 || !IsInRange(header.renameSectionOffset, header.renameSectionSize, size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.metadataSectionOffset % Alignment != 0 || !IsInRange(header.metadataSectionOffset, header.metadataSectionSize, size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.metadataSectionCount > size / sizeof(std::uint64_t) || header.metadataSectionCount > 0xFFFFFFFF) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.pathSectionOffset % Alignment != 0 || !IsInRange(header.pathSectionOffset, header.metadataSectionCount * sizeof(std::uint64_t), size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.indexBucketCount == 0 || (header.indexBucketCount & (header.indexBucketCount - 1)) != 0 || header.indexBucketCount > size / sizeof(IndexBucket)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.indexSectionOffset % Alignment != 0 || !IsInRange(header.indexSectionOffset, header.indexBucketCount * sizeof(IndexBucket), size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+  }
+
+  // ordinal is the position in key order
+  const MetadataEntryHeader& GetEntry(const std::byte* data, std::uint64_t ordinal) {
+    const auto& header = GetHeader(data);
+    assert(ordinal < header.metadataSectionCount);
+    const auto offset = reinterpret_cast<const std::uint64_t*>(data + header.pathSectionOffset)[ordinal];
+    const auto sectionEnd = header.metadataSectionOffset + header.metadataSectionSize;
+    if (offset < header.metadataSectionOffset || offset % Alignment != 0 || !IsInRange(offset, sizeof(MetadataEntryHeader), sectionEnd)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    const auto& entry = *reinterpret_cast<const MetadataEntryHeader*>(data + offset);
+    const std::uint64_t minBlockSize = sizeof(MetadataEntryHeader) + Align(std::uint64_t{entry.filenameSize} * sizeof(char16_t)) + Align(std::uint64_t{entry.securitySize});
+    if (entry.blockSize % Alignment != 0 || entry.blockSize < minBlockSize || !IsInRange(offset, entry.blockSize, sectionEnd)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    return entry;
+  }
+
+  std::wstring_view GetKey(const MetadataEntryHeader& entry) noexcept {
+    static_assert(sizeof(wchar_t) == sizeof(char16_t));
+    return std::wstring_view(reinterpret_cast<const wchar_t*>(reinterpret_cast<const std::byte*>(&entry) + sizeof(MetadataEntryHeader)), entry.filenameSize);
+  }
+
+  Metadata ToMetadata(const MetadataEntryHeader& entry) {
+    Metadata metadata;
+    if (entry.flags & HasAttributes) {
+      metadata.fileAttributes.emplace(entry.attributes);
+    }
+    if (entry.flags & HasCreationTime) {
+      metadata.creationTime.emplace(ToFILETIME(entry.creationTime));
+    }
+    if (entry.flags & HasLastAccessTime) {
+      metadata.lastAccessTime.emplace(ToFILETIME(entry.lastAccessTime));
+    }
+    if (entry.flags & HasLastWriteTime) {
+      metadata.lastWriteTime.emplace(ToFILETIME(entry.lastWriteTime));
+    }
+    if (entry.flags & HasSecurity) {
+      const auto securityPtr = reinterpret_cast<const char*>(&entry) + sizeof(MetadataEntryHeader) + Align(entry.filenameSize * sizeof(char16_t));
+      metadata.security.emplace(securityPtr, entry.securitySize);
+    }
+    return metadata;
+  }
+}
+
+
+// V3と同じ構成で、各エントリを詰めて並べ、文字列をUTF-8と前方圧縮、数値を可変長整数で格納したもの
+// 前方圧縮はEntriesPerBlock個ごとのブロック内でのみ行い、パス部はブロックの位置を指す（検索時はブロックの先頭から復号する）
+namespace MetadataFileV4 {
+  using MetadataFileV2::Alignment;
+  using MetadataFileV2::Align;
+  using MetadataFileV2::AppendixDataType;
+  using MetadataFileV2::AppendixEntryHeader;
+  using MetadataFileV2::EntryFlags::HasAttributes;
+  using MetadataFileV2::EntryFlags::HasCreationTime;
+  using MetadataFileV2::EntryFlags::HasLastAccessTime;
+  using MetadataFileV2::EntryFlags::HasLastWriteTime;
+  using MetadataFileV2::EntryFlags::HasSecurity;
+  using MetadataFileV2::ReadFILETIME;
+  using MetadataFileV2::ToFILETIME;
+  using MetadataFileV3::GetIndexBucketCount;
+  using MetadataFileV3::Hash;
+  using MetadataFileV3::IndexBucket;
+  using MetadataFileV3::IsInRange;
+
+  constexpr std::uint32_t Signature = MetadataFileV2::Signature;
+  constexpr std::uint32_t Version   = 0x00040000;
+
+  // a lookup decodes up to this many entries from the start of a block
+  constexpr std::uint32_t EntriesPerBlock    = 16;
+  constexpr std::uint32_t MaxEntriesPerBlock = 1024;
+
+  constexpr std::uint32_t AllEntryFlags = HasAttributes | HasCreationTime | HasLastAccessTime | HasLastWriteTime | HasSecurity;
+
+  // the times in the order they are stored
+  constexpr std::pair<std::uint32_t, std::optional<FILETIME> Metadata::*> Times[]{
+    {HasCreationTime,   &Metadata::creationTime},
+    {HasLastAccessTime, &Metadata::lastAccessTime},
+    {HasLastWriteTime,  &Metadata::lastWriteTime},
+  };
+
+  struct Header {
+    std::uint32_t signature;
+    std::uint32_t version;
+    std::uint64_t dataSize;
+    std::uint64_t renameSectionOffset;
+    std::uint64_t renameSectionSize;
+    std::uint64_t renameSectionCount;
+    std::uint64_t reserved1;
+    std::uint64_t metadataSectionOffset;
+    std::uint64_t metadataSectionSize;
+    std::uint64_t metadataSectionCount;
+    std::uint32_t entriesPerBlock;
+    std::uint32_t reserved2;
+    std::uint64_t pathSectionOffset;
+    std::uint64_t indexSectionOffset;
+    std::uint64_t indexBucketCount;
+    std::uint64_t reserved3;
+  };
+  static_assert(sizeof(Header) == 16 * 7);
+
+  const Header& GetHeader(const std::byte* data) noexcept {
+    return *reinterpret_cast<const Header*>(data);
+  }
+
+  constexpr std::uint64_t GetBlockCount(const Header& header) noexcept {
+    return (header.metadataSectionCount + header.entriesPerBlock - 1) / header.entriesPerBlock;
+  }
+
+  void AppendVarint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  // differences of times are stored zigzag-encoded so that small negative ones stay short
+  constexpr std::uint64_t ZigZag(std::uint64_t difference) noexcept {
+    return (difference << 1) ^ (0 - (difference >> 63));
+  }
+
+  constexpr std::uint64_t UnZigZag(std::uint64_t value) noexcept {
+    return (value >> 1) ^ (0 - (value & 1));
+  }
+
+  // bounds-checked reader of the variable-length fields of a section or an appendix record
+  class Reader {
+    const std::byte* mPtr;
+    const std::byte* mEnd;
+
+  public:
+    Reader(const std::byte* ptr, const std::byte* end) noexcept :
+      mPtr(ptr),
+      mEnd(end)
+    {}
+
+    const std::byte* GetPointer() const noexcept {
+      return mPtr;
+    }
+
+    std::uint64_t ReadVarint() {
+      // most fields are lengths and flags below 0x80
+      if (mPtr != mEnd && static_cast<std::uint8_t>(*mPtr) < 0x80) {
+        return static_cast<std::uint8_t>(*mPtr++);
+      }
+      return ReadLongVarint();
+    }
+
+    std::uint64_t ReadLongVarint() {
+      std::uint64_t value = 0;
+      for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (mPtr == mEnd) {
+          throw W32Error(ERROR_BUFFER_OVERFLOW);
+        }
+        const auto byte = static_cast<std::uint8_t>(*mPtr++);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+          return value;
+        }
+      }
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+
+    std::string_view ReadBytes(std::uint64_t size) {
+      if (size > static_cast<std::uint64_t>(mEnd - mPtr)) {
+        throw W32Error(ERROR_BUFFER_OVERFLOW);
+      }
+      const std::string_view bytes(reinterpret_cast<const char*>(mPtr), static_cast<std::size_t>(size));
+      mPtr += size;
+      return bytes;
+    }
+  };
+
+  // UTF-8, except that unpaired surrogates are kept in their 3-byte form (as WTF-8 does), since filenames may have them
+  void AppendUtf8(std::string& out, std::wstring_view value) {
+    // a code unit takes at most 4 bytes
+    const auto start = out.size();
+    out.resize(start + value.size() * 4);
+    auto ptr = out.data() + start;
+    for (std::size_t i = 0; i < value.size(); i++) {
+      auto c = static_cast<std::uint32_t>(value[i]);
+      if (c < 0x80) {
+        *ptr++ = static_cast<char>(c);
+        continue;
+      }
+      if (c >= 0xD800 && c < 0xDC00 && i + 1 < value.size()) {
+        const auto low = static_cast<std::uint32_t>(value[i + 1]);
+        if (low >= 0xDC00 && low < 0xE000) {
+          c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+          i++;
+        }
+      }
+      if (c < 0x800) {
+        *ptr++ = static_cast<char>(0xC0 | (c >> 6));
+        *ptr++ = static_cast<char>(0x80 | (c & 0x3F));
+      } else if (c < 0x10000) {
+        *ptr++ = static_cast<char>(0xE0 | (c >> 12));
+        *ptr++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        *ptr++ = static_cast<char>(0x80 | (c & 0x3F));
+      } else {
+        *ptr++ = static_cast<char>(0xF0 | (c >> 18));
+        *ptr++ = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        *ptr++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        *ptr++ = static_cast<char>(0x80 | (c & 0x3F));
+      }
+    }
+    out.resize(static_cast<std::size_t>(ptr - out.data()));
+  }
+
+  std::wstring DecodeUtf8(std::string_view value) {
+    // a byte makes at most one code unit
+    std::wstring result(value.size(), L'\0');
+    auto ptr = result.data();
+    for (std::size_t i = 0; i < value.size();) {
+      const auto lead = static_cast<std::uint8_t>(value[i]);
+      if (lead < 0x80) {
+        *ptr++ = static_cast<wchar_t>(lead);
+        i++;
+        continue;
+      }
+      std::size_t length = 0;
+      std::uint32_t c = 0;
+      if ((lead & 0xE0) == 0xC0) {
+        length = 2;
+        c = lead & 0x1F;
+      } else if ((lead & 0xF0) == 0xE0) {
+        length = 3;
+        c = lead & 0x0F;
+      } else if ((lead & 0xF8) == 0xF0) {
+        length = 4;
+        c = lead & 0x07;
+      } else {
+        throw W32Error(ERROR_INVALID_PARAMETER);
+      }
+      if (length > value.size() - i) {
+        throw W32Error(ERROR_INVALID_PARAMETER);
+      }
+      for (std::size_t j = 1; j < length; j++) {
+        const auto trail = static_cast<std::uint8_t>(value[i + j]);
+        if ((trail & 0xC0) != 0x80) {
+          throw W32Error(ERROR_INVALID_PARAMETER);
+        }
+        c = (c << 6) | (trail & 0x3F);
+      }
+      i += length;
+
+      if (c > 0x10FFFF) {
+        throw W32Error(ERROR_INVALID_PARAMETER);
+      }
+      if (c >= 0x10000 && sizeof(wchar_t) == 2) {
+        *ptr++ = static_cast<wchar_t>(0xD800 + ((c - 0x10000) >> 10));
+        *ptr++ = static_cast<wchar_t>(0xDC00 + ((c - 0x10000) & 0x3FF));
+        continue;
+      }
+      *ptr++ = static_cast<wchar_t>(c);
+    }
+    result.resize(static_cast<std::size_t>(ptr - result.data()));
+    return result;
+  }
+
+  // whether encoded is value encoded by AppendUtf8; compares without allocating, for lookups
+  bool IsUtf8Of(std::string_view encoded, std::wstring_view value) {
+    std::size_t position = 0;
+    for (std::size_t i = 0; i < value.size(); i++) {
+      const auto c = static_cast<std::uint32_t>(value[i]);
+      if (c < 0x80) {
+        if (position == encoded.size() || encoded[position] != static_cast<char>(c)) {
+          return false;
+        }
+        position++;
+        continue;
+      }
+      // a surrogate pair is encoded at once; at most 8 bytes, which a std::string holds without allocating
+      std::size_t count = 1;
+      if (c >= 0xD800 && c < 0xDC00 && i + 1 < value.size() && static_cast<std::uint32_t>(value[i + 1]) >= 0xDC00 && static_cast<std::uint32_t>(value[i + 1]) < 0xE000) {
+        count = 2;
+      }
+      std::string bytes;
+      AppendUtf8(bytes, value.substr(i, count));
+      if (encoded.compare(position, bytes.size(), bytes) != 0) {
+        return false;
+      }
+      position += bytes.size();
+      i += count - 1;
+    }
+    return position == encoded.size();
+  }
+
+  // front-coded: the length of the prefix shared with previous, the length of the rest and the rest
+  void AppendString(std::string& out, std::string_view previous, std::string_view value) {
+    const auto shared = static_cast<std::size_t>(std::mismatch(previous.begin(), previous.end(), value.begin(), value.end()).first - previous.begin());
+    AppendVarint(out, shared);
+    AppendVarint(out, value.size() - shared);
+    out.append(value.substr(shared));
+  }
+
+  // value holds the previous string and is replaced with the string read
+  void ReadString(Reader& reader, std::string& value) {
+    const auto shared = reader.ReadVarint();
+    if (shared > value.size()) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    const auto rest = reader.ReadBytes(reader.ReadVarint());
+    value.resize(static_cast<std::size_t>(shared));
+    value.append(rest);
+  }
+
+  // A is front-coded against A of the previous entry, and B against A
+  void AppendRenameEntry(std::string& out, std::string_view previousA, std::string_view a, std::string_view b) {
+    AppendString(out, previousA, a);
+    AppendString(out, a, b);
+  }
+
+  // a holds A of the previous entry
+  void ReadRenameEntry(Reader& reader, std::string& a, std::string& b) {
+    ReadString(reader, a);
+    b = a;
+    ReadString(reader, b);
+  }
+
+  std::uint32_t GetEntryFlags(const Metadata& metadata) noexcept {
+    std::uint32_t flags = 0;
+    if (metadata.fileAttributes) flags |= HasAttributes;
+    if (metadata.creationTime)   flags |= HasCreationTime;
+    if (metadata.lastAccessTime) flags |= HasLastAccessTime;
+    if (metadata.lastWriteTime)  flags |= HasLastWriteTime;
+    if (metadata.security)       flags |= HasSecurity;
+    return flags;
+  }
+
+  // the flags (the presence bitmap) followed by the fields present; each time is stored as the difference from
+  // previousTime, the time stored last in the same block or record
+  void AppendFields(std::string& out, const Metadata& metadata, std::uint64_t& previousTime) {
+    AppendVarint(out, GetEntryFlags(metadata));
+    if (metadata.fileAttributes) {
+      AppendVarint(out, metadata.fileAttributes.value());
+    }
+    for (const auto& [flag, member] : Times) {
+      if (const auto& time = metadata.*member) {
+        const auto value = ReadFILETIME(time.value());
+        AppendVarint(out, ZigZag(value - previousTime));
+        previousTime = value;
+      }
+    }
+    if (metadata.security) {
+      AppendVarint(out, metadata.security.value().size());
+      out.append(metadata.security.value());
+    }
+  }
+
+  // returns the flags; the fields are stored to metadataN unless it is nullptr
+  std::uint32_t ReadFields(Reader& reader, std::uint64_t& previousTime, Metadata* metadataN) {
+    const auto flags = reader.ReadVarint();
+    if (flags & ~std::uint64_t{AllEntryFlags}) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    if (flags & HasAttributes) {
+      const auto attributes = reader.ReadVarint();
+      if (attributes > 0xFFFFFFFF) {
+        throw W32Error(ERROR_INVALID_PARAMETER);
+      }
+      if (metadataN) {
+        metadataN->fileAttributes.emplace(static_cast<DWORD>(attributes));
+      }
+    }
+    for (const auto& [flag, member] : Times) {
+      if (flags & flag) {
+        previousTime += UnZigZag(reader.ReadVarint());
+        if (metadataN) {
+          (metadataN->*member).emplace(ToFILETIME(previousTime));
+        }
+      }
+    }
+    if (flags & HasSecurity) {
+      const auto security = reader.ReadBytes(reader.ReadVarint());
+      if (metadataN) {
+        metadataN->security.emplace(security);
+      }
+    }
+    return static_cast<std::uint32_t>(flags);
+  }
+
+  // zero-filled up to the alignment; operator new aligns the buffer for the header
+  std::vector<std::byte> MakeAppendixRecord(AppendixDataType dataType, std::string_view data) {
+    const auto blockSize = Align(sizeof(AppendixEntryHeader) + data.size());
+    std::vector<std::byte> record(blockSize);
+    *reinterpret_cast<AppendixEntryHeader*>(record.data()) = AppendixEntryHeader{
+      static_cast<std::uint32_t>(blockSize),
+      0,
+      dataType,
+      0,
+    };
+    std::memcpy(record.data() + sizeof(AppendixEntryHeader), data.data(), data.size());
+    return record;
+  }
+
+  // checks everything but the entries, which are checked when they are decoded
+  void Validate(const std::byte* data, std::uint64_t size) {
+    if (size < sizeof(Header)) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    const auto& header = GetHeader(data);
+    if (header.signature != Signature || header.version != Version || header.dataSize != size) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    if (header.entriesPerBlock == 0 || header.entriesPerBlock > MaxEntriesPerBlock) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+    if (header.renameSectionOffset % Alignment != 0 || !IsInRange(header.renameSectionOffset, header.renameSectionSize, size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.metadataSectionOffset % Alignment != 0 || !IsInRange(header.metadataSectionOffset, header.metadataSectionSize, size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    // an entry takes at least 3 bytes
+    if (header.metadataSectionCount > header.metadataSectionSize || header.metadataSectionCount > 0xFFFFFFFF) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.pathSectionOffset % Alignment != 0 || !IsInRange(header.pathSectionOffset, GetBlockCount(header) * sizeof(std::uint64_t), size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.indexBucketCount == 0 || (header.indexBucketCount & (header.indexBucketCount - 1)) != 0 || header.indexBucketCount > size / sizeof(IndexBucket)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+    if (header.indexSectionOffset % Alignment != 0 || !IsInRange(header.indexSectionOffset, header.indexBucketCount * sizeof(IndexBucket), size)) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+  }
+
+  // decodes the metadata entries one by one in key order, starting from the first entry of a block
+  // ReadKey and ReadFields are called alternately
+  class EntryReader {
+    const Header& mHeader;
+    Reader mReader;
+    std::uint64_t mOrdinal;
+    // the key last read in UTF-8, which the next key is front-coded against
+    std::string mKey;
+    std::uint64_t mPreviousTime = 0;
+
+  public:
+    EntryReader(const std::byte* data, std::uint64_t block) :
+      mHeader(GetHeader(data)),
+      mReader(nullptr, nullptr),
+      mOrdinal(block * mHeader.entriesPerBlock)
+    {
+      assert(block < GetBlockCount(mHeader));
+      const auto offset = reinterpret_cast<const std::uint64_t*>(data + mHeader.pathSectionOffset)[block];
+      const auto sectionEnd = mHeader.metadataSectionOffset + mHeader.metadataSectionSize;
+      if (offset < mHeader.metadataSectionOffset || offset > sectionEnd) {
+        throw W32Error(ERROR_BUFFER_OVERFLOW);
+      }
+      mReader = Reader(data + offset, data + sectionEnd);
+    }
+
+    // the ordinal of the entry read next
+    std::uint64_t GetOrdinal() const noexcept {
+      return mOrdinal;
+    }
+
+    const std::string& ReadKey() {
+      // the first key of a block shares nothing
+      if (mOrdinal % mHeader.entriesPerBlock == 0) {
+        mKey.clear();
+        mPreviousTime = 0;
+      }
+      ReadString(mReader, mKey);
+      mOrdinal++;
+      return mKey;
+    }
+
+    std::uint32_t ReadFields(Metadata* metadataN) {
+      return MetadataFileV4::ReadFields(mReader, mPreviousTime, metadataN);
+    }
+  };
+
+  // returns the reader positioned at the fields of the entry of key
+  std::optional<EntryReader> FindEntry(const std::byte* data, std::wstring_view key) {
+    const auto& header = GetHeader(data);
+    const auto buckets = reinterpret_cast<const IndexBucket*>(data + header.indexSectionOffset);
+    const auto hash = Hash(key);
+    const auto tag = static_cast<std::uint32_t>(hash >> 32);
+    const auto mask = header.indexBucketCount - 1;
+    for (std::uint64_t i = 0, index = hash & mask; i < header.indexBucketCount; i++, index = (index + 1) & mask) {
+      const auto& bucket = buckets[index];
+      if (bucket.ordinal == 0) {
+        return std::nullopt;
+      }
+      if (bucket.tag != tag) {
+        continue;
+      }
+      if (bucket.ordinal > header.metadataSectionCount) {
+        throw W32Error(ERROR_BUFFER_OVERFLOW);
+      }
+      const std::uint64_t ordinal = bucket.ordinal - 1;
+      EntryReader reader(data, ordinal / header.entriesPerBlock);
+      while (reader.GetOrdinal() < ordinal) {
+        reader.ReadKey();
+        reader.ReadFields(nullptr);
+      }
+      if (IsUtf8Of(reader.ReadKey(), key)) {
+        return reader;
+      }
+    }
+    return std::nullopt;
+  }
+}
+
+
+namespace {
+  // buffered sequential writer of a new file
+  class FileWriter {
+    static constexpr std::size_t BufferSize = 1 << 20;
+
+    HANDLE mHFile;
+    std::vector<std::byte> mBuffer;
+    std::uint64_t mPosition;
+
+  public:
+    FileWriter(const FileWriter&) = delete;
+
+    FileWriter(const std::wstring& filepath) :
+      mHFile(CreateFileW(filepath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)),
+      mBuffer(),
+      mPosition(0)
+    {
+      if (!util::IsValidHandle(mHFile)) {
+        throw W32Error();
+      }
+      mBuffer.reserve(BufferSize);
+    }
+
+    ~FileWriter() {
+      CloseHandle(mHFile);
+    }
+
+    std::uint64_t GetPosition() const noexcept {
+      return mPosition;
+    }
+
+    void Flush() {
+      if (mBuffer.empty()) {
+        return;
+      }
+      DWORD written = 0;
+      if (!WriteFile(mHFile, mBuffer.data(), static_cast<DWORD>(mBuffer.size()), &written, NULL) || written != mBuffer.size()) {
+        throw W32Error();
+      }
+      mBuffer.clear();
+    }
+
+    void Write(const void* data, std::size_t size) {
+      auto ptr = static_cast<const std::byte*>(data);
+      mPosition += size;
+      while (size) {
+        if (mBuffer.size() == BufferSize) {
+          Flush();
+        }
+        const auto count = std::min(size, BufferSize - mBuffer.size());
+        mBuffer.insert(mBuffer.end(), ptr, ptr + count);
+        ptr += count;
+        size -= count;
+      }
+    }
+
+    void WriteZeros(std::size_t size) {
+      static constexpr std::byte Zeros[MetadataFileV4::Alignment]{};
+      while (size) {
+        const auto count = std::min(size, sizeof(Zeros));
+        Write(Zeros, count);
+        size -= count;
+      }
+    }
+
+    // pads to the alignment of the metadata file
+    void Pad() {
+      WriteZeros(static_cast<std::size_t>(MetadataFileV4::Align(mPosition) - mPosition));
+    }
+
+    // writes over what has been written; the position is not changed
+    void Overwrite(std::uint64_t offset, const void* data, std::size_t size) {
+      Flush();
+      auto overlapped = util::CreateOverlapped(offset);
+      DWORD written = 0;
+      if (!WriteFile(mHFile, data, static_cast<DWORD>(size), &written, &overlapped) || written != size) {
+        throw W32Error();
+      }
+      if (!SetFilePointerEx(mHFile, util::CreateLargeInteger(static_cast<LONGLONG>(mPosition)), NULL, FILE_BEGIN)) {
+        throw W32Error();
+      }
+    }
+
+    void Commit() {
+      Flush();
+      if (!FlushFileBuffers(mHFile)) {
+        throw W32Error();
+      }
+    }
+  };
+
+
+  // writes a V2 file without rename entries nor appendix section; only for BenchmarkFormats, as V2 files are no longer written
+  void WriteV2(FileWriter& writer, const std::vector<std::pair<std::wstring, Metadata>>& entries) {
+    using namespace MetadataFileV2;
+
+    Header header{};
+    header.signature = Signature;
+    header.version = Version;
+    header.renameSectionOffset = sizeof(Header);
+    header.metadataSectionOffset = sizeof(Header);
+    header.metadataSectionCount = entries.size();
+    writer.Write(&header, sizeof(header));
+
+    for (const auto& [key, metadata] : entries) {
+      MetadataEntryHeader entryHeader{};
+      entryHeader.filenameSize = static_cast<std::uint32_t>(key.size());
+      entryHeader.securitySize = static_cast<std::uint32_t>(metadata.security ? metadata.security->size() : 0);
+      entryHeader.blockSize = static_cast<std::uint32_t>(sizeof(MetadataEntryHeader) + Align(key.size() * sizeof(char16_t)) + Align(static_cast<std::size_t>(entryHeader.securitySize)));
+      if (metadata.fileAttributes) {
+        entryHeader.flags |= EntryFlags::HasAttributes;
+        entryHeader.attributes = metadata.fileAttributes.value();
+      }
+      if (metadata.creationTime) {
+        entryHeader.flags |= EntryFlags::HasCreationTime;
+        entryHeader.creationTime = ReadFILETIME(metadata.creationTime.value());
+      }
+      if (metadata.lastAccessTime) {
+        entryHeader.flags |= EntryFlags::HasLastAccessTime;
+        entryHeader.lastAccessTime = ReadFILETIME(metadata.lastAccessTime.value());
+      }
+      if (metadata.lastWriteTime) {
+        entryHeader.flags |= EntryFlags::HasLastWriteTime;
+        entryHeader.lastWriteTime = ReadFILETIME(metadata.lastWriteTime.value());
+      }
+      if (metadata.security) {
+        entryHeader.flags |= EntryFlags::HasSecurity;
+      }
+      writer.Write(&entryHeader, sizeof(entryHeader));
+      writer.Write(key.data(), key.size() * sizeof(char16_t));
+      writer.Pad();
+      if (metadata.security) {
+        writer.Write(metadata.security->data(), metadata.security->size());
+        writer.Pad();
+      }
+    }
+
+    header.dataSize = writer.GetPosition();
+    header.metadataSectionSize = header.dataSize - header.metadataSectionOffset;
+    writer.Overwrite(0, &header, sizeof(header));
+  }
+
+
+  std::uint64_t GetStoreFileSize(const std::wstring& filepath) {
+    const HANDLE hFile = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (!util::IsValidHandle(hFile)) {
+      throw W32Error();
+    }
+    LARGE_INTEGER liFileSize;
+    const auto succeeded = GetFileSizeEx(hFile, &liFileSize);
+    CloseHandle(hFile);
+    if (!succeeded) {
+      throw W32Error();
+    }
+    return static_cast<std::uint64_t>(liFileSize.QuadPart);
+  }
+
+
+  // writes a V4 file without appendix section, which holds the entries of baseDataN (a mapped V4 file or nullptr)
+  // updated by overlay, and renameEntries; the file is not committed
+  void WriteBase(FileWriter& writer, const std::byte* baseDataN, const std::unordered_map<std::wstring, std::optional<Metadata>>& overlay, const std::vector<std::pair<std::wstring, std::wstring>>& renameEntries) {
+    using namespace MetadataFileV4;
+
+    // sort the overlay to merge it with the entries of the base, which are in key order
+    std::vector<const std::pair<const std::wstring, std::optional<Metadata>>*> overlayEntries;
+    overlayEntries.reserve(overlay.size());
+    for (const auto& entry : overlay) {
+      overlayEntries.push_back(&entry);
+    }
+    std::sort(overlayEntries.begin(), overlayEntries.end(), [](const auto a, const auto b) {
+      return a->first < b->first;
+    });
+
+    // filled later
+    writer.WriteZeros(sizeof(Header));
+
+    // an encoded entry
+    std::string buffer;
+
+    const auto offsetToRenameSection = writer.GetPosition();
+    {
+      std::string previousA;
+      std::string encodedA;
+      std::string encodedB;
+      for (const auto& [b, a] : renameEntries) {
+        encodedA.clear();
+        AppendUtf8(encodedA, a);
+        encodedB.clear();
+        AppendUtf8(encodedB, b);
+        buffer.clear();
+        AppendRenameEntry(buffer, previousA, encodedA, encodedB);
+        writer.Write(buffer.data(), buffer.size());
+        previousA.swap(encodedA);
+      }
+    }
+    const auto renameSectionSize = writer.GetPosition() - offsetToRenameSection;
+    writer.Pad();
+
+    const auto offsetToMetadataSection = writer.GetPosition();
+    std::vector<std::uint64_t> blockOffsets;
+    std::vector<std::uint64_t> hashes;
+    std::string previousKey;
+    std::string encodedKey;
+    std::uint64_t previousTime = 0;
+
+    const auto writeEntry = [&](std::wstring_view keyName, const Metadata& metadata) {
+      if (hashes.size() % EntriesPerBlock == 0) {
+        blockOffsets.push_back(writer.GetPosition());
+        previousKey.clear();
+        previousTime = 0;
+      }
+      hashes.push_back(Hash(keyName));
+      encodedKey.clear();
+      AppendUtf8(encodedKey, keyName);
+      buffer.clear();
+      AppendString(buffer, previousKey, encodedKey);
+      AppendFields(buffer, metadata, previousTime);
+      writer.Write(buffer.data(), buffer.size());
+      previousKey.swap(encodedKey);
+    };
+
+    const std::uint64_t numBaseEntries = baseDataN ? GetHeader(baseDataN).metadataSectionCount : 0;
+    std::optional<EntryReader> baseReaderN;
+    if (numBaseEntries) {
+      baseReaderN.emplace(baseDataN, 0);
+    }
+    // the key of the next entry of the base, whose fields are yet to be read
+    std::optional<std::wstring> baseKeyN;
+    const auto readBaseKey = [&]() {
+      if (baseReaderN && baseReaderN->GetOrdinal() < numBaseEntries) {
+        baseKeyN = DecodeUtf8(baseReaderN->ReadKey());
+      } else {
+        baseKeyN.reset();
+      }
+    };
+
+    readBaseKey();
+    std::size_t overlayIndex = 0;
+    while (baseKeyN || overlayIndex < overlayEntries.size()) {
+      const auto overlayEntry = overlayIndex < overlayEntries.size() ? overlayEntries[overlayIndex] : nullptr;
+
+      if (overlayEntry && (!baseKeyN || overlayEntry->first <= baseKeyN.value())) {
+        // the overlay replaces (or removes) the entry of the base
+        if (baseKeyN && overlayEntry->first == baseKeyN.value()) {
+          baseReaderN->ReadFields(nullptr);
+          readBaseKey();
+        }
+        overlayIndex++;
+        if (overlayEntry->second) {
+          writeEntry(overlayEntry->first, overlayEntry->second.value());
+        }
+        continue;
+      }
+
+      // entries of the base are encoded again, since they may follow a different entry
+      Metadata metadata;
+      baseReaderN->ReadFields(&metadata);
+      writeEntry(baseKeyN.value(), metadata);
+      readBaseKey();
+    }
+    const auto metadataSectionSize = writer.GetPosition() - offsetToMetadataSection;
+    writer.Pad();
+
+    const auto offsetToPathSection = writer.GetPosition();
+    writer.Write(blockOffsets.data(), blockOffsets.size() * sizeof(std::uint64_t));
+    writer.Pad();
+
+    const auto offsetToIndexSection = writer.GetPosition();
+    const auto indexBucketCount = GetIndexBucketCount(hashes.size());
+    {
+      std::vector<IndexBucket> buckets(static_cast<std::size_t>(indexBucketCount), IndexBucket{0, 0});
+      const auto mask = indexBucketCount - 1;
+      for (std::size_t i = 0; i < hashes.size(); i++) {
+        auto index = hashes[i] & mask;
+        while (buckets[index].ordinal) {
+          index = (index + 1) & mask;
+        }
+        buckets[index] = IndexBucket{
+          static_cast<std::uint32_t>(hashes[i] >> 32),
+          static_cast<std::uint32_t>(i + 1),
+        };
+      }
+      writer.Write(buckets.data(), buckets.size() * sizeof(IndexBucket));
+    }
+    writer.Pad();
+
+    const auto fileSize = writer.GetPosition();
+    assert(fileSize % Alignment == 0);
+
+    const Header header{
+      Signature,
+      Version,
+      fileSize,
+      offsetToRenameSection,
+      renameSectionSize,
+      static_cast<std::uint64_t>(renameEntries.size()),
+      0,
+      offsetToMetadataSection,
+      metadataSectionSize,
+      static_cast<std::uint64_t>(hashes.size()),
+      EntriesPerBlock,
+      0,
+      offsetToPathSection,
+      offsetToIndexSection,
+      indexBucketCount,
+      0,
+    };
+    writer.Overwrite(0, &header, sizeof(header));
+  }
+}
+
+
+// a new store file written in the background from a snapshot (see MetadataFileBackend::StartCompaction)
+struct MetadataFileBackend::Compaction {
+  std::wstring tempFilepath;
+  // the overlay at the snapshot; looked up between the overlay and the mapped file until the new file replaces it
+  std::unique_ptr<const std::unordered_map<std::wstring, std::optional<Metadata>>> overlay;
+  std::vector<std::pair<std::wstring, std::wstring>> renameEntries;
+  std::uint64_t snapshotAppendixSize;
+  // offset in the current store file of the first appendix record not yet copied to the appendix section of the new file
+  std::uint64_t tailOffset;
+  std::optional<FileWriter> writerN;
+  std::exception_ptr errorN;
+  std::atomic<bool> done;
+  // when done, the thread waits to be released and then frees the frozen overlay if the new file was installed;
+  // freeing 10^5 entries takes tens of milliseconds, which the caller of FinishCompaction should not wait for
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool released = false;
+  bool installed = false;
+  std::thread thread;
+
+  ~Compaction() {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  void Release(bool install) {
+    {
+      std::lock_guard lock(mutex);
+      released = true;
+      installed = install;
+    }
+    cv.notify_one();
+  }
+};
+
+
+static_assert(sizeof(DWORD) == 4);
+static_assert(sizeof(FILETIME) == sizeof(DWORD) * 2);
+
+
+// looks up the mapped file and the overlay being compacted into its replacement, ignoring mMetadataOverlay
+bool MetadataFileBackend::ContainsBaseMetadata(const std::wstring& key) const {
+  if (mCompactionN) {
+    if (const auto itr = mCompactionN->overlay->find(key); itr != mCompactionN->overlay->cend()) {
+      return itr->second.has_value();
+    }
+  }
+  return mBaseData && MetadataFileV4::FindEntry(mBaseData, key);
+}
+
+
+bool MetadataFileBackend::Contains(const std::wstring& key) const {
+  if (const auto itr = mMetadataOverlay.find(key); itr != mMetadataOverlay.cend()) {
+    return itr->second.has_value();
+  }
+  return ContainsBaseMetadata(key);
+}
+
+
+std::optional<Metadata> MetadataFileBackend::Find(const std::wstring& key) const {
+  if (const auto itr = mMetadataOverlay.find(key); itr != mMetadataOverlay.cend()) {
+    return itr->second;
+  }
+  if (mCompactionN) {
+    if (const auto itr = mCompactionN->overlay->find(key); itr != mCompactionN->overlay->cend()) {
+      return itr->second;
+    }
+  }
+  if (!mBaseData) {
+    return std::nullopt;
+  }
+  auto entryN = MetadataFileV4::FindEntry(mBaseData, key);
+  if (!entryN) {
+    return std::nullopt;
+  }
+  Metadata metadata;
+  entryN->ReadFields(&metadata);
+  return metadata;
+}
+
+
+void MetadataFileBackend::PutMetadata(const std::wstring& key, const Metadata& metadata) {
+  mMetadataOverlay.insert_or_assign(key, metadata);
+}
+
+
+bool MetadataFileBackend::EraseMetadata(const std::wstring& key) {
+  const bool inBase = ContainsBaseMetadata(key);
+  const auto itr = mMetadataOverlay.find(key);
+  const bool existed = itr != mMetadataOverlay.end() ? itr->second.has_value() : inBase;
+  if (inBase) {
+    // hide the entry of the base until the next SaveToFile
+    mMetadataOverlay.insert_or_assign(key, std::nullopt);
+  } else if (itr != mMetadataOverlay.end()) {
+    mMetadataOverlay.erase(itr);
+  }
+  return existed;
+}
+
+
+void MetadataFileBackend::LoadFromFileV1() {
+  using namespace MetadataFileV1;
+
+  DWORD read = 0;
+
+  if (SetFilePointer(mHFile, 4, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    throw W32Error();
+  }
+
+  EntryCount count = 0;
+  if (!ReadFile(mHFile, &count, sizeof(count), &read, NULL) || read != sizeof(count)) {
+    throw W32Error();
+  }
+
+  EntrySize maxBufferSize = 0;
+  std::unique_ptr<char[]> buffer;
+  for (std::size_t i = 0; i < count; i++) {
+    EntrySize entrySize;
+    if (!ReadFile(mHFile, &entrySize, sizeof(entrySize), &read, NULL) || read != sizeof(entrySize)) {
+      throw W32Error();
+    }
+
+    if (entrySize == 0) {
+      // invalid entry
+      continue;
+    }
+
+    if (entrySize > maxBufferSize) {
+      maxBufferSize = entrySize;
+      buffer = std::make_unique<char[]>(maxBufferSize);
+    }
+
+    if (!ReadFile(mHFile, buffer.get(), entrySize, &read, NULL) || read != entrySize) {
+      throw W32Error();
+    }
+
+    Metadata metadata;
+    const char* ptr = buffer.get();
+
+    const auto entryFlag = *reinterpret_cast<const EntryFlag*>(ptr);
+    ptr += sizeof(entryFlag);
+
+    const auto keyNameCount = *reinterpret_cast<const KeyNameCount*>(ptr);
+    ptr += sizeof(keyNameCount);
+    const auto keyName = reinterpret_cast<const wchar_t*>(ptr);
+    ptr += keyNameCount * sizeof(wchar_t);
+    const std::wstring key(keyName, keyNameCount);
+
+    if (entryFlag & EntryFlags::HasAttributes) {
+      const auto fileAttributes = *reinterpret_cast<const DWORD*>(ptr);
+      ptr += sizeof(fileAttributes);
+      metadata.fileAttributes = fileAttributes;
+    }
+    if (entryFlag & EntryFlags::HasCreationTime) {
+      const auto creationTime = *reinterpret_cast<const FILETIME*>(ptr);
+      ptr += sizeof(creationTime);
+      metadata.creationTime = creationTime;
+    }
+    if (entryFlag & EntryFlags::HasLastAccessTime) {
+      const auto lastAccessTime = *reinterpret_cast<const FILETIME*>(ptr);
+      ptr += sizeof(lastAccessTime);
+      metadata.lastAccessTime = lastAccessTime;
+    }
+    if (entryFlag & EntryFlags::HasLastWriteTime) {
+      const auto lastWriteTime = *reinterpret_cast<const FILETIME*>(ptr);
+      ptr += sizeof(lastWriteTime);
+      metadata.lastWriteTime = lastWriteTime;
+    }
+    if (entryFlag & EntryFlags::HasSecurity) {
+      const auto securityCount = *reinterpret_cast<const SecurityCount*>(ptr);
+      ptr += sizeof(securityCount);
+      const auto securityData = reinterpret_cast<const char*>(ptr);
+      ptr += securityCount * sizeof(char);
+      metadata.security = std::string(securityData, securityCount);
+    }
+
+    mMetadataOverlay.emplace(key, metadata);
+  }
+
+  std::uint64_t renameCount;
+  if (!ReadFile(mHFile, &renameCount, sizeof(renameCount), &read, NULL) || read != sizeof(renameCount)) {
+    throw W32Error();
+  }
+
+  for (std::uint64_t i = 0; i < renameCount; i++) {
+    std::uint32_t renamedSize;
+    if (!ReadFile(mHFile, &renamedSize, sizeof(renamedSize), &read, NULL) || read != sizeof(renamedSize)) {
+      throw W32Error();
+    }
+
+    std::uint32_t originalSize;
+    if (!ReadFile(mHFile, &originalSize, sizeof(originalSize), &read, NULL) || read != sizeof(originalSize)) {
+      throw W32Error();
+    }
+
+    const std::size_t renamedStrSize = renamedSize * sizeof(wchar_t);
+    auto renamedBuffer = std::make_unique<wchar_t[]>(renamedSize);
+    if (!ReadFile(mHFile, renamedBuffer.get(), static_cast<DWORD>(renamedStrSize), &read, NULL) || read != renamedStrSize) {
+      throw W32Error();
+    }
+    const std::wstring_view renamed(renamedBuffer.get(), renamedSize);
+
+    const std::size_t originalStrSize = originalSize * sizeof(wchar_t);
+    auto originalBuffer = std::make_unique<wchar_t[]>(originalSize);
+    if (!ReadFile(mHFile, originalBuffer.get(), static_cast<DWORD>(originalStrSize), &read, NULL) || read != originalStrSize) {
+      throw W32Error();
+    }
+    const std::wstring_view original(originalBuffer.get(), originalSize);
+
+    mRenameStore.AddEntry(original, renamed);
+  }
+}
+
+
+void MetadataFileBackend::LoadFromFileV2() {
+  using namespace MetadataFileV2;
+
+  DWORD read = 0;
+
+  LARGE_INTEGER liFileSize;
+  if (!GetFileSizeEx(mHFile, &liFileSize)) {
+    throw W32Error();
+  }
+  const std::uint_fast64_t fileSize = liFileSize.QuadPart;
+
+  if (fileSize % Alignment != 0) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  auto fileData = make_unique_aligned<std::byte, Alignment>(fileSize);
+  if (!ReadFile(mHFile, fileData.get(), fileSize, &read, NULL) || read != fileSize) {
+    throw W32Error();
+  }
+
+  // Read Header
+
+  const auto& header = *reinterpret_cast<const Header*>(fileData.get());
+
+  if (header.dataSize % Alignment != 0 || header.dataSize > fileSize) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  // Read Rename Entries
+  LoadRenameSectionV2(fileData.get() + header.renameSectionOffset, header.renameSectionSize, header.renameSectionCount);
+
+  // Read Metadata Entries
+  {
+    const auto endPtr = const_cast<const std::byte*>(fileData.get()) + header.metadataSectionOffset + header.metadataSectionSize;
+    auto checkPtr = [endPtr] (const std::byte* ptr) {
+      if (ptr > endPtr) {
+        throw W32Error(ERROR_BUFFER_OVERFLOW);
+      }
+    };
+
+    auto ptr = const_cast<const std::byte*>(fileData.get()) + header.metadataSectionOffset;
+    for (std::uint_fast32_t i = 0; i < header.metadataSectionCount; i++) {
+      std::size_t size = 0;
+      const auto metadataEntry = MetadataEntry::Parse(ptr, checkPtr, size);
+      ptr += size;
+      if (metadataEntry.flags == 0) {
+        continue;
+      }
+      mMetadataOverlay.emplace(metadataEntry.filename, static_cast<Metadata>(metadataEntry));
+    }
+
+    assert(ptr == endPtr);
+  }
+
+  // Read Appendix Entries
+  ApplyAppendix(fileData.get() + header.dataSize, fileSize - header.dataSize);
+}
+
+
+void MetadataFileBackend::LoadFromFileV3() {
+  using namespace MetadataFileV3;
+
+  DWORD read = 0;
+
+  LARGE_INTEGER liFileSize;
+  if (!GetFileSizeEx(mHFile, &liFileSize)) {
+    throw W32Error();
+  }
+  const std::uint64_t fileSize = liFileSize.QuadPart;
+
+  if (fileSize < sizeof(Header)) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  auto fileData = make_unique_aligned<std::byte, Alignment>(static_cast<std::size_t>(fileSize));
+  if (!ReadFile(mHFile, fileData.get(), static_cast<DWORD>(fileSize), &read, NULL) || read != fileSize) {
+    throw W32Error();
+  }
+
+  // Read Header
+
+  const auto& header = GetHeader(fileData.get());
+
+  if (header.dataSize > fileSize) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+  Validate(fileData.get(), header.dataSize);
+
+  // Read Rename Entries
+  LoadRenameSectionV2(fileData.get() + header.renameSectionOffset, header.renameSectionSize, header.renameSectionCount);
+
+  // Read Metadata Entries
+  for (std::uint64_t i = 0; i < header.metadataSectionCount; i++) {
+    const auto& entry = GetEntry(fileData.get(), i);
+    mMetadataOverlay.emplace(GetKey(entry), ToMetadata(entry));
+  }
+
+  // Read Appendix Entries
+  // a torn entry at the end is dropped by the conversion
+  ApplyAppendix(fileData.get() + header.dataSize, fileSize - header.dataSize);
+}
+
+
+void MetadataFileBackend::LoadFromFileV4() {
+  using namespace MetadataFileV4;
+
+  MapBase();
+
+  const auto& header = GetHeader(mBaseData);
+
+  // Read Rename Entries
+  LoadRenameSectionV4(mBaseData + header.renameSectionOffset, header.renameSectionSize, header.renameSectionCount);
+
+  // Read Appendix Entries
+  // the metadata entries are not read; they are looked up in the mapped file
+  LARGE_INTEGER liFileSize;
+  if (!GetFileSizeEx(mHFile, &liFileSize)) {
+    throw W32Error();
+  }
+  const std::uint64_t fileSize = liFileSize.QuadPart;
+
+  mAppendixSize = fileSize - header.dataSize;
+  if (mAppendixSize) {
+    auto appendixData = make_unique_aligned<std::byte, Alignment>(mAppendixSize);
+    auto overlapped = util::CreateOverlapped(header.dataSize);
+    DWORD read = 0;
+    if (!ReadFile(mHFile, appendixData.get(), static_cast<DWORD>(mAppendixSize), &read, &overlapped) || read != mAppendixSize) {
+      throw W32Error();
+    }
+    const auto appliedSize = ApplyAppendix(appendixData.get(), mAppendixSize);
+    if (appliedSize != mAppendixSize) {
+      // drop the torn entry so that later entries are not appended after it
+      if (!SetFilePointerEx(mHFile, util::CreateLargeInteger(static_cast<LONGLONG>(header.dataSize + appliedSize)), NULL, FILE_BEGIN) || !SetEndOfFile(mHFile)) {
+        throw W32Error();
+      }
+      mAppendixSize = appliedSize;
+    }
+  }
+
+  // later appendix entries are appended
+  StartLogWriter();
+}
+
+
+void MetadataFileBackend::LoadRenameSectionV2(const std::byte* data, std::uint64_t size, std::uint64_t count) {
+  using namespace MetadataFileV2;
+
+  const auto endPtr = data + size;
+  auto checkPtr = [endPtr] (const std::byte* ptr) {
+    if (ptr > endPtr) {
+      throw W32Error(ERROR_BUFFER_OVERFLOW);
+    }
+  };
+
+  auto ptr = data;
+  for (std::uint64_t i = 0; i < count; i++) {
+    std::size_t entrySize = 0;
+    const auto renameEntry = RenameEntry::Parse(ptr, checkPtr, entrySize);
+    ptr += entrySize;
+    if (renameEntry.bSize == 0 || renameEntry.a == renameEntry.b) {
+      continue;
+    }
+    mRenameStore.AddEntry(renameEntry.a, renameEntry.b);
+  }
+
+  assert(ptr == endPtr);
+}
+
+
+void MetadataFileBackend::LoadRenameSectionV4(const std::byte* data, std::uint64_t size, std::uint64_t count) {
+  using namespace MetadataFileV4;
+
+  Reader reader(data, data + size);
+  std::string a;
+  std::string b;
+  for (std::uint64_t i = 0; i < count; i++) {
+    ReadRenameEntry(reader, a, b);
+    if (b.empty() || a == b) {
+      continue;
+    }
+    mRenameStore.AddEntry(DecodeUtf8(a), DecodeUtf8(b));
+  }
+
+  if (reader.GetPointer() != data + size) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+}
+
+
+// returns the size of the complete entries; the last entry may have been cut off by a crash while it was written,
+// which drops it and anything after it
+std::uint64_t MetadataFileBackend::ApplyAppendix(const std::byte* data, std::uint64_t size) {
+  using namespace MetadataFileV2;
+
+  const auto endPtr = data + size;
+
+  auto ptr = data;
+  while (ptr != endPtr) {
+    if (static_cast<std::uint64_t>(endPtr - ptr) < sizeof(AppendixEntryHeader)) {
+      break;
+    }
+    const auto& appendixEntry = *reinterpret_cast<const AppendixEntryHeader*>(ptr);
+    // the rest of a torn entry reads as zeros or stale data
+    if (appendixEntry.blockSize < sizeof(AppendixEntryHeader) || appendixEntry.blockSize % Alignment != 0 || appendixEntry.blockSize > static_cast<std::uint64_t>(endPtr - ptr)) {
+      break;
+    }
+    const auto nextPtr = ptr + appendixEntry.blockSize;
+    ptr += sizeof(AppendixEntryHeader);
+
+    auto checkPtr2 = [nextPtr] (const std::byte* ptr) {
+      if (ptr > nextPtr) {
+        throw W32Error(ERROR_BUFFER_OVERFLOW);
+      }
+    };
+
+    std::size_t entrySize = 0;
+
+    switch (appendixEntry.dataType) {
+      case AppendixDataType::Rename:
+      {
+        const auto renameEntry = RenameEntry::Parse(ptr, checkPtr2, entrySize);
+        if (renameEntry.bSize != 0) {
+          mRenameStore.Rename(renameEntry.a, renameEntry.b);
+        } else {
+          mRenameStore.RemoveEntry(renameEntry.a);
+        }
+        break;
+      }
+
+      case AppendixDataType::Metadata:
+      {
+        const auto metadataEntry = MetadataEntry::Parse(ptr, checkPtr2, entrySize);
+        if (metadataEntry.flags != 0) {
+          PutMetadata(metadataEntry.filename, static_cast<Metadata>(metadataEntry));
+        } else {
+          EraseMetadata(metadataEntry.filename);
+        }
+        break;
+      }
+
+      // the rest of the block after the data is padding
+      case AppendixDataType::CompactRename:
+      {
+        MetadataFileV4::Reader reader(ptr, nextPtr);
+        std::string a;
+        std::string b;
+        MetadataFileV4::ReadRenameEntry(reader, a, b);
+        if (!b.empty()) {
+          mRenameStore.Rename(MetadataFileV4::DecodeUtf8(a), MetadataFileV4::DecodeUtf8(b));
+        } else {
+          mRenameStore.RemoveEntry(MetadataFileV4::DecodeUtf8(a));
+        }
+        entrySize = nextPtr - ptr;
+        break;
+      }
+
+      case AppendixDataType::CompactMetadata:
+      {
+        MetadataFileV4::Reader reader(ptr, nextPtr);
+        std::string key;
+        MetadataFileV4::ReadString(reader, key);
+        Metadata metadata;
+        std::uint64_t previousTime = 0;
+        if (MetadataFileV4::ReadFields(reader, previousTime, &metadata) != 0) {
+          PutMetadata(MetadataFileV4::DecodeUtf8(key), metadata);
+        } else {
+          EraseMetadata(MetadataFileV4::DecodeUtf8(key));
+        }
+        entrySize = nextPtr - ptr;
+        break;
+      }
+
+      default:
+        throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+
+    ptr += entrySize;
+    assert(ptr == nextPtr);
+
+    ptr = nextPtr;
+  }
+
+  return static_cast<std::uint64_t>(ptr - data);
+}
+
+
+void MetadataFileBackend::LoadFromFile() {
+  if (!util::IsValidHandle(mHFile)) {
+    throw W32Error(ERROR_INVALID_HANDLE);
+  }
+
+  mMetadataOverlay.clear();
+  if (SetFilePointer(mHFile, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    throw W32Error();
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(mHFile, &fileSize)) {
+    throw W32Error();
+  }
+  if (fileSize.QuadPart == 0) {
+    // the first time
+    SaveToFile();
+    return;
+  }
+
+  DWORD read = 0;
+
+  std::uint32_t signature = 0;
+  if (!ReadFile(mHFile, &signature, sizeof(signature), &read, NULL) || read != sizeof(signature)) {
+    throw W32Error();
+  }
+
+  // V2 and later share the signature
+  std::uint32_t version = 0;
+  if (signature == MetadataFileV2::Signature) {
+    if (!ReadFile(mHFile, &version, sizeof(version), &read, NULL) || read != sizeof(version)) {
+      throw W32Error();
+    }
+  }
+
+  if (SetFilePointer(mHFile, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    throw W32Error();
+  }
+
+  switch (signature) {
+    case MetadataFileV1::Signature:
+      LoadFromFileV1();
+      // convert to V4 format
+      SaveToFile();
+      break;
+
+    case MetadataFileV2::Signature:
+      switch (version) {
+        case MetadataFileV2::Version:
+          LoadFromFileV2();
+          // convert to V4 format
+          SaveToFile();
+          break;
+
+        case MetadataFileV3::Version:
+          LoadFromFileV3();
+          // convert to V4 format
+          SaveToFile();
+          break;
+
+        case MetadataFileV4::Version:
+          // the appendix section is kept until the next SaveToFile, so that mounting does not depend on the number of entries
+          LoadFromFileV4();
+          break;
+
+        default:
+          throw W32Error(ERROR_INVALID_PARAMETER);
+      }
+      break;
+
+    default:
+      throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+}
+
+
+void MetadataFileBackend::OpenStoreFile() {
+  mHFile = CreateFileW(mFilepath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (!util::IsValidHandle(mHFile)) {
+    mHFile = NULL;
+    throw W32Error(GetLastError());
+  }
+}
+
+
+// maps the file except its appendix section, which is written through mHFile
+void MetadataFileBackend::MapBase() {
+  using namespace MetadataFileV4;
+
+  assert(!mBaseData);
+
+  MetadataFileV4::Header header;
+  auto overlapped = util::CreateOverlapped(0);
+  DWORD read = 0;
+  if (!ReadFile(mHFile, &header, sizeof(header), &read, &overlapped) || read != sizeof(header)) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  LARGE_INTEGER liFileSize;
+  if (!GetFileSizeEx(mHFile, &liFileSize)) {
+    throw W32Error();
+  }
+  if (header.dataSize < sizeof(Header) || header.dataSize > static_cast<std::uint64_t>(liFileSize.QuadPart) || header.dataSize % Alignment != 0) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  mHMapping = CreateFileMappingW(mHFile, NULL, PAGE_READONLY, static_cast<DWORD>(header.dataSize >> 32), static_cast<DWORD>(header.dataSize & 0xFFFFFFFF), NULL);
+  if (!mHMapping) {
+    throw W32Error();
+  }
+  const auto view = MapViewOfFile(mHMapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(header.dataSize));
+  if (!view) {
+    const auto error = GetLastError();
+    CloseHandle(mHMapping);
+    mHMapping = NULL;
+    throw W32Error(error);
+  }
+  mBaseData = static_cast<const std::byte*>(view);
+
+  try {
+    Validate(mBaseData, header.dataSize);
+  } catch (...) {
+    UnmapBase();
+    throw;
+  }
+}
+
+
+// appendix records are written at the end of the file from now on
+void MetadataFileBackend::StartLogWriter() {
+  LARGE_INTEGER liFileSize;
+  if (!GetFileSizeEx(mHFile, &liFileSize)) {
+    throw W32Error();
+  }
+  mLogWriter = std::make_unique<MetadataLogWriter>(mHFile, static_cast<std::uint64_t>(liFileSize.QuadPart), MetadataConfig::LogDurability);
+}
+
+
+void MetadataFileBackend::UnmapBase() noexcept {
+  if (mBaseData) {
+    UnmapViewOfFile(mBaseData);
+    mBaseData = nullptr;
+  }
+  if (mHMapping) {
+    CloseHandle(mHMapping);
+    mHMapping = NULL;
+  }
+}
+
+
+// replaces the store file with tempFilepath, which has been written by SaveToFile or a compaction, and maps it
+// the caller updates mAppendixSize and the overlays
+void MetadataFileBackend::ReplaceStoreFile(const std::wstring& tempFilepath) {
+  const bool wasMapped = mBaseData;
+
+  // the records queued so far still go to the previous file, which is kept if the replacement fails
+  mLogWriter.reset();
+  UnmapBase();
+  if (util::IsValidHandle(mHFile)) {
+    CloseHandle(mHFile);
+  }
+  mHFile = NULL;
+
+  const bool moved = MoveFileExW(tempFilepath.c_str(), mFilepath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+  const auto error = GetLastError();
+
+  OpenStoreFile();
+  if (!moved) {
+    // keep the previous file
+    if (wasMapped) {
+      MapBase();
+    }
+    StartLogWriter();
+    throw W32Error(error);
+  }
+
+  MapBase();
+  StartLogWriter();
+}
+
+
+// writes the mapped entries and the overlay as a new V4 file without appendix section
+// the file is written next to the store file and then replaces it, so that the store file is valid at any time
+void MetadataFileBackend::SaveToFile() {
+  assert(!mCompactionN);
+
+  if (!util::IsValidHandle(mHFile)) {
+    throw W32Error(ERROR_INVALID_HANDLE);
+  }
+
+  const std::wstring tempFilepath = mFilepath + L".tmp"s;
+  {
+    FileWriter writer(tempFilepath);
+    WriteBase(writer, mBaseData, mMetadataOverlay, mRenameStore.GetEntries());
+    writer.Commit();
+  }
+
+  ReplaceStoreFile(tempFilepath);
+  mAppendixSize = 0;
+  mMetadataOverlay.clear();
+}
+
+// starts a compaction once the appendix section has grown large relative to the rest of the file, or installs the
+// finished one; called after every appendix record, where the caller has the store exclusively
+void MetadataFileBackend::MaybeCompact() {
+  if (mCompactionN) {
+    if (mCompactionN->done.load(std::memory_order_acquire)) {
+      FinishCompaction();
+    }
+    return;
+  }
+
+  if (!MetadataConfig::CompactionEnabled || !mBaseData) {
+    return;
+  }
+  const auto baseSize = MetadataFileV4::GetHeader(mBaseData).dataSize;
+  if (mAppendixSize < mMinCompactionAppendixSize || mAppendixSize * 100 < baseSize * MetadataConfig::CompactionAppendixPercent) {
+    return;
+  }
+  StartCompaction();
+}
+
+
+// takes a snapshot of the store and writes it as a new file in the background
+// the overlay is frozen for the compaction and a new one collects later changes, so the snapshot costs no copy of the
+// metadata entries; the records appended after the snapshot become the appendix section of the new file
+void MetadataFileBackend::StartCompaction() {
+  auto compaction = std::make_unique<Compaction>();
+  compaction->tempFilepath = mFilepath + L".tmp"s;
+  compaction->renameEntries = mRenameStore.GetEntries();
+  compaction->snapshotAppendixSize = mAppendixSize;
+  compaction->tailOffset = MetadataFileV4::GetHeader(mBaseData).dataSize + mAppendixSize;
+  compaction->done = false;
+  compaction->overlay = std::make_unique<const std::unordered_map<std::wstring, std::optional<Metadata>>>(std::move(mMetadataOverlay));
+  mMetadataOverlay.clear();
+
+  mCompactionN = std::move(compaction);
+  try {
+    mCompactionN->thread = std::thread(&MetadataFileBackend::CompactMain, this, std::ref(*mCompactionN));
+  } catch (...) {
+    AbortCompaction();
+    throw;
+  }
+}
+
+
+// the mapped file, the frozen overlay and the log writer stay as they are until the compaction is finished or aborted
+void MetadataFileBackend::CompactMain(Compaction& compaction) {
+  try {
+    compaction.writerN.emplace(compaction.tempFilepath);
+    WriteBase(compaction.writerN.value(), mBaseData, *compaction.overlay, compaction.renameEntries);
+    // most of the tail is copied and flushed here, so that FinishCompaction handles only what is appended in the meantime
+    CopyTail(compaction, mLogWriter->Drain());
+    compaction.writerN->Commit();
+  } catch (...) {
+    compaction.errorN = std::current_exception();
+  }
+  compaction.done.store(true, std::memory_order_release);
+
+  std::unique_lock lock(compaction.mutex);
+  compaction.cv.wait(lock, [&compaction]() {
+    return compaction.released;
+  });
+  if (compaction.installed) {
+    lock.unlock();
+    compaction.overlay.reset();
+  }
+}
+
+
+// appends the appendix records in [compaction.tailOffset, endOffset) of the current store file to the new file
+void MetadataFileBackend::CopyTail(Compaction& compaction, std::uint64_t endOffset) {
+  constexpr std::size_t BufferSize = 1 << 20;
+
+  std::vector<std::byte> buffer(static_cast<std::size_t>(std::min<std::uint64_t>(endOffset - compaction.tailOffset, BufferSize)));
+  while (compaction.tailOffset < endOffset) {
+    const auto size = static_cast<DWORD>(std::min<std::uint64_t>(endOffset - compaction.tailOffset, BufferSize));
+    auto overlapped = util::CreateOverlapped(compaction.tailOffset);
+    DWORD read = 0;
+    if (!ReadFile(mHFile, buffer.data(), size, &read, &overlapped) || read != size) {
+      throw W32Error(ERROR_READ_FAULT);
+    }
+    compaction.writerN->Write(buffer.data(), size);
+    compaction.tailOffset += size;
+  }
+}
+
+
+// replaces the store file with the new file; the records appended since the compaction thread copied the tail are
+// copied while the caller has the store exclusively, so nothing is appended meanwhile
+// a failed compaction leaves the store as it was and is retried after the appendix has doubled
+void MetadataFileBackend::FinishCompaction() {
+  auto& compaction = *mCompactionN;
+
+  try {
+    if (compaction.errorN) {
+      std::rethrow_exception(compaction.errorN);
+    }
+    CopyTail(compaction, mLogWriter->Drain());
+    compaction.writerN->Commit();
+    compaction.writerN.reset();
+    ReplaceStoreFile(compaction.tempFilepath);
+  } catch (...) {
+    AbortCompaction();
+    mMinCompactionAppendixSize = std::max(mAppendixSize * 2, MetadataConfig::MinCompactionAppendixBytes);
+    if (!util::IsValidHandle(mHFile)) {
+      // the previous file could not be reopened
+      throw;
+    }
+    return;
+  }
+
+  mAppendixSize -= compaction.snapshotAppendixSize;
+  mMinCompactionAppendixSize = MetadataConfig::MinCompactionAppendixBytes;
+  compaction.Release(true);
+  // joins the previous one, which has long finished
+  mRetiredCompactionN = std::move(mCompactionN);
+}
+
+
+// waits for the compaction thread and discards its file; the frozen overlay is merged back into the overlay
+void MetadataFileBackend::AbortCompaction() {
+  if (!mCompactionN) {
+    return;
+  }
+  auto& compaction = *mCompactionN;
+  compaction.Release(false);
+  if (compaction.thread.joinable()) {
+    compaction.thread.join();
+  }
+  compaction.writerN.reset();
+  DeleteFileW(compaction.tempFilepath.c_str());
+
+  // later changes take precedence
+  for (const auto& [key, metadataN] : *compaction.overlay) {
+    mMetadataOverlay.try_emplace(key, metadataN);
+  }
+  mCompactionN.reset();
+}
+
+
+void MetadataFileBackend::AddRenameAppendix(std::wstring_view a, std::wstring_view b) {
+  using namespace MetadataFileV4;
+
+  std::string encodedA;
+  AppendUtf8(encodedA, a);
+  std::string encodedB;
+  AppendUtf8(encodedB, b);
+  std::string data;
+  AppendRenameEntry(data, {}, encodedA, encodedB);
+  auto record = MakeAppendixRecord(AppendixDataType::CompactRename, data);
+
+  // the in-memory state is written by SaveToFile even if the record is lost
+  mAppendixSize += record.size();
+  mLogWriter->Append(std::move(record));
+
+  MaybeCompact();
+}
+
+
+void MetadataFileBackend::AddRenameAppendix(std::wstring_view a) {
+  // on removed
+  AddRenameAppendix(a, L""sv);
+}
+
+
+void MetadataFileBackend::AddMetadataAppendix(std::wstring_view keyName, const Metadata& metadata) {
+  using namespace MetadataFileV4;
+
+  std::string encodedKey;
+  AppendUtf8(encodedKey, keyName);
+  std::string data;
+  AppendString(data, {}, encodedKey);
+  std::uint64_t previousTime = 0;
+  AppendFields(data, metadata, previousTime);
+  auto record = MakeAppendixRecord(AppendixDataType::CompactMetadata, data);
+
+  // the in-memory state is written by SaveToFile even if the record is lost
+  mAppendixSize += record.size();
+  mLogWriter->Append(std::move(record));
+
+  MaybeCompact();
+}
+
+
+void MetadataFileBackend::AddMetadataAppendix(std::wstring_view keyName) {
+  static const Metadata emptyMetadata{};
+  AddMetadataAppendix(keyName, emptyMetadata);
+}
+
+
+MetadataFileBackend::MetadataFileBackend(std::wstring_view storeFilename, bool caseSensitive) :
+  mFilepath(storeFilename),
+  mRenameStore(caseSensitive)
+{
+  OpenStoreFile();
+  try {
+    LoadFromFile();
+  } catch (...) {
+    mLogWriter.reset();
+    UnmapBase();
+    CloseHandle(mHFile);
+    mHFile = NULL;
+    throw;
+  }
+}
+
+
+MetadataFileBackend::~MetadataFileBackend() {
+  // the whole store is written below anyway
+  AbortCompaction();
+  mRetiredCompactionN.reset();
+  if (util::IsValidHandle(mHFile)) {
+    // merge the appendix section
+    if (mAppendixSize) {
+      SaveToFile();
+    }
+    mLogWriter.reset();
+    UnmapBase();
+    CloseHandle(mHFile);
+    mHFile = NULL;
+  }
+}
+
+
+void MetadataFileBackend::Put(const std::wstring& key, const Metadata& metadata) {
+  PutMetadata(key, metadata);
+  AddMetadataAppendix(key, metadata);
+}
+
+
+bool MetadataFileBackend::Erase(const std::wstring& key) {
+  const auto ret = EraseMetadata(key);
+  AddMetadataAppendix(key);
+  return ret;
+}
+
+
+std::optional<std::wstring> MetadataFileBackend::Resolve(std::wstring_view filename) const {
+  return mRenameStore.Resolve(filename);
+}
+
+
+std::optional<bool> MetadataFileBackend::Exists(std::wstring_view filename) const {
+  return mRenameStore.Exists(filename);
+}
+
+
+std::vector<std::pair<std::wstring, std::wstring>> MetadataFileBackend::ListChildrenInForwardLookupTree(std::wstring_view filename) const {
+  return mRenameStore.ListChildrenInForwardLookupTree(filename);
+}
+
+
+std::vector<std::pair<std::wstring, std::wstring>> MetadataFileBackend::ListChildrenInReverseLookupTree(std::wstring_view filename) const {
+  return mRenameStore.ListChildrenInReverseLookupTree(filename);
+}
+
+
+RenameStore::Result MetadataFileBackend::Rename(std::wstring_view srcFilename, std::wstring_view destFilename) {
+  const auto result = mRenameStore.Rename(srcFilename, destFilename);
+  if (result == RenameStore::Result::Success) {
+    AddRenameAppendix(srcFilename, destFilename);
+  }
+  return result;
+}
+
+
+bool MetadataFileBackend::RemoveRename(std::wstring_view filename) {
+  const auto result = mRenameStore.RemoveEntry(filename);
+  AddRenameAppendix(filename);
+  return result;
+}
+
+
+void MetadataFileBackend::MoveTo(std::wstring_view storeFilename) {
+  AbortCompaction();
+  if (mAppendixSize) {
+    SaveToFile();
+  }
+  // the current data is written to the new file, which is then mapped instead
+  mFilepath = storeFilename;
+  SaveToFile();
+}
+
+
+// the entries are files of a deep tree, whose paths share long prefixes as in real mounts; every entry has attributes and
+// 4 in 10 have creation and last write times, which is what a mount records for files copied in or touched
+MetadataFileBackend::FormatBenchmarkResult MetadataFileBackend::BenchmarkFormats(std::wstring_view directory, std::size_t numEntries) {
+  using Clock = std::chrono::steady_clock;
+  const auto nanosecondsSince = [](Clock::time_point begin) {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+  };
+
+  if (numEntries == 0) {
+    throw W32Error(ERROR_INVALID_PARAMETER);
+  }
+
+  std::vector<std::pair<std::wstring, Metadata>> entries;
+  entries.reserve(numEntries);
+  std::mt19937_64 random(1);
+  for (std::size_t i = 0; i < numEntries; i++) {
+    const auto filename = L"\\Users\\MergeFS\\Documents\\Project"s + std::to_wstring(i / 20000) + L"\\src\\module"s + std::to_wstring(i / 400 % 50) + L"\\component"s + std::to_wstring(i / 20 % 20) + L"\\file"s + std::to_wstring(i) + L".txt"s;
+    Metadata metadata;
+    metadata.fileAttributes.emplace(FILE_ATTRIBUTE_ARCHIVE);
+    if (i % 10 >= 6) {
+      const std::uint64_t creationTime = 0x01DA000000000000 + random() % (10000000ull * 86400 * 365);
+      metadata.creationTime.emplace(MetadataFileV2::ToFILETIME(creationTime));
+      metadata.lastWriteTime.emplace(MetadataFileV2::ToFILETIME(creationTime + random() % (10000000ull * 86400 * 30)));
+    }
+    entries.emplace_back(FilenameToKey(filename, false), std::move(metadata));
+  }
+
+  // looked up in an order unrelated to that of the files; the missing keys share all but their last character with an entry
+  std::vector<std::wstring> hitKeys;
+  hitKeys.reserve(numEntries);
+  for (const auto& entry : entries) {
+    hitKeys.push_back(entry.first);
+  }
+  std::shuffle(hitKeys.begin(), hitKeys.end(), random);
+  std::vector<std::wstring> missKeys;
+  missKeys.reserve(numEntries);
+  for (const auto& key : hitKeys) {
+    missKeys.push_back(key + L"~"s);
+  }
+
+  const auto filepath = std::wstring(directory) + L"\\MergeFSMetadataBenchmark.mfmd"s;
+  FormatBenchmarkResult result{};
+  try {
+    {
+      FileWriter writer(filepath);
+      WriteV2(writer, entries);
+      writer.Commit();
+    }
+    result.v2.fileBytes = GetStoreFileSize(filepath);
+
+    // V2 mounts read the whole file into a hash map (as LoadFromFileV2 still does before converting it)
+    {
+      auto begin = Clock::now();
+      const HANDLE hFile = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (!util::IsValidHandle(hFile)) {
+        throw W32Error();
+      }
+      const auto fileSize = result.v2.fileBytes;
+      auto fileData = make_unique_aligned<std::byte, MetadataFileV2::Alignment>(static_cast<std::size_t>(fileSize));
+      DWORD read = 0;
+      const auto succeeded = ReadFile(hFile, fileData.get(), static_cast<DWORD>(fileSize), &read, NULL);
+      CloseHandle(hFile);
+      if (!succeeded || read != fileSize) {
+        throw W32Error();
+      }
+      const auto& header = *reinterpret_cast<const MetadataFileV2::Header*>(fileData.get());
+      const auto endPtr = const_cast<const std::byte*>(fileData.get()) + header.metadataSectionOffset + header.metadataSectionSize;
+      auto checkPtr = [endPtr] (const std::byte* ptr) {
+        if (ptr > endPtr) {
+          throw W32Error(ERROR_BUFFER_OVERFLOW);
+        }
+      };
+      std::unordered_map<std::wstring, Metadata> metadataMap;
+      auto ptr = const_cast<const std::byte*>(fileData.get()) + header.metadataSectionOffset;
+      for (std::uint64_t i = 0; i < header.metadataSectionCount; i++) {
+        std::size_t size = 0;
+        const auto metadataEntry = MetadataFileV2::MetadataEntry::Parse(ptr, checkPtr, size);
+        ptr += size;
+        metadataMap.emplace(metadataEntry.filename, static_cast<Metadata>(metadataEntry));
+      }
+      result.v2.loadNanoseconds = nanosecondsSince(begin);
+
+      std::size_t found = 0;
+      begin = Clock::now();
+      for (const auto& key : hitKeys) {
+        found += metadataMap.count(key);
+      }
+      result.v2.hitNanoseconds = nanosecondsSince(begin) / numEntries;
+      begin = Clock::now();
+      for (const auto& key : missKeys) {
+        found += metadataMap.count(key);
+      }
+      result.v2.missNanoseconds = nanosecondsSince(begin) / numEntries;
+      if (found != numEntries) {
+        throw W32Error(ERROR_FILE_CORRUPT);
+      }
+    }
+
+    // opening the V2 file converts it to V4
+    {
+      const auto begin = Clock::now();
+      MetadataFileBackend backend(filepath, false);
+      result.migrationNanoseconds = nanosecondsSince(begin);
+    }
+    result.v4.fileBytes = GetStoreFileSize(filepath);
+
+    {
+      auto begin = Clock::now();
+      MetadataFileBackend backend(filepath, false);
+      result.v4.loadNanoseconds = nanosecondsSince(begin);
+
+      std::size_t found = 0;
+      begin = Clock::now();
+      for (const auto& key : hitKeys) {
+        found += backend.Find(key).has_value();
+      }
+      result.v4.hitNanoseconds = nanosecondsSince(begin) / numEntries;
+      begin = Clock::now();
+      for (const auto& key : missKeys) {
+        found += backend.Find(key).has_value();
+      }
+      result.v4.missNanoseconds = nanosecondsSince(begin) / numEntries;
+      if (found != numEntries) {
+        throw W32Error(ERROR_FILE_CORRUPT);
+      }
+    }
+  } catch (...) {
+    DeleteFileW(filepath.c_str());
+    throw;
+  }
+  DeleteFileW(filepath.c_str());
+  return result;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Metadata.hpp"
+#include "MetadataBackend.hpp"
+#include "MetadataConfig.hpp"
+#include "MetadataLogWriter.hpp"
+#include "RenameStore.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+
+// the MFMD store file (see metadata.md); V1 to V3 files are converted to V4 when opened
+// the V4 base is memory-mapped and changes are appended to the file by a MetadataLogWriter, which a background
+// compaction merges into a new base from time to time
+class MetadataFileBackend : public MetadataBackend {
+  struct Compaction;
+
+  std::wstring mFilepath;
+  RenameStore mRenameStore;
+  HANDLE mHFile = NULL;
+  HANDLE mHMapping = NULL;
+  // the store file except its appendix section, mapped read-only; metadata entries are looked up in place
+  const std::byte* mBaseData = nullptr;
+  std::uint64_t mAppendixSize = 0;
+  // writes the appendix records behind the callers; started when the file is loaded and restarted whenever it is replaced
+  std::unique_ptr<MetadataLogWriter> mLogWriter;
+  // changes since the mapped file was written; std::nullopt hides an entry of the mapped file
+  std::unordered_map<std::wstring, std::optional<Metadata>> mMetadataOverlay;
+  // a new store file being written in the background; its overlay lies between mMetadataOverlay and the mapped file
+  std::unique_ptr<Compaction> mCompactionN;
+  // the last installed compaction, whose thread may still be freeing its overlay
+  std::unique_ptr<Compaction> mRetiredCompactionN;
+  std::uint64_t mMinCompactionAppendixSize = MetadataConfig::MinCompactionAppendixBytes;
+
+  bool ContainsBaseMetadata(const std::wstring& key) const;
+  void PutMetadata(const std::wstring& key, const Metadata& metadata);
+  bool EraseMetadata(const std::wstring& key);
+  void LoadFromFile();
+  void LoadFromFileV1();
+  void LoadFromFileV2();
+  void LoadFromFileV3();
+  void LoadFromFileV4();
+  void LoadRenameSectionV2(const std::byte* data, std::uint64_t size, std::uint64_t count);
+  void LoadRenameSectionV4(const std::byte* data, std::uint64_t size, std::uint64_t count);
+  std::uint64_t ApplyAppendix(const std::byte* data, std::uint64_t size);
+  void OpenStoreFile();
+  void MapBase();
+  void UnmapBase() noexcept;
+  void StartLogWriter();
+  void ReplaceStoreFile(const std::wstring& tempFilepath);
+  void SaveToFile();
+  void MaybeCompact();
+  void StartCompaction();
+  void CompactMain(Compaction& compaction);
+  void CopyTail(Compaction& compaction, std::uint64_t endOffset);
+  void FinishCompaction();
+  void AbortCompaction();
+  void AddRenameAppendix(std::wstring_view a, std::wstring_view b);
+  void AddRenameAppendix(std::wstring_view a);
+  void AddMetadataAppendix(std::wstring_view keyName, const Metadata& metadata);
+  void AddMetadataAppendix(std::wstring_view keyName);
+
+public:
+  struct FormatBenchmarkResult {
+    struct Format {
+      std::uint64_t fileBytes;
+      std::uint64_t loadNanoseconds;
+      std::uint64_t hitNanoseconds;    // per lookup of an existing entry
+      std::uint64_t missNanoseconds;   // per lookup of a missing entry
+    };
+
+    Format v2;
+    Format v4;
+    std::uint64_t migrationNanoseconds;   // opening the V2 file, which converts it to V4
+  };
+
+  // writes numEntries synthetic metadata entries as a V2 file in directory, converts it to V4 and times loading and
+  // looking up the entries in each format; the file is removed afterwards
+  static FormatBenchmarkResult BenchmarkFormats(std::wstring_view directory, std::size_t numEntries);
+
+  MetadataFileBackend(const MetadataFileBackend&) = delete;
+
+  // opens or creates the store file; its rename entries are kept in memory in a RenameStore
+  MetadataFileBackend(std::wstring_view storeFilename, bool caseSensitive);
+  ~MetadataFileBackend() override;
+
+  bool Contains(const std::wstring& key) const override;
+  std::optional<Metadata> Find(const std::wstring& key) const override;
+  void Put(const std::wstring& key, const Metadata& metadata) override;
+  bool Erase(const std::wstring& key) override;
+  std::optional<std::wstring> Resolve(std::wstring_view filename) const override;
+  std::optional<bool> Exists(std::wstring_view filename) const override;
+  std::vector<std::pair<std::wstring, std::wstring>> ListChildrenInForwardLookupTree(std::wstring_view filename) const override;
+  std::vector<std::pair<std::wstring, std::wstring>> ListChildrenInReverseLookupTree(std::wstring_view filename) const override;
+  RenameStore::Result Rename(std::wstring_view srcFilename, std::wstring_view destFilename) override;
+  bool RemoveRename(std::wstring_view filename) override;
+  void MoveTo(std::wstring_view storeFilename) override;
+};
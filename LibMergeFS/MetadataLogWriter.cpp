@@ -0,0 +1,239 @@
+#include "MetadataLogWriter.hpp"
+#include "NsError.hpp"
+
+#include "../Util/Common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+
+
+void MetadataLogWriter::WriterMain() {
+  std::vector<std::byte> buffer;
+  auto flushDeadline = std::chrono::steady_clock::time_point::max();
+
+  while (true) {
+    const auto head = mPending.exchange(nullptr, std::memory_order_acquire);
+    if (head) {
+      WriteBatch(head, buffer);
+
+      bool flush = false;
+      {
+        std::lock_guard lock(mMutex);
+        switch (mDurability) {
+          case MetadataConfig::Durability::None:
+            break;
+
+          case MetadataConfig::Durability::Interval:
+            if (flushDeadline == std::chrono::steady_clock::time_point::max()) {
+              flushDeadline = std::chrono::steady_clock::now() + MetadataConfig::FlushInterval;
+            }
+            // keep flushing while records arrive faster than the writer goes idle
+            flush = std::chrono::steady_clock::now() >= flushDeadline;
+            break;
+
+          case MetadataConfig::Durability::Batch:
+            flush = true;
+            break;
+        }
+      }
+      if (flush) {
+        Flush();
+        flushDeadline = std::chrono::steady_clock::time_point::max();
+      }
+      continue;
+    }
+
+    std::unique_lock lock(mMutex);
+    const auto wakeUp = [this]() {
+      return mStopping || mPending.load(std::memory_order_relaxed);
+    };
+    if (flushDeadline == std::chrono::steady_clock::time_point::max()) {
+      mCv.wait(lock, wakeUp);
+    } else if (!mCv.wait_until(lock, flushDeadline, wakeUp)) {
+      // Interval; idle since the deadline
+      lock.unlock();
+      Flush();
+      flushDeadline = std::chrono::steady_clock::time_point::max();
+      continue;
+    }
+    if (!mPending.load(std::memory_order_relaxed)) {
+      // stopping and every record has been written
+      break;
+    }
+  }
+
+  if (mDurability != MetadataConfig::Durability::None) {
+    Flush();
+  }
+}
+
+
+// writes the records of a batch in the order they were appended, concatenated into as few WriteFile calls as possible
+void MetadataLogWriter::WriteBatch(Record* head, std::vector<std::byte>& buffer) {
+  // the queue is a stack
+  Record* first = nullptr;
+  std::uint64_t numRecords = 0;
+  while (head) {
+    const auto next = head->next;
+    head->next = first;
+    first = head;
+    head = next;
+    numRecords++;
+  }
+
+  auto record = first;
+  while (record) {
+    auto end = record;
+    std::size_t size = 0;
+    do {
+      size += end->data.size();
+      end = end->next;
+    } while (end && size + end->data.size() <= MetadataConfig::MaxBatchBytes);
+
+    // records are discarded after the first error
+    if (!mFailed.load(std::memory_order_relaxed)) {
+      try {
+        buffer.clear();
+        buffer.reserve(size);
+        for (auto current = record; current != end; current = current->next) {
+          buffer.insert(buffer.end(), current->data.cbegin(), current->data.cend());
+        }
+        auto overlapped = util::CreateOverlapped(mPosition);
+        DWORD written = 0;
+        if (!WriteFile(mHFile, buffer.data(), static_cast<DWORD>(buffer.size()), &written, &overlapped) || written != buffer.size()) {
+          throw W32Error();
+        }
+        mPosition += buffer.size();
+      } catch (...) {
+        SetError(std::current_exception());
+      }
+    }
+
+    while (record != end) {
+      const auto next = record->next;
+      delete record;
+      record = next;
+    }
+  }
+
+  {
+    std::lock_guard lock(mMutex);
+    mNumWritten += numRecords;
+    mWrittenPosition = mPosition;
+    mUnflushed = true;
+  }
+  mDrainCv.notify_all();
+}
+
+
+void MetadataLogWriter::Flush() {
+  {
+    std::lock_guard lock(mMutex);
+    if (!mUnflushed) {
+      return;
+    }
+    mUnflushed = false;
+  }
+  if (!mFailed.load(std::memory_order_relaxed) && !FlushFileBuffers(mHFile)) {
+    SetError(std::make_exception_ptr(W32Error()));
+  }
+}
+
+
+void MetadataLogWriter::SetError(std::exception_ptr error) {
+  std::lock_guard lock(mMutex);
+  if (!mErrorN) {
+    mErrorN = error;
+  }
+  mFailed.store(true, std::memory_order_relaxed);
+}
+
+
+void MetadataLogWriter::ThrowIfFailed() {
+  if (!mFailed.load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::lock_guard lock(mMutex);
+  std::rethrow_exception(mErrorN);
+}
+
+
+MetadataLogWriter::MetadataLogWriter(HANDLE hFile, std::uint64_t position, MetadataConfig::Durability durability) :
+  mHFile(hFile),
+  mDurability(durability),
+  mPosition(position),
+  mPending(nullptr),
+  mNumAppended(0),
+  mFailed(false),
+  mMutex(),
+  mCv(),
+  mDrainCv(),
+  mNumWritten(0),
+  mWrittenPosition(position),
+  mUnflushed(false),
+  mStopping(false),
+  mErrorN(),
+  mThread()
+{
+  mThread = std::thread(&MetadataLogWriter::WriterMain, this);
+}
+
+
+MetadataLogWriter::~MetadataLogWriter() {
+  {
+    std::lock_guard lock(mMutex);
+    mStopping = true;
+  }
+  mCv.notify_one();
+  mThread.join();
+}
+
+
+void MetadataLogWriter::Append(std::vector<std::byte>&& data) {
+  ThrowIfFailed();
+
+  auto record = new Record{
+    nullptr,
+    std::move(data),
+  };
+  mNumAppended.fetch_add(1, std::memory_order_relaxed);
+
+  auto next = mPending.load(std::memory_order_relaxed);
+  do {
+    record->next = next;
+  } while (!mPending.compare_exchange_weak(next, record, std::memory_order_release, std::memory_order_relaxed));
+
+  // the writer waits only after it found the queue empty, so only the first record after that has to wake it up
+  // (record may already have been written and freed here)
+  if (!next) {
+    {
+      std::lock_guard lock(mMutex);
+    }
+    mCv.notify_one();
+  }
+}
+
+
+std::uint64_t MetadataLogWriter::Drain() {
+  const auto numAppended = mNumAppended.load(std::memory_order_relaxed);
+  std::uint64_t position;
+  {
+    std::unique_lock lock(mMutex);
+    mDrainCv.wait(lock, [this, numAppended]() {
+      return mNumWritten >= numAppended;
+    });
+    position = mWrittenPosition;
+  }
+  ThrowIfFailed();
+  return position;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "MetadataConfig.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+
+// group-commit writer of the appendix section of a metadata store file
+// Append queues an encoded record without taking a lock; a background thread writes all queued records at the end of
+// the file with a single WriteFile and flushes the file according to the durability
+// records are written in the order of Append; the handle must outlive the writer
+class MetadataLogWriter {
+  struct Record {
+    Record* next;
+    std::vector<std::byte> data;
+  };
+
+  const HANDLE mHFile;
+  const MetadataConfig::Durability mDurability;
+  std::uint64_t mPosition;
+  // records appended since the last batch was taken, in reverse order
+  std::atomic<Record*> mPending;
+  std::atomic<std::uint64_t> mNumAppended;
+  std::atomic<bool> mFailed;
+
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::condition_variable mDrainCv;
+  std::uint64_t mNumWritten;
+  std::uint64_t mWrittenPosition;
+  bool mUnflushed;
+  bool mStopping;
+  // the first write error; later records are discarded and the error is rethrown by Append and Drain
+  std::exception_ptr mErrorN;
+  std::thread mThread;
+
+  void WriterMain();
+  void WriteBatch(Record* head, std::vector<std::byte>& buffer);
+  void Flush();
+  void SetError(std::exception_ptr error);
+  void ThrowIfFailed();
+
+public:
+  MetadataLogWriter(const MetadataLogWriter&) = delete;
+  MetadataLogWriter& operator=(const MetadataLogWriter&) = delete;
+
+  // position is the end of the file, where the first record is written
+  MetadataLogWriter(HANDLE hFile, std::uint64_t position, MetadataConfig::Durability durability);
+  // writes the remaining records and flushes the file unless the durability is None
+  ~MetadataLogWriter();
+
+  // data is a complete appendix entry
+  void Append(std::vector<std::byte>&& data);
+  // returns after every record appended so far has been written (but not necessarily flushed)
+  // returns the end of the written records
+  std::uint64_t Drain();
+};
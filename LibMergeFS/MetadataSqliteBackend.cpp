@@ -0,0 +1,792 @@
+#ifdef MERGEFS_SQLITE
+
+#include "MetadataSqliteBackend.hpp"
+#include "Metadata.hpp"
+#include "MetadataConfig.hpp"
+#include "RenameStore.hpp"
+#include "Util.hpp"
+#include "NsError.hpp"
+
+#include "../Util/VirtualFs.hpp"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+using namespace std::literals;
+
+
+
+namespace {
+  // keys and filenames are bound as UTF-16
+  static_assert(sizeof(wchar_t) == 2);
+
+  constexpr int SchemaVersion = 1;
+
+
+  [[noreturn]] void ThrowSqliteError(int result) {
+    switch (result & 0xFF) {
+      case SQLITE_NOMEM:
+        throw std::bad_alloc();
+
+      case SQLITE_FULL:
+        throw W32Error(ERROR_DISK_FULL);
+
+      case SQLITE_CANTOPEN:
+        throw W32Error(ERROR_OPEN_FAILED);
+
+      case SQLITE_BUSY:
+      case SQLITE_LOCKED:
+        throw W32Error(ERROR_SHARING_VIOLATION);
+
+      case SQLITE_CORRUPT:
+      case SQLITE_NOTADB:
+        throw W32Error(ERROR_FILE_CORRUPT);
+
+      case SQLITE_IOERR:
+        throw W32Error(ERROR_IO_DEVICE);
+
+      default:
+        throw W32Error(ERROR_DATABASE_FAILURE);
+    }
+  }
+
+
+  void Check(int result) {
+    if (result != SQLITE_OK) {
+      ThrowSqliteError(result);
+    }
+  }
+
+
+  // resets a shared statement when it goes out of scope, so that it can be reused whatever happened
+  class StatementReset {
+    sqlite3_stmt* mStatement;
+
+  public:
+    StatementReset(const StatementReset&) = delete;
+
+    explicit StatementReset(sqlite3_stmt* statement) noexcept :
+      mStatement(statement)
+    {}
+
+    ~StatementReset() {
+      sqlite3_reset(mStatement);
+      sqlite3_clear_bindings(mStatement);
+    }
+  };
+
+
+  // the text must outlive the step of the statement
+  void BindText(sqlite3_stmt* statement, int index, std::wstring_view text) {
+    Check(sqlite3_bind_text16(statement, index, text.data(), static_cast<int>(text.size() * sizeof(wchar_t)), SQLITE_STATIC));
+  }
+
+
+  std::wstring ColumnText(sqlite3_stmt* statement, int index) {
+    const auto data = static_cast<const wchar_t*>(sqlite3_column_text16(statement, index));
+    const auto size = static_cast<std::size_t>(sqlite3_column_bytes16(statement, index)) / sizeof(wchar_t);
+    return data ? std::wstring(data, size) : std::wstring();
+  }
+
+
+  void BindFILETIME(sqlite3_stmt* statement, int index, const std::optional<FILETIME>& filetimeN) {
+    if (!filetimeN) {
+      Check(sqlite3_bind_null(statement, index));
+      return;
+    }
+    const auto& filetime = filetimeN.value();
+    const auto value = static_cast<std::uint64_t>(filetime.dwLowDateTime) | (static_cast<std::uint64_t>(filetime.dwHighDateTime) << 32);
+    Check(sqlite3_bind_int64(statement, index, static_cast<sqlite3_int64>(value)));
+  }
+
+
+  std::optional<FILETIME> ColumnFILETIME(sqlite3_stmt* statement, int index) {
+    if (sqlite3_column_type(statement, index) == SQLITE_NULL) {
+      return std::nullopt;
+    }
+    const auto value = static_cast<std::uint64_t>(sqlite3_column_int64(statement, index));
+    return FILETIME{
+      static_cast<DWORD>(value & 0xFFFFFFFF),
+      static_cast<DWORD>((value >> 32) & 0xFFFFFFFF),
+    };
+  }
+
+
+  // steps a statement which returns no rows
+  void Run(sqlite3_stmt* statement) {
+    StatementReset reset(statement);
+    const auto result = sqlite3_step(statement);
+    if (result != SQLITE_DONE) {
+      ThrowSqliteError(result);
+    }
+  }
+
+
+  // binds texts to ?1, ?2, ... and steps a statement which returns no rows; the texts must outlive the call
+  void Run(sqlite3_stmt* statement, std::initializer_list<std::wstring_view> texts) {
+    StatementReset reset(statement);
+    int index = 1;
+    for (const auto text : texts) {
+      BindText(statement, index++, text);
+    }
+    const auto result = sqlite3_step(statement);
+    if (result != SQLITE_DONE) {
+      ThrowSqliteError(result);
+    }
+  }
+
+
+  // splits the key of a path into the key of its parent directory (empty for the root directory) and its last component
+  std::pair<std::wstring_view, std::wstring_view> SplitKey(std::wstring_view key) noexcept {
+    const auto pos = key.find_last_of(L'\\');
+    return {key.substr(0, pos), key.substr(pos + 1)};
+  }
+}
+
+
+
+void MetadataSqliteBackend::DatabaseDeleter::operator()(sqlite3* database) const noexcept {
+  // closes the database once its remaining statements are finalized
+  sqlite3_close_v2(database);
+}
+
+
+void MetadataSqliteBackend::StatementDeleter::operator()(sqlite3_stmt* statement) const noexcept {
+  sqlite3_finalize(statement);
+}
+
+
+std::wstring MetadataSqliteBackend::FilenameToKey(std::wstring_view filename) const {
+  return ::FilenameToKey(filename, mCaseSensitive);
+}
+
+
+MetadataSqliteBackend::Statement MetadataSqliteBackend::Prepare(const char* sql) {
+  sqlite3_stmt* statement = nullptr;
+  Check(sqlite3_prepare_v3(mDatabase.get(), sql, -1, SQLITE_PREPARE_PERSISTENT, &statement, nullptr));
+  return Statement(statement);
+}
+
+
+void MetadataSqliteBackend::Execute(const char* sql) {
+  Check(sqlite3_exec(mDatabase.get(), sql, nullptr, nullptr, nullptr));
+}
+
+
+void MetadataSqliteBackend::OpenDatabase() {
+  sqlite3* database = nullptr;
+  const auto result = sqlite3_open16(mFilepath.c_str(), &database);
+  // a handle is returned even on failure
+  mDatabase.reset(database);
+  Check(result);
+
+  // text is compared bytewise, which in UTF-8 is the order of code points that the range queries of the rename tables
+  // rely on (in UTF-16LE, the default of sqlite3_open16, U+015C sorts between '\' and ']'); an existing database keeps
+  // its encoding
+  Execute("PRAGMA encoding = 'UTF-8'");
+
+  // the mount is the only user of the database, which saves the shared-memory index of the WAL as well
+  Execute("PRAGMA locking_mode = EXCLUSIVE");
+  Execute("PRAGMA journal_mode = WAL");
+  switch (MetadataConfig::LogDurability) {
+    case MetadataConfig::Durability::None:
+      Execute("PRAGMA synchronous = OFF");
+      break;
+
+    case MetadataConfig::Durability::Interval:
+      // commits are durable once the WAL is checkpointed, but the database is never left inconsistent
+      Execute("PRAGMA synchronous = NORMAL");
+      break;
+
+    case MetadataConfig::Durability::Batch:
+      Execute("PRAGMA synchronous = FULL");
+      break;
+  }
+  const auto cachePragma = "PRAGMA cache_size = -"s + std::to_string(MetadataConfig::SqliteCacheBytes / 1024);
+  Execute(cachePragma.c_str());
+
+  {
+    const auto versionStatement = Prepare("PRAGMA user_version");
+    if (sqlite3_step(versionStatement.get()) != SQLITE_ROW || sqlite3_column_int(versionStatement.get(), 0) > SchemaVersion) {
+      throw W32Error(ERROR_INVALID_PARAMETER);
+    }
+  }
+
+  Execute(
+    "BEGIN;"
+    // every optional field of Metadata is NULL if not set
+    "CREATE TABLE IF NOT EXISTS metadata ("
+    "  key TEXT PRIMARY KEY NOT NULL,"
+    "  attributes INTEGER,"
+    "  creation_time INTEGER,"
+    "  last_access_time INTEGER,"
+    "  last_write_time INTEGER,"
+    "  security BLOB"
+    ") WITHOUT ROWID;"
+    // the valid nodes of the lookup trees of RenameStore; parent and name are the key of the path of the node split by
+    // SplitKey, so that the children of a directory are a range of the primary key, and the descendants are the rows
+    // whose parent is the key of the directory or starts with it followed by a backslash
+    // forward lookup tree: a renamed path and the original path it resolves to
+    "CREATE TABLE IF NOT EXISTS forward_renames ("
+    "  parent TEXT NOT NULL,"
+    "  name TEXT NOT NULL,"
+    "  renamed TEXT NOT NULL,"
+    "  original TEXT NOT NULL,"
+    "  original_parent TEXT NOT NULL,"
+    "  original_name TEXT NOT NULL,"
+    "  PRIMARY KEY (parent, name)"
+    ") WITHOUT ROWID;"
+    // reverse lookup tree: an original path and the path it was renamed to
+    "CREATE TABLE IF NOT EXISTS reverse_renames ("
+    "  parent TEXT NOT NULL,"
+    "  name TEXT NOT NULL,"
+    "  original TEXT NOT NULL,"
+    "  renamed TEXT NOT NULL,"
+    "  PRIMARY KEY (parent, name)"
+    ") WITHOUT ROWID;"
+    "PRAGMA user_version = 1;"
+    "COMMIT;"
+  );
+  static_assert(SchemaVersion == 1);
+
+  mSelectMetadata = Prepare("SELECT attributes, creation_time, last_access_time, last_write_time, security FROM metadata WHERE key = ?1");
+  mContainsMetadata = Prepare("SELECT 1 FROM metadata WHERE key = ?1");
+  mReplaceMetadata = Prepare("INSERT OR REPLACE INTO metadata (key, attributes, creation_time, last_access_time, last_write_time, security) VALUES (?1, ?2, ?3, ?4, ?5, ?6)");
+  mDeleteMetadata = Prepare("DELETE FROM metadata WHERE key = ?1");
+  mSelectForward = Prepare("SELECT original FROM forward_renames WHERE parent = ?1 AND name = ?2");
+  mSelectReverse = Prepare("SELECT renamed FROM reverse_renames WHERE parent = ?1 AND name = ?2");
+  mListForward = Prepare("SELECT renamed, original FROM forward_renames WHERE parent = ?1");
+  mListReverse = Prepare("SELECT original, renamed FROM reverse_renames WHERE parent = ?1");
+  // ?1 is the key of a path and ?2, ?3 are its parent and name; whether the path has a node with or without descendants
+  mContainsForwardTree = Prepare("SELECT 1 FROM forward_renames WHERE (parent = ?2 AND name = ?3) OR parent = ?1 OR (parent >= ?1 || '\\' AND parent < ?1 || ']') LIMIT 1");
+  mDeleteForwardDescendants = Prepare("DELETE FROM forward_renames WHERE parent = ?1 OR (parent >= ?1 || '\\' AND parent < ?1 || ']')");
+  mMoveForward = Prepare("UPDATE forward_renames SET parent = ?3, name = ?4, renamed = ?5 WHERE parent = ?1 AND name = ?2");
+  // ?1, ?2 are the keys of the source and the destination, ?3, ?4 the paths; the prefixes have the same length as the keys
+  mMoveForwardDescendants = Prepare("UPDATE forward_renames SET parent = ?2 || substr(parent, length(?1) + 1), renamed = ?4 || substr(renamed, length(?3) + 1) WHERE parent = ?1 OR (parent >= ?1 || '\\' AND parent < ?1 || ']')");
+  mReplaceForward = Prepare("INSERT OR REPLACE INTO forward_renames (parent, name, renamed, original, original_parent, original_name) VALUES (?1, ?2, ?3, ?4, ?5, ?6)");
+  mInsertReverse = Prepare("INSERT OR IGNORE INTO reverse_renames (parent, name, original, renamed) VALUES (?1, ?2, ?3, ?4)");
+  // ?1 is the key of the destination, ?2, ?3 the source and destination paths
+  mUpdateReverseOfDescendants = Prepare("UPDATE reverse_renames SET renamed = ?3 || substr(renamed, length(?2) + 1) WHERE (parent, name) IN (SELECT original_parent, original_name FROM forward_renames WHERE parent = ?1 OR (parent >= ?1 || '\\' AND parent < ?1 || ']'))");
+  mDeleteForward = Prepare("DELETE FROM forward_renames WHERE parent = ?1 AND name = ?2");
+  mDeleteReverse = Prepare("DELETE FROM reverse_renames WHERE parent = ?1 AND name = ?2");
+  mBegin = Prepare("BEGIN");
+  mCommit = Prepare("COMMIT");
+
+  {
+    const auto statement = Prepare("SELECT EXISTS (SELECT 1 FROM forward_renames) OR EXISTS (SELECT 1 FROM reverse_renames)");
+    const auto result = sqlite3_step(statement.get());
+    if (result != SQLITE_ROW) {
+      ThrowSqliteError(result);
+    }
+    mHasRenames = sqlite3_column_int(statement.get(), 0) != 0;
+  }
+}
+
+
+void MetadataSqliteBackend::CloseDatabase() noexcept {
+  mSelectMetadata.reset();
+  mContainsMetadata.reset();
+  mReplaceMetadata.reset();
+  mDeleteMetadata.reset();
+  mSelectForward.reset();
+  mSelectReverse.reset();
+  mListForward.reset();
+  mListReverse.reset();
+  mContainsForwardTree.reset();
+  mDeleteForwardDescendants.reset();
+  mMoveForward.reset();
+  mMoveForwardDescendants.reset();
+  mReplaceForward.reset();
+  mInsertReverse.reset();
+  mUpdateReverseOfDescendants.reset();
+  mDeleteForward.reset();
+  mDeleteReverse.reset();
+  mBegin.reset();
+  mCommit.reset();
+  // checkpoints and removes the WAL
+  mDatabase.reset();
+}
+
+
+void MetadataSqliteBackend::StartFlushThread() {
+  mStopping = false;
+  mFlushThread = std::thread(&MetadataSqliteBackend::FlushMain, this);
+}
+
+
+void MetadataSqliteBackend::StopFlushThread() noexcept {
+  {
+    std::lock_guard lock(mMutex);
+    mStopping = true;
+  }
+  mCv.notify_one();
+  if (mFlushThread.joinable()) {
+    mFlushThread.join();
+  }
+}
+
+
+// commits the open transaction once its deadline has passed
+void MetadataSqliteBackend::FlushMain() {
+  std::unique_lock lock(mMutex);
+  while (!mStopping) {
+    if (!mBatchChanges) {
+      mCv.wait(lock);
+      continue;
+    }
+    if (mCv.wait_until(lock, mBatchDeadline) != std::cv_status::timeout || !mBatchChanges || mStopping) {
+      continue;
+    }
+    try {
+      CommitBatch();
+    } catch (...) {
+      if (!mErrorN) {
+        mErrorN = std::current_exception();
+      }
+      // wait for the next change instead of retrying at once
+      mBatchDeadline = std::chrono::steady_clock::now() + MetadataConfig::FlushInterval;
+    }
+  }
+}
+
+
+// called with mMutex held before every change; opens a transaction for the batch unless every change commits itself
+void MetadataSqliteBackend::BeginChange() {
+  if (mErrorN) {
+    std::rethrow_exception(mErrorN);
+  }
+  if (MetadataConfig::LogDurability == MetadataConfig::Durability::Batch) {
+    return;
+  }
+  if (!mBatchChanges) {
+    Run(mBegin.get());
+    mBatchDeadline = std::chrono::steady_clock::now() + MetadataConfig::FlushInterval;
+    mCv.notify_one();
+  }
+  mBatchChanges++;
+}
+
+
+void MetadataSqliteBackend::EndChange() {
+  if (mBatchChanges >= MetadataConfig::SqliteMaxBatchStatements) {
+    CommitBatch();
+  }
+}
+
+
+void MetadataSqliteBackend::CommitBatch() {
+  if (!mBatchChanges) {
+    return;
+  }
+  try {
+    Run(mCommit.get());
+  } catch (...) {
+    // SQLite rolls back the transaction on some errors and keeps it open on others
+    if (sqlite3_get_autocommit(mDatabase.get())) {
+      mBatchChanges = 0;
+    }
+    throw;
+  }
+  mBatchChanges = 0;
+}
+
+
+// the longest of key and its ancestors which has a row selected by statement (mSelectForward or mSelectReverse), as
+// the length of its key and the text of the row
+std::optional<std::pair<std::size_t, std::wstring>> MetadataSqliteBackend::FindLongestMatchL(sqlite3_stmt* statement, std::wstring_view key) const {
+  for (auto length = key.size(); length != 0 && length != std::wstring_view::npos; length = key.find_last_of(L'\\', length - 1)) {
+    const auto [parent, name] = SplitKey(key.substr(0, length));
+    StatementReset reset(statement);
+    BindText(statement, 1, parent);
+    BindText(statement, 2, name);
+    const auto result = sqlite3_step(statement);
+    if (result == SQLITE_ROW) {
+      return std::make_pair(length, ColumnText(statement, 0));
+    }
+    if (result != SQLITE_DONE) {
+      ThrowSqliteError(result);
+    }
+  }
+  return std::nullopt;
+}
+
+
+// like RenameStore::Resolve
+std::optional<std::wstring> MetadataSqliteBackend::ResolveL(std::wstring_view filename) const {
+  if (util::vfs::IsRootDirectory(filename)) {
+    return std::wstring(filename);
+  }
+  const auto key = FilenameToKey(filename);
+  if (const auto forwardMatch = FindLongestMatchL(mSelectForward.get(), key)) {
+    return forwardMatch.value().second + std::wstring(filename.substr(forwardMatch.value().first));
+  }
+  if (FindLongestMatchL(mSelectReverse.get(), key)) {
+    return std::nullopt;
+  }
+  return std::wstring(filename);
+}
+
+
+// statement is mListForward or mListReverse; returns the names of the children and the texts of their rows
+std::vector<std::pair<std::wstring, std::wstring>> MetadataSqliteBackend::ListChildrenL(sqlite3_stmt* statement, std::wstring_view filename) const {
+  const auto key = util::vfs::IsRootDirectory(filename) ? std::wstring() : FilenameToKey(filename);
+  std::vector<std::pair<std::wstring, std::wstring>> children;
+  StatementReset reset(statement);
+  BindText(statement, 1, key);
+  int result;
+  while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+    const auto path = ColumnText(statement, 0);
+    children.emplace_back(util::vfs::GetBaseName(path), ColumnText(statement, 1));
+  }
+  if (result != SQLITE_DONE) {
+    ThrowSqliteError(result);
+  }
+  return children;
+}
+
+
+// like RenameStore::Rename, including its handling of the descendants of the source and the destination
+RenameStore::Result MetadataSqliteBackend::RenameL(std::wstring_view srcFilename, std::wstring_view destFilename) {
+  if (util::vfs::IsRootDirectory(srcFilename) || util::vfs::IsRootDirectory(destFilename)) {
+    return RenameStore::Result::Invalid;
+  }
+
+  if (srcFilename == destFilename) {
+    return RenameStore::Result::Success;
+  }
+
+  const auto resolvedSrcFilenameN = ResolveL(srcFilename);
+  if (!resolvedSrcFilenameN) {
+    return RenameStore::Result::NotExists;
+  }
+  const auto& resolvedSrcFilename = resolvedSrcFilenameN.value();
+
+  const auto srcKey = FilenameToKey(srcFilename);
+  const auto destKey = FilenameToKey(destFilename);
+  const auto resolvedSrcKey = FilenameToKey(resolvedSrcFilename);
+  const auto [srcParent, srcName] = SplitKey(srcKey);
+  const auto [destParent, destName] = SplitKey(destKey);
+  const auto [resolvedSrcParent, resolvedSrcName] = SplitKey(resolvedSrcKey);
+
+  // modify forward lookup tree
+  bool srcNodeExists = false;
+  {
+    const auto statement = mContainsForwardTree.get();
+    StatementReset reset(statement);
+    BindText(statement, 1, srcKey);
+    BindText(statement, 2, srcParent);
+    BindText(statement, 3, srcName);
+    const auto result = sqlite3_step(statement);
+    if (result != SQLITE_ROW && result != SQLITE_DONE) {
+      ThrowSqliteError(result);
+    }
+    srcNodeExists = result == SQLITE_ROW;
+  }
+  if (srcNodeExists) {
+    // node already exists; move it with its descendants
+    if (destKey != srcKey) {
+      {
+        const auto statement = mSelectForward.get();
+        StatementReset reset(statement);
+        BindText(statement, 1, destParent);
+        BindText(statement, 2, destName);
+        const auto result = sqlite3_step(statement);
+        if (result == SQLITE_ROW) {
+          return RenameStore::Result::AlreadyExists;
+        }
+        if (result != SQLITE_DONE) {
+          ThrowSqliteError(result);
+        }
+      }
+      // the node replaces the destination node with its descendants
+      Run(mDeleteForwardDescendants.get(), {destKey});
+    }
+    Run(mMoveForwardDescendants.get(), {srcKey, destKey, srcFilename, destFilename});
+    Run(mMoveForward.get(), {srcParent, srcName, destParent, destName, destFilename});
+  }
+  // use resolved one
+  Run(mReplaceForward.get(), {destParent, destName, destFilename, resolvedSrcFilename, resolvedSrcParent, resolvedSrcName});
+
+  // modify reverse lookup tree
+  Run(mInsertReverse.get(), {srcParent, srcName, srcFilename, destFilename});
+  Run(mUpdateReverseOfDescendants.get(), {destKey, srcFilename, destFilename});
+
+  mHasRenames = true;
+  return RenameStore::Result::Success;
+}
+
+
+// like RenameStore::RemoveEntry
+bool MetadataSqliteBackend::RemoveRenameL(std::wstring_view filename) {
+  if (util::vfs::IsRootDirectory(filename)) {
+    return false;
+  }
+  const auto key = FilenameToKey(filename);
+  const auto [parent, name] = SplitKey(key);
+  std::wstring original;
+  {
+    const auto statement = mSelectForward.get();
+    StatementReset reset(statement);
+    BindText(statement, 1, parent);
+    BindText(statement, 2, name);
+    const auto result = sqlite3_step(statement);
+    if (result == SQLITE_DONE) {
+      return false;
+    }
+    if (result != SQLITE_ROW) {
+      ThrowSqliteError(result);
+    }
+    original = ColumnText(statement, 0);
+  }
+  Run(mDeleteForward.get(), {parent, name});
+
+  const auto originalKey = FilenameToKey(original);
+  const auto [originalParent, originalName] = SplitKey(originalKey);
+  Run(mDeleteReverse.get(), {originalParent, originalName});
+  return sqlite3_changes(mDatabase.get()) != 0;
+}
+
+
+MetadataSqliteBackend::MetadataSqliteBackend(std::wstring_view storeFilename, bool caseSensitive) :
+  mFilepath(storeFilename),
+  mCaseSensitive(caseSensitive)
+{
+  try {
+    OpenDatabase();
+    StartFlushThread();
+  } catch (...) {
+    CloseDatabase();
+    throw;
+  }
+}
+
+
+MetadataSqliteBackend::~MetadataSqliteBackend() {
+  StopFlushThread();
+  try {
+    CommitBatch();
+  } catch (...) {
+    // the changes of the batch are lost, as if the process had crashed
+  }
+  CloseDatabase();
+}
+
+
+bool MetadataSqliteBackend::Contains(const std::wstring& key) const {
+  std::lock_guard lock(mMutex);
+  const auto statement = mContainsMetadata.get();
+  StatementReset reset(statement);
+  BindText(statement, 1, key);
+  const auto result = sqlite3_step(statement);
+  if (result != SQLITE_ROW && result != SQLITE_DONE) {
+    ThrowSqliteError(result);
+  }
+  return result == SQLITE_ROW;
+}
+
+
+std::optional<Metadata> MetadataSqliteBackend::Find(const std::wstring& key) const {
+  std::lock_guard lock(mMutex);
+  const auto statement = mSelectMetadata.get();
+  StatementReset reset(statement);
+  BindText(statement, 1, key);
+  const auto result = sqlite3_step(statement);
+  if (result == SQLITE_DONE) {
+    return std::nullopt;
+  }
+  if (result != SQLITE_ROW) {
+    ThrowSqliteError(result);
+  }
+
+  Metadata metadata;
+  if (sqlite3_column_type(statement, 0) != SQLITE_NULL) {
+    metadata.fileAttributes = static_cast<DWORD>(sqlite3_column_int64(statement, 0));
+  }
+  metadata.creationTime = ColumnFILETIME(statement, 1);
+  metadata.lastAccessTime = ColumnFILETIME(statement, 2);
+  metadata.lastWriteTime = ColumnFILETIME(statement, 3);
+  if (sqlite3_column_type(statement, 4) != SQLITE_NULL) {
+    const auto data = static_cast<const char*>(sqlite3_column_blob(statement, 4));
+    const auto size = static_cast<std::size_t>(sqlite3_column_bytes(statement, 4));
+    metadata.security = data ? std::string(data, size) : std::string();
+  }
+  return metadata;
+}
+
+
+void MetadataSqliteBackend::Put(const std::wstring& key, const Metadata& metadata) {
+  std::lock_guard lock(mMutex);
+  BeginChange();
+  {
+    const auto statement = mReplaceMetadata.get();
+    StatementReset reset(statement);
+    BindText(statement, 1, key);
+    if (metadata.fileAttributes) {
+      Check(sqlite3_bind_int64(statement, 2, metadata.fileAttributes.value()));
+    }
+    BindFILETIME(statement, 3, metadata.creationTime);
+    BindFILETIME(statement, 4, metadata.lastAccessTime);
+    BindFILETIME(statement, 5, metadata.lastWriteTime);
+    if (metadata.security) {
+      const auto& security = metadata.security.value();
+      Check(sqlite3_bind_blob(statement, 6, security.data(), static_cast<int>(security.size()), SQLITE_STATIC));
+    }
+    if (const auto result = sqlite3_step(statement); result != SQLITE_DONE) {
+      ThrowSqliteError(result);
+    }
+  }
+  EndChange();
+}
+
+
+bool MetadataSqliteBackend::Erase(const std::wstring& key) {
+  std::lock_guard lock(mMutex);
+  BeginChange();
+  {
+    const auto statement = mDeleteMetadata.get();
+    StatementReset reset(statement);
+    BindText(statement, 1, key);
+    if (const auto result = sqlite3_step(statement); result != SQLITE_DONE) {
+      ThrowSqliteError(result);
+    }
+  }
+  const bool existed = sqlite3_changes(mDatabase.get()) != 0;
+  EndChange();
+  return existed;
+}
+
+
+std::optional<std::wstring> MetadataSqliteBackend::Resolve(std::wstring_view filename) const {
+  if (!mHasRenames) {
+    return std::wstring(filename);
+  }
+  std::lock_guard lock(mMutex);
+  return ResolveL(filename);
+}
+
+
+// like RenameStore::Exists
+std::optional<bool> MetadataSqliteBackend::Exists(std::wstring_view filename) const {
+  if (util::vfs::IsRootDirectory(filename) || !mHasRenames) {
+    return std::nullopt;
+  }
+  std::lock_guard lock(mMutex);
+  const auto key = FilenameToKey(filename);
+  if (FindLongestMatchL(mSelectForward.get(), key)) {
+    return true;
+  }
+  if (FindLongestMatchL(mSelectReverse.get(), key)) {
+    return false;
+  }
+  return std::nullopt;
+}
+
+
+std::vector<std::pair<std::wstring, std::wstring>> MetadataSqliteBackend::ListChildrenInForwardLookupTree(std::wstring_view filename) const {
+  if (!mHasRenames) {
+    return {};
+  }
+  std::lock_guard lock(mMutex);
+  return ListChildrenL(mListForward.get(), filename);
+}
+
+
+std::vector<std::pair<std::wstring, std::wstring>> MetadataSqliteBackend::ListChildrenInReverseLookupTree(std::wstring_view filename) const {
+  if (!mHasRenames) {
+    return {};
+  }
+  std::lock_guard lock(mMutex);
+  return ListChildrenL(mListReverse.get(), filename);
+}
+
+
+// the statements of a change are applied together or not at all
+RenameStore::Result MetadataSqliteBackend::Rename(std::wstring_view srcFilename, std::wstring_view destFilename) {
+  std::lock_guard lock(mMutex);
+  BeginChange();
+  Execute("SAVEPOINT rename_entry");
+  RenameStore::Result result;
+  try {
+    result = RenameL(srcFilename, destFilename);
+    Execute("RELEASE rename_entry");
+  } catch (...) {
+    sqlite3_exec(mDatabase.get(), "ROLLBACK TO rename_entry; RELEASE rename_entry", nullptr, nullptr, nullptr);
+    throw;
+  }
+  EndChange();
+  return result;
+}
+
+
+bool MetadataSqliteBackend::RemoveRename(std::wstring_view filename) {
+  std::lock_guard lock(mMutex);
+  BeginChange();
+  Execute("SAVEPOINT remove_rename");
+  bool result;
+  try {
+    result = RemoveRenameL(filename);
+    Execute("RELEASE remove_rename");
+  } catch (...) {
+    sqlite3_exec(mDatabase.get(), "ROLLBACK TO remove_rename; RELEASE remove_rename", nullptr, nullptr, nullptr);
+    throw;
+  }
+  EndChange();
+  return result;
+}
+
+
+// copies the database to storeFilename, replacing any file there, and reopens it from there
+void MetadataSqliteBackend::MoveTo(std::wstring_view storeFilename) {
+  const std::wstring filepath(storeFilename);
+
+  StopFlushThread();
+  {
+    std::lock_guard lock(mMutex);
+    try {
+      CommitBatch();
+      DeleteFileW(filepath.c_str());
+      const auto statement = Prepare("VACUUM INTO ?1");
+      BindText(statement.get(), 1, filepath);
+      if (const auto result = sqlite3_step(statement.get()); result != SQLITE_DONE) {
+        ThrowSqliteError(result);
+      }
+    } catch (...) {
+      StartFlushThread();
+      throw;
+    }
+
+    CloseDatabase();
+    // the copy has the same rows
+    const auto previousFilepath = std::exchange(mFilepath, filepath);
+    try {
+      OpenDatabase();
+    } catch (...) {
+      // keep the previous database
+      CloseDatabase();
+      mFilepath = previousFilepath;
+      OpenDatabase();
+      StartFlushThread();
+      throw;
+    }
+  }
+  StartFlushThread();
+}
+
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+
+// SQLite 3 store file; built when MERGEFS_SQLITE is defined (needs sqlite3.h and the sqlite3 library, 3.27 or later)
+#ifdef MERGEFS_SQLITE
+
+#include "Metadata.hpp"
+#include "MetadataBackend.hpp"
+#include "RenameStore.hpp"
+
+#include <sqlite3.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// a SQLite database in WAL mode, held exclusively by the mount
+// metadata and rename entries are looked up in the database through its page cache (MetadataConfig::SqliteCacheBytes),
+// so the memory does not grow with the number of entries
+// the rename entries are kept in two tables keyed by the parent and the name of a path, one per lookup tree of
+// RenameStore: a path is resolved by point queries for its ancestors and a directory listing is a range query
+// changes are made with prepared statements in batched transactions, committed by a background thread at the latest
+// MetadataConfig::FlushInterval after the first change of the batch (see MetadataConfig::LogDurability)
+class MetadataSqliteBackend : public MetadataBackend {
+  struct DatabaseDeleter {
+    void operator()(sqlite3* database) const noexcept;
+  };
+
+  struct StatementDeleter {
+    void operator()(sqlite3_stmt* statement) const noexcept;
+  };
+
+  using Statement = std::unique_ptr<sqlite3_stmt, StatementDeleter>;
+
+  std::wstring mFilepath;
+  const bool mCaseSensitive;
+  // lookups are made with the store held shared but share the prepared statements, so every use of the database is
+  // serialized by mMutex, including the commits of the flush thread
+  mutable std::mutex mMutex;
+  std::unique_ptr<sqlite3, DatabaseDeleter> mDatabase;
+  Statement mSelectMetadata;
+  Statement mContainsMetadata;
+  Statement mReplaceMetadata;
+  Statement mDeleteMetadata;
+  Statement mSelectForward;
+  Statement mSelectReverse;
+  Statement mListForward;
+  Statement mListReverse;
+  Statement mContainsForwardTree;
+  Statement mDeleteForwardDescendants;
+  Statement mMoveForward;
+  Statement mMoveForwardDescendants;
+  Statement mReplaceForward;
+  Statement mInsertReverse;
+  Statement mUpdateReverseOfDescendants;
+  Statement mDeleteForward;
+  Statement mDeleteReverse;
+  Statement mBegin;
+  Statement mCommit;
+  // paths resolve to themselves without a query while the database has never had a rename entry
+  std::atomic<bool> mHasRenames{false};
+  // changes in the open transaction; 0 if there is none
+  std::size_t mBatchChanges = 0;
+  std::chrono::steady_clock::time_point mBatchDeadline;
+  // the first error of a background commit; rethrown by every later change
+  std::exception_ptr mErrorN;
+  std::condition_variable mCv;
+  bool mStopping = false;
+  std::thread mFlushThread;
+
+  std::wstring FilenameToKey(std::wstring_view filename) const;
+  Statement Prepare(const char* sql);
+  void Execute(const char* sql);
+  void OpenDatabase();
+  void CloseDatabase() noexcept;
+  void StartFlushThread();
+  void StopFlushThread() noexcept;
+  void FlushMain();
+  void BeginChange();
+  void EndChange();
+  void CommitBatch();
+  std::optional<std::pair<std::size_t, std::wstring>> FindLongestMatchL(sqlite3_stmt* statement, std::wstring_view key) const;
+  std::optional<std::wstring> ResolveL(std::wstring_view filename) const;
+  std::vector<std::pair<std::wstring, std::wstring>> ListChildrenL(sqlite3_stmt* statement, std::wstring_view filename) const;
+  RenameStore::Result RenameL(std::wstring_view srcFilename, std::wstring_view destFilename);
+  bool RemoveRenameL(std::wstring_view filename);
+
+public:
+  MetadataSqliteBackend(const MetadataSqliteBackend&) = delete;
+
+  // opens or creates the database
+  MetadataSqliteBackend(std::wstring_view storeFilename, bool caseSensitive);
+  ~MetadataSqliteBackend() override;
+
+  bool Contains(const std::wstring& key) const override;
+  std::optional<Metadata> Find(const std::wstring& key) const override;
+  void Put(const std::wstring& key, const Metadata& metadata) override;
+  bool Erase(const std::wstring& key) override;
+  std::optional<std::wstring> Resolve(std::wstring_view filename) const override;
+  std::optional<bool> Exists(std::wstring_view filename) const override;
+  std::vector<std::pair<std::wstring, std::wstring>> ListChildrenInForwardLookupTree(std::wstring_view filename) const override;
+  std::vector<std::pair<std::wstring, std::wstring>> ListChildrenInReverseLookupTree(std::wstring_view filename) const override;
+  RenameStore::Result Rename(std::wstring_view srcFilename, std::wstring_view destFilename) override;
+  bool RemoveRename(std::wstring_view filename) override;
+  void MoveTo(std::wstring_view storeFilename) override;
+};
+
+#endif
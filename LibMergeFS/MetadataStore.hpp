@@ -1,38 +1,30 @@
 #pragma once
 
 #include "Metadata.hpp"
-#include "RenameStore.hpp"
+#include "MetadataBackend.hpp"
 
+#include <memory>
 #include <optional>
-#include <shared_mutex>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
-#include <Windows.h>
-
 
+// metadata and rename entries of a mount; the entries are stored by a MetadataBackend chosen by the format of the
+// store file (see MetadataConfig::NewStoreBackend), which also resolves paths through its rename entries
 class MetadataStore {
 public:
+  static constexpr auto SystemDataDirectory = L"\\$MergeFSSystemData";
   static constexpr auto RemovedPrefix = L"\\$MergeFSSystemData\\Removed";
 
 private:
   const bool mCaseSensitive;
-  HANDLE mHFile = NULL;
-  RenameStore mRenameStore;
-  std::unordered_map<std::wstring, Metadata> mMetadataMap;
+  // nullptr until SetFilePath is called; every path resolves to itself until then
+  std::unique_ptr<MetadataBackend> mBackendN;
 
   std::wstring FilenameToKey(std::wstring_view filename) const;
-  void LoadFromFile();
-  void LoadFromFileV1();
-  bool LoadFromFileV2();
-  void SaveToFile();
-  void AddRenameAppendix(std::wstring_view a, std::wstring_view b);
-  void AddRenameAppendix(std::wstring_view a);
-  void AddMetadataAppendix(std::wstring_view keyName, const Metadata& metadata);
-  void AddMetadataAppendix(std::wstring_view keyName);
+  std::unique_ptr<MetadataBackend> OpenBackend(std::wstring_view storeFilename);
 
 public:
   MetadataStore(const MetadataStore&) = delete;
@@ -45,8 +37,8 @@ public:
   std::optional<std::wstring> ResolveFilepath(std::wstring_view filename) const;
   bool HasMetadataR(std::wstring_view resolvedFilename) const;
   bool HasMetadata(std::wstring_view filename) const;
-  const Metadata& GetMetadataR(std::wstring_view resolvedFilename) const;
-  const Metadata& GetMetadata(std::wstring_view filename) const;
+  Metadata GetMetadataR(std::wstring_view resolvedFilename) const;
+  Metadata GetMetadata(std::wstring_view filename) const;
   Metadata GetMetadata2R(std::wstring_view resolvedFilename) const;
   Metadata GetMetadata2(std::wstring_view filename) const;
   void SetMetadataR(std::wstring_view resolvedFilename, const Metadata& metadata);
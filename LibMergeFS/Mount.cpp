@@ -3,16 +3,25 @@
 #include "Mount.hpp"
 #include "NsError.hpp"
 #include "Util.hpp"
+#include "CacheConfig.hpp"
 #include "DokanConfig.hpp"
 #include "DokanOperations.hpp"
+#include "OverlayConfig.hpp"
+#include "ParallelConfig.hpp"
+#include "PresenceFilterConfig.hpp"
+#include "ReadAheadConfig.hpp"
+#include "TransportConfig.hpp"
 
 #include "../Util/VirtualFs.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <future>
 #include <ios>
 #include <limits>
 #include <map>
@@ -24,6 +33,8 @@
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -31,11 +42,6 @@ using namespace std::literals;
 
 
 
-std::shared_mutex Mount::gFileContextMapMutex;
-std::unordered_map<Mount::FileContext*, std::shared_ptr<Mount::FileContext>> Mount::gFileContextPtrToSharedPtrMap;
-
-
-
 namespace {
   template<typename T>
   NTSTATUS WrapException(const T& func) noexcept {
@@ -99,6 +105,30 @@ namespace {
 
     return fileIndexBases;
   }
+
+
+  // only sources which neither change nor are written through this mount can be cached
+  std::vector<std::optional<std::uint64_t>> CreateBlockCacheNamespaces(BlockCache& blockCache, const std::vector<std::unique_ptr<MountSource>>& mountSources) {
+    std::vector<std::optional<std::uint64_t>> namespaces(mountSources.size());
+    if (!blockCache.IsEnabled()) {
+      return namespaces;
+    }
+    for (std::size_t index = 0; index < mountSources.size(); index++) {
+      const auto& sourceInfo = mountSources[index]->GetSourceInfo();
+      if (sourceInfo.cacheable && !sourceInfo.writable) {
+        namespaces[index] = blockCache.NewNamespace();
+      }
+    }
+    return namespaces;
+  }
+
+
+  std::vector<std::unique_ptr<MountSource>> AttachTraceRecorder(TraceRecorder& traceRecorder, std::vector<std::unique_ptr<MountSource>>&& mountSources) noexcept {
+    for (std::size_t index = 0; index < mountSources.size(); index++) {
+      mountSources[index]->AttachTraceRecorder(traceRecorder, index);
+    }
+    return std::move(mountSources);
+  }
 }
 
 
@@ -115,6 +145,35 @@ int Mount::DokanMainError::GetError() const {
 
 
 
+void Mount::CopyUpJob::Progress(ULONGLONG newCopiedBytes) {
+  {
+    std::lock_guard lock(mutex);
+    copiedBytes = newCopiedBytes;
+  }
+  cv.notify_all();
+}
+
+
+void Mount::CopyUpJob::Complete(NTSTATUS result) {
+  {
+    std::lock_guard lock(mutex);
+    status = result;
+    finished = true;
+  }
+  cv.notify_all();
+}
+
+
+// waits until [0, requiredBytes) has been copied or the copy-up has finished (either way)
+void Mount::CopyUpJob::Wait(ULONGLONG requiredBytes) {
+  std::unique_lock lock(mutex);
+  cv.wait(lock, [this, requiredBytes]() {
+    return finished || copiedBytes >= requiredBytes;
+  });
+}
+
+
+
 NTSTATUS Mount::FileContext::UpdateLastAccessTime() {
   if (writable || !autoUpdateLastAccessTime) {
     return STATUS_SUCCESS;
@@ -134,6 +193,7 @@ NTSTATUS Mount::FileContext::UpdateLastAccessTime() {
     metadata.lastAccessTime = currentFiletime;
     mount.m_metadataStore.SetMetadataR(resolvedFilename, metadata);
   }
+  mount.m_listingCache.InvalidateParent(filename);
 
   return STATUS_SUCCESS;
 }
@@ -158,6 +218,7 @@ NTSTATUS Mount::FileContext::UpdateLastWriteTime() {
     metadata.lastWriteTime = currentFiletime;
     mount.m_metadataStore.SetMetadataR(resolvedFilename, metadata);
   }
+  mount.m_listingCache.InvalidateParent(filename);
 
   return STATUS_SUCCESS;
 }
@@ -180,11 +241,12 @@ std::shared_ptr<Mount::FileContext> Mount::GetFileContextSharedPtr(PDOKAN_FILE_I
   if (!ptrFileContext) {
     throw NsError(STATUS_INVALID_HANDLE);
   }
-  std::shared_lock lock(gFileContextMapMutex);
-  if (!gFileContextPtrToSharedPtrMap.count(ptrFileContext)) {
+  // the owner is m_fileContextTable, which keeps it alive until CloseFile
+  auto spFileContext = ptrFileContext->weakThis.lock();
+  if (!spFileContext) {
     throw NsError(STATUS_INVALID_HANDLE);
   }
-  return gFileContextPtrToSharedPtrMap.at(ptrFileContext);
+  return spFileContext;
 }
 #else
 Mount::FileContext* Mount::GetFileContextSharedPtr(PDOKAN_FILE_INFO DokanFileInfo) {
@@ -204,7 +266,13 @@ Mount::FileContext& Mount::GetFileContext(PDOKAN_FILE_INFO DokanFileInfo) {
 //*/
 
 
-NTSTATUS Mount::TransportR(std::wstring_view path, bool empty, FILE_CONTEXT_ID fileContextId, MountSource& source, MountSource& destination) {
+const Mount::TransportOptions Mount::DefaultTransportOptions{
+  TransportConfig::BufferSize,
+  TransportConfig::NativeCopyEnabled,
+};
+
+
+NTSTATUS Mount::TransportR(std::wstring_view path, bool empty, FILE_CONTEXT_ID fileContextId, MountSource& source, MountSource& destination, const TransportOptions& transportOptions, CopyUpJob* ptrCopyUpJob) {
   const std::wstring sPath(path);
   const auto csPath = sPath.c_str();
 
@@ -213,18 +281,38 @@ NTSTATUS Mount::TransportR(std::wstring_view path, bool empty, FILE_CONTEXT_ID f
     fileContextId,
     empty ? TRUE : FALSE,
   };
+  portationInfo.bufferSize = transportOptions.bufferSize;
 
   if (const auto status = source.ExportStart(&portationInfo); status != STATUS_SUCCESS) {
     return status;
   }
 
+  if (!transportOptions.nativeCopy) {
+    portationInfo.nativeHandle = NULL;
+  }
+
   if (const auto status = destination.ImportStart(&portationInfo); status != STATUS_SUCCESS) {
     source.ExportFinish(&portationInfo, false);
     return status;
   }
 
-  if (!empty && !portationInfo.directory) {
+  if (ptrCopyUpJob) {
+    ptrCopyUpJob->totalBytes = portationInfo.fileSize.QuadPart;
+  }
+
+  if (portationInfo.dataImported) {
+    // the importer has copied the data from nativeHandle
+    if (ptrCopyUpJob) {
+      ptrCopyUpJob->Progress(portationInfo.fileSize.QuadPart);
+    }
+  } else if (!empty && !portationInfo.directory) {
     while (true) {
+      if (ptrCopyUpJob && ptrCopyUpJob->cancelRequested) {
+        source.ExportFinish(&portationInfo, false);
+        destination.ImportFinish(&portationInfo, false);
+        return STATUS_CANCELLED;
+      }
+
       const auto statusS = source.ExportData(&portationInfo);
       if (statusS == STATUS_ALREADY_COMPLETE) {
         break;
@@ -236,8 +324,14 @@ NTSTATUS Mount::TransportR(std::wstring_view path, bool empty, FILE_CONTEXT_ID f
       }
 
       if (const auto statusD = destination.ImportData(&portationInfo); statusD != STATUS_SUCCESS) {
+        source.ExportFinish(&portationInfo, false);
+        destination.ImportFinish(&portationInfo, false);
         return statusD;
       }
+
+      if (ptrCopyUpJob) {
+        ptrCopyUpJob->Progress(portationInfo.currentOffset.QuadPart + portationInfo.currentSize);
+      }
     }
   }
 
@@ -259,47 +353,74 @@ std::wstring Mount::FilenameToKey(std::wstring_view filename) const {
 }
 
 
-Mount::Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, std::vector<std::unique_ptr<MountSource>>&& sources, std::function<void(Mount&, int)> callback) :
+Mount::Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, const ReadAheadOptions& readAheadOptions, const DokanTuningOptions& dokanTuningOptions, bool headless, BlockCache& blockCache, std::vector<std::unique_ptr<MountSource>>&& sources, std::function<void(Mount&, int)> callback) :
   m_imdMutex(),
   m_imdCv(),
   m_imdState(ImdState::Pending),
   m_imdResult(DOKAN_SUCCESS),
-  m_mutex(),
+  m_headlessUnmountRequested(false),
   m_metadataMutex(),
   m_mountPoint(mountPoint),
-  m_mountSources(std::move(sources)),
+  m_traceRecorder(),
+  m_mountSources(AttachTraceRecorder(m_traceRecorder, std::move(sources))),
   m_topSource(*m_mountSources[0].get()),
   m_writable(writable && m_topSource.GetSourceInfo().writable),
   m_metadataFileName(m_writable ? metadataFileName : L""sv),
   m_deferCopyEnabled(deferCopyEnabled),
   m_caseSensitive(caseSensitive),
   m_volumeInfoOverride(volumeInfoOverride),
+  m_readAheadOptions(readAheadOptions),
   m_metadataStore(m_metadataFileName, caseSensitive),
-  m_fileContextMap(),
-  m_minimumUnusedFileContextId(FileContextIdStart),
+  m_extentStoreMutex(),
+  m_extentStore(OverlayConfig::Enabled && !m_metadataFileName.empty() ? m_metadataFileName + L".extents"s : L""s, caseSensitive),
+  m_overlayMutex(),
+  m_openOverlays(),
+  m_nextInternalFileContextId(1),
+  m_lookupCache(caseSensitive, CacheConfig::LookupCacheMaxEntries, CacheConfig::LookupCacheTtl),
+  m_listingCache(caseSensitive, CacheConfig::ListingCacheMaxBytes, CacheConfig::ListingCacheTtl),
+  m_blockCache(blockCache),
+  m_blockCacheNamespaces(CreateBlockCacheNamespaces(m_blockCache, m_mountSources)),
+  m_fileContextTable(),
   m_fileIndexBases(CalcFileIndexBases(m_mountSources.size())),
+  m_workerPool(std::min(ParallelConfig::MaxWorkerThreads, m_mountSources.size() - 1)),
+  m_presenceFilterPool(PresenceFilterConfig::Enabled ? PresenceFilterConfig::BuildThreads : 0),
+  m_copyUpMutex(),
+  m_copyUpJobs(),
+  m_copyUpStatistics(),
+  m_copyUpPool(m_writable && m_deferCopyEnabled ? ParallelConfig::CopyUpThreads : 0),
+  m_operationStatistics(MountOperation{}),
+  m_readAheadBudget(m_readAheadOptions.memoryBudget),
+  m_readAheadPool(m_readAheadOptions.enabled && m_mountSources.size() > 1 ? ReadAheadConfig::Threads : 0),
+  m_dokanTuningOptions(dokanTuningOptions),
+  m_concurrencyLimiter(m_dokanTuningOptions.autoConcurrency, m_dokanTuningOptions.minConcurrency, m_dokanTuningOptions.maxConcurrency),
+  m_headless(headless),
   m_thread([this, callback]() {
-    // TODO: make customizable
-    ULONG options = DokanConfig::Options;
+    int ret = DOKAN_SUCCESS;
+    if (m_headless) {
+      ret = HeadlessMain();
+    } else {
+      // TODO: make options customizable
+      ULONG options = DokanConfig::Options;
 #ifdef _DEBUG
-    options |= DOKAN_OPTION_DEBUG;
+      options |= DOKAN_OPTION_DEBUG;
 #endif
-    if (!m_writable) {
-      options |= DOKAN_OPTION_WRITE_PROTECT;
-    }
-    DOKAN_OPTIONS config = {
-      DokanConfig::Version,
-      DokanConfig::ThreadCount,
-      options,
-      GetGlobalContextFromMount(this),
-      m_mountPoint.c_str(),
-      nullptr,
-      DokanConfig::Timeout,
-      DokanConfig::AllocationUnitSize,
-      DokanConfig::SectorSize,
-    };
-    DOKAN_OPERATIONS operations = gDokanOperations;
-    const auto ret = DokanMain(&config, &operations);
+      if (!m_writable) {
+        options |= DOKAN_OPTION_WRITE_PROTECT;
+      }
+      DOKAN_OPTIONS config = {
+        DokanConfig::Version,
+        m_dokanTuningOptions.threadCount,
+        options,
+        GetGlobalContextFromMount(this),
+        m_mountPoint.c_str(),
+        nullptr,
+        m_dokanTuningOptions.timeout,
+        m_dokanTuningOptions.allocationUnitSize,
+        m_dokanTuningOptions.sectorSize,
+      };
+      DOKAN_OPERATIONS operations = gDokanOperations;
+      ret = DokanMain(&config, &operations);
+    }
     
     bool callCallback = false;
     {
@@ -325,14 +446,41 @@ Mount::Mount(std::wstring_view mountPoint, bool writable, std::wstring_view meta
   if (m_imdState == ImdState::Finished) {
     assert(m_imdResult != DOKAN_SUCCESS);
     m_thread.join();
+    for (const auto& namespaceIdN : m_blockCacheNamespaces) {
+      if (namespaceIdN) {
+        m_blockCache.RemoveNamespace(namespaceIdN.value());
+      }
+    }
     throw DokanMainError(m_imdResult);
   }
+  lock.unlock();
+
+  // immutable sources never change; the top source of a writable mount changes only through this mount, which keeps its filter up to date
+  if (PresenceFilterConfig::Enabled) {
+    for (std::size_t index = 0; index < m_mountSources.size(); index++) {
+      auto& mountSource = *m_mountSources[index];
+      const auto& sourceInfo = mountSource.GetSourceInfo();
+      const bool immutable = sourceInfo.cacheable && !sourceInfo.writable;
+      const bool maintained = index == TopSourceIndex && m_writable && PresenceFilterConfig::FilterWritableTopSource;
+      if (!immutable && !maintained) {
+        continue;
+      }
+      m_presenceFilterPool.Submit([&mountSource, caseSensitive = m_caseSensitive, maintained]() {
+        mountSource.BuildPresenceFilter(caseSensitive, maintained);
+      });
+    }
+  }
 }
 
 
 Mount::~Mount() {
   Unmount();
 
+  // m_presenceFilterPool waits for the builds when it is destroyed
+  for (auto& mountSource : m_mountSources) {
+    mountSource->CancelPresenceFilterBuild();
+  }
+
   {
     std::unique_lock lock(m_imdMutex);
     m_imdCv.wait(lock, [this]() {
@@ -341,6 +489,33 @@ Mount::~Mount() {
   }
 
   m_thread.join();
+
+  // file contexts should have been closed by now; do not keep copying files nobody can reach
+  {
+    std::lock_guard lock(m_copyUpMutex);
+    for (auto& [fileContextId, spCopyUpJob] : m_copyUpJobs) {
+      spCopyUpJob->cancelRequested = true;
+    }
+  }
+
+  // likewise; save extent maps of overlays which somehow remain open
+  {
+    std::lock_guard lock(m_overlayMutex);
+    for (auto& [key, wpOverlay] : m_openOverlays) {
+      if (const auto spOverlay = wpOverlay.lock()) {
+        std::lock_guard overlayLock(spOverlay->mutex);
+        CloseOverlayL(*spOverlay);
+      }
+    }
+    m_openOverlays.clear();
+  }
+
+  // the cache is shared with other mounts; nothing can read these blocks any more
+  for (const auto& namespaceIdN : m_blockCacheNamespaces) {
+    if (namespaceIdN) {
+      m_blockCache.RemoveNamespace(namespaceIdN.value());
+    }
+  }
 }
 
 
@@ -349,12 +524,122 @@ bool Mount::IsWritable() const {
 }
 
 
+bool Mount::IsHeadless() const {
+  return m_headless;
+}
+
+
+LookupCache::Statistics Mount::GetLookupCacheStatistics() const {
+  return m_lookupCache.GetStatistics();
+}
+
+
+ListingCache::Statistics Mount::GetListingCacheStatistics() const {
+  return m_listingCache.GetStatistics();
+}
+
+
+Mount::CopyUpStatistics Mount::GetCopyUpStatistics() const {
+  std::lock_guard lock(m_copyUpMutex);
+  auto statistics = m_copyUpStatistics;
+  for (const auto& [fileContextId, spCopyUpJob] : m_copyUpJobs) {
+    if (spCopyUpJob->finished) {
+      continue;
+    }
+    statistics.numActive++;
+    statistics.activeCopiedBytes += spCopyUpJob->copiedBytes;
+    statistics.activeTotalBytes += spCopyUpJob->totalBytes;
+  }
+  return statistics;
+}
+
+
+const OperationStatistics& Mount::GetOperationStatistics() const {
+  return m_operationStatistics;
+}
+
+
+std::vector<OperationStatistics::Entry> Mount::GetSourceOperationStatistics(std::size_t sourceIndex) const {
+  return m_mountSources.at(sourceIndex)->GetOperationStatistics().Get();
+}
+
+
+MountSource::PresenceFilterStatistics Mount::GetPresenceFilterStatistics(std::size_t sourceIndex) const {
+  return m_mountSources.at(sourceIndex)->GetPresenceFilterStatistics();
+}
+
+
+TraceRecorder& Mount::GetTraceRecorder() {
+  return m_traceRecorder;
+}
+
+
+ConcurrencyLimiter& Mount::GetConcurrencyLimiter() {
+  return m_concurrencyLimiter;
+}
+
+
+void Mount::StartTrace(std::size_t maxEvents) {
+  m_traceRecorder.Start(maxEvents);
+}
+
+
+void Mount::StopTrace() {
+  m_traceRecorder.Stop();
+}
+
+
+void Mount::SaveTrace(std::wstring_view filepath) const {
+  m_traceRecorder.SaveChromeTrace(filepath, m_mountPoint);
+}
+
+
+// copies a lower-layer file to the top source as CopyFileToTopSourceR does, with the given transport options
+// for OperationReplay, which measures the copy-up throughput; large files are otherwise overlaid rather than copied up
+// returns the size of the copied file, or std::nullopt if the file is not in a lower layer or has an overlay
+std::optional<ULONGLONG> Mount::CopyUpForReplay(std::wstring_view filename, const TransportOptions& transportOptions) {
+  if (!m_writable) {
+    throw NsError(STATUS_MEDIA_WRITE_PROTECTED);
+  }
+
+  const auto resolvedFilenameN = ResolveFilepathN(filename);
+  if (!resolvedFilenameN) {
+    return std::nullopt;
+  }
+  const auto& resolvedFilename = resolvedFilenameN.value();
+
+  const auto [sourceIndex, fileType] = LookupR(resolvedFilename);
+  if (!sourceIndex || sourceIndex == TopSourceIndex || fileType == FileType::Directory) {
+    return std::nullopt;
+  }
+  // the written ranges of an overlaid file are not in its source, so copying it would lose them
+  if (CanOverlayR(resolvedFilename, sourceIndex.value(), false)) {
+    return std::nullopt;
+  }
+
+  WIN32_FILE_ATTRIBUTE_DATA win32FileAttributeData;
+  if (const auto status = m_mountSources[sourceIndex.value()]->GetFileInfo(resolvedFilename.c_str(), &win32FileAttributeData); status != STATUS_SUCCESS) {
+    throw NsError(status);
+  }
+
+  ExecuteCopyUpPlanR(PlanCopyUpR({resolvedFilename}, false), false, transportOptions);
+  return (static_cast<ULONGLONG>(win32FileAttributeData.nFileSizeHigh) << 32) | win32FileAttributeData.nFileSizeLow;
+}
+
+
 bool Mount::SafeUnmount() {
   {
     std::lock_guard lock(m_imdMutex);
     if (m_imdState != ImdState::Mounting) {
       return true;
     }
+    if (m_headless) {
+      m_headlessUnmountRequested = true;
+    }
+  }
+  if (m_headless) {
+    m_imdCv.notify_all();
+    return true;
   }
   if (!DokanRemoveMountPoint(m_mountPoint.c_str())) {
     return false;
@@ -369,6 +654,13 @@ bool Mount::Unmount() {
     if (m_imdState != ImdState::Mounting) {
       return true;
     }
+    if (m_headless) {
+      m_headlessUnmountRequested = true;
+    }
+  }
+  if (m_headless) {
+    m_imdCv.notify_all();
+    return true;
   }
 #if DOKAN_VERSION >= 200
   if (!DokanRemoveMountPointEx(m_mountPoint.c_str(), FALSE)) {
@@ -381,6 +673,35 @@ bool Mount::Unmount() {
 }
 
 
+// stands in for DokanMain on a headless mount: the volume counts as mounted until Unmount is called
+int Mount::HeadlessMain() {
+  DOKAN_OPTIONS config{
+    DokanConfig::Version,
+    m_dokanTuningOptions.threadCount,
+    static_cast<ULONG>(DokanConfig::Options | (m_writable ? 0 : DOKAN_OPTION_WRITE_PROTECT)),
+    GetGlobalContextFromMount(this),
+    m_mountPoint.c_str(),
+    nullptr,
+    m_dokanTuningOptions.timeout,
+    m_dokanTuningOptions.allocationUnitSize,
+    m_dokanTuningOptions.sectorSize,
+  };
+  DOKAN_FILE_INFO fileInfo{};
+  fileInfo.DokanOptions = &config;
+  gDokanOperations.Mounted(&fileInfo);
+
+  {
+    std::unique_lock lock(m_imdMutex);
+    m_imdCv.wait(lock, [this]() {
+      return m_headlessUnmountRequested;
+    });
+  }
+
+  gDokanOperations.Unmounted(&fileInfo);
+  return DOKAN_SUCCESS;
+}
+
+
 std::optional<std::wstring> Mount::ResolveFilepathN(std::wstring_view filename) {
   return m_metadataStore.ResolveFilepath(filename);
 }
@@ -395,40 +716,202 @@ std::wstring Mount::ResolveFilepath(std::wstring_view filename) {
 }
 
 
-std::optional<std::size_t> Mount::GetMountSourceIndexR(std::wstring_view resolvedFilename) {
-  if (util::vfs::IsRootDirectory(resolvedFilename)) {
-    return TopSourceIndex;
-  }
+// looks up the given paths without consulting the cache for them, together with their ancestors which are not cached yet
+// all of them are probed at once with one GetFileTypes call per source, instead of one GetFileType call per path and source;
+// the results of all probed paths are cached
+std::vector<LookupCache::Entry> Mount::LookupNoCacheR(const std::vector<std::wstring_view>& resolvedFilenames) {
+  constexpr LookupCache::Entry InexistentEntry{std::nullopt, FileType::Inexistent};
+  constexpr LookupCache::Entry RootEntry{TopSourceIndex, FileType::Directory};
+  constexpr std::size_t NoParent = std::numeric_limits<std::size_t>::max();
+
+  struct Node {
+    std::wstring resolvedFilename;
+    std::size_t parent;                 // index in nodes; NoParent if the entry of the parent directory is known (parentEntry)
+    LookupCache::Entry parentEntry;
+    bool deleted;
+    std::uint64_t generation;
+  };
+
+  const auto isDirectory = [](const LookupCache::Entry& entry) noexcept {
+    return entry.sourceIndex && entry.fileType == FileType::Directory;
+  };
 
-  // 祖先ディレクトリの正当性を確認する
+  // 対象のパスと、キャッシュに無い祖先ディレクトリを集める
   // 祖先ディレクトリがここより優先度の高いソースにおいてファイルとして存在しているか、
-  // メタデータにより削除済みとマークされている場合は対象のオブジェクトは存在しない
-  // ここでは直属の親ディレクトリに対してGetMountSourceIndexを呼び出して確認することで再帰的にチェックしている
-  const std::wstring parentFilename(util::vfs::GetParentPath(resolvedFilename));
-  const auto index = GetMountSourceIndexR(parentFilename);
-  if (!index || m_mountSources[index.value()]->GetFileType(parentFilename.c_str()) != FileType::Directory) {
-    return std::nullopt;
+  // メタデータにより削除済みとマークされている場合は対象のオブジェクトは存在しないので、祖先も合わせて確認する必要がある
+  // キャッシュされている祖先より上は確認済みなので辿らない
+  std::vector<Node> nodes;
+  std::unordered_map<std::wstring, std::size_t> nodeMap;
+  std::vector<std::size_t> targetNodeIndices(resolvedFilenames.size(), NoParent);
+  for (std::size_t i = 0; i < resolvedFilenames.size(); i++) {
+    std::size_t child = NoParent;
+    for (auto path = resolvedFilenames[i]; ; path = util::vfs::GetParentPath(path)) {
+      const bool isTarget = child == NoParent;
+      std::optional<LookupCache::Entry> knownEntry;
+      if (util::vfs::IsRootDirectory(path)) {
+        knownEntry = RootEntry;
+      } else if (auto itr = nodeMap.find(FilenameToKey(path)); itr != nodeMap.end()) {
+        if (isTarget) {
+          targetNodeIndices[i] = itr->second;
+        } else {
+          nodes[child].parent = itr->second;
+        }
+        break;
+      } else if (!isTarget) {
+        knownEntry = m_lookupCache.Get(path);
+      }
+
+      if (knownEntry) {
+        if (!isTarget) {
+          nodes[child].parentEntry = knownEntry.value();
+        }
+        break;
+      }
+
+      const auto index = nodes.size();
+      // 問い合わせ中にそのパスか祖先が無効化された場合に古い結果を登録しないよう、問い合わせ前の世代を渡す
+      nodes.push_back(Node{std::wstring(path), NoParent, InexistentEntry, false, m_lookupCache.GetGeneration(path)});
+      nodeMap.emplace(FilenameToKey(path), index);
+      if (isTarget) {
+        targetNodeIndices[i] = index;
+      } else {
+        nodes[child].parent = index;
+      }
+      child = index;
+    }
   }
 
-  // メタデータにより削除済みとマークされている場合は存在しない
+  // メタデータにより削除済みとマークされているものは存在しない
   {
     std::shared_lock lock(m_metadataMutex);
-    if (!m_metadataStore.ExistsR(resolvedFilename)) {
-      return std::nullopt;
+    for (auto& node : nodes) {
+      node.deleted = !m_metadataStore.ExistsR(node.resolvedFilename);
     }
   }
 
-  // それ以外の場合、一番上位のソースに存在するものを探す
-  const std::wstring sResolvedFilename(resolvedFilename);
+  // 上位のソースから順に、まだ見つかっていないものをまとめて問い合わせる
+  // 見つかった時点でそのパスの結果は確定するので、ファイルとして見つかったものの子孫や削除済みのものの子孫は以降問い合わせない
+  std::vector<std::optional<LookupCache::Entry>> foundEntries(nodes.size());
+  const auto isExcluded = [&nodes, &foundEntries, &isDirectory](const auto& self, std::size_t index) -> bool {
+    const auto& node = nodes[index];
+    if (node.deleted) {
+      return true;
+    }
+    if (node.parent == NoParent) {
+      return !isDirectory(node.parentEntry);
+    }
+    if (const auto& parentEntryN = foundEntries[node.parent]; parentEntryN && parentEntryN->fileType != FileType::Directory) {
+      return true;
+    }
+    return self(self, node.parent);
+  };
+
+  std::vector<std::size_t> pendingIndices;
+  std::vector<LPCWSTR> pendingFilenames;
+  std::vector<FileType> fileTypes;
   for (std::size_t i = 0; i < m_mountSources.size(); i++) {
-    const auto& mountSource = *m_mountSources[i];
-    if (mountSource.GetFileType(sResolvedFilename.c_str()) != FileType::Inexistent) {
-      return i;
+    pendingIndices.clear();
+    pendingFilenames.clear();
+    auto& mountSource = *m_mountSources[i];
+    bool anyPending = false;
+    for (std::size_t j = 0; j < nodes.size(); j++) {
+      if (!foundEntries[j] && !isExcluded(isExcluded, j)) {
+        anyPending = true;
+        // 親ディレクトリが存在しないことが分かっているソースには問い合わせない
+        if (mountSource.MayExist(nodes[j].resolvedFilename)) {
+          pendingIndices.push_back(j);
+          pendingFilenames.push_back(nodes[j].resolvedFilename.c_str());
+        }
+      }
     }
+    if (!anyPending) {
+      break;
+    }
+    if (pendingIndices.empty()) {
+      continue;
+    }
+
+    fileTypes.resize(pendingIndices.size());
+    mountSource.GetFileTypes(pendingFilenames.data(), pendingFilenames.size(), fileTypes.data());
+    std::size_t numMisses = 0;
+    for (std::size_t k = 0; k < pendingIndices.size(); k++) {
+      if (fileTypes[k] != FileType::Inexistent) {
+        foundEntries[pendingIndices[k]] = LookupCache::Entry{i, fileTypes[k]};
+      } else {
+        numMisses++;
+      }
+    }
+    mountSource.RecordPresenceFilterMisses(numMisses);
   }
 
-  // 見つからなかった
-  return std::nullopt;
+  // 親から順に確定させる
+  std::vector<std::optional<LookupCache::Entry>> nodeEntries(nodes.size());
+  const auto resolveEntry = [&nodes, &foundEntries, &nodeEntries, &isDirectory, InexistentEntry](const auto& self, std::size_t index) -> LookupCache::Entry {
+    if (nodeEntries[index]) {
+      return nodeEntries[index].value();
+    }
+    const auto& node = nodes[index];
+    const auto parentEntry = node.parent == NoParent ? node.parentEntry : self(self, node.parent);
+    const auto entry = !node.deleted && isDirectory(parentEntry) && foundEntries[index] ? foundEntries[index].value() : InexistentEntry;
+    nodeEntries[index] = entry;
+    return entry;
+  };
+
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    m_lookupCache.Set(nodes[i].resolvedFilename, resolveEntry(resolveEntry, i), nodes[i].generation);
+  }
+
+  std::vector<LookupCache::Entry> entries;
+  entries.reserve(resolvedFilenames.size());
+  for (const auto index : targetNodeIndices) {
+    entries.push_back(index == NoParent ? RootEntry : nodeEntries[index].value());
+  }
+  return entries;
+}
+
+
+LookupCache::Entry Mount::LookupR(std::wstring_view resolvedFilename) {
+  if (util::vfs::IsRootDirectory(resolvedFilename)) {
+    return LookupCache::Entry{TopSourceIndex, FileType::Directory};
+  }
+
+  if (const auto cachedEntry = m_lookupCache.Get(resolvedFilename)) {
+    return cachedEntry.value();
+  }
+
+  return LookupNoCacheR(std::vector<std::wstring_view>{resolvedFilename}).front();
+}
+
+
+// looks up the paths which are not cached in one go (see LookupNoCacheR)
+std::vector<LookupCache::Entry> Mount::LookupR(const std::vector<std::wstring_view>& resolvedFilenames) {
+  std::vector<LookupCache::Entry> entries(resolvedFilenames.size());
+  std::vector<std::size_t> missedIndices;
+  std::vector<std::wstring_view> missedFilenames;
+  for (std::size_t i = 0; i < resolvedFilenames.size(); i++) {
+    const auto resolvedFilename = resolvedFilenames[i];
+    if (util::vfs::IsRootDirectory(resolvedFilename)) {
+      entries[i] = LookupCache::Entry{TopSourceIndex, FileType::Directory};
+    } else if (const auto cachedEntry = m_lookupCache.Get(resolvedFilename)) {
+      entries[i] = cachedEntry.value();
+    } else {
+      missedIndices.push_back(i);
+      missedFilenames.push_back(resolvedFilename);
+    }
+  }
+
+  if (!missedFilenames.empty()) {
+    const auto missedEntries = LookupNoCacheR(missedFilenames);
+    for (std::size_t i = 0; i < missedIndices.size(); i++) {
+      entries[missedIndices[i]] = missedEntries[i];
+    }
+  }
+  return entries;
+}
+
+
+std::optional<std::size_t> Mount::GetMountSourceIndexR(std::wstring_view resolvedFilename) {
+  return LookupR(resolvedFilename).sourceIndex;
 }
 
 
@@ -447,15 +930,9 @@ bool Mount::FileExists(std::wstring_view filename) {
 
 
 Mount::FileType Mount::GetFileTypeR(std::wstring_view resolvedFilename) {
-  if (util::vfs::IsRootDirectory(resolvedFilename)) {
-    return FileType::Directory;
-  }
-  const auto index = GetMountSourceIndexR(resolvedFilename);
-  if (!index) {
-    return FileType::Inexistent;
-  }
-  const std::wstring sResolvedFilename(resolvedFilename);
-  return m_mountSources[index.value()]->GetFileType(sResolvedFilename.c_str());
+  return m_traceRecorder.Trace(TraceCategory::Internal, L"GetFileTypeR", TraceRecorder::NoSourceIndex, resolvedFilename, [&]() {
+    return LookupR(resolvedFilename).fileType;
+  });
 }
 
 
@@ -468,59 +945,139 @@ Mount::FileType Mount::GetFileType(std::wstring_view filename) {
 }
 
 
-void Mount::CopyFileToTopSourceR(std::wstring_view resolvedFilename, bool empty, FILE_CONTEXT_ID fileContextId) {
-  if (!m_writable) {
-    throw NsError(STATUS_MEDIA_WRITE_PROTECTED);
-  }
+// resolves the ancestor chain of each file once, bottom-up, stopping at the first ancestor which is already in the top source
+// ancestors shared by several files are planned only once
+// files which are already in the top source are skipped if skipExisting, otherwise STATUS_OBJECT_NAME_COLLISION is thrown
+Mount::CopyUpPlan Mount::PlanCopyUpR(const std::vector<std::wstring>& resolvedFilenames, bool skipExisting) {
+  CopyUpPlan plan;
+  std::unordered_set<std::wstring> plannedDirectories;
+  std::vector<CopyUpPlan::Transport> chain;
 
-  /*
-  if (fileContextId != FILE_CONTEXT_ID_NULL) {
-    const auto sourceIndex = GetMountSourceIndexR(resolvedFilename);
-    if (sourceIndex == TopSourceIndex) {
-      const auto status = TransportR(resolvedFilename, empty, fileContextId, source, m_topSource);
-      if (status != STATUS_SUCCESS) {
-        throw NsError(status);
-      }
-      return;
+  // 対象と祖先をまとめて問い合わせておく
+  const auto entries = LookupR(std::vector<std::wstring_view>(resolvedFilenames.cbegin(), resolvedFilenames.cend()));
+
+  for (std::size_t i = 0; i < resolvedFilenames.size(); i++) {
+    const auto& resolvedFilename = resolvedFilenames[i];
+    if (plannedDirectories.count(resolvedFilename)) {
+      continue;
     }
-  }
-  //*/
-  
-  std::size_t offset = 0;
-  std::size_t firstCreation = 0;
-  try {
-    do {
-      offset = resolvedFilename.find_first_of(L'\\', offset + 1);
 
-      auto path = resolvedFilename.substr(0, offset);
+    const auto& entry = entries[i];
+    if (!entry.sourceIndex) {
+      throw NsError(STATUS_OBJECT_NAME_NOT_FOUND);
+    }
+    if (entry.sourceIndex == TopSourceIndex) {
+      if (!skipExisting) {
+        throw NsError(STATUS_OBJECT_NAME_COLLISION);
+      }
+      continue;
+    }
 
-      const auto sourceIndex = GetMountSourceIndexR(path);
+    // 親から順に作成する必要があるので、下から集めて逆順に追加する
+    // TopSourceに存在するディレクトリの祖先は全てTopSourceに存在するので、そこで打ち切る
+    chain.clear();
+    for (auto path = util::vfs::GetParentPath(resolvedFilename); !util::vfs::IsRootDirectory(path); path = util::vfs::GetParentPath(path)) {
+      const std::wstring sPath(path);
+      if (plannedDirectories.count(sPath)) {
+        break;
+      }
+      const auto sourceIndex = GetMountSourceIndexR(sPath);
       if (!sourceIndex) {
         throw NsError(STATUS_OBJECT_NAME_NOT_FOUND);
       }
       if (sourceIndex == TopSourceIndex) {
-        if (offset == std::wstring_view::npos) {
-          offset = 0;
-          throw NsError(STATUS_OBJECT_NAME_COLLISION);
-        }
-        continue;
+        break;
       }
+      chain.push_back(CopyUpPlan::Transport{sPath, sourceIndex.value(), FILE_CONTEXT_ID_NULL});
+    }
+    for (auto itr = chain.rbegin(); itr != chain.rend(); itr++) {
+      plannedDirectories.emplace(itr->resolvedFilename);
+      plan.directories.push_back(std::move(*itr));
+    }
 
-      if (!firstCreation) {
-        firstCreation = offset;
-      }
+    if (entry.fileType == FileType::Directory) {
+      plannedDirectories.emplace(resolvedFilename);
+      plan.directories.push_back(CopyUpPlan::Transport{resolvedFilename, entry.sourceIndex.value(), FILE_CONTEXT_ID_NULL});
+    } else {
+      plan.files.push_back(CopyUpPlan::Transport{resolvedFilename, entry.sourceIndex.value(), FILE_CONTEXT_ID_NULL});
+    }
+  }
 
-      auto& source = *m_mountSources.at(sourceIndex.value());
+  return plan;
+}
 
-      const auto status = TransportR(path, empty, fileContextId, source, m_topSource);
-      if (status != STATUS_SUCCESS) {
-        throw NsError(status);
-      }
-    } while (offset != std::wstring_view::npos);
+
+// creates the directories in order, then transports the files concurrently on m_workerPool
+void Mount::ExecuteCopyUpPlanR(const CopyUpPlan& plan, bool empty, const TransportOptions& transportOptions) {
+  const auto transport = [this, empty, &transportOptions](const CopyUpPlan::Transport& plannedTransport, bool directory) -> NTSTATUS {
+    auto& source = *m_mountSources.at(plannedTransport.sourceIndex);
+    const auto status = m_traceRecorder.Trace(TraceCategory::Internal, L"TransportR", static_cast<std::uint32_t>(plannedTransport.sourceIndex), plannedTransport.resolvedFilename.c_str(), [&]() {
+      return WrapException([&]() -> NTSTATUS {
+        return TransportR(plannedTransport.resolvedFilename, directory || empty, plannedTransport.fileContextId, source, m_topSource, transportOptions);
+      });
+    });
+    // 失敗した場合も途中まで作成されている可能性があるので、常に無効化する
+    m_lookupCache.Invalidate(plannedTransport.resolvedFilename, false);
+    return status;
+  };
+
+  for (const auto& directory : plan.directories) {
+    if (const auto status = transport(directory, true); status != STATUS_SUCCESS) {
+      // TODO: remove created directories
+      throw NsError(status);
+    }
+  }
+
+  if (plan.files.empty()) {
+    return;
+  }
+
+  // 単一ファイルの場合はその場で転送する
+  if (plan.files.size() == 1) {
+    if (const auto status = transport(plan.files.front(), false); status != STATUS_SUCCESS) {
+      throw NsError(status);
+    }
+    return;
+  }
+
+  std::vector<NTSTATUS> statuses(plan.files.size(), STATUS_PENDING);
+  std::vector<std::future<void>> futures;
+  futures.reserve(plan.files.size());
+  try {
+    for (std::size_t i = 0; i < plan.files.size(); i++) {
+      futures.push_back(m_workerPool.Submit([&transport, &plan, &statuses, i]() {
+        statuses[i] = transport(plan.files[i], false);
+      }));
+    }
   } catch (...) {
-    // TODO: remove created directories
+    // planとstatusesを参照しているので、投入済みのものは終了を待つ必要がある
+    for (auto& future : futures) {
+      future.wait();
+    }
     throw;
   }
+  for (auto& future : futures) {
+    future.wait();
+  }
+
+  for (const auto status : statuses) {
+    if (status != STATUS_SUCCESS) {
+      throw NsError(status);
+    }
+  }
+}
+
+
+void Mount::CopyFileToTopSourceR(std::wstring_view resolvedFilename, bool empty, FILE_CONTEXT_ID fileContextId) {
+  if (!m_writable) {
+    throw NsError(STATUS_MEDIA_WRITE_PROTECTED);
+  }
+
+  auto plan = PlanCopyUpR({std::wstring(resolvedFilename)}, false);
+  for (auto& file : plan.files) {
+    file.fileContextId = fileContextId;
+  }
+  ExecuteCopyUpPlanR(plan, empty);
 }
 
 
@@ -532,7 +1089,7 @@ void Mount::CopyFileToTopSource(std::wstring_view filename, bool empty, FILE_CON
 void Mount::RemoveFile(std::wstring_view filename) {
   const auto resolvedFileName = ResolveFilepath(filename);
 
-  const auto sourceIndex = GetMountSourceIndexR(resolvedFileName);
+  const auto [sourceIndex, fileType] = LookupR(resolvedFileName);
   if (!sourceIndex) {
     throw NsError(STATUS_OBJECT_NAME_NOT_FOUND);
   }
@@ -540,16 +1097,25 @@ void Mount::RemoveFile(std::wstring_view filename) {
   bool editMetadata = true;
 
   if (sourceIndex == TopSourceIndex) {
-    if (const auto status = m_mountSources[sourceIndex.value()]->RemoveFile(resolvedFileName.c_str()); status != STATUS_SUCCESS) {
+    const auto status = m_mountSources[sourceIndex.value()]->RemoveFile(resolvedFileName.c_str());
+    m_lookupCache.Invalidate(resolvedFileName, fileType == FileType::Directory);
+    if (status != STATUS_SUCCESS) {
       throw NsError(status);
     }
     editMetadata = FileExists(filename);
   }
 
+  if (sourceIndex != TopSourceIndex && fileType != FileType::Directory) {
+    DiscardOverlayR(resolvedFileName);
+  }
+
   if (editMetadata) {
     std::lock_guard lock(m_metadataMutex);
     m_metadataStore.Delete(filename);
   }
+
+  m_listingCache.InvalidateParent(filename);
+  m_listingCache.Invalidate(filename, true);
 }
 
 
@@ -558,131 +1124,611 @@ Mount::FILE_CONTEXT_ID Mount::AssignFileContextId(std::wstring_view FileName, st
     return fileContextPtr->id;
   }
 
-  std::lock_guard lock(m_mutex);
+  const bool writable = m_writable && mountSourceIndex == TopSourceIndex;
+  FileContext* ptrFileContext = nullptr;
+  const FILE_CONTEXT_ID id = m_fileContextTable.Insert([&](FILE_CONTEXT_ID newId) {
+    ptrFileContext = new FileContext{
+      std::shared_mutex(),
+      newId,
+      *this,
+      *m_mountSources[mountSourceIndex].get(),
+      std::wstring(FileName),
+      std::wstring(ResolvedFileName),
+      isDirectory,
+      writable,
+      deferCopy,
+      true,
+      true,
+      false,
+      m_fileIndexBases.at(mountSourceIndex),
+      *SecurityContext,
+      DesiredAccess,
+      FileAttributes,
+      ShareAccess,
+      CreateDisposition,
+      CreateOptions,
+    };
+#ifdef USE_SHARED_PTR_FOR_FILE_CONTEXT
+    std::shared_ptr<FileContext> spFileContext(ptrFileContext);
+    spFileContext->weakThis = spFileContext;
+    return spFileContext;
+#else
+    return std::unique_ptr<FileContext>(ptrFileContext);
+#endif
+  });
+  DokanFileInfo->Context = reinterpret_cast<ULONG64>(ptrFileContext);
+
+  return id;
+}
+
+
+bool Mount::ReleaseFileContextId(FILE_CONTEXT_ID FileContextId) noexcept {
+  try {
+    if (FileContextId == FILE_CONTEXT_ID_NULL) {
+      return false;
+    }
+#if defined(USE_SHARED_PTR_FOR_FILE_CONTEXT) && defined(_DEBUG)
+    m_fileContextTable.With(FileContextId, [FileContextId](const std::shared_ptr<FileContext>& spFileContext) {
+      // use_count will be usually 2 (+1 for m_fileContextTable and +1 for ptrFileContext in DCloseFile)
+      const std::size_t useCount = spFileContext.use_count();
+      //assert(useCount == 2);
+      if (useCount != 2) {
+        OutputDebugStringW((L"### FileContext "s + std::to_wstring(FileContextId) + L" released with use count "s + std::to_wstring(useCount) + L"\n"s).c_str());
+      }
+    });
+#endif
+    // destroy the context (if this is the last reference) outside of the table lock
+    const auto removedFileContext = m_fileContextTable.Remove(FileContextId);
+    assert(removedFileContext);
+    return static_cast<bool>(removedFileContext);
+  } catch (...) {}
+  return false;
+}
+
+
+bool Mount::ReleaseFileContextId(PDOKAN_FILE_INFO DokanFileInfo) noexcept {
+  try {
+    if (!DokanFileInfo->Context) {
+      return false;
+    }
+    const auto id = GetFileContextPtr(DokanFileInfo)->id;
+    DokanFileInfo->Context = NULL;
+    return ReleaseFileContextId(id);
+  } catch (...) {}
+  return false;
+}
+
+
+// fileContext.mutex must be locked exclusively
+// opens the destination and starts transporting the file in the background; returns the running job if already started
+std::shared_ptr<Mount::CopyUpJob> Mount::StartCopyUpL(FileContext& fileContext, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (fileContext.copyUpJob) {
+    return fileContext.copyUpJob;
+  }
+  // ensure parent directory
+  const auto parentPath = util::vfs::GetParentPath(fileContext.resolvedFilename);
+  if (GetMountSourceIndexR(parentPath) != TopSourceIndex) {
+    CopyFileToTopSourceR(parentPath, true);
+  }
+  // retrieve original source
+  const auto sourceIndex = GetMountSourceIndexR(fileContext.resolvedFilename);
+  if (!sourceIndex) {
+    throw NsError(STATUS_OBJECT_NAME_NOT_FOUND);
+  }
+  if (sourceIndex == TopSourceIndex) {
+    throw NsError(STATUS_OBJECT_NAME_COLLISION);
+  }
+  auto& source = *m_mountSources.at(sourceIndex.value());
+  // the destination is opened here as DokanFileInfo is only valid during this callback
+  if (const auto status = m_topSource.SwitchDestinationOpen(fileContext.resolvedFilename.c_str(), &fileContext.SecurityContext, fileContext.DesiredAccess, fileContext.FileAttributes, fileContext.ShareAccess, fileContext.CreateDisposition, fileContext.CreateOptions, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
+    throw NsError(status);
+  }
+
+  auto spCopyUpJob = std::make_shared<CopyUpJob>();
+  spCopyUpJob->filename = fileContext.resolvedFilename;
+  {
+    std::lock_guard lock(m_copyUpMutex);
+    m_copyUpJobs.emplace(fileContext.id, spCopyUpJob);
+  }
+  fileContext.copyUpJob = spCopyUpJob;
+
+  // transport (reads are served from the original source until FinishCopyUpL switches the file context)
+  m_copyUpPool.Submit([this, spCopyUpJob, fileContextId = fileContext.id, sourceIndex = sourceIndex.value(), &source]() {
+    const auto startTime = std::chrono::steady_clock::now();
+    const auto status = m_traceRecorder.Trace(TraceCategory::Internal, L"TransportR", static_cast<std::uint32_t>(sourceIndex), spCopyUpJob->filename.c_str(), [&]() {
+      return WrapException([&]() -> NTSTATUS {
+        return TransportR(spCopyUpJob->filename, false, fileContextId, source, m_topSource, DefaultTransportOptions, spCopyUpJob.get());
+      });
+    });
+    const auto elapsedTime = std::chrono::steady_clock::now() - startTime;
+    m_lookupCache.Invalidate(spCopyUpJob->filename, false);
+    {
+      std::lock_guard lock(m_copyUpMutex);
+      if (status == STATUS_SUCCESS) {
+        m_copyUpStatistics.numCompleted++;
+        m_copyUpStatistics.completedBytes += spCopyUpJob->totalBytes;
+        m_copyUpStatistics.completedMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+      } else if (status == STATUS_CANCELLED) {
+        m_copyUpStatistics.numCancelled++;
+      } else {
+        m_copyUpStatistics.numFailed++;
+      }
+    }
+    spCopyUpJob->Complete(status);
+  });
+
+  return spCopyUpJob;
+}
+
+
+// fileContext.mutex must be locked exclusively
+// waits for the copy-up and switches the file context to the top source, or closes the destination if the copy-up failed
+NTSTATUS Mount::FinishCopyUpL(FileContext& fileContext, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (!fileContext.copyDeferred || !fileContext.copyUpJob) {
+    return STATUS_SUCCESS;
+  }
+  const auto spCopyUpJob = std::move(fileContext.copyUpJob);
+  spCopyUpJob->Wait(std::numeric_limits<ULONGLONG>::max());
+  {
+    std::lock_guard lock(m_copyUpMutex);
+    m_copyUpJobs.erase(fileContext.id);
+  }
+
+  if (spCopyUpJob->status != STATUS_SUCCESS) {
+    // SwitchDestinationClose may set DeleteOnClose to discard the destination; it must not reach our caller (e.g. DCleanup)
+    const auto deleteOnClose = DokanFileInfo->DeleteOnClose;
+    m_topSource.SwitchDestinationClose(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+    DokanFileInfo->DeleteOnClose = deleteOnClose;
+    m_lookupCache.Invalidate(fileContext.resolvedFilename, false);
+    return spCopyUpJob->status;
+  }
+
+  auto& oldMountSource = fileContext.mountSource.get();
+  if (const auto status = oldMountSource.SwitchSourceClose(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
+    return status;
+  }
+  fileContext.mountSource = m_topSource;
+  fileContext.copyDeferred = false;
+  fileContext.writable = true;
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS Mount::TransportIfNeeded(PDOKAN_FILE_INFO DokanFileInfo) {
+  auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
+  auto& fileContext = *ptrFileContext;
+  if (!fileContext.copyDeferred) {
+    return STATUS_SUCCESS;
+  }
+  std::shared_ptr<CopyUpJob> spCopyUpJob;
+  {
+    std::lock_guard lock(fileContext.mutex);
+    if (!fileContext.copyDeferred) {
+      return STATUS_SUCCESS;
+    }
+    spCopyUpJob = StartCopyUpL(fileContext, DokanFileInfo);
+  }
+  // wait without the lock so that reads can be served meanwhile
+  spCopyUpJob->Wait(std::numeric_limits<ULONGLONG>::max());
+  std::lock_guard lock(fileContext.mutex);
+  return FinishCopyUpL(fileContext, DokanFileInfo);
+}
+
+
+std::optional<std::uint64_t> Mount::GetBlockCacheNamespaceN(const MountSource& mountSource) const {
+  for (std::size_t index = 0; index < m_mountSources.size(); index++) {
+    if (m_mountSources[index].get() == &mountSource) {
+      return m_blockCacheNamespaces[index];
+    }
+  }
+  return std::nullopt;
+}
+
+
+// reads a file in a source through m_blockCache if the source is cacheable
+// missing blocks are read from the source by block-aligned requests, contiguous ones with a single call
+NTSTATUS Mount::ReadSourceR(MountSource& mountSource, const std::wstring& resolvedFilename, LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID fileContextId) {
+  const auto namespaceIdN = GetBlockCacheNamespaceN(mountSource);
+  if (!namespaceIdN || Offset < 0) {
+    return mountSource.DReadFile(resolvedFilename.c_str(), Buffer, BufferLength, ReadLength, Offset, DokanFileInfo, fileContextId);
+  }
+
+  const std::uint64_t namespaceId = namespaceIdN.value();
+  const std::size_t blockSize = m_blockCache.GetBlockSize();
+  const auto key = FilenameToKey(resolvedFilename);
+  const ULONGLONG offset = static_cast<ULONGLONG>(Offset);
+  const ULONGLONG endOffset = offset + BufferLength;
+  const auto buffer = static_cast<char*>(Buffer);
+
+  DWORD totalReadLength = 0;
+  bool endOfFile = false;
+  while (!endOfFile && offset + totalReadLength < endOffset) {
+    const ULONGLONG current = offset + totalReadLength;
+    const ULONGLONG blockIndex = current / blockSize;
+
+    if (const auto spBlock = m_blockCache.Get(namespaceId, key, blockIndex)) {
+      const std::size_t blockOffset = static_cast<std::size_t>(current - blockIndex * blockSize);
+      const std::size_t size = blockOffset < spBlock->size() ? static_cast<std::size_t>(std::min<ULONGLONG>(spBlock->size() - blockOffset, endOffset - current)) : 0;
+      std::memcpy(buffer + totalReadLength, spBlock->data() + blockOffset, size);
+      totalReadLength += static_cast<DWORD>(size);
+      // only the last block of a file is shorter than blockSize
+      endOfFile = spBlock->size() < blockSize && blockOffset + size >= spBlock->size();
+      continue;
+    }
+
+    ULONGLONG blockIndexEnd = blockIndex + 1;
+    const ULONGLONG lastBlockIndex = (endOffset - 1) / blockSize;
+    while (blockIndexEnd <= lastBlockIndex && !m_blockCache.Contains(namespaceId, key, blockIndexEnd)) {
+      blockIndexEnd++;
+    }
+
+    const ULONGLONG runOffset = blockIndex * blockSize;
+    const std::size_t runLength = static_cast<std::size_t>((blockIndexEnd - blockIndex) * blockSize);
+    const auto data = std::make_unique<char[]>(runLength);
+    // a source may return fewer bytes than requested before the end of the file, so keep reading until the run is full or nothing is returned
+    DWORD runReadLength = 0;
+    while (runReadLength < runLength) {
+      DWORD partReadLength = 0;
+      if (const auto status = mountSource.DReadFile(resolvedFilename.c_str(), data.get() + runReadLength, static_cast<DWORD>(runLength - runReadLength), &partReadLength, static_cast<LONGLONG>(runOffset + runReadLength), DokanFileInfo, fileContextId); status != STATUS_SUCCESS) {
+        if (status != STATUS_END_OF_FILE) {
+          return status;
+        }
+        partReadLength = 0;
+      }
+      if (!partReadLength) {
+        break;
+      }
+      runReadLength += partReadLength;
+    }
+
+    // a short block is cached only if it is the last block of the file, as a cached short block is taken as the end of the file
+    std::size_t cacheLength = runReadLength;
+    if (const std::size_t tailLength = runReadLength % blockSize) {
+      BY_HANDLE_FILE_INFORMATION fileInformation{};
+      const auto status = mountSource.DGetFileInformation(resolvedFilename.c_str(), &fileInformation, DokanFileInfo, fileContextId);
+      const ULONGLONG fileSize = (static_cast<ULONGLONG>(fileInformation.nFileSizeHigh) << 32) | fileInformation.nFileSizeLow;
+      if (status != STATUS_SUCCESS || runOffset + runReadLength != fileSize) {
+        cacheLength -= tailLength;
+      }
+    }
+
+    for (std::size_t blockOffset = 0; blockOffset < cacheLength; blockOffset += blockSize) {
+      const std::size_t size = std::min<std::size_t>(blockSize, cacheLength - blockOffset);
+      m_blockCache.Set(namespaceId, key, blockIndex + blockOffset / blockSize, std::make_shared<const BlockCache::Block>(data.get() + blockOffset, data.get() + blockOffset + size));
+    }
+
+    const std::size_t dataOffset = static_cast<std::size_t>(current - runOffset);
+    const std::size_t size = dataOffset < runReadLength ? static_cast<std::size_t>(std::min<ULONGLONG>(runReadLength - dataOffset, endOffset - current)) : 0;
+    std::memcpy(buffer + totalReadLength, data.get() + dataOffset, size);
+    totalReadLength += static_cast<DWORD>(size);
+    endOfFile = runReadLength < runLength && dataOffset + size >= runReadLength;
+  }
+
+  *ReadLength = totalReadLength;
+  return STATUS_SUCCESS;
+}
+
+
+// returns nullptr if read-ahead is disabled for the mount
+// the prefetch runs on m_readAheadPool after the callback returns, so it reads with a copy of DokanFileInfo
+// (source plugins do not use DOKAN_FILE_INFO::Context)
+std::shared_ptr<ReadAheadStream> Mount::OpenReadAheadStream(FileContext& fileContext, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (!m_readAheadPool.GetNumThreads() || !m_readAheadOptions.maxWindowSize) {
+    return nullptr;
+  }
+  auto& mountSource = fileContext.mountSource.get();
+  DOKAN_FILE_INFO prefetchFileInfo = *DokanFileInfo;
+  prefetchFileInfo.PagingIo = FALSE;
+  return std::make_shared<ReadAheadStream>(m_readAheadBudget, m_readAheadPool, m_readAheadOptions.maxWindowSize, [this, &mountSource, resolvedFilename = fileContext.resolvedFilename, fileContextId = fileContext.id, prefetchFileInfo](void* buffer, DWORD length, DWORD* readLength, ULONGLONG offset) mutable -> NTSTATUS {
+    return ReadSourceR(mountSource, resolvedFilename, buffer, length, readLength, static_cast<LONGLONG>(offset), &prefetchFileInfo, fileContextId);
+  });
+}
+
+
+// \$MergeFSSystemData holds our own data in the top source and is not part of the merged view
+bool Mount::IsSystemDataPath(std::wstring_view filename) const {
+  const std::wstring_view systemDataDirectory(MetadataStore::SystemDataDirectory);
+  if (filename.size() < systemDataDirectory.size()) {
+    return false;
+  }
+  if (filename.size() > systemDataDirectory.size() && filename[systemDataDirectory.size()] != L'\\') {
+    return false;
+  }
+  return FilenameToKey(filename.substr(0, systemDataDirectory.size())) == FilenameToKey(systemDataDirectory);
+}
+
+
+// IDs for files we open in sources by ourselves; never collides with IDs of file contexts
+Mount::FILE_CONTEXT_ID Mount::NewInternalFileContextId() noexcept {
+  constexpr FILE_CONTEXT_ID NumInternalIds = decltype(m_fileContextTable)::MinId - 1;
+  return m_nextInternalFileContextId++ % NumInternalIds + 1;
+}
+
+
+// whether writes to the lower-layer file should go to an overlay (create) or the file already has one
+bool Mount::CanOverlayR(std::wstring_view resolvedFilename, std::size_t sourceIndex, bool create) {
+  if (!m_extentStore.IsEnabled() || sourceIndex == TopSourceIndex) {
+    return false;
+  }
+  {
+    std::lock_guard lock(m_overlayMutex);
+    if (const auto itr = m_openOverlays.find(FilenameToKey(resolvedFilename)); itr != m_openOverlays.end() && !itr->second.expired()) {
+      return true;
+    }
+    std::lock_guard storeLock(m_extentStoreMutex);
+    if (m_extentStore.GetFileSizeR(resolvedFilename)) {
+      return true;
+    }
+  }
+  if (!create) {
+    return false;
+  }
+  const std::wstring sResolvedFilename(resolvedFilename);
+  WIN32_FILE_ATTRIBUTE_DATA win32FileAttributeData;
+  if (m_mountSources[sourceIndex]->GetFileInfo(sResolvedFilename.c_str(), &win32FileAttributeData) != STATUS_SUCCESS) {
+    // fall back to copying the whole file
+    return false;
+  }
+  const ULONGLONG fileSize = (static_cast<ULONGLONG>(win32FileAttributeData.nFileSizeHigh) << 32) | win32FileAttributeData.nFileSizeLow;
+  return fileSize >= OverlayConfig::MinFileSize;
+}
+
+
+// returns the overlay shared by the file contexts of the file, loading its extent map or starting a new one
+std::shared_ptr<Mount::Overlay> Mount::OpenOverlayR(std::wstring_view resolvedFilename, std::size_t sourceIndex) {
+  std::lock_guard lock(m_overlayMutex);
+
+  const auto key = FilenameToKey(resolvedFilename);
+  if (const auto itr = m_openOverlays.find(key); itr != m_openOverlays.end()) {
+    if (auto spOverlay = itr->second.lock()) {
+      return spOverlay;
+    }
+    m_openOverlays.erase(itr);
+  }
+
+  std::optional<ExtentStore::Entry> entryN;
+  {
+    std::lock_guard storeLock(m_extentStoreMutex);
+    entryN = m_extentStore.GetR(resolvedFilename);
+  }
+  if (!entryN) {
+    const std::wstring sResolvedFilename(resolvedFilename);
+    WIN32_FILE_ATTRIBUTE_DATA win32FileAttributeData;
+    if (const auto status = m_mountSources.at(sourceIndex)->GetFileInfo(sResolvedFilename.c_str(), &win32FileAttributeData); status != STATUS_SUCCESS) {
+      throw NsError(status);
+    }
+    const ULONGLONG fileSize = (static_cast<ULONGLONG>(win32FileAttributeData.nFileSizeHigh) << 32) | win32FileAttributeData.nFileSizeLow;
+    entryN = ExtentStore::Entry{0, ExtentMap(fileSize)};
+  }
+
+  auto spOverlay = std::make_shared<Overlay>();
+  spOverlay->resolvedFilename = resolvedFilename;
+  spOverlay->overlayId = entryN->overlayId;
+  spOverlay->dataFileContextId = FILE_CONTEXT_ID_NULL;
+  spOverlay->dataFileInfo = DOKAN_FILE_INFO{};
+  spOverlay->extentMap = std::move(entryN->extentMap);
+  spOverlay->dirty = false;
+  spOverlay->discarded = false;
+  if (spOverlay->overlayId) {
+    // existing extents are read from the data file
+    OpenOverlayDataFileL(*spOverlay);
+  }
+
+  m_openOverlays.insert_or_assign(key, spOverlay);
+  return spOverlay;
+}
+
+
+// closes the overlay if this was the last file context which uses it
+void Mount::ReleaseOverlay(std::shared_ptr<Overlay> spOverlay) noexcept {
+  try {
+    if (!spOverlay) {
+      return;
+    }
+    // references are only added by OpenOverlayR while m_overlayMutex is held, so use_count is reliable here
+    std::lock_guard lock(m_overlayMutex);
+    if (spOverlay.use_count() > 1) {
+      spOverlay.reset();
+      return;
+    }
+    {
+      std::lock_guard overlayLock(spOverlay->mutex);
+      CloseOverlayL(*spOverlay);
+    }
+    if (const auto itr = m_openOverlays.find(FilenameToKey(spOverlay->resolvedFilename)); itr != m_openOverlays.end() && itr->second.lock() == spOverlay) {
+      m_openOverlays.erase(itr);
+    }
+  } catch (...) {}
+}
+
+
+// forgets the overlay of the file (which is being removed or replaced) and deletes its data file
+void Mount::DiscardOverlayR(std::wstring_view resolvedFilename) {
+  if (!m_extentStore.IsEnabled()) {
+    return;
+  }
+
+  std::lock_guard lock(m_overlayMutex);
+
+  std::optional<ULONGLONG> removedOverlayIdN;
+  {
+    std::lock_guard storeLock(m_extentStoreMutex);
+    removedOverlayIdN = m_extentStore.RemoveR(resolvedFilename);
+    m_extentStore.Save();
+  }
+
+  if (const auto itr = m_openOverlays.find(FilenameToKey(resolvedFilename)); itr != m_openOverlays.end()) {
+    const auto spOverlay = itr->second.lock();
+    m_openOverlays.erase(itr);
+    if (spOverlay) {
+      // still in use; the data file is deleted when the last file context is closed
+      std::lock_guard overlayLock(spOverlay->mutex);
+      spOverlay->discarded = true;
+      return;
+    }
+  }
+
+  if (removedOverlayIdN) {
+    m_topSource.RemoveFile(ExtentStore::GetOverlayFilename(removedOverlayIdN.value()).c_str());
+  }
+}
+
+
+// returns the size of the file as seen through its overlay, or nullopt if the file is not overlaid
+std::optional<ULONGLONG> Mount::GetOverlaidFileSizeR(std::wstring_view resolvedFilename) {
+  if (!m_extentStore.IsEnabled()) {
+    return std::nullopt;
+  }
+
+  std::lock_guard lock(m_overlayMutex);
+  // an open overlay may have extents which are not saved yet
+  if (const auto itr = m_openOverlays.find(FilenameToKey(resolvedFilename)); itr != m_openOverlays.end()) {
+    if (const auto spOverlay = itr->second.lock(); spOverlay && spOverlay->overlayId) {
+      std::shared_lock overlayLock(spOverlay->mutex);
+      return spOverlay->extentMap.GetFileSize();
+    }
+  }
+  std::lock_guard storeLock(m_extentStoreMutex);
+  return m_extentStore.GetFileSizeR(resolvedFilename);
+}
+
+
+void Mount::EnsureOverlayDirectory() {
+  for (const auto directory : {MetadataStore::SystemDataDirectory, ExtentStore::OverlayDirectory}) {
+    const auto fileContextId = NewInternalFileContextId();
+    DOKAN_IO_SECURITY_CONTEXT securityContext{};
+    DOKAN_FILE_INFO dokanFileInfo{};
+    dokanFileInfo.IsDirectory = TRUE;
+    const auto status = m_topSource.DZwCreateFile(directory, &securityContext, FILE_GENERIC_READ, FILE_ATTRIBUTE_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN_IF, FILE_DIRECTORY_FILE, &dokanFileInfo, false, fileContextId);
+    if (status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_COLLISION) {
+      throw NsError(status);
+    }
+    m_topSource.DCleanup(directory, &dokanFileInfo, fileContextId);
+    m_topSource.DCloseFile(directory, &dokanFileInfo, fileContextId);
+    m_lookupCache.Invalidate(directory, false);
+  }
+}
+
+
+// overlay.mutex must be locked exclusively (or the overlay must not be shared yet)
+void Mount::OpenOverlayDataFileL(Overlay& overlay) {
+  if (overlay.dataFileContextId != FILE_CONTEXT_ID_NULL) {
+    return;
+  }
+
+  const bool created = !overlay.overlayId;
+  if (created) {
+    std::lock_guard storeLock(m_extentStoreMutex);
+    overlay.overlayId = m_extentStore.NewOverlayId();
+  }
+  overlay.dataFilename = ExtentStore::GetOverlayFilename(overlay.overlayId);
+
+  if (created) {
+    EnsureOverlayDirectory();
+  }
 
-  const FILE_CONTEXT_ID id = m_minimumUnusedFileContextId;
-  do {
-    m_minimumUnusedFileContextId++;
-  } while (m_fileContextMap.count(m_minimumUnusedFileContextId));
+  const auto fileContextId = NewInternalFileContextId();
+  DOKAN_IO_SECURITY_CONTEXT securityContext{};
+  overlay.dataFileInfo = DOKAN_FILE_INFO{};
+  const auto status = m_topSource.DZwCreateFile(overlay.dataFilename.c_str(), &securityContext, FILE_GENERIC_READ | FILE_GENERIC_WRITE, FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ, created ? FILE_OVERWRITE_IF : FILE_OPEN, FILE_NON_DIRECTORY_FILE, &overlay.dataFileInfo, false, fileContextId);
+  if (status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_COLLISION) {
+    throw NsError(status);
+  }
+  overlay.dataFileContextId = fileContextId;
+}
 
-  const bool writable = m_writable && mountSourceIndex == TopSourceIndex;
-  auto ptrFileContext = new FileContext{
-    std::shared_mutex(),
-    id,
-    *this,
-    *m_mountSources[mountSourceIndex].get(),
-    std::wstring(FileName),
-    std::wstring(ResolvedFileName),
-    isDirectory,
-    writable,
-    deferCopy,
-    true,
-    true,
-    m_fileIndexBases.at(mountSourceIndex),
-    *SecurityContext,
-    DesiredAccess,
-    FileAttributes,
-    ShareAccess,
-    CreateDisposition,
-    CreateOptions,
-  };
-#ifdef USE_SHARED_PTR_FOR_FILE_CONTEXT
-  std::lock_guard glock(gFileContextMapMutex);
-  std::shared_ptr<FileContext> spFileContext(ptrFileContext);
-  m_fileContextMap.emplace(id, spFileContext);
-  gFileContextPtrToSharedPtrMap.emplace(ptrFileContext, spFileContext);
-#else
-  m_fileContextMap.emplace(id, std::move(std::unique_ptr<FileContext>(ptrFileContext)));
-#endif
-  DokanFileInfo->Context = reinterpret_cast<ULONG64>(ptrFileContext);
 
-  return id;
+// overlay.mutex must be locked
+void Mount::SaveOverlayL(Overlay& overlay) {
+  if (!overlay.dirty || overlay.discarded) {
+    return;
+  }
+  std::lock_guard storeLock(m_extentStoreMutex);
+  m_extentStore.SetR(overlay.resolvedFilename, ExtentStore::Entry{overlay.overlayId, overlay.extentMap});
+  m_extentStore.Save();
+  overlay.dirty = false;
 }
 
 
-bool Mount::ReleaseFileContextId(FILE_CONTEXT_ID FileContextId) noexcept {
+// overlay.mutex must be locked exclusively
+void Mount::CloseOverlayL(Overlay& overlay) noexcept {
   try {
-    if (FileContextId < FileContextIdStart) {
-      return false;
-    }
-    std::lock_guard lock(m_mutex);
-    if (FileContextId < m_minimumUnusedFileContextId) {
-      m_minimumUnusedFileContextId = FileContextId;
-    }
-#ifdef USE_SHARED_PTR_FOR_FILE_CONTEXT
-# ifdef _DEBUG
-    assert(m_fileContextMap.count(FileContextId));
-    // use_count will be usually 3 (+1 for m_fileContextMap and +1 for gFileContextPtrToSharedPtrMap and +1 for ptrFileContext in DCloseFile)
-    const std::size_t useCount = m_fileContextMap.at(FileContextId).use_count();
-    //assert(useCount == 3);
-    if (useCount != 3) {
-      OutputDebugStringW((L"### FileContext "s + std::to_wstring(FileContextId) + L" released with use count "s + std::to_wstring(useCount) + L"\n"s).c_str());
-    }
-# endif
-    std::lock_guard glock(gFileContextMapMutex);
-    gFileContextPtrToSharedPtrMap.erase(m_fileContextMap.at(FileContextId).get());
-#endif
-    return m_fileContextMap.erase(FileContextId);
+    SaveOverlayL(overlay);
   } catch (...) {}
-  return false;
+  if (overlay.dataFileContextId != FILE_CONTEXT_ID_NULL) {
+    m_topSource.DCleanup(overlay.dataFilename.c_str(), &overlay.dataFileInfo, overlay.dataFileContextId);
+    m_topSource.DCloseFile(overlay.dataFilename.c_str(), &overlay.dataFileInfo, overlay.dataFileContextId);
+    overlay.dataFileContextId = FILE_CONTEXT_ID_NULL;
+  }
+  if (overlay.discarded && overlay.overlayId) {
+    m_topSource.RemoveFile(overlay.dataFilename.c_str());
+  }
 }
 
 
-bool Mount::ReleaseFileContextId(PDOKAN_FILE_INFO DokanFileInfo) noexcept {
-  try {
-    if (!DokanFileInfo->Context) {
-      return false;
+// overlay.mutex must be locked
+// reads each range from the data file, the lower-layer file or zero-fills it according to the extent map
+NTSTATUS Mount::ReadOverlayL(FileContext& fileContext, Overlay& overlay, LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo) {
+  const ULONGLONG offset = static_cast<ULONGLONG>(Offset);
+  DWORD totalReadLength = 0;
+  for (const auto& segment : overlay.extentMap.Map(offset, BufferLength)) {
+    const auto ptr = static_cast<char*>(Buffer) + (segment.offset - offset);
+    const auto length = static_cast<DWORD>(segment.length);
+    DWORD readLength = 0;
+    NTSTATUS status = STATUS_SUCCESS;
+    switch (segment.type) {
+      case ExtentMap::SegmentType::Lower:
+        status = ReadSourceR(fileContext.mountSource.get(), fileContext.resolvedFilename, ptr, length, &readLength, static_cast<LONGLONG>(segment.offset), DokanFileInfo, fileContext.id);
+        break;
+
+      case ExtentMap::SegmentType::Overlay:
+        status = m_topSource.DReadFile(overlay.dataFilename.c_str(), ptr, length, &readLength, static_cast<LONGLONG>(segment.dataOffset), &overlay.dataFileInfo, overlay.dataFileContextId);
+        break;
+
+      case ExtentMap::SegmentType::Zero:
+        std::memset(ptr, 0, length);
+        readLength = length;
+        break;
     }
-    const auto id = GetFileContextPtr(DokanFileInfo)->id;
-    DokanFileInfo->Context = NULL;
-    return ReleaseFileContextId(id);
-  } catch (...) {}
-  return false;
+    if (status != STATUS_SUCCESS) {
+      return status;
+    }
+    totalReadLength += readLength;
+    if (readLength < length) {
+      // the lower-layer file has been shortened underneath us
+      break;
+    }
+  }
+  *ReadLength = totalReadLength;
+  return STATUS_SUCCESS;
 }
 
 
-NTSTATUS Mount::TransportIfNeeded(PDOKAN_FILE_INFO DokanFileInfo) {
-  auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
-  auto& fileContext = *ptrFileContext;
-  if (fileContext.copyDeferred) {
-    std::lock_guard lock(fileContext.mutex);
-    if (fileContext.copyDeferred) {
-      auto& oldMountSource = fileContext.mountSource.get();
-      // ensure parent directory
-      const auto parentPath = util::vfs::GetParentPath(fileContext.resolvedFilename);
-      if (GetMountSourceIndexR(parentPath) != TopSourceIndex) {
-        CopyFileToTopSourceR(parentPath, true);
-      }
-      // retrieve original source
-      const auto sourceIndex = GetMountSourceIndexR(fileContext.resolvedFilename);
-      if (!sourceIndex) {
-        return STATUS_OBJECT_NAME_NOT_FOUND;
-      }
-      if (sourceIndex == TopSourceIndex) {
-        return STATUS_OBJECT_NAME_COLLISION;
-      }
-      auto& source = *m_mountSources.at(sourceIndex.value());
-      if (const auto status = m_topSource.SwitchDestinationOpen(fileContext.resolvedFilename.c_str(), &fileContext.SecurityContext, fileContext.DesiredAccess, fileContext.FileAttributes, fileContext.ShareAccess, fileContext.CreateDisposition, fileContext.CreateOptions, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
-        return status;
-      }
-      // transport
-      try {
-        if (const auto status = TransportR(fileContext.resolvedFilename, false, fileContext.id, source, m_topSource); status != STATUS_SUCCESS) {
-          throw NsError(status);
-        }
-        //CopyFileToTopSourceR(fileContext.resolvedFilename, false, fileContext.id);
-      } catch (...) {
-        m_topSource.SwitchDestinationClose(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
-        throw;
-      }
-      if (const auto status = oldMountSource.SwitchSourceClose(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
-        return status;
-      }
-      fileContext.mountSource = m_topSource;
-      fileContext.copyDeferred = false;
-      fileContext.writable = true;
+// overlay.mutex must be locked exclusively
+// appends the data to the data file (or overwrites it in place if the range is already there) and records it in the extent map
+NTSTATUS Mount::WriteOverlayL(Overlay& overlay, LPCVOID Buffer, DWORD NumberOfBytesToWrite, LPDWORD NumberOfBytesWritten, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo) {
+  const ULONGLONG fileSize = overlay.extentMap.GetFileSize();
+  const ULONGLONG offset = DokanFileInfo->WriteToEndOfFile ? fileSize : static_cast<ULONGLONG>(Offset);
+  DWORD length = NumberOfBytesToWrite;
+  if (DokanFileInfo->PagingIo) {
+    // paging I/O cannot write after the end of the file
+    if (offset >= fileSize) {
+      *NumberOfBytesWritten = 0;
+      return STATUS_SUCCESS;
     }
+    length = static_cast<DWORD>(std::min<ULONGLONG>(length, fileSize - offset));
+  }
+
+  OpenOverlayDataFileL(overlay);
+
+  const ULONGLONG dataOffset = overlay.extentMap.FindInPlace(offset, length).value_or(overlay.extentMap.GetDataSize());
+  DWORD writtenLength = 0;
+  if (const auto status = m_topSource.DWriteFile(overlay.dataFilename.c_str(), Buffer, length, &writtenLength, static_cast<LONGLONG>(dataOffset), &overlay.dataFileInfo, overlay.dataFileContextId); status != STATUS_SUCCESS) {
+    return status;
   }
+  overlay.extentMap.Insert(offset, writtenLength, dataOffset);
+  overlay.dirty = true;
+  *NumberOfBytesWritten = writtenLength;
   return STATUS_SUCCESS;
 }
 
@@ -706,6 +1752,11 @@ NTSTATUS Mount::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT Secur
   return WrapException([=]() -> NTSTATUS {
     DokanFileInfo->Context = NULL;
 
+    // システムデータ（TopSource上の差分データなど）は見せない
+    if (IsSystemDataPath(FileName)) {
+      return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
     // 親ディレクトリが存在することを確認する
     if (!util::vfs::IsRootDirectory(FileName)) {
       if (GetFileType(util::vfs::GetParentPath(FileName)) != FileType::Directory) {
@@ -714,6 +1765,7 @@ NTSTATUS Mount::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT Secur
     }
 
     bool deferCopy = false;
+    bool overlay = false;
 
     const auto resolvedFilenameN = ResolveFilepathN(FileName);
 
@@ -819,16 +1871,29 @@ NTSTATUS Mount::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT Secur
         }
 
         if (sourceIndex != TopSourceIndex) {
+          // 大きなファイルは丸ごとコピーせず、書き込まれた範囲のみをTopSource上に差分として持つ
+          // 既に差分を持つファイルは削除される場合も差分のまま扱う
+          if (!directory && !willBeReplaced && CanOverlayR(resolvedFilenameN.value(), sourceIndex.value(), !(CreateOptions & FILE_DELETE_ON_CLOSE))) {
+            overlay = true;
+          }
+
           // 事前にmutateeにコピーしておく
-          if (m_deferCopyEnabled && !directory && !willBeReplaced && !(CreateOptions & FILE_DELETE_ON_CLOSE)) {
+          if (!overlay && m_deferCopyEnabled && !directory && !willBeReplaced && !(CreateOptions & FILE_DELETE_ON_CLOSE)) {
             deferCopy = true;
           }
           
-          if (!deferCopy) {
+          if (!overlay && !deferCopy) {
+            if (willBeReplaced && !directory) {
+              // 内容は破棄されるので差分も不要
+              DiscardOverlayR(resolvedFilenameN.value());
+            }
             CopyFileToTopSourceR(resolvedFilenameN.value(), willBeReplaced);
             targetSourceIndex = TopSourceIndex;
           }
         }
+      } else if (!directory && sourceIndex != TopSourceIndex) {
+        // 差分を持つファイルは読み込みのみの場合も差分を重ねる必要がある
+        overlay = CanOverlayR(resolvedFilenameN.value(), sourceIndex.value(), false);
       }
     }
 
@@ -879,6 +1944,7 @@ NTSTATUS Mount::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT Secur
     if (deferCopy) {
       // TODO: ensure path?
       const auto status = m_topSource.SwitchDestinationPrepare(resolvedFilename.c_str(), SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, fileContextId);
+      m_lookupCache.Invalidate(resolvedFilename, false);
       if (status != STATUS_SUCCESS && (status != STATUS_OBJECT_NAME_COLLISION || !createAlways)) {
         return status;
       }
@@ -886,10 +1952,23 @@ NTSTATUS Mount::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT Secur
 
     const auto status = targetSource.DZwCreateFile(resolvedFilename.c_str(), SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, deferCopy, fileContextId);
 
+    if (existingFileType == FileType::Inexistent) {
+      // 新たに作成された（かもしれない）
+      m_lookupCache.Invalidate(resolvedFilename, false);
+    }
+
     if (status != STATUS_SUCCESS && (status != STATUS_OBJECT_NAME_COLLISION || !createAlways)) {
       return status;
     }
 
+    if (overlay) {
+      GetFileContextPtr(DokanFileInfo)->overlay = OpenOverlayR(resolvedFilename, targetSourceIndex);
+    } else if (!DokanFileInfo->IsDirectory && !deferCopy && targetSourceIndex != TopSourceIndex) {
+      // 下位層のファイルは書き換えられないので、先読みしたデータをそのまま返せる
+      auto& fileContext = *GetFileContextPtr(DokanFileInfo);
+      fileContext.readAhead = OpenReadAheadStream(fileContext, DokanFileInfo);
+    }
+
     if (!resolvedFilenameN) {
       // TODO: もっと効率良く書く
       std::lock_guard lock(m_metadataMutex);
@@ -897,6 +1976,11 @@ NTSTATUS Mount::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT Secur
       //m_metadataStore.Rename(resolvedFilename, FileName);
     }
 
+    // 作成・上書き・TopSourceへのコピーが行われた場合は親ディレクトリの列挙結果が変わる
+    if (existingFileType == FileType::Inexistent || willBeReplaced || targetSourceIndex != sourceIndex) {
+      m_listingCache.InvalidateParent(FileName);
+    }
+
     if (existingFileType != FileType::Inexistent && createAlways) {
       // OPEN_ALWAYSまたはCREATE_ALWAYSが指定されている場合、既存のファイルを開いた（新たにファイルを作成しなかった）ときは
       // STATUS_SUCCESSではなくSTATUS_OBJECT_NAME_COLLISIONを返すことになっている（どのみち成功していることに変わりはない）
@@ -922,9 +2006,26 @@ void Mount::DCleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) noexcept
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (fileContext.copyDeferred) {
+      std::lock_guard lock(fileContext.mutex);
+      if (fileContext.copyUpJob && !fileContext.copyUpJob->written) {
+        // 書き込みが反映されていなければコピーを完了させる必要はない
+        fileContext.copyUpJob->cancelRequested = true;
+      }
+      FinishCopyUpL(fileContext, DokanFileInfo);
+    }
     fileContext.mountSource.get().DCleanup(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
     if (fileContext.copyDeferred) {
       m_topSource.SwitchDestinationCleanup(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+      m_lookupCache.Invalidate(fileContext.resolvedFilename, false);
+    }
+    if (fileContext.modified) {
+      if (fileContext.overlay) {
+        // 下位層のファイル自体は更新されないので、更新日時はメタデータとして記録する
+        fileContext.UpdateLastWriteTime();
+      }
+      // 書き込みによりサイズや更新日時が変わっている
+      m_listingCache.InvalidateParent(FileName);
     }
     if (DokanFileInfo->DeleteOnClose) {
       // Cleanup後CloseFile前にもファイルハンドルを要求されることがあるため、ここで削除するのが正しいかは分からない
@@ -951,10 +2052,27 @@ void Mount::DCloseFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) noexcep
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (fileContext.copyDeferred) {
+      // usually already finished in DCleanup
+      std::lock_guard lock(fileContext.mutex);
+      FinishCopyUpL(fileContext, DokanFileInfo);
+    }
+    if (fileContext.readAhead) {
+      // the prefetch reads through the source's file context, so it must finish before the source closes it
+      fileContext.readAhead->Close();
+    }
     fileContext.mountSource.get().DCloseFile(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
     if (fileContext.copyDeferred) {
       m_topSource.SwitchDestinationClose(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
     }
+    if (fileContext.overlay) {
+      ReleaseOverlay(std::move(fileContext.overlay));
+    }
+    if (fileContext.copyDeferred || (fileContext.writable && DokanFileInfo->DeleteOnClose)) {
+      // ハンドルを閉じた時点で削除されるソースがあるため、ここでも無効化する
+      m_lookupCache.Invalidate(fileContext.resolvedFilename, fileContext.directory);
+      m_listingCache.InvalidateParent(FileName);
+    }
     ReleaseFileContextId(DokanFileInfo);
   } catch (...) {}
 }
@@ -973,8 +2091,41 @@ NTSTATUS Mount::DReadFile(LPCWSTR FileName, LPVOID Buffer, DWORD BufferLength, L
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (const auto& spOverlay = fileContext.overlay) {
+      std::shared_lock overlayLock(spOverlay->mutex);
+      return ReadOverlayL(fileContext, *spOverlay, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo);
+    }
     std::shared_lock lock(fileContext.mutex);
-    if (const auto status = fileContext.mountSource.get().DReadFile(fileContext.resolvedFilename.c_str(), Buffer, BufferLength, ReadLength, Offset, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
+    if (const auto& spCopyUpJob = fileContext.copyUpJob; spCopyUpJob && spCopyUpJob->written) {
+      // コピー中に書き込まれている場合、コピー済みの範囲はTopSourceから、残りは元のソースから読む
+      const ULONGLONG copiedBytes = spCopyUpJob->copiedBytes;
+      const ULONGLONG offset = static_cast<ULONGLONG>(Offset);
+      const DWORD headLength = offset < copiedBytes ? static_cast<DWORD>(std::min<ULONGLONG>(copiedBytes - offset, BufferLength)) : 0;
+      DWORD headReadLength = 0;
+      if (headLength) {
+        if (const auto status = m_topSource.DReadFile(fileContext.resolvedFilename.c_str(), Buffer, headLength, &headReadLength, Offset, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
+          return status;
+        }
+      }
+      if (headLength == BufferLength || headReadLength < headLength) {
+        *ReadLength = headReadLength;
+        return STATUS_SUCCESS;
+      }
+      DWORD tailReadLength = 0;
+      if (const auto status = ReadSourceR(fileContext.mountSource.get(), fileContext.resolvedFilename, static_cast<char*>(Buffer) + headLength, BufferLength - headLength, &tailReadLength, Offset + headLength, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
+        return status;
+      }
+      *ReadLength = headReadLength + tailReadLength;
+      return STATUS_SUCCESS;
+    }
+    // TransportIfNeededによりTopSourceに切り替えられたファイルは先読みしたデータが古い可能性がある
+    if (const auto& spReadAhead = fileContext.readAhead; spReadAhead && !fileContext.writable && !fileContext.copyDeferred) {
+      auto& mountSource = fileContext.mountSource.get();
+      return spReadAhead->Read(Buffer, BufferLength, ReadLength, static_cast<ULONGLONG>(Offset), [&](void* buffer, DWORD length, DWORD* readLength, ULONGLONG offset) -> NTSTATUS {
+        return ReadSourceR(mountSource, fileContext.resolvedFilename, buffer, length, readLength, static_cast<LONGLONG>(offset), DokanFileInfo, fileContext.id);
+      });
+    }
+    if (const auto status = ReadSourceR(fileContext.mountSource.get(), fileContext.resolvedFilename, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
       return status;
     }
     /*
@@ -1001,14 +2152,52 @@ NTSTATUS Mount::DWriteFile(LPCWSTR FileName, LPCVOID Buffer, DWORD NumberOfBytes
     if (!m_writable) {
       return STATUS_MEDIA_WRITE_PROTECTED;
     }
-    if (const auto status = TransportIfNeeded(DokanFileInfo); status != STATUS_SUCCESS) {
-      return status;
-    }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (const auto& spOverlay = fileContext.overlay) {
+      if (!fileContext.modified.exchange(true)) {
+        m_listingCache.InvalidateParent(FileName);
+      }
+      std::lock_guard overlayLock(spOverlay->mutex);
+      return WriteOverlayL(*spOverlay, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo);
+    }
+    if (fileContext.copyDeferred) {
+      std::shared_ptr<CopyUpJob> spCopyUpJob;
+      {
+        std::lock_guard lock(fileContext.mutex);
+        if (fileContext.copyDeferred) {
+          spCopyUpJob = StartCopyUpL(fileContext, DokanFileInfo);
+        }
+      }
+      if (spCopyUpJob) {
+        // 書き込み範囲のコピーが終わるまでだけ待つ（末尾への追記はコピー完了まで待つ）
+        const ULONGLONG requiredBytes = DokanFileInfo->WriteToEndOfFile ? std::numeric_limits<ULONGLONG>::max() : static_cast<ULONGLONG>(Offset) + NumberOfBytesToWrite;
+        spCopyUpJob->Wait(requiredBytes);
+        if (spCopyUpJob->finished) {
+          std::lock_guard lock(fileContext.mutex);
+          if (const auto status = FinishCopyUpL(fileContext, DokanFileInfo); status != STATUS_SUCCESS) {
+            return status;
+          }
+        } else {
+          // the shared lock keeps FinishCopyUpL from closing the destination during the write
+          std::shared_lock lock(fileContext.mutex);
+          if (fileContext.copyUpJob == spCopyUpJob) {
+            spCopyUpJob->written = true;
+            if (!fileContext.modified.exchange(true)) {
+              m_listingCache.InvalidateParent(FileName);
+            }
+            return m_topSource.DWriteFile(fileContext.resolvedFilename.c_str(), Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo, fileContext.id);
+          }
+        }
+      }
+    }
     if (!fileContext.writable) {
       return STATUS_ACCESS_DENIED;
     }
+    if (!fileContext.modified.exchange(true)) {
+      // 最初の書き込み時のみ（以降はCleanupで無効化する）
+      m_listingCache.InvalidateParent(FileName);
+    }
     return fileContext.mountSource.get().DWriteFile(fileContext.resolvedFilename.c_str(), Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo, fileContext.id);
   });
 }
@@ -1029,7 +2218,22 @@ NTSTATUS Mount::DFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileIn
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (const auto& spOverlay = fileContext.overlay) {
+      // 差分データとエクステントマップの両方を永続化する
+      std::lock_guard overlayLock(spOverlay->mutex);
+      if (spOverlay->dataFileContextId != FILE_CONTEXT_ID_NULL) {
+        if (const auto status = m_topSource.DFlushFileBuffers(spOverlay->dataFilename.c_str(), &spOverlay->dataFileInfo, spOverlay->dataFileContextId); status != STATUS_SUCCESS) {
+          return status;
+        }
+      }
+      SaveOverlayL(*spOverlay);
+      return STATUS_SUCCESS;
+    }
     if (fileContext.copyDeferred) {
+      std::shared_lock lock(fileContext.mutex);
+      if (fileContext.copyUpJob && fileContext.copyUpJob->written) {
+        return m_topSource.DFlushFileBuffers(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+      }
       return STATUS_SUCCESS;
     }
     if (!fileContext.writable) {
@@ -1066,6 +2270,14 @@ NTSTATUS Mount::DGetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATI
       Buffer->nFileIndexLow = fileIndex & 0xFFFFFFFF;
     }
 
+    // file size seen through the overlay
+    if (Buffer && fileContext.overlay) {
+      std::shared_lock overlayLock(fileContext.overlay->mutex);
+      const auto fileSize = fileContext.overlay->extentMap.GetFileSize();
+      Buffer->nFileSizeHigh = (fileSize >> 32) & 0xFFFFFFFF;
+      Buffer->nFileSizeLow = fileSize & 0xFFFFFFFF;
+    }
+
     // read metadata if available
     if (Buffer) {
       std::shared_lock lock(m_metadataMutex);
@@ -1086,6 +2298,25 @@ NTSTATUS Mount::DGetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATI
       }
     }
 
+    // state written so far while a copy-up is running (the original source does not know about the writes)
+    if (Buffer && fileContext.copyDeferred) {
+      std::shared_lock lock(fileContext.mutex);
+      if (const auto& spCopyUpJob = fileContext.copyUpJob; spCopyUpJob && spCopyUpJob->written) {
+        BY_HANDLE_FILE_INFORMATION topFileInformation{};
+        if (const auto topStatus = m_topSource.DGetFileInformation(resolvedFilename.c_str(), &topFileInformation, DokanFileInfo, fileContext.id); topStatus != STATUS_SUCCESS) {
+          return topStatus;
+        }
+        // the rest of the original content will still be copied, so the file is at least as large as the original
+        const auto originalFileSize = (static_cast<ULONGLONG>(Buffer->nFileSizeHigh) << 32) | Buffer->nFileSizeLow;
+        const auto topFileSize = (static_cast<ULONGLONG>(topFileInformation.nFileSizeHigh) << 32) | topFileInformation.nFileSizeLow;
+        const auto fileSize = std::max(originalFileSize, topFileSize);
+        Buffer->nFileSizeHigh = (fileSize >> 32) & 0xFFFFFFFF;
+        Buffer->nFileSizeLow = fileSize & 0xFFFFFFFF;
+        Buffer->ftLastAccessTime = topFileInformation.ftLastAccessTime;
+        Buffer->ftLastWriteTime = topFileInformation.ftLastWriteTime;
+      }
+    }
+
     return STATUS_SUCCESS;
   });
 }
@@ -1097,15 +2328,44 @@ FindFiles Dokan API callback.
 List all files in the requested path DOKAN_OPERATIONS::FindFilesWithPattern is checked first. If it is not implemented or returns STATUS_NOT_IMPLEMENTED, then FindFiles is called, if implemented.
 */
 NTSTATUS Mount::DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_FILE_INFO DokanFileInfo) noexcept {
+  return DFindFilesWithPattern(FileName, nullptr, FillFindData, DokanFileInfo);
+}
+
+
+/*
+FindFilesWithPattern Dokan API callback.
+
+Same as FindFiles but with a search pattern. The search pattern is a Windows MS-DOS-style expression.
+SearchPattern may be nullptr (called from DFindFiles), which lists all files.
+*/
+NTSTATUS Mount::DFindFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PFillFindData FillFindData, PDOKAN_FILE_INFO DokanFileInfo) noexcept {
   return WrapException([=]() -> NTSTATUS {
     const bool isRootDirectory = util::vfs::IsRootDirectory(FileName);
     std::map<std::wstring, WIN32_FIND_DATAW> findDataMap;
 
+    // "*" はパターン無しとして扱い、キャッシュへの格納も行う
+    const bool filtered = SearchPattern && !util::vfs::IsMatchAllExpression(SearchPattern);
+    const auto matchesPattern = [this, filtered, SearchPattern](std::wstring_view filename) -> bool {
+      return !filtered || util::vfs::IsNameInExpression(SearchPattern, filename, m_caseSensitive);
+    };
+
     //const auto resolvedFilename = ResolveFilepath(FileName);
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
     const auto& resolvedFilename = fileContext.resolvedFilename;
 
+    // キャッシュされた列挙結果があればそれを使う
+    if (const auto cachedListing = m_listingCache.Get(FileName, resolvedFilename)) {
+      for (auto findData : *cachedListing) {
+        if (!matchesPattern(findData.cFileName)) {
+          continue;
+        }
+        FillFindData(&findData, DokanFileInfo);
+      }
+      return STATUS_SUCCESS;
+    }
+    const auto listingCacheGeneration = m_listingCache.GetGeneration();
+
     //
     std::vector<std::pair<std::wstring, std::wstring>> excludeList;
     std::vector<std::pair<std::wstring, std::wstring>> includeList;
@@ -1122,59 +2382,79 @@ NTSTATUS Mount::DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_
 
     const auto resolvedDirectoryPrefix = resolvedFilename + L"\\";
 
-    // list files
-    bool isFirst = true;
-    for (std::size_t i = 0; i < m_mountSources.size(); i++) {
-      const bool canAddCurrentAndParentDirectory = !isRootDirectory && isFirst;
+    // TopSource上のシステムデータのディレクトリはルートディレクトリから隠す
+    const auto systemDataKey = isRootDirectory ? FilenameToKey(std::wstring_view(MetadataStore::SystemDataDirectory).substr(1)) : L""s;
 
-      auto& mountSource = *m_mountSources[i];
+    // list files
+    // 各ソースの列挙は並行して行い結果をソースごとに溜めておく
+    // マージは従来通り優先度順に行うので、上位のソースが優先される点や2番目以降のソースのディレクトリ以外が無視される点は変わらない
+    struct SourceListing {
+      NTSTATUS status = STATUS_SUCCESS;
       NTSTATUS statusFromCallback = STATUS_SUCCESS;
-      const auto status = mountSource.ListFiles(resolvedFilename.c_str(), [this, sourceIndex = i, &resolvedDirectoryPrefix, &excludeSet, &findDataMap, canAddCurrentAndParentDirectory, &statusFromCallback](PWIN32_FIND_DATAW ptrFindData) noexcept {
-        if (statusFromCallback != STATUS_SUCCESS) {
+      std::vector<WIN32_FIND_DATAW> entries;
+    };
+    std::vector<SourceListing> sourceListings(m_mountSources.size());
+
+    // パターンはソースにも渡すが、ソースの照合規則（短いファイル名など）に依存しないよう受け取った結果も必ず照合する
+    const auto listFiles = [this, &resolvedFilename, &sourceListings, filtered, SearchPattern, &matchesPattern](std::size_t sourceIndex) noexcept {
+      auto& sourceListing = sourceListings[sourceIndex];
+      const auto callback = [&sourceListing, &matchesPattern](PWIN32_FIND_DATAW ptrFindData) noexcept {
+        if (sourceListing.statusFromCallback != STATUS_SUCCESS) {
           return;
         }
         if (!ptrFindData) {
-          statusFromCallback = STATUS_ACCESS_VIOLATION;
+          sourceListing.statusFromCallback = STATUS_ACCESS_VIOLATION;
           return;
         }
-        statusFromCallback = WrapExceptionV([&]() {
-          WIN32_FIND_DATAW findData(*ptrFindData);
-
-          const std::wstring wsFileName(findData.cFileName);
-          const std::wstring wsKey(FilenameToKey(wsFileName));
-          if (!canAddCurrentAndParentDirectory && (wsFileName == L"."sv || wsFileName == L".."sv)) {
-            return;
-          }
-          if (excludeSet.count(wsKey)) {
-            return;
-          }
-          if (findDataMap.count(wsKey)) {
+        sourceListing.statusFromCallback = WrapExceptionV([&]() {
+          if (!matchesPattern(ptrFindData->cFileName)) {
             return;
           }
-          // refer metadata if available
-          // excludeSetに登録されていないということは、このファイルはリネームされていない
-          if (sourceIndex != TopSourceIndex) {
-            std::shared_lock lock(m_metadataMutex);
-            const auto resolvedFilepath = resolvedDirectoryPrefix + wsFileName;
-            if (m_metadataStore.HasMetadataR(resolvedFilepath)) {
-              const auto& metadata = m_metadataStore.GetMetadataR(resolvedFilepath);
-              if (metadata.fileAttributes) {
-                findData.dwFileAttributes = metadata.fileAttributes.value();
-              }
-              if (metadata.creationTime) {
-                findData.ftCreationTime = metadata.creationTime.value();
-              }
-              if (metadata.lastAccessTime) {
-                findData.ftLastAccessTime = metadata.lastAccessTime.value();
-              }
-              if (metadata.lastWriteTime) {
-                findData.ftLastWriteTime = metadata.lastWriteTime.value();
-              }
-            }
-          }
-          findDataMap.emplace(wsKey, findData);
+          sourceListing.entries.push_back(*ptrFindData);
         });
-      });
+      };
+      auto& mountSource = *m_mountSources[sourceIndex];
+      if (filtered) {
+        sourceListing.status = mountSource.ListFilesWithPattern(resolvedFilename.c_str(), SearchPattern, callback);
+        if (sourceListing.status != STATUS_NOT_IMPLEMENTED) {
+          return;
+        }
+        // ListFilesWithPatternに対応していないソースは全件列挙して絞り込む
+        sourceListing.statusFromCallback = STATUS_SUCCESS;
+        sourceListing.entries.clear();
+      }
+      sourceListing.status = mountSource.ListFiles(resolvedFilename.c_str(), callback);
+    };
+
+    {
+      // TopSourceは呼び出し元のスレッドで列挙する
+      // ワーカースレッドが無い場合、Submitはその場で実行する
+      std::vector<std::future<void>> futures;
+      futures.reserve(m_mountSources.size());
+      try {
+        for (std::size_t i = TopSourceIndex + 1; i < m_mountSources.size(); i++) {
+          futures.push_back(m_workerPool.Submit([&listFiles, i]() {
+            listFiles(i);
+          }));
+        }
+      } catch (...) {
+        // sourceListingsを参照しているので、投入済みのものは終了を待つ必要がある
+        for (auto& future : futures) {
+          future.wait();
+        }
+        throw;
+      }
+      listFiles(TopSourceIndex);
+      for (auto& future : futures) {
+        future.wait();
+      }
+    }
+
+    // merge
+    bool isFirst = true;
+    for (std::size_t i = 0; i < m_mountSources.size(); i++) {
+      const auto& sourceListing = sourceListings[i];
+      const auto status = sourceListing.status;
       if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND) {
         // ディレクトリの存在しないソースは無視
         continue;
@@ -1186,8 +2466,55 @@ NTSTATUS Mount::DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_
       if (status != STATUS_SUCCESS) {
         return status;
       }
-      if (statusFromCallback != STATUS_SUCCESS) {
-        return statusFromCallback;
+      if (sourceListing.statusFromCallback != STATUS_SUCCESS) {
+        return sourceListing.statusFromCallback;
+      }
+
+      const bool canAddCurrentAndParentDirectory = !isRootDirectory && isFirst;
+
+      // refer metadata if available
+      std::shared_lock lock(m_metadataMutex);
+      for (auto findData : sourceListing.entries) {
+        const std::wstring wsFileName(findData.cFileName);
+        const std::wstring wsKey(FilenameToKey(wsFileName));
+        if (!canAddCurrentAndParentDirectory && (wsFileName == L"."sv || wsFileName == L".."sv)) {
+          continue;
+        }
+        if (excludeSet.count(wsKey)) {
+          continue;
+        }
+        if (findDataMap.count(wsKey)) {
+          continue;
+        }
+        if (isRootDirectory && wsKey == systemDataKey) {
+          continue;
+        }
+        // excludeSetに登録されていないということは、このファイルはリネームされていない
+        if (i != TopSourceIndex) {
+          const auto resolvedFilepath = resolvedDirectoryPrefix + wsFileName;
+          if (m_metadataStore.HasMetadataR(resolvedFilepath)) {
+            const auto& metadata = m_metadataStore.GetMetadataR(resolvedFilepath);
+            if (metadata.fileAttributes) {
+              findData.dwFileAttributes = metadata.fileAttributes.value();
+            }
+            if (metadata.creationTime) {
+              findData.ftCreationTime = metadata.creationTime.value();
+            }
+            if (metadata.lastAccessTime) {
+              findData.ftLastAccessTime = metadata.lastAccessTime.value();
+            }
+            if (metadata.lastWriteTime) {
+              findData.ftLastWriteTime = metadata.lastWriteTime.value();
+            }
+          }
+          if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            if (const auto fileSizeN = GetOverlaidFileSizeR(resolvedFilepath)) {
+              findData.nFileSizeHigh = (fileSizeN.value() >> 32) & 0xFFFFFFFF;
+              findData.nFileSizeLow = fileSizeN.value() & 0xFFFFFFFF;
+            }
+          }
+        }
+        findDataMap.emplace(wsKey, findData);
       }
       isFirst = false;
     }
@@ -1198,34 +2525,137 @@ NTSTATUS Mount::DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_
     }
 
 
+    // リネームされてきたものと . と .. を集め、ソースへの問い合わせはまとめて行う
+    struct PendingObject {
+      std::wstring_view filename;
+      std::wstring_view resolvedFullPath;
+      bool forceAddAsDirectory;
+      std::optional<std::size_t> sourceIndex;
+      NTSTATUS status;
+      WIN32_FILE_ATTRIBUTE_DATA win32FileAttributeData;
+    };
+    std::vector<PendingObject> pendingObjects;
+
+    const auto addPendingObject = [&pendingObjects](std::wstring_view filename, std::wstring_view resolvedFullPath, bool forceAddAsDirectory) {
+      pendingObjects.push_back(PendingObject{
+        filename,
+        resolvedFullPath,
+        forceAddAsDirectory,
+        std::nullopt,
+        STATUS_SUCCESS,
+        WIN32_FILE_ATTRIBUTE_DATA{
+          FILE_ATTRIBUTE_DIRECTORY,
+          {0, 0},
+          {0, 0},
+          {0, 0},
+          0,
+          0,
+        },
+      });
+    };
+
+    // add files in includeList
+    for (const auto& [key, value] : includeList) {
+      if (!matchesPattern(key)) {
+        continue;
+      }
+      if (isRootDirectory && FilenameToKey(key) == systemDataKey) {
+        continue;
+      }
+      addPendingObject(key, value, false);
+    }
+    const auto numIncludedObjects = pendingObjects.size();
+
+    // add . and .. for non-root directory
+    if (!isRootDirectory) {
+      if (matchesPattern(L"."sv)) {
+        addPendingObject(L"."sv, resolvedFilename, true);
+      }
+      if (matchesPattern(L".."sv)) {
+        addPendingObject(L".."sv, util::vfs::GetParentPath(resolvedFilename), true);
+      }
+    }
+
+    // 既に列挙済みの名前は問い合わせる必要が無い
+    std::vector<std::size_t> queriedIndices;
+    for (std::size_t i = 0; i < pendingObjects.size(); i++) {
+      if (!findDataMap.count(FilenameToKey(pendingObjects[i].filename))) {
+        queriedIndices.push_back(i);
+      }
+    }
+
+    // 存在するソースを対象と祖先についてまとめて調べ、属性はソースごとにまとめて取得する
+    {
+      std::vector<std::wstring_view> queriedFilenames;
+      for (const auto index : queriedIndices) {
+        queriedFilenames.push_back(pendingObjects[index].resolvedFullPath);
+      }
+      const auto entries = LookupR(queriedFilenames);
+
+      std::vector<std::vector<std::size_t>> sourceObjectIndices(m_mountSources.size());
+      for (std::size_t i = 0; i < queriedIndices.size(); i++) {
+        auto& pendingObject = pendingObjects[queriedIndices[i]];
+        pendingObject.sourceIndex = entries[i].sourceIndex;
+        if (pendingObject.sourceIndex) {
+          sourceObjectIndices[pendingObject.sourceIndex.value()].push_back(queriedIndices[i]);
+        }
+      }
+
+      std::vector<std::wstring> resolvedFullPaths;
+      std::vector<LPCWSTR> fileNames;
+      std::vector<NTSTATUS> statuses;
+      std::vector<WIN32_FILE_ATTRIBUTE_DATA> win32FileAttributeData;
+      for (std::size_t i = 0; i < m_mountSources.size(); i++) {
+        const auto& objectIndices = sourceObjectIndices[i];
+        if (objectIndices.empty()) {
+          continue;
+        }
+        resolvedFullPaths.clear();
+        fileNames.clear();
+        for (const auto index : objectIndices) {
+          resolvedFullPaths.emplace_back(pendingObjects[index].resolvedFullPath);
+        }
+        for (const auto& resolvedFullPath : resolvedFullPaths) {
+          fileNames.push_back(resolvedFullPath.c_str());
+        }
+        statuses.assign(objectIndices.size(), STATUS_SUCCESS);
+        win32FileAttributeData.assign(objectIndices.size(), WIN32_FILE_ATTRIBUTE_DATA{});
+        if (const auto status = m_mountSources[i]->GetFileInfoBatch(fileNames.data(), static_cast<DWORD>(fileNames.size()), statuses.data(), win32FileAttributeData.data()); status != STATUS_SUCCESS) {
+          return status;
+        }
+        for (std::size_t j = 0; j < objectIndices.size(); j++) {
+          auto& pendingObject = pendingObjects[objectIndices[j]];
+          pendingObject.status = statuses[j];
+          if (statuses[j] == STATUS_SUCCESS) {
+            pendingObject.win32FileAttributeData = win32FileAttributeData[j];
+          }
+        }
+      }
+    }
+
     //
-    auto addObject = [this, &findDataMap](std::wstring_view filename, std::wstring_view resolvedFullPath, bool forceAddAsDirectory) -> NTSTATUS {
+    auto addObject = [this, &findDataMap](const PendingObject& pendingObject) -> NTSTATUS {
+      const auto filename = pendingObject.filename;
+      const auto resolvedFullPath = pendingObject.resolvedFullPath;
+      const auto& sourceIndex = pendingObject.sourceIndex;
+
       const std::wstring wsKey = FilenameToKey(filename);
       if (findDataMap.count(wsKey)) {
         return STATUS_OBJECT_NAME_COLLISION;
       }
 
-      WIN32_FILE_ATTRIBUTE_DATA Win32FileAttributeData{
-        FILE_ATTRIBUTE_DIRECTORY,
-        {0, 0},
-        {0, 0},
-        {0, 0},
-        0,
-        0,
-      };
-
-      const auto sourceIndex = GetMountSourceIndexR(resolvedFullPath);
-      if (!forceAddAsDirectory && !sourceIndex) {
+      if (!pendingObject.forceAddAsDirectory && !sourceIndex) {
         // TODO: STATUS_OBJECT_NAME_NOT_FOUNDとSTATUS_OBJECT_PATH_NOT_FOUNDの使い分け
         return STATUS_OBJECT_NAME_NOT_FOUND;
       }
 
-      const std::wstring sResolvedFullPath(resolvedFullPath);
-      if (const auto status = m_mountSources[sourceIndex.value()]->GetFileInfo(sResolvedFullPath.c_str(), &Win32FileAttributeData); status != STATUS_SUCCESS) {
-        return status;
+      if (pendingObject.status != STATUS_SUCCESS) {
+        return pendingObject.status;
       }
 
-      if (sourceIndex != TopSourceIndex) {
+      WIN32_FILE_ATTRIBUTE_DATA Win32FileAttributeData = pendingObject.win32FileAttributeData;
+
+      if (sourceIndex && sourceIndex != TopSourceIndex) {
         std::shared_lock lock(m_metadataMutex);
         if (m_metadataStore.HasMetadataR(resolvedFullPath)) {
           const auto& metadata = m_metadataStore.GetMetadataR(resolvedFullPath);
@@ -1242,6 +2672,10 @@ NTSTATUS Mount::DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_
             Win32FileAttributeData.ftLastWriteTime = metadata.lastWriteTime.value();
           }
         }
+        if (const auto fileSizeN = GetOverlaidFileSizeR(resolvedFullPath)) {
+          Win32FileAttributeData.nFileSizeHigh = (fileSizeN.value() >> 32) & 0xFFFFFFFF;
+          Win32FileAttributeData.nFileSizeLow = fileSizeN.value() & 0xFFFFFFFF;
+        }
       }
 
       Win32FileAttributeData.dwFileAttributes &= ~static_cast<DWORD>(FILE_ATTRIBUTE_REPARSE_POINT);
@@ -1266,21 +2700,24 @@ NTSTATUS Mount::DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_
       return STATUS_SUCCESS;
     };
 
-    // add files in includeList
-    for (const auto& [key, value] : includeList) {
-      if (const auto status = addObject(key, value, false); status != STATUS_SUCCESS) {
-        return status;
+    // . と .. は名前の衝突を無視する
+    for (std::size_t i = 0; i < pendingObjects.size(); i++) {
+      const auto status = addObject(pendingObjects[i]);
+      if (status == STATUS_SUCCESS || (i >= numIncludedObjects && status == STATUS_OBJECT_NAME_COLLISION)) {
+        continue;
       }
+      return status;
     }
 
-    // add . and .. for non-root directory
-    if (!isRootDirectory) {
-      if (const auto status = addObject(L"."sv, resolvedFilename, true); status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_COLLISION) {
-        return status;
-      }
-      if (const auto status = addObject(L".."sv, util::vfs::GetParentPath(resolvedFilename), true); status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_COLLISION) {
-        return status;
+    // store to cache
+    // 絞り込んだ結果はディレクトリ全体の列挙結果ではないのでキャッシュしない
+    if (!filtered && m_listingCache.IsEnabled()) {
+      auto listing = std::make_shared<ListingCache::Listing>();
+      listing->reserve(findDataMap.size());
+      for (const auto& [key, findData] : findDataMap) {
+        listing->push_back(findData);
       }
+      m_listingCache.Set(FileName, resolvedFilename, std::move(listing), listingCacheGeneration);
     }
 
     // call callback
@@ -1310,7 +2747,9 @@ NTSTATUS Mount::DSetFileAttributes(LPCWSTR FileName, DWORD FileAttributes, PDOKA
     auto& fileContext = *ptrFileContext;
     const auto& resolvedFilename = fileContext.resolvedFilename;
     if (fileContext.writable) {
-      return fileContext.mountSource.get().DSetFileAttributes(resolvedFilename.c_str(), FileAttributes, DokanFileInfo, fileContext.id);
+      const auto status = fileContext.mountSource.get().DSetFileAttributes(resolvedFilename.c_str(), FileAttributes, DokanFileInfo, fileContext.id);
+      m_listingCache.InvalidateParent(FileName);
+      return status;
     }
   
     // edit metadata
@@ -1323,6 +2762,7 @@ NTSTATUS Mount::DSetFileAttributes(LPCWSTR FileName, DWORD FileAttributes, PDOKA
       metadata.fileAttributes = filteredFileAttributes;
       m_metadataStore.SetMetadataR(resolvedFilename, metadata);
     }
+    m_listingCache.InvalidateParent(FileName);
 
     /*
     if (const auto status = fileContext.UpdateLastWriteTime(); status != STATUS_SUCCESS) {
@@ -1352,7 +2792,9 @@ NTSTATUS Mount::DSetFileTime(LPCWSTR FileName, const FILETIME *CreationTime, con
     auto& fileContext = *ptrFileContext;
     const auto& resolvedFilename = fileContext.resolvedFilename;
     if (fileContext.writable) {
-      return fileContext.mountSource.get().DSetFileTime(resolvedFilename.c_str(), CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo, fileContext.id);
+      const auto status = fileContext.mountSource.get().DSetFileTime(resolvedFilename.c_str(), CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo, fileContext.id);
+      m_listingCache.InvalidateParent(FileName);
+      return status;
     }
 
     constexpr auto IsZeroFiletime = [](const FILETIME& filetime) -> bool {
@@ -1386,6 +2828,7 @@ NTSTATUS Mount::DSetFileTime(LPCWSTR FileName, const FILETIME *CreationTime, con
       }
       m_metadataStore.SetMetadataR(resolvedFilename, metadata);
     }
+    m_listingCache.InvalidateParent(FileName);
 
     return STATUS_SUCCESS;
   });
@@ -1422,7 +2865,9 @@ NTSTATUS Mount::DDeleteFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) no
       return STATUS_ACCESS_DENIED;
     }
     if (fileContext.writable) {
-      return fileContext.mountSource.get().DDeleteFile(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+      const auto status = fileContext.mountSource.get().DDeleteFile(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+      m_lookupCache.Invalidate(fileContext.resolvedFilename, false);
+      return status;
     }
     // メタデータの編集だけで済むので、常に成功する
     return STATUS_SUCCESS;
@@ -1460,7 +2905,9 @@ NTSTATUS Mount::DDeleteDirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInf
       return STATUS_ACCESS_DENIED;
     }
     if (fileContext.writable) {
-      return fileContext.mountSource.get().DDeleteDirectory(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+      const auto status = fileContext.mountSource.get().DDeleteDirectory(fileContext.resolvedFilename.c_str(), DokanFileInfo, fileContext.id);
+      m_lookupCache.Invalidate(fileContext.resolvedFilename, true);
+      return status;
     }
     // メタデータの編集だけで済むので、常に成功する
     return STATUS_SUCCESS;
@@ -1490,6 +2937,14 @@ NTSTATUS Mount::DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfE
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    // 移動元・移動先それぞれの親ディレクトリと、移動されるディレクトリ以下の列挙結果を無効化する
+    // 処理中に古い結果が登録されないよう、変更を加えた後に呼ぶこと
+    const auto invalidateListingCache = [this, FileName, NewFileName]() {
+      m_listingCache.InvalidateParent(FileName);
+      m_listingCache.InvalidateParent(NewFileName);
+      m_listingCache.Invalidate(FileName, true);
+      m_listingCache.Invalidate(NewFileName, true);
+    };
     // 既に存在するか確認
     if (!ReplaceIfExisting && FileExists(NewFileName)) {
       return STATUS_OBJECT_NAME_COLLISION;
@@ -1511,6 +2966,9 @@ NTSTATUS Mount::DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfE
       if (fileContext.directory) {
         for (std::size_t i = TopSourceIndex + 1; i < m_mountSources.size(); i++) {
           auto& mountSource = *m_mountSources[i];
+          if (!mountSource.MayExist(resolvedFilename)) {
+            continue;
+          }
           if (mountSource.GetFileType(resolvedFilename.c_str()) == FileType::Directory) {
             directlyRenamable = false;
             break;
@@ -1540,8 +2998,13 @@ NTSTATUS Mount::DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfE
             i++;
           } while (FileExists(resolvedNewFileName));
         }
-        if (const auto status = fileContext.mountSource.get().DMoveFile(resolvedFilename.c_str(), resolvedNewFileName.c_str(), ReplaceIfExisting, DokanFileInfo, fileContext.id); status != STATUS_SUCCESS) {
-          return status;
+        const auto moveStatus = fileContext.mountSource.get().DMoveFile(resolvedFilename.c_str(), resolvedNewFileName.c_str(), ReplaceIfExisting, DokanFileInfo, fileContext.id);
+        // 移動元と移動先の両方（ディレクトリの場合はその子孫も）を無効化する
+        m_lookupCache.Invalidate(resolvedFilename, fileContext.directory);
+        m_lookupCache.Invalidate(resolvedNewFileName, true);
+        if (moveStatus != STATUS_SUCCESS) {
+          invalidateListingCache();
+          return moveStatus;
         }
         // リネームにより下位層に隠れていたファイルが出現してしまうことがあるので、その対策
         // TopSourceと比較しているのは、同名の大文字小文字違いにリネームされたときに削除しないようにするため
@@ -1558,6 +3021,7 @@ NTSTATUS Mount::DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfE
           m_metadataStore.Rename(std::wstring(util::vfs::GetParentPathTs(NewFileName)) + std::wstring(util::vfs::GetBaseName(resolvedNewFileName)), NewFileName);
           //m_metadataStore.Rename(resolvedNewFileName, NewFileName);
         }
+        invalidateListingCache();
         return STATUS_SUCCESS;
       }
     }
@@ -1566,6 +3030,7 @@ NTSTATUS Mount::DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfE
       std::lock_guard lock(m_metadataMutex);
       m_metadataStore.Rename(FileName, NewFileName);
     }
+    invalidateListingCache();
     return STATUS_SUCCESS;
   });
 }
@@ -1589,9 +3054,19 @@ NTSTATUS Mount::DSetEndOfFile(LPCWSTR FileName, LONGLONG ByteOffset, PDOKAN_FILE
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (const auto& spOverlay = fileContext.overlay) {
+      fileContext.modified = true;
+      m_listingCache.InvalidateParent(FileName);
+      std::lock_guard overlayLock(spOverlay->mutex);
+      spOverlay->extentMap.Truncate(static_cast<ULONGLONG>(ByteOffset));
+      spOverlay->dirty = true;
+      return STATUS_SUCCESS;
+    }
     if (!fileContext.writable) {
       return STATUS_ACCESS_DENIED;
     }
+    fileContext.modified = true;
+    m_listingCache.InvalidateParent(FileName);
     return fileContext.mountSource.get().DSetEndOfFile(fileContext.resolvedFilename.c_str(), ByteOffset, DokanFileInfo, fileContext.id);
   });
 }
@@ -1615,9 +3090,22 @@ NTSTATUS Mount::DSetAllocationSize(LPCWSTR FileName, LONGLONG AllocSize, PDOKAN_
     }
     auto ptrFileContext = GetFileContextSharedPtr(DokanFileInfo);
     auto& fileContext = *ptrFileContext;
+    if (const auto& spOverlay = fileContext.overlay) {
+      // allocation is not tracked in the overlay; only shrinking changes the file
+      std::lock_guard overlayLock(spOverlay->mutex);
+      if (static_cast<ULONGLONG>(AllocSize) < spOverlay->extentMap.GetFileSize()) {
+        fileContext.modified = true;
+        m_listingCache.InvalidateParent(FileName);
+        spOverlay->extentMap.Truncate(static_cast<ULONGLONG>(AllocSize));
+        spOverlay->dirty = true;
+      }
+      return STATUS_SUCCESS;
+    }
     if (!fileContext.writable) {
       return STATUS_ACCESS_DENIED;
     }
+    fileContext.modified = true;
+    m_listingCache.InvalidateParent(FileName);
     return fileContext.mountSource.get().DSetAllocationSize(fileContext.resolvedFilename.c_str(), AllocSize, DokanFileInfo, fileContext.id);
   });
 }
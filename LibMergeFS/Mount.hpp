@@ -4,11 +4,24 @@
 
 #include "../dokan/dokan/dokan.h"
 
+#include "BlockCache.hpp"
+#include "ConcurrencyLimiter.hpp"
+#include "ExtentMap.hpp"
+#include "ExtentStore.hpp"
+#include "FileContextTable.hpp"
+#include "ListingCache.hpp"
+#include "LookupCache.hpp"
 #include "MountSource.hpp"
 #include "MetadataStore.hpp"
+#include "OperationStatistics.hpp"
+#include "ReadAhead.hpp"
+#include "ThreadPool.hpp"
+#include "TraceRecorder.hpp"
 
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -36,6 +49,24 @@ struct VolumeInfoOverride {
 };
 
 
+struct ReadAheadOptions {
+  bool enabled;
+  std::size_t maxWindowSize;
+  std::size_t memoryBudget;
+};
+
+
+struct DokanTuningOptions {
+  USHORT threadCount;
+  ULONG timeout;
+  ULONG allocationUnitSize;
+  ULONG sectorSize;
+  bool autoConcurrency;
+  std::size_t minConcurrency;
+  std::size_t maxConcurrency;
+};
+
+
 class Mount {
 public:
   class DokanMainError : std::runtime_error {
@@ -47,6 +78,25 @@ public:
     int GetError() const;
   };
 
+  struct CopyUpStatistics {
+    std::size_t numActive;
+    std::size_t numCompleted;
+    std::size_t numCancelled;
+    std::size_t numFailed;
+    ULONGLONG activeCopiedBytes;
+    ULONGLONG activeTotalBytes;
+    ULONGLONG completedBytes;
+    ULONGLONG completedMicroseconds;
+  };
+
+  // how TransportR moves the data; copy-ups use DefaultTransportOptions (see TransportConfig)
+  struct TransportOptions {
+    DWORD bufferSize;   // PORTATION_INFO::bufferSize
+    bool nativeCopy;    // pass the native file handle of the exporter to the importer
+  };
+
+  static const TransportOptions DefaultTransportOptions;
+
 private:
   using FILE_CONTEXT_ID = MountSource::FILE_CONTEXT_ID;
   using PORTATION_INFO = MountSource::PORTATION_INFO;
@@ -55,7 +105,6 @@ private:
   static constexpr FILE_CONTEXT_ID FILE_CONTEXT_ID_NULL = MountSource::FILE_CONTEXT_ID_NULL;
 
   static constexpr std::size_t TopSourceIndex = 0;
-  static constexpr FILE_CONTEXT_ID FileContextIdStart = FILE_CONTEXT_ID_NULL + 1;
 
   enum class ImdState {
     Pending,
@@ -63,6 +112,50 @@ private:
     Finished,
   };
 
+  // background transport of a deferred-copy file to the top source
+  // [0, copiedBytes) is already in the top source, so writes to that range need not wait for the whole copy
+  struct CopyUpJob {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::wstring filename;
+    std::atomic<ULONGLONG> copiedBytes{0};
+    std::atomic<ULONGLONG> totalBytes{0};
+    std::atomic<bool> cancelRequested{false};
+    std::atomic<bool> written{false};   // the top source has data which is not in the original source
+    std::atomic<bool> finished{false};
+    NTSTATUS status = STATUS_PENDING;
+
+    void Progress(ULONGLONG newCopiedBytes);
+    void Complete(NTSTATUS result);
+    void Wait(ULONGLONG requiredBytes);
+  };
+
+  // transports needed to bring a set of files to the top source, computed by PlanCopyUpR
+  struct CopyUpPlan {
+    struct Transport {
+      std::wstring resolvedFilename;
+      std::size_t sourceIndex;
+      FILE_CONTEXT_ID fileContextId;
+    };
+
+    std::vector<Transport> directories;   // missing ancestors (and directory targets); a parent always precedes its children
+    std::vector<Transport> files;         // independent of each other, so they can be transported concurrently
+  };
+
+  // range-based copy-on-write state of a lower-layer file, shared by its file contexts
+  // written ranges are appended to a data file in the top source and looked up through extentMap
+  struct Overlay {
+    std::shared_mutex mutex;
+    std::wstring resolvedFilename;
+    ULONGLONG overlayId;    // 0 until the first write
+    std::wstring dataFilename;
+    FILE_CONTEXT_ID dataFileContextId;
+    DOKAN_FILE_INFO dataFileInfo;   // the data file is not opened by Dokan, so this is our own
+    ExtentMap extentMap;
+    bool dirty;             // extentMap has not been saved to m_extentStore
+    bool discarded;         // the file has been removed or replaced; the data file is deleted on release
+  };
+
   struct FileContext {
     std::shared_mutex mutex;
     FILE_CONTEXT_ID id;
@@ -75,6 +168,7 @@ private:
     std::atomic<bool> copyDeferred;
     std::atomic<bool> autoUpdateLastAccessTime;
     std::atomic<bool> autoUpdateLastWriteTime;
+    std::atomic<bool> modified;
     ULONGLONG fileIndexBase;
     DOKAN_IO_SECURITY_CONTEXT SecurityContext;
     ACCESS_MASK DesiredAccess;
@@ -82,6 +176,13 @@ private:
     ULONG ShareAccess;
     ULONG CreateDisposition;
     ULONG CreateOptions;
+    std::shared_ptr<CopyUpJob> copyUpJob;   // guarded by mutex; set while copyDeferred and a copy-up is running
+    std::shared_ptr<Overlay> overlay;       // set from ZwCreateFile to CloseFile if the file is overlaid
+    std::shared_ptr<ReadAheadStream> readAhead;   // set from ZwCreateFile to CloseFile for read-only opens of lower-layer files
+#ifdef USE_SHARED_PTR_FOR_FILE_CONTEXT
+    // DOKAN_FILE_INFO::Context holds a raw pointer; this lets us get a shared_ptr back without a global lookup
+    std::weak_ptr<FileContext> weakThis;
+#endif
 
     FileContext(const FileContext&) = delete;
 
@@ -89,16 +190,14 @@ private:
     NTSTATUS UpdateLastWriteTime();
   };
 
-  static std::shared_mutex gFileContextMapMutex;
-  static std::unordered_map<Mount::FileContext*, std::shared_ptr<Mount::FileContext>> gFileContextPtrToSharedPtrMap;
-
   std::mutex m_imdMutex;
   std::condition_variable m_imdCv;
   ImdState m_imdState;
   int m_imdResult;
-  std::mutex m_mutex;
+  bool m_headlessUnmountRequested;   // guarded by m_imdMutex
   std::shared_mutex m_metadataMutex;
   const std::wstring m_mountPoint;
+  TraceRecorder m_traceRecorder;    // used by m_mountSources and every thread of this mount, so it is destroyed last
   std::vector<std::unique_ptr<MountSource>> m_mountSources;
   MountSource& m_topSource;
   const bool m_writable;
@@ -106,14 +205,35 @@ private:
   const bool m_deferCopyEnabled;
   const bool m_caseSensitive;
   const VolumeInfoOverride m_volumeInfoOverride;
+  const ReadAheadOptions m_readAheadOptions;
   MetadataStore m_metadataStore;
+  std::mutex m_extentStoreMutex;
+  ExtentStore m_extentStore;
+  std::mutex m_overlayMutex;
+  std::unordered_map<std::wstring, std::weak_ptr<Overlay>> m_openOverlays;
+  std::atomic<FILE_CONTEXT_ID> m_nextInternalFileContextId;
+  LookupCache m_lookupCache;
+  ListingCache m_listingCache;
+  BlockCache& m_blockCache;
+  const std::vector<std::optional<std::uint64_t>> m_blockCacheNamespaces;   // per source; std::nullopt for sources whose data is not cached
 #ifdef USE_SHARED_PTR_FOR_FILE_CONTEXT
-  std::unordered_map<FILE_CONTEXT_ID, std::shared_ptr<FileContext>> m_fileContextMap;
+  FileContextTable<std::shared_ptr<FileContext>> m_fileContextTable;
 #else
-  std::unordered_map<FILE_CONTEXT_ID, std::unique_ptr<FileContext>> m_fileContextMap;
+  FileContextTable<std::unique_ptr<FileContext>> m_fileContextTable;
 #endif
-  FILE_CONTEXT_ID m_minimumUnusedFileContextId;
   std::vector<ULONGLONG> m_fileIndexBases;
+  ThreadPool m_workerPool;
+  ThreadPool m_presenceFilterPool;   // builds the presence filters of m_mountSources after mounting
+  mutable std::mutex m_copyUpMutex;
+  std::unordered_map<FILE_CONTEXT_ID, std::shared_ptr<CopyUpJob>> m_copyUpJobs;
+  CopyUpStatistics m_copyUpStatistics;   // numActive, activeCopiedBytes and activeTotalBytes are computed from m_copyUpJobs
+  ThreadPool m_copyUpPool;
+  OperationStatistics m_operationStatistics;   // Dokan callbacks, recorded by DokanOperations.cpp
+  ReadAheadBudget m_readAheadBudget;
+  ThreadPool m_readAheadPool;   // destroyed before m_readAheadBudget, which the pending prefetches use
+  const DokanTuningOptions m_dokanTuningOptions;
+  ConcurrencyLimiter m_concurrencyLimiter;   // Dokan callbacks, acquired by DokanOperations.cpp
+  const bool m_headless;   // no driver serves the volume; the callbacks are called in-process only (see OperationReplay)
   std::thread m_thread;
 
   static bool HasFileContext(PDOKAN_FILE_INFO DokanFileInfo) noexcept;
@@ -124,29 +244,66 @@ private:
   static FileContext* GetFileContextSharedPtr(PDOKAN_FILE_INFO DokanFileInfo);
 #endif
   //static FileContext& GetFileContext(PDOKAN_FILE_INFO DokanFileInfo);
-  static NTSTATUS TransportR(std::wstring_view path, bool empty, FILE_CONTEXT_ID fileContextId, MountSource& source, MountSource& destination);
+  static NTSTATUS TransportR(std::wstring_view path, bool empty, FILE_CONTEXT_ID fileContextId, MountSource& source, MountSource& destination, const TransportOptions& transportOptions, CopyUpJob* ptrCopyUpJob = nullptr);
 
   std::wstring FilenameToKey(std::wstring_view filename) const;
   std::optional<std::wstring> ResolveFilepathN(std::wstring_view filename);
   std::wstring ResolveFilepath(std::wstring_view filename);
+  std::vector<LookupCache::Entry> LookupNoCacheR(const std::vector<std::wstring_view>& resolvedFilenames);
+  LookupCache::Entry LookupR(std::wstring_view resolvedFilename);
+  std::vector<LookupCache::Entry> LookupR(const std::vector<std::wstring_view>& resolvedFilenames);
   std::optional<std::size_t> GetMountSourceIndexR(std::wstring_view resolvedFilename);
   std::optional<std::size_t> GetMountSourceIndex(std::wstring_view filename);
   bool FileExists(std::wstring_view filename);
   FileType GetFileTypeR(std::wstring_view resolvedFilename);
   FileType GetFileType(std::wstring_view filename);
+  CopyUpPlan PlanCopyUpR(const std::vector<std::wstring>& resolvedFilenames, bool skipExisting);
+  void ExecuteCopyUpPlanR(const CopyUpPlan& plan, bool empty, const TransportOptions& transportOptions = DefaultTransportOptions);
   void CopyFileToTopSourceR(std::wstring_view filename, bool empty = false, FILE_CONTEXT_ID fileContextId = FILE_CONTEXT_ID_NULL);
   void CopyFileToTopSource(std::wstring_view filename, bool empty = false, FILE_CONTEXT_ID fileContextId = FILE_CONTEXT_ID_NULL);
   void RemoveFile(std::wstring_view filename);
   FILE_CONTEXT_ID AssignFileContextId(std::wstring_view FileName, std::wstring_view ResolvedFileName, PDOKAN_FILE_INFO DokanFileInfo, std::size_t mountSourceIndex, bool isDirectory, bool deferCopy, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions);
   bool ReleaseFileContextId(FILE_CONTEXT_ID FileContextId) noexcept;
   bool ReleaseFileContextId(PDOKAN_FILE_INFO DokanFileInfo) noexcept;
+  std::shared_ptr<CopyUpJob> StartCopyUpL(FileContext& fileContext, PDOKAN_FILE_INFO DokanFileInfo);
+  NTSTATUS FinishCopyUpL(FileContext& fileContext, PDOKAN_FILE_INFO DokanFileInfo);
   NTSTATUS TransportIfNeeded(PDOKAN_FILE_INFO DokanFileInfo);
+  std::optional<std::uint64_t> GetBlockCacheNamespaceN(const MountSource& mountSource) const;
+  NTSTATUS ReadSourceR(MountSource& mountSource, const std::wstring& resolvedFilename, LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID fileContextId);
+  std::shared_ptr<ReadAheadStream> OpenReadAheadStream(FileContext& fileContext, PDOKAN_FILE_INFO DokanFileInfo);
+  bool IsSystemDataPath(std::wstring_view filename) const;
+  FILE_CONTEXT_ID NewInternalFileContextId() noexcept;
+  bool CanOverlayR(std::wstring_view resolvedFilename, std::size_t sourceIndex, bool create);
+  std::shared_ptr<Overlay> OpenOverlayR(std::wstring_view resolvedFilename, std::size_t sourceIndex);
+  void ReleaseOverlay(std::shared_ptr<Overlay> spOverlay) noexcept;
+  void DiscardOverlayR(std::wstring_view resolvedFilename);
+  std::optional<ULONGLONG> GetOverlaidFileSizeR(std::wstring_view resolvedFilename);
+  void EnsureOverlayDirectory();
+  void OpenOverlayDataFileL(Overlay& overlay);
+  void SaveOverlayL(Overlay& overlay);
+  void CloseOverlayL(Overlay& overlay) noexcept;
+  NTSTATUS ReadOverlayL(FileContext& fileContext, Overlay& overlay, LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo);
+  NTSTATUS WriteOverlayL(Overlay& overlay, LPCVOID Buffer, DWORD NumberOfBytesToWrite, LPDWORD NumberOfBytesWritten, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo);
+  int HeadlessMain();
 
 public:
-  Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, std::vector<std::unique_ptr<MountSource>>&& sources, std::function<void(Mount&, int)> callback);
+  Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, const ReadAheadOptions& readAheadOptions, const DokanTuningOptions& dokanTuningOptions, bool headless, BlockCache& blockCache, std::vector<std::unique_ptr<MountSource>>&& sources, std::function<void(Mount&, int)> callback);
   ~Mount();
 
   bool IsWritable() const;
+  bool IsHeadless() const;
+  LookupCache::Statistics GetLookupCacheStatistics() const;
+  ListingCache::Statistics GetListingCacheStatistics() const;
+  CopyUpStatistics GetCopyUpStatistics() const;
+  const OperationStatistics& GetOperationStatistics() const;
+  std::vector<OperationStatistics::Entry> GetSourceOperationStatistics(std::size_t sourceIndex) const;
+  MountSource::PresenceFilterStatistics GetPresenceFilterStatistics(std::size_t sourceIndex) const;
+  TraceRecorder& GetTraceRecorder();
+  ConcurrencyLimiter& GetConcurrencyLimiter();
+  void StartTrace(std::size_t maxEvents);
+  void StopTrace();
+  void SaveTrace(std::wstring_view filepath) const;
+  std::optional<ULONGLONG> CopyUpForReplay(std::wstring_view filename, const TransportOptions& transportOptions);
 
   bool SafeUnmount();
   bool Unmount();
@@ -159,6 +316,7 @@ public:
   NTSTATUS DFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
   NTSTATUS DGetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION Buffer, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
   NTSTATUS DFindFiles(LPCWSTR FileName, PFillFindData FillFindData, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
+  NTSTATUS DFindFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PFillFindData FillFindData, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
   NTSTATUS DSetFileAttributes(LPCWSTR FileName, DWORD FileAttributes, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
   NTSTATUS DSetFileTime(LPCWSTR FileName, const FILETIME* CreationTime, const FILETIME* LastAccessTime, const FILETIME* LastWriteTime, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
   NTSTATUS DDeleteFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) noexcept;
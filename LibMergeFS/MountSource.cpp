@@ -1,8 +1,19 @@
 #include "MountSource.hpp"
 #include "NsError.hpp"
+#include "PresenceFilterConfig.hpp"
+#include "Util.hpp"
 
+#include "../Util/VirtualFs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 using namespace std::literals;
 
@@ -23,7 +34,20 @@ MountSource::FileType MountSource::FileAttributesToFileType(DWORD fileAttributes
 
 
 MountSource::MountSource(const PLUGIN_INITIALIZE_MOUNT_INFO& initializeMountInfo, SourcePlugin& sourcePlugin) :
-  m_sourcePlugin(sourcePlugin)
+  m_sourcePlugin(sourcePlugin),
+  m_operationStatistics(SourceOperation{}),
+  m_traceRecorder(nullptr),
+  m_sourceIndex(TraceRecorder::NoSourceIndex),
+  m_presenceFilterMutex(),
+  m_presenceFilterState(PresenceFilterState::None),
+  m_presenceFilterCaseSensitive(false),
+  m_pendingDirectoryHashes(),
+  m_presenceFilter(),
+  m_readyPresenceFilter(nullptr),
+  m_presenceFilterCancelled(false),
+  m_presenceFilterQueries(0),
+  m_presenceFilterNegatives(0),
+  m_presenceFilterPassedInexistent(0)
 {
   if (const auto status = m_sourcePlugin.Mount(&initializeMountInfo, m_sourceContextId); status != STATUS_SUCCESS) {
     throw NsError(status);
@@ -42,9 +66,248 @@ const MountSource::SOURCE_INFO& MountSource::GetSourceInfo() const noexcept {
 }
 
 
+const OperationStatistics& MountSource::GetOperationStatistics() const noexcept {
+  return m_operationStatistics;
+}
+
+
+void MountSource::AttachTraceRecorder(TraceRecorder& traceRecorder, std::size_t sourceIndex) noexcept {
+  m_traceRecorder = &traceRecorder;
+  m_sourceIndex = static_cast<std::uint32_t>(sourceIndex);
+}
+
+
+std::uint64_t MountSource::HashDirectory(std::wstring_view resolvedFilename) const {
+  return PresenceFilter::Hash(FilenameToKey(resolvedFilename, m_presenceFilterCaseSensitive));
+}
+
+
+// walks the directories below resolvedFilename and hashes them as if they were below hashedFilename
+// returns false if cancelled, if listing a directory failed or if there are more than maxDirectories directories
+bool MountSource::CollectDirectoryHashes(std::wstring_view resolvedFilename, std::wstring_view hashedFilename, std::size_t maxDirectories, std::vector<std::uint64_t>& hashes) const {
+  const auto toPrefix = [](std::wstring_view directory) {
+    return util::vfs::IsRootDirectory(directory) ? L"\\"s : std::wstring(directory) + L"\\"s;
+  };
+
+  // (resolved path, hashed path)
+  std::vector<std::pair<std::wstring, std::wstring>> stack;
+  stack.emplace_back(resolvedFilename, hashedFilename);
+  // (name, whether to descend into it)
+  std::vector<std::pair<std::wstring, bool>> children;
+  std::size_t numDirectories = 0;
+  while (!stack.empty()) {
+    if (m_presenceFilterCancelled.load(std::memory_order_relaxed)) {
+      return false;
+    }
+
+    const auto [directory, hashedDirectory] = std::move(stack.back());
+    stack.pop_back();
+
+    // ジャンクションなどは辿らない（存在は記録する）
+    children.clear();
+    const auto status = ListFiles(directory.c_str(), [&children](PWIN32_FIND_DATAW findData) {
+      if (!(findData->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return;
+      }
+      const std::wstring_view name(findData->cFileName);
+      if (name == L"."sv || name == L".."sv) {
+        return;
+      }
+      children.emplace_back(name, !(findData->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT));
+    });
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND) {
+      // 走査中に削除された
+      continue;
+    }
+    if (status != STATUS_SUCCESS) {
+      return false;
+    }
+
+    const auto prefix = toPrefix(directory);
+    const auto hashedPrefix = toPrefix(hashedDirectory);
+    for (const auto& [name, descend] : children) {
+      if (++numDirectories > maxDirectories) {
+        return false;
+      }
+      auto hashedChild = hashedPrefix + name;
+      hashes.push_back(HashDirectory(hashedChild));
+      if (descend) {
+        stack.emplace_back(prefix + name, std::move(hashedChild));
+      }
+    }
+  }
+  return true;
+}
+
+
+void MountSource::AddPresentDirectories(const std::vector<std::uint64_t>& hashes) noexcept {
+  try {
+    std::lock_guard lock(m_presenceFilterMutex);
+    switch (m_presenceFilterState) {
+      case PresenceFilterState::None:
+        return;
+
+      case PresenceFilterState::Building:
+        m_pendingDirectoryHashes.insert(m_pendingDirectoryHashes.end(), hashes.cbegin(), hashes.cend());
+        return;
+
+      case PresenceFilterState::Ready:
+        for (const auto hash : hashes) {
+          m_presenceFilter->Add(hash);
+        }
+        return;
+    }
+  } catch (...) {
+    std::lock_guard lock(m_presenceFilterMutex);
+    DisablePresenceFilterL();
+  }
+}
+
+
+// a directory could not be recorded; the filter might deny it, so stop filtering
+// MayExist may still be reading m_presenceFilter, so it is not freed here
+void MountSource::DisablePresenceFilterL() noexcept {
+  m_readyPresenceFilter.store(nullptr, std::memory_order_release);
+  m_presenceFilterState = PresenceFilterState::None;
+  m_pendingDirectoryHashes.clear();
+}
+
+
+// the directory is recorded before it is created; a failed creation only leaves a false positive
+void MountSource::NoteCreatedDirectory(LPCWSTR FileName) noexcept {
+  {
+    std::lock_guard lock(m_presenceFilterMutex);
+    if (m_presenceFilterState == PresenceFilterState::None) {
+      return;
+    }
+  }
+  try {
+    AddPresentDirectories({HashDirectory(FileName)});
+  } catch (...) {
+    std::lock_guard lock(m_presenceFilterMutex);
+    DisablePresenceFilterL();
+  }
+}
+
+
+// the directories below FileName will be found below NewFileName; record them before moving
+void MountSource::NoteMovedDirectory(LPCWSTR FileName, LPCWSTR NewFileName) noexcept {
+  {
+    std::lock_guard lock(m_presenceFilterMutex);
+    if (m_presenceFilterState == PresenceFilterState::None) {
+      return;
+    }
+  }
+  try {
+    std::vector<std::uint64_t> hashes{HashDirectory(NewFileName)};
+    if (CollectDirectoryHashes(FileName, NewFileName, PresenceFilterConfig::MaxDirectories, hashes)) {
+      AddPresentDirectories(hashes);
+      return;
+    }
+  } catch (...) {}
+  std::lock_guard lock(m_presenceFilterMutex);
+  DisablePresenceFilterL();
+}
+
+
+void MountSource::BuildPresenceFilter(bool caseSensitive, bool maintained) noexcept {
+  try {
+    {
+      std::lock_guard lock(m_presenceFilterMutex);
+      if (m_presenceFilterState != PresenceFilterState::None || m_presenceFilter) {
+        return;
+      }
+      m_presenceFilterCaseSensitive = caseSensitive;
+      m_presenceFilterState = PresenceFilterState::Building;
+    }
+
+    std::vector<std::uint64_t> hashes;
+    const bool complete = CollectDirectoryHashes(L"\\"sv, L"\\"sv, PresenceFilterConfig::MaxDirectories, hashes);
+
+    std::lock_guard lock(m_presenceFilterMutex);
+    // disabled while building (see NoteMovedDirectory)
+    if (!complete || m_presenceFilterState != PresenceFilterState::Building) {
+      DisablePresenceFilterL();
+      return;
+    }
+    const std::size_t capacity = maintained ? std::max(hashes.size() * PresenceFilterConfig::WritableCapacityFactor, PresenceFilterConfig::WritableMinCapacity) : hashes.size();
+    auto presenceFilter = std::make_unique<PresenceFilter>(capacity, PresenceFilterConfig::BitsPerDirectory, PresenceFilterConfig::NumHashes);
+    for (const auto hash : hashes) {
+      presenceFilter->Add(hash);
+    }
+    for (const auto hash : m_pendingDirectoryHashes) {
+      presenceFilter->Add(hash);
+    }
+    m_pendingDirectoryHashes.clear();
+    m_pendingDirectoryHashes.shrink_to_fit();
+    m_presenceFilter = std::move(presenceFilter);
+    m_readyPresenceFilter.store(m_presenceFilter.get(), std::memory_order_release);
+    m_presenceFilterState = PresenceFilterState::Ready;
+  } catch (...) {
+    std::lock_guard lock(m_presenceFilterMutex);
+    DisablePresenceFilterL();
+  }
+}
+
+
+void MountSource::CancelPresenceFilterBuild() noexcept {
+  m_presenceFilterCancelled.store(true, std::memory_order_relaxed);
+}
+
+
+bool MountSource::MayExist(std::wstring_view resolvedFilename) const noexcept {
+  const auto presenceFilter = m_readyPresenceFilter.load(std::memory_order_acquire);
+  if (!presenceFilter) {
+    return true;
+  }
+  try {
+    if (util::vfs::IsRootDirectory(resolvedFilename)) {
+      return true;
+    }
+    const auto parent = util::vfs::GetParentPath(resolvedFilename);
+    if (util::vfs::IsRootDirectory(parent)) {
+      return true;
+    }
+    m_presenceFilterQueries.fetch_add(1, std::memory_order_relaxed);
+    if (presenceFilter->MayContain(HashDirectory(parent))) {
+      return true;
+    }
+    m_presenceFilterNegatives.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  } catch (...) {
+    return true;
+  }
+}
+
+
+void MountSource::RecordPresenceFilterMisses(std::size_t count) noexcept {
+  if (!count || !m_readyPresenceFilter.load(std::memory_order_relaxed)) {
+    return;
+  }
+  m_presenceFilterPassedInexistent.fetch_add(count, std::memory_order_relaxed);
+}
+
+
+MountSource::PresenceFilterStatistics MountSource::GetPresenceFilterStatistics() const noexcept {
+  std::lock_guard lock(m_presenceFilterMutex);
+  const bool ready = m_presenceFilterState == PresenceFilterState::Ready;
+  return PresenceFilterStatistics{
+    ready,
+    ready ? m_presenceFilter->GetNumKeys() : 0,
+    ready ? m_presenceFilter->GetNumBytes() : 0,
+    ready ? m_presenceFilter->GetFalsePositiveRate() : 0.0,
+    m_presenceFilterQueries.load(std::memory_order_relaxed),
+    m_presenceFilterNegatives.load(std::memory_order_relaxed),
+    m_presenceFilterPassedInexistent.load(std::memory_order_relaxed),
+  };
+}
+
+
 NTSTATUS MountSource::GetFileInfoAttributes(LPCWSTR FileName, DWORD* FileAttributes) const noexcept {
   WIN32_FILE_ATTRIBUTE_DATA win32FileAttributeData;
-  const auto status = m_sourcePlugin.GetFileInfo(FileName, &win32FileAttributeData, m_sourceContextId);
+  const auto status = Measure(SourceOperation::GetFileInfo, FileName, [&]() {
+    return m_sourcePlugin.GetFileInfo(FileName, &win32FileAttributeData, m_sourceContextId);
+  });
   if (FileAttributes) {
     *FileAttributes = win32FileAttributeData.dwFileAttributes;
   }
@@ -65,79 +328,160 @@ MountSource::FileType MountSource::GetFileType(LPCWSTR FileName) const {
 }
 
 
+void MountSource::GetFileTypes(const LPCWSTR* FileNames, std::size_t Count, FileType* fileTypes) const {
+  if (Count == 0) {
+    return;
+  }
+  if (Count == 1) {
+    fileTypes[0] = GetFileType(FileNames[0]);
+    return;
+  }
+  std::vector<NTSTATUS> statuses(Count);
+  std::vector<WIN32_FILE_ATTRIBUTE_DATA> win32FileAttributeData(Count);
+  if (const auto status = GetFileInfoBatch(FileNames, static_cast<DWORD>(Count), statuses.data(), win32FileAttributeData.data()); status != STATUS_SUCCESS) {
+    throw NsError(status);
+  }
+  for (std::size_t i = 0; i < Count; i++) {
+    const auto status = statuses[i];
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND) {
+      fileTypes[i] = FileType::Inexistent;
+      continue;
+    }
+    if (status != STATUS_SUCCESS) {
+      throw NsError(status);
+    }
+    fileTypes[i] = FileAttributesToFileType(win32FileAttributeData[i].dwFileAttributes);
+  }
+}
+
+
 NTSTATUS MountSource::GetDirectoryInfo(LPCWSTR FileName) const noexcept {
-  return m_sourcePlugin.GetDirectoryInfo(FileName, m_sourceContextId);
+  return Measure(SourceOperation::GetDirectoryInfo, FileName, [&]() {
+    return m_sourcePlugin.GetDirectoryInfo(FileName, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) const noexcept {
-  return m_sourcePlugin.GetFileInfo(FileName, Win32FileAttributeData, m_sourceContextId);
+  return Measure(SourceOperation::GetFileInfo, FileName, [&]() {
+    return m_sourcePlugin.GetFileInfo(FileName, Win32FileAttributeData, m_sourceContextId);
+  });
+}
+
+
+// recorded as one operation, traced with the first file name
+NTSTATUS MountSource::GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) const noexcept {
+  return Measure(SourceOperation::GetFileInfoBatch, Count ? FileNames[0] : L"", [&]() {
+    return m_sourcePlugin.GetFileInfoBatch(FileNames, Count, Statuses, Win32FileAttributeData, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::RemoveFile(LPCWSTR FileName) noexcept {
-  return m_sourcePlugin.RemoveFile(FileName, m_sourceContextId);
+  return Measure(SourceOperation::RemoveFile, FileName, [&]() {
+    return m_sourcePlugin.RemoveFile(FileName, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ExportStart(PORTATION_INFO* PortationInfo) noexcept {
-  return m_sourcePlugin.ExportStart(PortationInfo, m_sourceContextId);
+  return Measure(SourceOperation::ExportStart, PortationInfo->filepath, [&]() {
+    return m_sourcePlugin.ExportStart(PortationInfo, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ExportData(PORTATION_INFO* PortationInfo) noexcept {
-  return m_sourcePlugin.ExportData(PortationInfo, m_sourceContextId);
+  return Measure(SourceOperation::ExportData, PortationInfo->filepath, [&]() {
+    return m_sourcePlugin.ExportData(PortationInfo, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ExportFinish(PORTATION_INFO* PortationInfo, bool Success) noexcept {
-  return m_sourcePlugin.ExportFinish(PortationInfo, Success ? TRUE : FALSE, m_sourceContextId);
+  return Measure(SourceOperation::ExportFinish, PortationInfo->filepath, [&]() {
+    return m_sourcePlugin.ExportFinish(PortationInfo, Success ? TRUE : FALSE, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ImportStart(PORTATION_INFO* PortationInfo) noexcept {
-  return m_sourcePlugin.ImportStart(PortationInfo, m_sourceContextId);
+  if (PortationInfo->directory) {
+    NoteCreatedDirectory(PortationInfo->filepath);
+  }
+  return Measure(SourceOperation::ImportStart, PortationInfo->filepath, [&]() {
+    return m_sourcePlugin.ImportStart(PortationInfo, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ImportData(PORTATION_INFO* PortationInfo) noexcept {
-  return m_sourcePlugin.ImportData(PortationInfo, m_sourceContextId);
+  return Measure(SourceOperation::ImportData, PortationInfo->filepath, [&]() {
+    return m_sourcePlugin.ImportData(PortationInfo, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ImportFinish(PORTATION_INFO* PortationInfo, bool Success) noexcept {
-  return m_sourcePlugin.ImportFinish(PortationInfo, Success ? TRUE : FALSE, m_sourceContextId);
+  return Measure(SourceOperation::ImportFinish, PortationInfo->filepath, [&]() {
+    return m_sourcePlugin.ImportFinish(PortationInfo, Success ? TRUE : FALSE, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::SwitchSourceClose(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.SwitchSourceClose(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SwitchSourceClose, FileName, [&]() {
+    return m_sourcePlugin.SwitchSourceClose(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::SwitchDestinationPrepare(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.SwitchDestinationPrepare(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SwitchDestinationPrepare, FileName, [&]() {
+    return m_sourcePlugin.SwitchDestinationPrepare(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::SwitchDestinationOpen(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.SwitchDestinationOpen(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SwitchDestinationOpen, FileName, [&]() {
+    return m_sourcePlugin.SwitchDestinationOpen(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::SwitchDestinationCleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.SwitchDestinationCleanup(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SwitchDestinationCleanup, FileName, [&]() {
+    return m_sourcePlugin.SwitchDestinationCleanup(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::SwitchDestinationClose(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.SwitchDestinationClose(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SwitchDestinationClose, FileName, [&]() {
+    return m_sourcePlugin.SwitchDestinationClose(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::ListFiles(LPCWSTR FileName, ListFilesCallback Callback) const noexcept {
   try {
-    return m_sourcePlugin.ListFiles(FileName, Callback, m_sourceContextId);
+    return Measure(SourceOperation::ListFiles, FileName, [&]() {
+      return m_sourcePlugin.ListFiles(FileName, Callback, m_sourceContextId);
+    });
+  } catch (std::bad_alloc&) {
+    return STATUS_NO_MEMORY;
+  } catch (...) {
+    return STATUS_UNSUCCESSFUL;
+  }
+}
+
+
+NTSTATUS MountSource::ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, ListFilesCallback Callback) const noexcept {
+  try {
+    return Measure(SourceOperation::ListFilesWithPattern, FileName, [&]() {
+      return m_sourcePlugin.ListFilesWithPattern(FileName, SearchPattern, Callback, m_sourceContextId);
+    });
   } catch (std::bad_alloc&) {
     return STATUS_NO_MEMORY;
   } catch (...) {
@@ -148,7 +492,9 @@ NTSTATUS MountSource::ListFiles(LPCWSTR FileName, ListFilesCallback Callback) co
 
 NTSTATUS MountSource::ListStreams(LPCWSTR FileName, ListStreamsCallback Callback) const noexcept {
   try {
-    return m_sourcePlugin.ListStreams(FileName, Callback, m_sourceContextId);
+    return Measure(SourceOperation::ListStreams, FileName, [&]() {
+      return m_sourcePlugin.ListStreams(FileName, Callback, m_sourceContextId);
+    });
   } catch (std::bad_alloc&) {
     return STATUS_NO_MEMORY;
   } catch (...) {
@@ -158,92 +504,134 @@ NTSTATUS MountSource::ListStreams(LPCWSTR FileName, ListStreamsCallback Callback
 
 
 NTSTATUS MountSource::DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, bool MaybeSwitched, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DZwCreateFile(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, MaybeSwitched ? TRUE : FALSE, FileContextId, m_sourceContextId);
+  if ((CreateOptions & FILE_DIRECTORY_FILE) && (CreateDisposition == FILE_CREATE || CreateDisposition == FILE_OPEN_IF)) {
+    NoteCreatedDirectory(FileName);
+  }
+  return Measure(SourceOperation::ZwCreateFile, FileName, [&]() {
+    return m_sourcePlugin.DZwCreateFile(FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, MaybeSwitched ? TRUE : FALSE, FileContextId, m_sourceContextId);
+  });
 }
 
 
 void MountSource::DCleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  m_sourcePlugin.DCleanup(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  Measure(SourceOperation::Cleanup, FileName, [&]() {
+    m_sourcePlugin.DCleanup(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 void MountSource::DCloseFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  m_sourcePlugin.DCloseFile(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  Measure(SourceOperation::CloseFile, FileName, [&]() {
+    m_sourcePlugin.DCloseFile(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DReadFile(LPCWSTR FileName, LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
   // MUST BE THEAD SAFE
-  return m_sourcePlugin.DReadFile(FileName, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::ReadFile, FileName, [&]() {
+    return m_sourcePlugin.DReadFile(FileName, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DWriteFile(LPCWSTR FileName, LPCVOID Buffer, DWORD NumberOfBytesToWrite, LPDWORD NumberOfBytesWritten, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
   // MUST BE THEAD SAFE
-  return m_sourcePlugin.DWriteFile(FileName, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::WriteFile, FileName, [&]() {
+    return m_sourcePlugin.DWriteFile(FileName, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, Offset, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DFlushFileBuffers(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::FlushFileBuffers, FileName, [&]() {
+    return m_sourcePlugin.DFlushFileBuffers(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DGetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION Buffer, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DGetFileInformation(FileName, Buffer, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::GetFileInformation, FileName, [&]() {
+    return m_sourcePlugin.DGetFileInformation(FileName, Buffer, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DSetFileAttributes(LPCWSTR FileName, DWORD FileAttributes, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DSetFileAttributes(FileName, FileAttributes, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SetFileAttributes, FileName, [&]() {
+    return m_sourcePlugin.DSetFileAttributes(FileName, FileAttributes, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DSetFileTime(LPCWSTR FileName, const FILETIME* CreationTime, const FILETIME* LastAccessTime, const FILETIME* LastWriteTime, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DSetFileTime(FileName, CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SetFileTime, FileName, [&]() {
+    return m_sourcePlugin.DSetFileTime(FileName, CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DDeleteFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DDeleteFile(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::DeleteFile, FileName, [&]() {
+    return m_sourcePlugin.DDeleteFile(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DDeleteDirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DDeleteDirectory(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::DeleteDirectory, FileName, [&]() {
+    return m_sourcePlugin.DDeleteDirectory(FileName, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DMoveFile(LPCWSTR FileName, LPCWSTR NewFileName, bool ReplaceIfExisting, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DMoveFile(FileName, NewFileName, ReplaceIfExisting, DokanFileInfo, FileContextId, m_sourceContextId);
+  if (DokanFileInfo && DokanFileInfo->IsDirectory) {
+    NoteMovedDirectory(FileName, NewFileName);
+  }
+  return Measure(SourceOperation::MoveFile, FileName, [&]() {
+    return m_sourcePlugin.DMoveFile(FileName, NewFileName, ReplaceIfExisting, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DSetEndOfFile(LPCWSTR FileName, LONGLONG ByteOffset, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DSetEndOfFile(FileName, ByteOffset, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SetEndOfFile, FileName, [&]() {
+    return m_sourcePlugin.DSetEndOfFile(FileName, ByteOffset, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DSetAllocationSize(LPCWSTR FileName, LONGLONG AllocSize, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DSetAllocationSize(FileName, AllocSize, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SetAllocationSize, FileName, [&]() {
+    return m_sourcePlugin.DSetAllocationSize(FileName, AllocSize, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DGetDiskFreeSpace(PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes, PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) noexcept {
-  return m_sourcePlugin.DGetDiskFreeSpace(FreeBytesAvailable, TotalNumberOfBytes, TotalNumberOfFreeBytes, DokanFileInfo, m_sourceContextId);
+  return Measure(SourceOperation::GetDiskFreeSpace, nullptr, [&]() {
+    return m_sourcePlugin.DGetDiskFreeSpace(FreeBytesAvailable, TotalNumberOfBytes, TotalNumberOfFreeBytes, DokanFileInfo, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber, LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize, PDOKAN_FILE_INFO DokanFileInfo) noexcept {
-  return m_sourcePlugin.DGetVolumeInformation(VolumeNameBuffer, VolumeNameSize, VolumeSerialNumber, MaximumComponentLength, FileSystemFlags, FileSystemNameBuffer, FileSystemNameSize, DokanFileInfo, m_sourceContextId);
+  return Measure(SourceOperation::GetVolumeInformation, nullptr, [&]() {
+    return m_sourcePlugin.DGetVolumeInformation(VolumeNameBuffer, VolumeNameSize, VolumeSerialNumber, MaximumComponentLength, FileSystemFlags, FileSystemNameBuffer, FileSystemNameSize, DokanFileInfo, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DGetFileSecurity(LPCWSTR FileName, PSECURITY_INFORMATION SecurityInformation, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG BufferLength, PULONG LengthNeeded, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DGetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, LengthNeeded, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::GetFileSecurity, FileName, [&]() {
+    return m_sourcePlugin.DGetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, LengthNeeded, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
 
 
 NTSTATUS MountSource::DSetFileSecurity(LPCWSTR FileName, PSECURITY_INFORMATION SecurityInformation, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG BufferLength, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept {
-  return m_sourcePlugin.DSetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, DokanFileInfo, FileContextId, m_sourceContextId);
+  return Measure(SourceOperation::SetFileSecurity, FileName, [&]() {
+    return m_sourcePlugin.DSetFileSecurity(FileName, SecurityInformation, SecurityDescriptor, BufferLength, DokanFileInfo, FileContextId, m_sourceContextId);
+  });
 }
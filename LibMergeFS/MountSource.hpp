@@ -2,10 +2,21 @@
 
 #include "../dokan/dokan/dokan.h"
 
+#include "OperationStatistics.hpp"
+#include "PresenceFilter.hpp"
 #include "SourcePlugin.hpp"
+#include "TraceRecorder.hpp"
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 
 
@@ -25,6 +36,16 @@ public:
     File,
   };
 
+  struct PresenceFilterStatistics {
+    bool ready;
+    std::size_t numDirectories;
+    std::size_t numBytes;
+    double estimatedFalsePositiveRate;
+    std::uint64_t queries;
+    std::uint64_t negatives;          // lookups which skipped this source
+    std::uint64_t passedInexistent;   // lookups which passed the filter but found nothing there; an upper bound of the false positives
+  };
+
   static constexpr SOURCE_CONTEXT_ID SOURCE_CONTEXT_ID_NULL = SourcePlugin::SOURCE_CONTEXT_ID_NULL;
   static constexpr FILE_CONTEXT_ID FILE_CONTEXT_ID_NULL = SourcePlugin::FILE_CONTEXT_ID_NULL;
 
@@ -39,6 +60,44 @@ private:
   SourcePlugin& m_sourcePlugin;
   SOURCE_CONTEXT_ID m_sourceContextId;
   SOURCE_INFO m_sourceInfo;
+  OperationStatistics m_operationStatistics;    // every call to m_sourcePlugin is recorded
+  TraceRecorder* m_traceRecorder;   // the trace of the mount which uses this source; nullptr until attached
+  std::uint32_t m_sourceIndex;
+
+  // presence filter over the directory paths of this source (see BuildPresenceFilter)
+  enum class PresenceFilterState {
+    None,
+    Building,
+    Ready,
+  };
+  mutable std::mutex m_presenceFilterMutex;
+  PresenceFilterState m_presenceFilterState;                 // guarded by m_presenceFilterMutex
+  bool m_presenceFilterCaseSensitive;                        // set before m_presenceFilterState leaves None
+  std::vector<std::uint64_t> m_pendingDirectoryHashes;       // directories created while building; guarded by m_presenceFilterMutex
+  std::unique_ptr<PresenceFilter> m_presenceFilter;          // kept until destruction once built, even if disabled later
+  std::atomic<const PresenceFilter*> m_readyPresenceFilter;  // nullptr unless m_presenceFilterState is Ready
+  std::atomic<bool> m_presenceFilterCancelled;
+  mutable std::atomic<std::uint64_t> m_presenceFilterQueries;
+  mutable std::atomic<std::uint64_t> m_presenceFilterNegatives;
+  std::atomic<std::uint64_t> m_presenceFilterPassedInexistent;
+
+  // records a call to m_sourcePlugin in the statistics and, while the mount is tracing, in its trace
+  template<typename F>
+  auto Measure(SourceOperation operation, LPCWSTR path, F&& function) const {
+    if (!m_traceRecorder) {
+      return m_operationStatistics.Measure(operation, std::forward<F>(function));
+    }
+    return m_traceRecorder->Trace(TraceCategory::Source, OperationStatistics::GetName(operation), m_sourceIndex, path, [&]() {
+      return m_operationStatistics.Measure(operation, std::forward<F>(function));
+    });
+  }
+
+  std::uint64_t HashDirectory(std::wstring_view resolvedFilename) const;
+  bool CollectDirectoryHashes(std::wstring_view resolvedFilename, std::wstring_view hashedFilename, std::size_t maxDirectories, std::vector<std::uint64_t>& hashes) const;
+  void AddPresentDirectories(const std::vector<std::uint64_t>& hashes) noexcept;
+  void DisablePresenceFilterL() noexcept;
+  void NoteCreatedDirectory(LPCWSTR FileName) noexcept;
+  void NoteMovedDirectory(LPCWSTR FileName, LPCWSTR NewFileName) noexcept;
 
 public:
   static FileType FileAttributesToFileType(DWORD fileAttributes) noexcept;
@@ -47,10 +106,23 @@ public:
   ~MountSource();
 
   const SOURCE_INFO& GetSourceInfo() const noexcept;
+  const OperationStatistics& GetOperationStatistics() const noexcept;
+  void AttachTraceRecorder(TraceRecorder& traceRecorder, std::size_t sourceIndex) noexcept;
+  // walks all directories of the source and starts filtering lookups with them; nothing is filtered if the walk fails
+  // maintained filters also learn the directories created or moved through this MountSource
+  void BuildPresenceFilter(bool caseSensitive, bool maintained) noexcept;
+  void CancelPresenceFilterBuild() noexcept;
+  // false if the parent directory of resolvedFilename is definitely not in this source, so neither is resolvedFilename
+  bool MayExist(std::wstring_view resolvedFilename) const noexcept;
+  void RecordPresenceFilterMisses(std::size_t count) noexcept;
+  PresenceFilterStatistics GetPresenceFilterStatistics() const noexcept;
   NTSTATUS GetFileInfoAttributes(LPCWSTR FileName, DWORD* FileAttributes) const noexcept;
   FileType GetFileType(LPCWSTR FileName) const;
+  // one plugin call for all files; fileTypes[i] receives the type of FileNames[i] and errors other than inexistence throw NsError like GetFileType
+  void GetFileTypes(const LPCWSTR* FileNames, std::size_t Count, FileType* fileTypes) const;
   NTSTATUS GetDirectoryInfo(LPCWSTR FileName) const noexcept;
   NTSTATUS GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) const noexcept;
+  NTSTATUS GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) const noexcept;
   NTSTATUS RemoveFile(LPCWSTR FileName) noexcept;
   NTSTATUS ExportStart(PORTATION_INFO* PortationInfo) noexcept;
   NTSTATUS ExportData(PORTATION_INFO* PortationInfo) noexcept;
@@ -64,6 +136,7 @@ public:
   NTSTATUS SwitchDestinationCleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept;
   NTSTATUS SwitchDestinationClose(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) noexcept;
   NTSTATUS ListFiles(LPCWSTR FileName, ListFilesCallback Callback) const noexcept;
+  NTSTATUS ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, ListFilesCallback Callback) const noexcept;
   NTSTATUS ListStreams(LPCWSTR FileName, ListStreamsCallback Callback) const noexcept;
 
   NTSTATUS DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, bool MaybeSwitched, FILE_CONTEXT_ID FileContextId) noexcept;
@@ -1,10 +1,12 @@
 #include "MountStore.hpp"
 #include "Mount.hpp"
+#include "CacheConfig.hpp"
 
 #include <algorithm>
 #include <cstddef>
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <string>
 #include <string_view>
@@ -178,6 +180,7 @@ const MOUNT_INFO& MountStore::MountData::MountInfoWrapper::Get() const {
 
 
 MountStore::MountStore() :
+  m_blockCache(CacheConfig::BlockCacheMaxBytes, CacheConfig::BlockCacheBlockSize),
   m_generalMutex(),
   m_mountMap(),
   m_minimumUnusedMountId(MountIdStart),
@@ -231,7 +234,7 @@ MountStore::~MountStore() {
 }
 
 
-MountStore::MOUNT_ID MountStore::Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, const std::vector<std::pair<PLUGIN_ID, PLUGIN_INITIALIZE_MOUNT_INFO>>& sources, std::function<void(MOUNT_ID, const MOUNT_INFO*, int)> callback) {
+MountStore::MOUNT_ID MountStore::Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, const ReadAheadOptions& readAheadOptions, const DokanTuningOptions& dokanTuningOptions, bool headless, const std::vector<std::pair<PLUGIN_ID, PLUGIN_INITIALIZE_MOUNT_INFO>>& sources, std::function<void(MOUNT_ID, const MOUNT_INFO*, int)> callback) {
   if (sources.empty()) {
     throw NoSourceError();
   }
@@ -259,7 +262,7 @@ MountStore::MOUNT_ID MountStore::Mount(std::wstring_view mountPoint, bool writab
   } while (m_mountMap.count(m_minimumUnusedMountId));
 
   MountData::MountInfoWrapper wrappedMountInfo(mountPoint, writable, metadataFileName, deferCopyEnabled, caseSensitive, sources);
-  auto mount = std::make_unique<::Mount>(mountPoint, writable, metadataFileName, deferCopyEnabled, caseSensitive, volumeInfoOverride, std::move(mountSources), [this, callback, mountId, wrappedMountInfo](::Mount& mount, int dokanMainResult) mutable {
+  auto mount = std::make_unique<::Mount>(mountPoint, writable, metadataFileName, deferCopyEnabled, caseSensitive, volumeInfoOverride, readAheadOptions, dokanTuningOptions, headless, m_blockCache, std::move(mountSources), [this, callback, mountId, wrappedMountInfo](::Mount& mount, int dokanMainResult) mutable {
     wrappedMountInfo.SetWritable(mount.IsWritable());
 
     callback(mountId, &wrappedMountInfo.Get(), dokanMainResult);
@@ -315,6 +318,76 @@ const MOUNT_INFO& MountStore::GetMountInfo(MOUNT_ID mountId) const {
 }
 
 
+Mount::CopyUpStatistics MountStore::GetCopyUpStatistics(MOUNT_ID mountId) const {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  return m_mountMap.at(mountId).mount->GetCopyUpStatistics();
+}
+
+
+// sourceIndex == std::nullopt for the Dokan callbacks of the mount itself
+std::vector<OperationStatistics::Entry> MountStore::GetOperationStatistics(MOUNT_ID mountId, std::optional<std::size_t> sourceIndex) const {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  const auto& mount = *m_mountMap.at(mountId).mount;
+  if (!sourceIndex) {
+    return mount.GetOperationStatistics().Get();
+  }
+  return mount.GetSourceOperationStatistics(sourceIndex.value());
+}
+
+
+MountSource::PresenceFilterStatistics MountStore::GetPresenceFilterStatistics(MOUNT_ID mountId, std::size_t sourceIndex) const {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  return m_mountMap.at(mountId).mount->GetPresenceFilterStatistics(sourceIndex);
+}
+
+
+void MountStore::StartTrace(MOUNT_ID mountId, std::size_t maxEvents) {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  m_mountMap.at(mountId).mount->StartTrace(maxEvents);
+}
+
+
+void MountStore::StopTrace(MOUNT_ID mountId) {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  m_mountMap.at(mountId).mount->StopTrace();
+}
+
+
+void MountStore::SaveTrace(MOUNT_ID mountId, std::wstring_view filepath) const {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  m_mountMap.at(mountId).mount->SaveTrace(filepath);
+}
+
+
+// the mount cannot be unmounted until the replay has finished
+OperationReplay::Result MountStore::ReplayOperations(MOUNT_ID mountId, const ReplayOptions& replayOptions) const {
+  std::shared_lock generalLock(m_generalMutex);
+  if (!m_mountMap.count(mountId)) {
+    throw std::out_of_range("no such mountId");
+  }
+  OperationReplay replay(*m_mountMap.at(mountId).mount, replayOptions);
+  return replay.Run();
+}
+
+
 bool MountStore::SafeUnmount(MOUNT_ID mountId) {
   std::lock_guard generalLock(m_generalMutex);
   if (!m_mountMap.count(mountId)) {
@@ -4,7 +4,9 @@
 
 #include "../SDK/LibMergeFS.h"
 
+#include "BlockCache.hpp"
 #include "Mount.hpp"
+#include "OperationReplay.hpp"
 #include "SourcePluginStore.hpp"
 
 #include <condition_variable>
@@ -15,6 +17,7 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <string>
 #include <string_view>
@@ -86,6 +89,7 @@ private:
     MountInfoWrapper wrappedMountInfo;
   };
 
+  BlockCache m_blockCache;   // shared by all mounts; must outlive them
   mutable std::shared_mutex m_generalMutex;
   std::unordered_map<MOUNT_ID, MountData> m_mountMap;
   MOUNT_ID m_minimumUnusedMountId;
@@ -99,11 +103,18 @@ public:
   MountStore();
   ~MountStore();
 
-  MOUNT_ID Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, const std::vector<std::pair<PLUGIN_ID, PLUGIN_INITIALIZE_MOUNT_INFO>>& sources, std::function<void(MOUNT_ID, const MOUNT_INFO*, int)> callback);
+  MOUNT_ID Mount(std::wstring_view mountPoint, bool writable, std::wstring_view metadataFileName, bool deferCopyEnabled, bool caseSensitive, const VolumeInfoOverride& volumeInfoOverride, const ReadAheadOptions& readAheadOptions, const DokanTuningOptions& dokanTuningOptions, bool headless, const std::vector<std::pair<PLUGIN_ID, PLUGIN_INITIALIZE_MOUNT_INFO>>& sources, std::function<void(MOUNT_ID, const MOUNT_INFO*, int)> callback);
   bool HasMount(MOUNT_ID mountId) const;
   std::size_t CountMounts() const;
   std::vector<MOUNT_ID> ListMounts() const;
   const MOUNT_INFO& GetMountInfo(MOUNT_ID mountId) const;
+  Mount::CopyUpStatistics GetCopyUpStatistics(MOUNT_ID mountId) const;
+  std::vector<OperationStatistics::Entry> GetOperationStatistics(MOUNT_ID mountId, std::optional<std::size_t> sourceIndex) const;
+  MountSource::PresenceFilterStatistics GetPresenceFilterStatistics(MOUNT_ID mountId, std::size_t sourceIndex) const;
+  void StartTrace(MOUNT_ID mountId, std::size_t maxEvents);
+  void StopTrace(MOUNT_ID mountId);
+  void SaveTrace(MOUNT_ID mountId, std::wstring_view filepath) const;
+  OperationReplay::Result ReplayOperations(MOUNT_ID mountId, const ReplayOptions& replayOptions) const;
   bool Unmount(MOUNT_ID mountId);
   void UnmountAll();
   bool SafeUnmount(MOUNT_ID mountId);
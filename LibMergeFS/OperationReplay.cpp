@@ -0,0 +1,736 @@
+#define NOMINMAX
+
+#include "OperationReplay.hpp"
+#include "DokanConfig.hpp"
+#include "DokanOperations.hpp"
+#include "NsError.hpp"
+#include "ReplayConfig.hpp"
+#include "../Util/Common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+using namespace std::literals;
+
+
+
+namespace {
+  constexpr const wchar_t* ReplayRequestNames[] = {
+    L"Stat",
+    L"List",
+    L"Read",
+    L"Write",
+    L"SetInfo",
+    L"CopyUp",
+  };
+  static_assert(std::size(ReplayRequestNames) == static_cast<std::size_t>(ReplayRequest::NumRequests));
+
+  constexpr ULONG ShareAll = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+
+  // filled into written ranges, so that copied-up data is easy to tell apart when a run is inspected afterwards
+  constexpr char WritePattern = '\xA5';
+
+
+  std::wstring JoinPath(const std::wstring& directory, std::wstring_view name) {
+    if (directory == L"\\"sv) {
+      return L"\\"s + std::wstring(name);
+    }
+    return directory + L"\\"s + std::wstring(name);
+  }
+
+
+  ULONGLONG GetFileSize(const WIN32_FIND_DATAW& findData) noexcept {
+    return (static_cast<ULONGLONG>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
+  }
+
+
+  // splitmix64; the random writes depend only on the seed and their index, not on which thread issues them
+  std::uint64_t Mix(std::uint64_t value) noexcept {
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+  }
+
+
+  // one buffer per thread, grown to the largest transfer seen
+  char* GetBuffer(std::size_t size) {
+    thread_local std::vector<char> tBuffer;
+    if (tBuffer.size() < size) {
+      tBuffer.resize(size, WritePattern);
+    }
+    return tBuffer.data();
+  }
+
+
+  std::wstring Utf8ToWide(std::string_view utf8) {
+    if (utf8.empty()) {
+      return {};
+    }
+    const int length = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8.data(), static_cast<int>(utf8.size()), nullptr, 0);
+    if (length <= 0) {
+      throw std::invalid_argument("trace file is not valid UTF-8");
+    }
+    std::wstring wide(static_cast<std::size_t>(length), L'\0');
+    MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8.data(), static_cast<int>(utf8.size()), wide.data(), length);
+    return wide;
+  }
+
+
+  std::string ReadWholeFile(std::wstring_view filename) {
+    const std::wstring sFilename(filename);
+    const HANDLE hFile = CreateFileW(sFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (!util::IsValidHandle(hFile)) {
+      throw W32Error();
+    }
+
+    std::string data;
+    char buffer[64 * 1024];
+    while (true) {
+      DWORD read = 0;
+      if (!ReadFile(hFile, buffer, sizeof(buffer), &read, NULL)) {
+        const DWORD error = GetLastError();
+        CloseHandle(hFile);
+        throw W32Error(error);
+      }
+      if (!read) {
+        break;
+      }
+      data.append(buffer, read);
+    }
+    CloseHandle(hFile);
+    return data;
+  }
+
+
+  std::wstring_view NextToken(std::wstring_view& line) noexcept {
+    const auto begin = std::min(line.find_first_not_of(L" \t"sv), line.size());
+    line.remove_prefix(begin);
+    const auto end = std::min(line.find_first_of(L" \t"sv), line.size());
+    const auto token = line.substr(0, end);
+    line.remove_prefix(end);
+    return token;
+  }
+
+
+  std::optional<ULONGLONG> ParseNumberN(std::wstring_view token) noexcept {
+    if (token.empty() || token.size() > 19) {
+      return std::nullopt;
+    }
+    ULONGLONG value = 0;
+    for (const auto c : token) {
+      if (c < L'0' || c > L'9') {
+        return std::nullopt;
+      }
+      value = value * 10 + (c - L'0');
+    }
+    return value;
+  }
+
+
+  // FindFiles callback; DokanContext points to the vector which receives the entries
+  int WINAPI FillFindData(PWIN32_FIND_DATAW FindData, PDOKAN_FILE_INFO DokanFileInfo) {
+    const std::wstring_view filename(FindData->cFileName);
+    if (filename == L"."sv || filename == L".."sv) {
+      return 0;
+    }
+    auto& entries = *reinterpret_cast<std::vector<WIN32_FIND_DATAW>*>(DokanFileInfo->DokanContext);
+    try {
+      entries.push_back(*FindData);
+    } catch (...) {
+      return 1;
+    }
+    return 0;
+  }
+}
+
+
+
+// an open file; Cleanup and CloseFile are called on destruction, as Dokan does when the last handle is closed
+struct OperationReplay::Handle {
+  const std::wstring& path;
+  DOKAN_FILE_INFO fileInfo;
+  bool opened;
+
+  Handle(const Handle&) = delete;
+
+  Handle(OperationReplay& replay, const std::wstring& path) :
+    path(path),
+    fileInfo{},
+    opened(false)
+  {
+    fileInfo.DokanOptions = &replay.mDokanOptions;
+    fileInfo.ProcessId = GetCurrentProcessId();
+  }
+
+  ~Handle() {
+    if (!opened) {
+      return;
+    }
+    gDokanOperations.Cleanup(path.c_str(), &fileInfo);
+    gDokanOperations.CloseFile(path.c_str(), &fileInfo);
+  }
+};
+
+
+
+// one request per line; empty lines and lines starting with '#' are skipped
+//   stat <path>
+//   list <path>
+//   read <offset> <length> <path>
+//   write <offset> <length> <path>
+// paths are relative to the root of the mount and may contain spaces; '/' is accepted as a separator
+std::vector<OperationReplay::TraceStep> OperationReplay::LoadTrace(std::wstring_view filename) {
+  auto data = ReadWholeFile(filename);
+  if (data.size() >= 3 && data.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+    data.erase(0, 3);
+  }
+  const auto text = Utf8ToWide(data);
+
+  std::vector<TraceStep> steps;
+  std::size_t lineNumber = 0;
+  for (std::size_t begin = 0; begin < text.size();) {
+    const auto end = std::min(text.find(L'\n', begin), text.size());
+    std::wstring_view line(text.data() + begin, end - begin);
+    begin = end + 1;
+    lineNumber++;
+
+    while (!line.empty() && (line.back() == L'\r' || line.back() == L' ' || line.back() == L'\t')) {
+      line.remove_suffix(1);
+    }
+    const auto command = NextToken(line);
+    if (command.empty() || command[0] == L'#') {
+      continue;
+    }
+
+    const auto invalidLine = [lineNumber]() {
+      return std::invalid_argument("invalid trace line "s + std::to_string(lineNumber));
+    };
+
+    TraceStep step{ReplayRequest::Stat, 0, 0, L""s};
+    if (command == L"stat"sv) {
+      step.request = ReplayRequest::Stat;
+    } else if (command == L"list"sv) {
+      step.request = ReplayRequest::List;
+    } else if (command == L"read"sv || command == L"write"sv) {
+      step.request = command == L"read"sv ? ReplayRequest::Read : ReplayRequest::Write;
+      const auto offsetN = ParseNumberN(NextToken(line));
+      const auto lengthN = ParseNumberN(NextToken(line));
+      if (!offsetN || !lengthN || lengthN.value() > ReplayConfig::MaxTransferSize) {
+        throw invalidLine();
+      }
+      step.offset = offsetN.value();
+      step.length = static_cast<DWORD>(lengthN.value());
+    } else {
+      throw invalidLine();
+    }
+
+    line.remove_prefix(std::min(line.find_first_not_of(L" \t"sv), line.size()));
+    if (line.empty()) {
+      throw invalidLine();
+    }
+    step.path = line;
+    std::replace(step.path.begin(), step.path.end(), L'/', L'\\');
+    if (step.path[0] != L'\\') {
+      step.path.insert(step.path.begin(), L'\\');
+    }
+    steps.push_back(std::move(step));
+  }
+  return steps;
+}
+
+
+OperationReplay::OperationReplay(Mount& mount, const ReplayOptions& options) :
+  mMount(mount),
+  mOptions(options),
+  mDokanOptions{
+    DokanConfig::Version,
+    static_cast<USHORT>(options.numThreads),
+    static_cast<ULONG>(DokanConfig::Options | (mount.IsWritable() ? 0 : DOKAN_OPTION_WRITE_PROTECT)),
+    GetGlobalContextFromMount(&mount),
+    L"",
+    nullptr,
+    0,
+    0,
+    0,
+  },
+  mStatistics(ReplayRequestNames, std::size(ReplayRequestNames))
+{
+  if (mOptions.numThreads == 0 || mOptions.numThreads > ReplayConfig::MaxThreads) {
+    throw std::invalid_argument("invalid number of threads");
+  }
+}
+
+
+NTSTATUS OperationReplay::Open(Handle& handle, ACCESS_MASK desiredAccess, ULONG createOptions) {
+  DOKAN_IO_SECURITY_CONTEXT securityContext{};
+  // Dokan sets IsDirectory from the create options before calling ZwCreateFile
+  handle.fileInfo.IsDirectory = createOptions & FILE_DIRECTORY_FILE ? TRUE : FALSE;
+  const auto status = gDokanOperations.ZwCreateFile(handle.path.c_str(), &securityContext, desiredAccess, 0, ShareAll, FILE_OPEN, createOptions, &handle.fileInfo);
+  if (status != STATUS_SUCCESS) {
+    // Dokan calls CloseFile for a failed create as well
+    gDokanOperations.CloseFile(handle.path.c_str(), &handle.fileInfo);
+    return status;
+  }
+  handle.opened = true;
+  return STATUS_SUCCESS;
+}
+
+
+template<typename F>
+NTSTATUS OperationReplay::Issue(ReplayRequest request, bool record, F&& function) {
+  const auto begin = OperationStatistics::Clock::now();
+  const NTSTATUS status = std::forward<F>(function)();
+  if (record) {
+    mStatistics.Record(static_cast<std::size_t>(request), status, OperationStatistics::Clock::now() - begin);
+  }
+  return status;
+}
+
+
+NTSTATUS OperationReplay::Stat(const std::wstring& path, bool directory) {
+  return Issue(ReplayRequest::Stat, true, [&]() -> NTSTATUS {
+    Handle handle(*this, path);
+    if (const auto status = Open(handle, FILE_READ_ATTRIBUTES, directory ? FILE_DIRECTORY_FILE : 0); status != STATUS_SUCCESS) {
+      return status;
+    }
+    BY_HANDLE_FILE_INFORMATION information{};
+    return gDokanOperations.GetFileInformation(path.c_str(), &information, &handle.fileInfo);
+  });
+}
+
+
+NTSTATUS OperationReplay::List(const std::wstring& path, bool record, std::vector<WIN32_FIND_DATAW>& entries) {
+  entries.clear();
+  return Issue(ReplayRequest::List, record, [&]() -> NTSTATUS {
+    Handle handle(*this, path);
+    if (const auto status = Open(handle, FILE_LIST_DIRECTORY | FILE_READ_ATTRIBUTES, FILE_DIRECTORY_FILE); status != STATUS_SUCCESS) {
+      return status;
+    }
+    handle.fileInfo.DokanContext = reinterpret_cast<ULONG64>(&entries);
+    return gDokanOperations.FindFiles(path.c_str(), FillFindData, &handle.fileInfo);
+  });
+}
+
+
+NTSTATUS OperationReplay::Read(const std::wstring& path, ULONGLONG offset, DWORD length) {
+  char* const buffer = GetBuffer(length);
+  return Issue(ReplayRequest::Read, true, [&]() -> NTSTATUS {
+    Handle handle(*this, path);
+    if (const auto status = Open(handle, FILE_GENERIC_READ, FILE_NON_DIRECTORY_FILE); status != STATUS_SUCCESS) {
+      return status;
+    }
+    DWORD readLength = 0;
+    return gDokanOperations.ReadFile(path.c_str(), buffer, length, &readLength, static_cast<LONGLONG>(offset), &handle.fileInfo);
+  });
+}
+
+
+// reads through a handle which is already open
+NTSTATUS OperationReplay::Read(Handle& handle, ULONGLONG offset, DWORD length) {
+  char* const buffer = GetBuffer(length);
+  return Issue(ReplayRequest::Read, true, [&]() -> NTSTATUS {
+    DWORD readLength = 0;
+    return gDokanOperations.ReadFile(handle.path.c_str(), buffer, length, &readLength, static_cast<LONGLONG>(offset), &handle.fileInfo);
+  });
+}
+
+
+// reads where media indexers look for tags and container indexes; the size is queried first, as they do
+NTSTATUS OperationReplay::ReadHeadAndTail(const std::wstring& path) {
+  char* const buffer = GetBuffer(std::max(ReplayConfig::MediaHeadBytes, ReplayConfig::MediaTailBytes));
+  return Issue(ReplayRequest::Read, true, [&]() -> NTSTATUS {
+    Handle handle(*this, path);
+    if (const auto status = Open(handle, FILE_GENERIC_READ, FILE_NON_DIRECTORY_FILE); status != STATUS_SUCCESS) {
+      return status;
+    }
+    BY_HANDLE_FILE_INFORMATION information{};
+    if (const auto status = gDokanOperations.GetFileInformation(path.c_str(), &information, &handle.fileInfo); status != STATUS_SUCCESS) {
+      return status;
+    }
+    const ULONGLONG fileSize = (static_cast<ULONGLONG>(information.nFileSizeHigh) << 32) | information.nFileSizeLow;
+
+    DWORD readLength = 0;
+    const auto headBytes = static_cast<DWORD>(std::min<ULONGLONG>(fileSize, ReplayConfig::MediaHeadBytes));
+    if (const auto status = gDokanOperations.ReadFile(path.c_str(), buffer, headBytes, &readLength, 0, &handle.fileInfo); status != STATUS_SUCCESS) {
+      return status;
+    }
+    if (fileSize <= ReplayConfig::MediaHeadBytes) {
+      return STATUS_SUCCESS;
+    }
+    const ULONGLONG tailOffset = std::max<ULONGLONG>(fileSize - std::min<ULONGLONG>(fileSize, ReplayConfig::MediaTailBytes), ReplayConfig::MediaHeadBytes);
+    return gDokanOperations.ReadFile(path.c_str(), buffer, static_cast<DWORD>(fileSize - tailOffset), &readLength, static_cast<LONGLONG>(tailOffset), &handle.fileInfo);
+  });
+}
+
+
+NTSTATUS OperationReplay::Write(const std::wstring& path, ULONGLONG offset, DWORD length) {
+  const char* const buffer = GetBuffer(length);
+  return Issue(ReplayRequest::Write, true, [&]() -> NTSTATUS {
+    Handle handle(*this, path);
+    if (const auto status = Open(handle, FILE_GENERIC_READ | FILE_GENERIC_WRITE, FILE_NON_DIRECTORY_FILE); status != STATUS_SUCCESS) {
+      return status;
+    }
+    DWORD written = 0;
+    return gDokanOperations.WriteFile(path.c_str(), buffer, length, &written, static_cast<LONGLONG>(offset), &handle.fileInfo);
+  });
+}
+
+
+NTSTATUS OperationReplay::Touch(const std::wstring& path, const FILETIME& time) {
+  return Issue(ReplayRequest::SetInfo, true, [&]() -> NTSTATUS {
+    Handle handle(*this, path);
+    if (const auto status = Open(handle, FILE_WRITE_ATTRIBUTES, FILE_NON_DIRECTORY_FILE); status != STATUS_SUCCESS) {
+      return status;
+    }
+    return gDokanOperations.SetFileTime(path.c_str(), nullptr, &time, &time, &handle.fileInfo);
+  });
+}
+
+
+// copies a lower-layer file up with mOptions.transportOptions; returns false without recording anything if the file is
+// not copied up because it is already in the top source or overlaid, so that only real copy-ups are measured
+bool OperationReplay::CopyUp(const std::wstring& path, ULONGLONG& copiedBytes) {
+  copiedBytes = 0;
+  const auto begin = OperationStatistics::Clock::now();
+  NTSTATUS status = STATUS_SUCCESS;
+  try {
+    const auto copiedBytesN = mMount.CopyUpForReplay(path, mOptions.transportOptions);
+    if (!copiedBytesN) {
+      return false;
+    }
+    copiedBytes = copiedBytesN.value();
+  } catch (const NsError& error) {
+    status = error.GetStatus();
+  }
+  mStatistics.Record(static_cast<std::size_t>(ReplayRequest::CopyUp), status, OperationStatistics::Clock::now() - begin);
+  return true;
+}
+
+
+// runs function on mOptions.numThreads threads at once and rethrows the first exception thrown by one of them
+void OperationReplay::RunThreads(const std::function<void(std::size_t)>& function) {
+  std::vector<std::exception_ptr> exceptions(mOptions.numThreads);
+  std::vector<std::thread> threads;
+  threads.reserve(mOptions.numThreads);
+  for (std::size_t threadIndex = 0; threadIndex < mOptions.numThreads; threadIndex++) {
+    threads.emplace_back([&function, &exceptions, threadIndex]() {
+      try {
+        function(threadIndex);
+      } catch (...) {
+        exceptions[threadIndex] = std::current_exception();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& exception : exceptions) {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+}
+
+
+// lists every directory reachable from the root and calls visit for each entry; directories are shared among the threads
+void OperationReplay::Walk(bool record, const std::function<void(const std::wstring&, const WIN32_FIND_DATAW&)>& visit) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::wstring> directories{L"\\"s};
+  std::size_t numBusy = 0;
+
+  RunThreads([&](std::size_t) {
+    std::vector<WIN32_FIND_DATAW> entries;
+    std::vector<std::wstring> subdirectories;
+    std::unique_lock lock(mutex);
+    while (true) {
+      cv.wait(lock, [&]() {
+        return !directories.empty() || numBusy == 0;
+      });
+      if (directories.empty()) {
+        // nobody is listing anymore, so no more directories can come
+        break;
+      }
+      const auto directory = std::move(directories.front());
+      directories.pop_front();
+      numBusy++;
+      lock.unlock();
+
+      subdirectories.clear();
+      try {
+        List(directory, record, entries);
+        for (const auto& entry : entries) {
+          const auto path = JoinPath(directory, entry.cFileName);
+          if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            subdirectories.push_back(path);
+          }
+          visit(path, entry);
+        }
+      } catch (...) {
+        lock.lock();
+        numBusy--;
+        cv.notify_all();
+        throw;
+      }
+
+      lock.lock();
+      for (auto& subdirectory : subdirectories) {
+        directories.push_back(std::move(subdirectory));
+      }
+      numBusy--;
+      cv.notify_all();
+    }
+  });
+}
+
+
+OperationReplay::Result OperationReplay::Run() {
+  std::vector<TraceStep> trace;
+  std::vector<std::pair<std::wstring, ULONGLONG>> files;
+  // ReplayWorkload::HandleReads; the handles of each thread and the sizes of their files, closed after the measurement
+  std::vector<std::vector<std::pair<std::unique_ptr<Handle>, ULONGLONG>>> threadHandles;
+
+  // preparation is not measured
+  switch (mOptions.workload) {
+    case ReplayWorkload::TreeWalk:
+    case ReplayWorkload::MediaScan:
+      break;
+
+    case ReplayWorkload::RandomWrites:
+    case ReplayWorkload::Touch:
+    {
+      if (!mMount.IsWritable()) {
+        throw std::invalid_argument("the mount is not writable");
+      }
+      // setting the times of a read-only file is allowed
+      const DWORD excludedAttributes = mOptions.workload == ReplayWorkload::Touch ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_READONLY;
+      std::mutex filesMutex;
+      Walk(false, [&](const std::wstring& path, const WIN32_FIND_DATAW& entry) {
+        if (entry.dwFileAttributes & excludedAttributes) {
+          return;
+        }
+        std::lock_guard lock(filesMutex);
+        files.emplace_back(path, GetFileSize(entry));
+      });
+      if (files.empty()) {
+        throw std::invalid_argument("no files to write to");
+      }
+      // the walk finishes in any order; the targets must not depend on it
+      std::sort(files.begin(), files.end());
+      break;
+    }
+
+    case ReplayWorkload::TraceFile:
+      trace = LoadTrace(mOptions.traceFilename);
+      break;
+
+    case ReplayWorkload::HandleReads:
+    {
+      std::mutex filesMutex;
+      Walk(false, [&](const std::wstring& path, const WIN32_FIND_DATAW& entry) {
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY || GetFileSize(entry) == 0) {
+          return;
+        }
+        std::lock_guard lock(filesMutex);
+        files.emplace_back(path, GetFileSize(entry));
+      });
+      if (files.empty()) {
+        throw std::invalid_argument("no files to read from");
+      }
+      std::sort(files.begin(), files.end());
+
+      // every thread opens its own handles, spread over the files
+      threadHandles.resize(mOptions.numThreads);
+      for (std::size_t threadIndex = 0; threadIndex < mOptions.numThreads; threadIndex++) {
+        for (std::size_t i = 0; i < ReplayConfig::HandlesPerThread; i++) {
+          const auto& [path, fileSize] = files[(threadIndex * ReplayConfig::HandlesPerThread + i) % files.size()];
+          auto handle = std::make_unique<Handle>(*this, path);
+          if (Open(*handle, FILE_GENERIC_READ, FILE_NON_DIRECTORY_FILE) != STATUS_SUCCESS) {
+            throw std::invalid_argument("failed to open a file to read from");
+          }
+          threadHandles[threadIndex].emplace_back(std::move(handle), fileSize);
+        }
+      }
+      break;
+    }
+
+    case ReplayWorkload::CopyUps:
+    {
+      if (!mMount.IsWritable()) {
+        throw std::invalid_argument("the mount is not writable");
+      }
+      std::mutex filesMutex;
+      Walk(false, [&](const std::wstring& path, const WIN32_FIND_DATAW& entry) {
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY || GetFileSize(entry) < ReplayConfig::MinCopyUpFileSize) {
+          return;
+        }
+        std::lock_guard lock(filesMutex);
+        files.emplace_back(path, GetFileSize(entry));
+      });
+      if (files.empty()) {
+        throw std::invalid_argument("no files to copy up");
+      }
+      std::sort(files.begin(), files.end());
+      break;
+    }
+
+    default:
+      throw std::invalid_argument("invalid workload");
+  }
+
+  // ReplayWorkload::CopyUps; the files are taken in order over all iterations, as a copied file stays in the top source
+  std::atomic<std::size_t> nextCopyUpFile(0);
+  std::atomic<std::uint64_t> numBytes(0);
+
+  const auto begin = OperationStatistics::Clock::now();
+
+  for (std::size_t iteration = 0; iteration < mOptions.iterations; iteration++) {
+    switch (mOptions.workload) {
+      case ReplayWorkload::TreeWalk:
+        Walk(true, [this](const std::wstring& path, const WIN32_FIND_DATAW& entry) {
+          Stat(path, entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        });
+        break;
+
+      case ReplayWorkload::MediaScan:
+        Walk(true, [this](const std::wstring& path, const WIN32_FIND_DATAW& entry) {
+          if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            ReadHeadAndTail(path);
+          }
+        });
+        break;
+
+      case ReplayWorkload::RandomWrites:
+      {
+        std::atomic<std::size_t> next(0);
+        RunThreads([&](std::size_t) {
+          for (std::size_t index; (index = next++) < mOptions.numOperations;) {
+            const auto hash = Mix(mOptions.seed ^ Mix(static_cast<std::uint64_t>(iteration) * mOptions.numOperations + index));
+            const auto& [path, fileSize] = files[hash % files.size()];
+            const ULONGLONG numBlocks = (fileSize + ReplayConfig::WriteSize - 1) / ReplayConfig::WriteSize;
+            const ULONGLONG offset = numBlocks ? Mix(hash) % numBlocks * ReplayConfig::WriteSize : 0;
+            Write(path, offset, static_cast<DWORD>(ReplayConfig::WriteSize));
+          }
+        });
+        break;
+      }
+
+      case ReplayWorkload::Touch:
+      {
+        std::atomic<std::size_t> next(0);
+        RunThreads([&](std::size_t) {
+          for (std::size_t index; (index = next++) < mOptions.numOperations;) {
+            const auto hash = Mix(mOptions.seed ^ Mix(static_cast<std::uint64_t>(iteration) * mOptions.numOperations + index));
+            const auto& path = files[hash % files.size()].first;
+            // distinct times, so that every touch changes the metadata
+            const auto time = static_cast<std::uint64_t>(iteration) * mOptions.numOperations + index + 1;
+            const FILETIME filetime{
+              static_cast<DWORD>(time & 0xFFFFFFFF),
+              static_cast<DWORD>((time >> 32) & 0xFFFFFFFF),
+            };
+            Touch(path, filetime);
+          }
+        });
+        break;
+      }
+
+      case ReplayWorkload::HandleReads:
+        RunThreads([&](std::size_t threadIndex) {
+          auto& handles = threadHandles[threadIndex];
+          for (std::size_t index = 0; index < mOptions.numOperations; index++) {
+            const auto hash = Mix(mOptions.seed ^ Mix((static_cast<std::uint64_t>(iteration) * mOptions.numThreads + threadIndex) * mOptions.numOperations + index));
+            auto& [handle, fileSize] = handles[hash % handles.size()];
+            const ULONGLONG numBlocks = (fileSize + ReplayConfig::ReadSize - 1) / ReplayConfig::ReadSize;
+            Read(*handle, Mix(hash) % numBlocks * ReplayConfig::ReadSize, static_cast<DWORD>(ReplayConfig::ReadSize));
+          }
+        });
+        break;
+
+      case ReplayWorkload::CopyUps:
+      {
+        // numOperations copy-ups per iteration, fewer if the files run out
+        std::atomic<std::size_t> numCopyUps(0);
+        RunThreads([&](std::size_t) {
+          while (numCopyUps++ < mOptions.numOperations) {
+            for (std::size_t index; (index = nextCopyUpFile++) < files.size();) {
+              if (ULONGLONG copiedBytes; CopyUp(files[index].first, copiedBytes)) {
+                numBytes += copiedBytes;
+                break;
+              }
+            }
+          }
+        });
+        break;
+      }
+
+      case ReplayWorkload::TraceFile:
+      {
+        // the threads take the lines in order, so a single thread replays the trace exactly
+        std::atomic<std::size_t> next(0);
+        RunThreads([&](std::size_t) {
+          std::vector<WIN32_FIND_DATAW> entries;
+          for (std::size_t index; (index = next++) < trace.size();) {
+            const auto& step = trace[index];
+            switch (step.request) {
+              case ReplayRequest::Stat:
+                Stat(step.path, false);
+                break;
+
+              case ReplayRequest::List:
+                List(step.path, true, entries);
+                break;
+
+              case ReplayRequest::Read:
+                Read(step.path, step.offset, step.length);
+                break;
+
+              case ReplayRequest::Write:
+                Write(step.path, step.offset, step.length);
+                break;
+
+              default:
+                break;
+            }
+          }
+        });
+        break;
+      }
+    }
+  }
+
+  const auto elapsed = OperationStatistics::Clock::now() - begin;
+
+  auto requestStatistics = mStatistics.Get();
+  std::uint64_t numRequests = 0;
+  std::uint64_t numFailures = 0;
+  for (const auto& entry : requestStatistics) {
+    numRequests += entry.count;
+    numFailures += entry.failures;
+  }
+  return Result{
+    static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+    numRequests,
+    numFailures,
+    numBytes.load(),
+    std::move(requestStatistics),
+  };
+}
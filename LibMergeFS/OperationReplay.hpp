@@ -0,0 +1,106 @@
+#pragma once
+
+#include "../dokan/dokan/dokan.h"
+
+#include "Mount.hpp"
+#include "OperationStatistics.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+enum class ReplayWorkload {
+  TreeWalk,       // lists every directory and queries every entry, like a build system checking its inputs
+  MediaScan,      // lists every directory and reads the head and the tail of every file, like a media library indexer
+  RandomWrites,   // small writes at random offsets of existing files, which copy lower-layer files up
+  TraceFile,      // requests read from a text file (see OperationReplay::LoadTrace)
+  Touch,          // sets the times of random existing files, which only adds metadata records for lower-layer files
+  HandleReads,    // reads at random offsets through handles opened beforehand, one set per thread, so that only the
+                  // per-request path of ReadFile is measured; shows how reads scale with the number of threads
+  CopyUps,        // copies large lower-layer files up to the top source with ReplayOptions::transportOptions, so that
+                  // the copy-up throughput of the transfer sizes and of the native-handle copy can be compared
+};
+
+
+// requests issued by OperationReplay; each one opens a file, calls one or more Dokan callbacks on it and closes it
+enum class ReplayRequest : std::size_t {
+  Stat,
+  List,
+  Read,
+  Write,
+  SetInfo,
+  CopyUp,         // Mount::CopyUpForReplay; no file is opened through the callbacks
+  NumRequests,
+};
+
+
+struct ReplayOptions {
+  ReplayWorkload workload;
+  std::wstring traceFilename;   // ReplayWorkload::TraceFile only
+  std::size_t numThreads;
+  std::size_t iterations;
+  std::uint64_t seed;           // ReplayWorkload::RandomWrites, ReplayWorkload::Touch and ReplayWorkload::HandleReads only
+  // writes or touches per iteration for ReplayWorkload::RandomWrites and ReplayWorkload::Touch,
+  // reads per thread and iteration for ReplayWorkload::HandleReads (so that each thread does the same work at any thread count)
+  std::size_t numOperations;
+  Mount::TransportOptions transportOptions;   // ReplayWorkload::CopyUps only; numOperations is the copy-ups per iteration
+};
+
+
+// drives a mount in-process through gDokanOperations with synthetic DOKAN_FILE_INFO
+// the whole callback path (GetMountSourceIndexR, listing merges, copy-up) is measured without a driver and its queues,
+// so it is meant for headless mounts; a mounted volume may be replayed against as well
+class OperationReplay {
+public:
+  struct Result {
+    std::uint64_t elapsedNanoseconds;
+    std::uint64_t numRequests;
+    std::uint64_t numFailures;
+    std::uint64_t numBytes;   // bytes copied up by ReplayWorkload::CopyUps; 0 for the other workloads
+    std::vector<OperationStatistics::Entry> requestStatistics;   // indexed by ReplayRequest
+  };
+
+private:
+  struct TraceStep {
+    ReplayRequest request;
+    ULONGLONG offset;
+    DWORD length;
+    std::wstring path;
+  };
+
+  struct Handle;
+
+  Mount& mMount;
+  const ReplayOptions mOptions;
+  DOKAN_OPTIONS mDokanOptions;
+  // per-thread slots; the requests and failures are counted from it, so that no counter is shared among the threads
+  OperationStatistics mStatistics;
+
+  static std::vector<TraceStep> LoadTrace(std::wstring_view filename);
+
+  NTSTATUS Open(Handle& handle, ACCESS_MASK desiredAccess, ULONG createOptions);
+  template<typename F>
+  NTSTATUS Issue(ReplayRequest request, bool record, F&& function);
+  NTSTATUS Stat(const std::wstring& path, bool directory);
+  NTSTATUS List(const std::wstring& path, bool record, std::vector<WIN32_FIND_DATAW>& entries);
+  NTSTATUS Read(const std::wstring& path, ULONGLONG offset, DWORD length);
+  NTSTATUS Read(Handle& handle, ULONGLONG offset, DWORD length);
+  NTSTATUS ReadHeadAndTail(const std::wstring& path);
+  NTSTATUS Write(const std::wstring& path, ULONGLONG offset, DWORD length);
+  NTSTATUS Touch(const std::wstring& path, const FILETIME& time);
+  bool CopyUp(const std::wstring& path, ULONGLONG& copiedBytes);
+  void RunThreads(const std::function<void(std::size_t)>& function);
+  void Walk(bool record, const std::function<void(const std::wstring&, const WIN32_FIND_DATAW&)>& visit);
+
+public:
+  OperationReplay(const OperationReplay&) = delete;
+
+  OperationReplay(Mount& mount, const ReplayOptions& options);
+
+  // throws std::invalid_argument if the workload cannot run on the mount (e.g. writes to a read-only mount)
+  Result Run();
+};
@@ -0,0 +1,221 @@
+#include "OperationStatistics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+
+namespace {
+  constexpr const wchar_t* MountOperationNames[] = {
+    L"ZwCreateFile",
+    L"Cleanup",
+    L"CloseFile",
+    L"ReadFile",
+    L"WriteFile",
+    L"FlushFileBuffers",
+    L"GetFileInformation",
+    L"FindFiles",
+    L"FindFilesWithPattern",
+    L"SetFileAttributes",
+    L"SetFileTime",
+    L"DeleteFile",
+    L"DeleteDirectory",
+    L"MoveFile",
+    L"SetEndOfFile",
+    L"SetAllocationSize",
+    L"GetDiskFreeSpace",
+    L"GetVolumeInformation",
+    L"Mounted",
+    L"Unmounted",
+    L"GetFileSecurity",
+    L"SetFileSecurity",
+    L"FindStreams",
+  };
+  static_assert(std::size(MountOperationNames) == static_cast<std::size_t>(MountOperation::NumOperations));
+
+  constexpr const wchar_t* SourceOperationNames[] = {
+    L"GetFileInfo",
+    L"GetFileInfoBatch",
+    L"GetDirectoryInfo",
+    L"RemoveFile",
+    L"ExportStart",
+    L"ExportData",
+    L"ExportFinish",
+    L"ImportStart",
+    L"ImportData",
+    L"ImportFinish",
+    L"SwitchSourceClose",
+    L"SwitchDestinationPrepare",
+    L"SwitchDestinationOpen",
+    L"SwitchDestinationCleanup",
+    L"SwitchDestinationClose",
+    L"ListFiles",
+    L"ListFilesWithPattern",
+    L"ListStreams",
+    L"ZwCreateFile",
+    L"Cleanup",
+    L"CloseFile",
+    L"ReadFile",
+    L"WriteFile",
+    L"FlushFileBuffers",
+    L"GetFileInformation",
+    L"SetFileAttributes",
+    L"SetFileTime",
+    L"DeleteFile",
+    L"DeleteDirectory",
+    L"MoveFile",
+    L"SetEndOfFile",
+    L"SetAllocationSize",
+    L"GetDiskFreeSpace",
+    L"GetVolumeInformation",
+    L"GetFileSecurity",
+    L"SetFileSecurity",
+  };
+  static_assert(std::size(SourceOperationNames) == static_cast<std::size_t>(SourceOperation::NumOperations));
+
+  // entries of destroyed instances stay in the thread-local caches of long-lived threads until they are dropped at this size
+  constexpr std::size_t MaxCachedSlots = 64;
+
+  std::atomic<std::uint64_t> gNextId(1);
+
+
+  // error and warning severities; informational codes such as STATUS_PENDING are not failures
+  bool IsFailure(NTSTATUS status) noexcept {
+    return (static_cast<std::uint32_t>(status) >> 30) >= 2;
+  }
+
+
+  // only the owner thread writes, so a load and a store are enough and cheaper than fetch_add
+  void Add(std::atomic<std::uint64_t>& counter, std::uint64_t value) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+}
+
+
+
+OperationStatistics::Slot::Slot(std::size_t numOperations) :
+  counters(std::make_unique<Counters[]>(numOperations))
+{}
+
+
+
+std::size_t OperationStatistics::GetBucketIndex(std::uint64_t nanoseconds) noexcept {
+  if (nanoseconds < 1024) {
+    return 0;
+  }
+  // position of the most significant bit, counted from 2^10
+  std::size_t group = 0;
+  for (std::uint64_t value = nanoseconds >> 11; value; value >>= 1) {
+    group++;
+  }
+  const std::size_t subBucket = static_cast<std::size_t>((nanoseconds >> (group + 8)) & 3);
+  return std::min(1 + group * 4 + subBucket, NumBuckets - 1);
+}
+
+
+const wchar_t* OperationStatistics::GetName(MountOperation operation) noexcept {
+  return MountOperationNames[static_cast<std::size_t>(operation)];
+}
+
+
+const wchar_t* OperationStatistics::GetName(SourceOperation operation) noexcept {
+  return SourceOperationNames[static_cast<std::size_t>(operation)];
+}
+
+
+OperationStatistics::OperationStatistics(const wchar_t* const* names, std::size_t numOperations) :
+  mId(gNextId++),
+  mNames(names),
+  mNumOperations(numOperations),
+  mMutex(),
+  mSlots()
+{}
+
+
+OperationStatistics::OperationStatistics(MountOperation) :
+  OperationStatistics(MountOperationNames, std::size(MountOperationNames))
+{}
+
+
+OperationStatistics::OperationStatistics(SourceOperation) :
+  OperationStatistics(SourceOperationNames, std::size(SourceOperationNames))
+{}
+
+
+OperationStatistics::Slot& OperationStatistics::GetSlot() const {
+  struct CacheEntry {
+    std::uint64_t id;
+    Slot* slot;
+  };
+  // a thread usually works for a few mounts and sources only
+  thread_local std::vector<CacheEntry> tCache;
+
+  for (const auto& entry : tCache) {
+    if (entry.id == mId) {
+      return *entry.slot;
+    }
+  }
+
+  if (tCache.size() >= MaxCachedSlots) {
+    // slots are kept by their owners, so a dropped entry only makes the thread allocate another slot
+    tCache.clear();
+  }
+
+  std::lock_guard lock(mMutex);
+  auto& slot = *mSlots.emplace_back(std::make_unique<Slot>(mNumOperations));
+  tCache.push_back(CacheEntry{mId, &slot});
+  return slot;
+}
+
+
+void OperationStatistics::Record(std::size_t operation, NTSTATUS status, Clock::duration duration) const noexcept {
+  if (operation >= mNumOperations) {
+    return;
+  }
+  try {
+    auto& counters = GetSlot().counters[operation];
+    const auto nanoseconds = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0));
+    Add(counters.count, 1);
+    if (IsFailure(status)) {
+      Add(counters.failures, 1);
+    }
+    Add(counters.totalNanoseconds, nanoseconds);
+    if (nanoseconds > counters.maxNanoseconds.load(std::memory_order_relaxed)) {
+      counters.maxNanoseconds.store(nanoseconds, std::memory_order_relaxed);
+    }
+    Add(counters.buckets[GetBucketIndex(nanoseconds)], 1);
+  } catch (...) {
+    // statistics must never fail the operation itself
+  }
+}
+
+
+std::vector<OperationStatistics::Entry> OperationStatistics::Get() const {
+  std::vector<Entry> entries(mNumOperations);
+  for (std::size_t operation = 0; operation < mNumOperations; operation++) {
+    entries[operation].name = mNames[operation];
+  }
+
+  std::lock_guard lock(mMutex);
+  for (const auto& slot : mSlots) {
+    for (std::size_t operation = 0; operation < mNumOperations; operation++) {
+      const auto& counters = slot->counters[operation];
+      auto& entry = entries[operation];
+      entry.count += counters.count.load(std::memory_order_relaxed);
+      entry.failures += counters.failures.load(std::memory_order_relaxed);
+      entry.totalNanoseconds += counters.totalNanoseconds.load(std::memory_order_relaxed);
+      entry.maxNanoseconds = std::max(entry.maxNanoseconds, counters.maxNanoseconds.load(std::memory_order_relaxed));
+      for (std::size_t bucket = 0; bucket < NumBuckets; bucket++) {
+        entry.buckets[bucket] += counters.buckets[bucket].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  return entries;
+}
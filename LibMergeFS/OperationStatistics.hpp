@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+
+// Dokan callbacks of a mount (see DokanOperations.cpp)
+enum class MountOperation : std::size_t {
+  ZwCreateFile,
+  Cleanup,
+  CloseFile,
+  ReadFile,
+  WriteFile,
+  FlushFileBuffers,
+  GetFileInformation,
+  FindFiles,
+  FindFilesWithPattern,
+  SetFileAttributes,
+  SetFileTime,
+  DeleteFile,
+  DeleteDirectory,
+  MoveFile,
+  SetEndOfFile,
+  SetAllocationSize,
+  GetDiskFreeSpace,
+  GetVolumeInformation,
+  Mounted,
+  Unmounted,
+  GetFileSecurity,
+  SetFileSecurity,
+  FindStreams,
+  NumOperations,
+};
+
+
+// source plugin calls of a mount source (see MountSource.cpp)
+enum class SourceOperation : std::size_t {
+  GetFileInfo,
+  GetFileInfoBatch,
+  GetDirectoryInfo,
+  RemoveFile,
+  ExportStart,
+  ExportData,
+  ExportFinish,
+  ImportStart,
+  ImportData,
+  ImportFinish,
+  SwitchSourceClose,
+  SwitchDestinationPrepare,
+  SwitchDestinationOpen,
+  SwitchDestinationCleanup,
+  SwitchDestinationClose,
+  ListFiles,
+  ListFilesWithPattern,
+  ListStreams,
+  ZwCreateFile,
+  Cleanup,
+  CloseFile,
+  ReadFile,
+  WriteFile,
+  FlushFileBuffers,
+  GetFileInformation,
+  SetFileAttributes,
+  SetFileTime,
+  DeleteFile,
+  DeleteDirectory,
+  MoveFile,
+  SetEndOfFile,
+  SetAllocationSize,
+  GetDiskFreeSpace,
+  GetVolumeInformation,
+  GetFileSecurity,
+  SetFileSecurity,
+  NumOperations,
+};
+
+
+// call counts and log-linear latency histograms per operation of a mount or a mount source
+// each thread records into its own slot with plain relaxed stores, so recording never contends; Get sums up the slots
+class OperationStatistics {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // bucket 0 holds latencies below 1024 ns; from there each power of two is split into 4 buckets (see OPERATION_STATISTICS)
+  static constexpr std::size_t NumBuckets = 96;
+
+  struct Entry {
+    const wchar_t* name;
+    std::uint64_t count;
+    std::uint64_t failures;
+    std::uint64_t totalNanoseconds;
+    std::uint64_t maxNanoseconds;
+    std::array<std::uint64_t, NumBuckets> buckets;
+  };
+
+private:
+  struct Counters {
+    std::atomic<std::uint64_t> count{0};
+    std::atomic<std::uint64_t> failures{0};
+    std::atomic<std::uint64_t> totalNanoseconds{0};
+    std::atomic<std::uint64_t> maxNanoseconds{0};
+    std::array<std::atomic<std::uint64_t>, NumBuckets> buckets{};
+  };
+
+  // written only by the thread which owns it
+  struct Slot {
+    std::unique_ptr<Counters[]> counters;
+
+    explicit Slot(std::size_t numOperations);
+  };
+
+  const std::uint64_t mId;    // never reused, unlike the address; keys the thread-local slot cache
+  const wchar_t* const* const mNames;
+  const std::size_t mNumOperations;
+  mutable std::mutex mMutex;
+  mutable std::vector<std::unique_ptr<Slot>> mSlots;
+
+  Slot& GetSlot() const;
+
+public:
+  static std::size_t GetBucketIndex(std::uint64_t nanoseconds) noexcept;
+  static const wchar_t* GetName(MountOperation operation) noexcept;
+  static const wchar_t* GetName(SourceOperation operation) noexcept;
+
+  OperationStatistics(const OperationStatistics&) = delete;
+
+  OperationStatistics(const wchar_t* const* names, std::size_t numOperations);
+  explicit OperationStatistics(MountOperation);
+  explicit OperationStatistics(SourceOperation);
+
+  void Record(std::size_t operation, NTSTATUS status, Clock::duration duration) const noexcept;
+  std::vector<Entry> Get() const;
+
+  // calls function and records its duration and result; functions which return void always count as successful
+  template<typename Operation, typename F>
+  auto Measure(Operation operation, F&& function) const {
+    const auto begin = Clock::now();
+    if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+      std::forward<F>(function)();
+      Record(static_cast<std::size_t>(operation), STATUS_SUCCESS, Clock::now() - begin);
+    } else {
+      auto result = std::forward<F>(function)();
+      Record(static_cast<std::size_t>(operation), result, Clock::now() - begin);
+      return result;
+    }
+  }
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+
+namespace OverlayConfig {
+  // Mount::DZwCreateFile; writes to lower-layer files are kept in a range-based overlay in the top source
+  // instead of copying the whole file first (requires a metadata file, next to which the extent maps are stored)
+  constexpr bool Enabled = true;
+  // smaller files are copied to the top source as before; copying them is cheap and keeps them simple
+  constexpr std::uint64_t MinFileSize = 1024 * 1024;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace ParallelConfig {
+  // maximum number of worker threads per mount used to run source operations concurrently
+  // (e.g. per-source enumeration in Mount::DFindFiles); 0 disables concurrent execution
+  constexpr std::size_t MaxWorkerThreads = 8;
+
+  // number of threads per mount which copy deferred-copy files to the top source in the background;
+  // 0 makes the copy synchronous (done inside the first write as before)
+  constexpr std::size_t CopyUpThreads = 2;
+}
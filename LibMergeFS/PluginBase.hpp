@@ -42,6 +42,12 @@ class PluginBase {
       }
       return reinterpret_cast<T>(address);
     }
+
+    // for optional exports; returns nullptr if not exported
+    template<typename T>
+    T GetProcN(LPCSTR ProcName) const noexcept {
+      return reinterpret_cast<T>(GetProcAddress(hModule, ProcName));
+    }
   };
 
 public:
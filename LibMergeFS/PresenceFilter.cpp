@@ -0,0 +1,88 @@
+#include "PresenceFilter.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+
+
+namespace {
+  constexpr std::size_t BitsPerWord = 64;
+
+
+  std::uint64_t Mix(std::uint64_t value) noexcept {
+    // splitmix64
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+  }
+}
+
+
+
+std::uint64_t PresenceFilter::Hash(std::wstring_view key) noexcept {
+  // FNV-1a over the UTF-16 code units
+  std::uint64_t hash = 0xCBF29CE484222325ull;
+  for (const auto c : key) {
+    hash ^= static_cast<std::uint16_t>(c);
+    hash *= 0x100000001B3ull;
+  }
+  return Mix(hash);
+}
+
+
+PresenceFilter::PresenceFilter(std::size_t capacity, std::size_t bitsPerKey, std::size_t numHashes) :
+  mNumBits(((capacity ? capacity : 1) * bitsPerKey + BitsPerWord - 1) / BitsPerWord * BitsPerWord),
+  mNumHashes(numHashes ? numHashes : 1),
+  mWords(std::make_unique<std::atomic<std::uint64_t>[]>(mNumBits / BitsPerWord)),
+  mNumKeys(0)
+{
+  for (std::size_t i = 0; i < mNumBits / BitsPerWord; i++) {
+    mWords[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+
+// double hashing; the second hash is odd so that it never degenerates to a single bit
+void PresenceFilter::Add(std::uint64_t hash) noexcept {
+  const std::uint64_t step = Mix(hash) | 1;
+  for (std::size_t i = 0; i < mNumHashes; i++) {
+    const std::size_t bit = static_cast<std::size_t>((hash + i * step) % mNumBits);
+    mWords[bit / BitsPerWord].fetch_or(std::uint64_t{1} << (bit % BitsPerWord), std::memory_order_release);
+  }
+  mNumKeys.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+bool PresenceFilter::MayContain(std::uint64_t hash) const noexcept {
+  const std::uint64_t step = Mix(hash) | 1;
+  for (std::size_t i = 0; i < mNumHashes; i++) {
+    const std::size_t bit = static_cast<std::size_t>((hash + i * step) % mNumBits);
+    if (!(mWords[bit / BitsPerWord].load(std::memory_order_acquire) & (std::uint64_t{1} << (bit % BitsPerWord)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+std::size_t PresenceFilter::GetNumKeys() const noexcept {
+  return mNumKeys.load(std::memory_order_relaxed);
+}
+
+
+std::size_t PresenceFilter::GetNumBytes() const noexcept {
+  return mNumBits / 8;
+}
+
+
+double PresenceFilter::GetFalsePositiveRate() const noexcept {
+  const double k = static_cast<double>(mNumHashes);
+  const double n = static_cast<double>(GetNumKeys());
+  const double m = static_cast<double>(mNumBits);
+  return std::pow(1.0 - std::exp(-k * n / m), k);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+
+// Bloom filter over 64-bit hashes of keys (see MountSource::MayExist)
+// never reports an added key as absent; Add and MayContain may be called concurrently
+class PresenceFilter {
+  const std::size_t mNumBits;
+  const std::size_t mNumHashes;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> mWords;
+  std::atomic<std::size_t> mNumKeys;
+
+public:
+  static std::uint64_t Hash(std::wstring_view key) noexcept;
+
+  PresenceFilter(std::size_t capacity, std::size_t bitsPerKey, std::size_t numHashes);
+
+  void Add(std::uint64_t hash) noexcept;
+  bool MayContain(std::uint64_t hash) const noexcept;
+  std::size_t GetNumKeys() const noexcept;
+  std::size_t GetNumBytes() const noexcept;
+  // estimated from the number of keys added so far
+  double GetFalsePositiveRate() const noexcept;
+};
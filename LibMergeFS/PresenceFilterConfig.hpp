@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace PresenceFilterConfig {
+  // MountSource::MayExist; Mount::LookupNoCacheR skips sources whose filter says the parent directory is not there
+  constexpr bool Enabled = true;
+
+  // also filter the top source of a writable mount; every change made through the mount is added to its filter,
+  // but directories created in it from outside the mount while mounted are hidden until remount
+  constexpr bool FilterWritableTopSource = true;
+
+  // 10 bits and 7 hashes per directory give a false-positive rate of about 1%
+  constexpr std::size_t BitsPerDirectory = 10;
+  constexpr std::size_t NumHashes = 7;
+
+  // sources with more directories than this are not filtered
+  constexpr std::size_t MaxDirectories = 4 * 1024 * 1024;
+
+  // room for directories created while mounted, relative to the number found when the filter was built
+  constexpr std::size_t WritableCapacityFactor = 2;
+  constexpr std::size_t WritableMinCapacity = 4096;
+
+  // number of threads per mount which build the filters in the background after mounting
+  constexpr std::size_t BuildThreads = 1;
+}
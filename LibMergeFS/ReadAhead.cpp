@@ -0,0 +1,309 @@
+#define NOMINMAX
+
+#include "ReadAhead.hpp"
+#include "ReadAheadConfig.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <Windows.h>
+
+
+
+ReadAheadBudget::ReadAheadBudget(std::size_t limit) :
+  mLimit(limit),
+  mUsed(0)
+{}
+
+
+bool ReadAheadBudget::TryAcquire(std::size_t size) noexcept {
+  std::size_t used = mUsed.load();
+  do {
+    if (used + size > mLimit) {
+      return false;
+    }
+  } while (!mUsed.compare_exchange_weak(used, used + size));
+  return true;
+}
+
+
+void ReadAheadBudget::Release(std::size_t size) noexcept {
+  mUsed -= size;
+}
+
+
+
+ReadAheadStream::ReadAheadStream(ReadAheadBudget& budget, ThreadPool& pool, std::size_t maxWindowSize, ReadFunction prefetchFunction) :
+  mBudget(budget),
+  mPool(pool),
+  mMaxWindowSize(maxWindowSize),
+  mPrefetchFunction(std::move(prefetchFunction)),
+  mMutex(),
+  mCv(),
+  mNextOffset(0),
+  mSequentialCount(0),
+  mWindowSize(0),
+  mChunks(),
+  mEndOffsetN(std::nullopt),
+  mGeneration(0),
+  mPrefetching(false),
+  mPrefetchOffset(0),
+  mPrefetchLength(0),
+  mClosed(false)
+{}
+
+
+ReadAheadStream::~ReadAheadStream() {
+  Close();
+}
+
+
+// mMutex must be held
+// drops the chunks which end at or before offset
+void ReadAheadStream::DropChunksL(ULONGLONG offset) noexcept {
+  while (!mChunks.empty() && mChunks.front().offset + mChunks.front().length <= offset) {
+    mBudget.Release(mChunks.front().capacity);
+    mChunks.pop_front();
+  }
+}
+
+
+// mMutex must be held
+void ReadAheadStream::ResetL() noexcept {
+  for (const auto& chunk : mChunks) {
+    mBudget.Release(chunk.capacity);
+  }
+  mChunks.clear();
+  mEndOffsetN = std::nullopt;
+  mSequentialCount = 0;
+  mWindowSize = 0;
+  // the running prefetch (if any) is discarded when it finishes
+  mGeneration++;
+}
+
+
+// mMutex must be held
+// reads issued concurrently by Dokan may arrive out of order, so a read inside the prefetched range also counts as sequential
+bool ReadAheadStream::IsExpectedL(ULONGLONG offset) const noexcept {
+  if (offset == mNextOffset) {
+    return true;
+  }
+  if (!mChunks.empty() && offset >= mChunks.front().offset && offset < mChunks.back().offset + mChunks.back().length) {
+    return true;
+  }
+  if (mPrefetching && offset >= mPrefetchOffset && offset < mPrefetchOffset + mPrefetchLength) {
+    return true;
+  }
+  return false;
+}
+
+
+// mMutex must be held
+// copies the prefetched data contiguous from offset and returns the number of bytes copied
+DWORD ReadAheadStream::CopyFromChunksL(char* buffer, DWORD length, ULONGLONG offset) const noexcept {
+  DWORD copied = 0;
+  for (const auto& chunk : mChunks) {
+    if (copied == length) {
+      break;
+    }
+    const ULONGLONG current = offset + copied;
+    if (current < chunk.offset) {
+      break;
+    }
+    const ULONGLONG chunkEnd = chunk.offset + chunk.length;
+    if (current >= chunkEnd) {
+      continue;
+    }
+    const DWORD size = static_cast<DWORD>(std::min<ULONGLONG>(length - copied, chunkEnd - current));
+    std::memcpy(buffer + copied, chunk.data.get() + (current - chunk.offset), size);
+    copied += size;
+  }
+  return copied;
+}
+
+
+// mMutex must be held
+// reserves the next prefetch if the data ahead of readEnd is running low; the caller submits it after unlocking
+bool ReadAheadStream::SchedulePrefetchL(ULONGLONG readEnd) {
+  if (mClosed || mPrefetching || !mWindowSize || mEndOffsetN) {
+    return false;
+  }
+
+  ULONGLONG prefetchOffset = readEnd;
+  if (!mChunks.empty()) {
+    const ULONGLONG bufferedEnd = mChunks.back().offset + mChunks.back().length;
+    if (bufferedEnd < readEnd) {
+      // the reader has overtaken the prefetched data
+      DropChunksL(readEnd);
+    } else {
+      if (bufferedEnd - readEnd >= mWindowSize / 2) {
+        return false;
+      }
+      prefetchOffset = bufferedEnd;
+    }
+  }
+
+  const std::size_t length = mWindowSize;
+  if (!mBudget.TryAcquire(length)) {
+    return false;
+  }
+
+  mPrefetching = true;
+  mPrefetchOffset = prefetchOffset;
+  mPrefetchLength = length;
+  mWindowSize = std::min(mWindowSize * 2, mMaxWindowSize);
+  return true;
+}
+
+
+void ReadAheadStream::Prefetch(ULONGLONG offset, std::size_t length, unsigned int generation) noexcept {
+  bool obsolete;
+  {
+    std::lock_guard lock(mMutex);
+    obsolete = mClosed || generation != mGeneration;
+  }
+
+  std::unique_ptr<char[]> data;
+  DWORD readLength = 0;
+  NTSTATUS status = STATUS_CANCELLED;
+  if (!obsolete) {
+    try {
+      data = std::make_unique<char[]>(length);
+      status = mPrefetchFunction(data.get(), static_cast<DWORD>(length), &readLength, offset);
+    } catch (...) {
+      status = STATUS_UNSUCCESSFUL;
+    }
+  }
+
+  {
+    std::lock_guard lock(mMutex);
+    mPrefetching = false;
+    const bool contiguous = mChunks.empty() || mChunks.back().offset + mChunks.back().length == offset;
+    if (!mClosed && generation == mGeneration && contiguous && (status == STATUS_SUCCESS || status == STATUS_END_OF_FILE)) {
+      if (status == STATUS_END_OF_FILE) {
+        readLength = 0;
+      }
+      if (readLength < length) {
+        mEndOffsetN = offset + readLength;
+      }
+      if (readLength) {
+        mChunks.push_back(Chunk{offset, readLength, length, std::move(data)});
+      } else {
+        mBudget.Release(length);
+      }
+    } else {
+      mBudget.Release(length);
+    }
+  }
+  mCv.notify_all();
+}
+
+
+NTSTATUS ReadAheadStream::Read(void* buffer, DWORD length, DWORD* readLength, ULONGLONG offset, const ReadFunction& readFunction) {
+  const auto charBuffer = static_cast<char*>(buffer);
+
+  DWORD copied = 0;
+  bool endOfFile = false;
+  bool prefetch = false;
+  ULONGLONG prefetchOffset = 0;
+  std::size_t prefetchLength = 0;
+  unsigned int generation = 0;
+  {
+    std::unique_lock lock(mMutex);
+    if (mClosed) {
+      lock.unlock();
+      return readFunction(buffer, length, readLength, offset);
+    }
+
+    // access pattern
+    if (IsExpectedL(offset)) {
+      if (mSequentialCount < ReadAheadConfig::SequentialThreshold) {
+        mSequentialCount++;
+      }
+      if (mSequentialCount >= ReadAheadConfig::SequentialThreshold && !mWindowSize) {
+        mWindowSize = std::min(ReadAheadConfig::InitialWindowSize, mMaxWindowSize);
+      }
+      mNextOffset = std::max(mNextOffset, offset + length);
+    } else {
+      ResetL();
+      mNextOffset = offset + length;
+    }
+
+    // serve from the prefetched data, waiting for the running prefetch if it covers the range
+    DropChunksL(offset);
+    while (true) {
+      copied += CopyFromChunksL(charBuffer + copied, length - copied, offset + copied);
+      if (copied == length) {
+        break;
+      }
+      const ULONGLONG current = offset + copied;
+      if (mEndOffsetN && current >= mEndOffsetN.value()) {
+        endOfFile = true;
+        break;
+      }
+      if (mPrefetching && current >= mPrefetchOffset && current < mPrefetchOffset + mPrefetchLength) {
+        mCv.wait(lock);
+        if (mClosed) {
+          break;
+        }
+        continue;
+      }
+      break;
+    }
+
+    prefetch = SchedulePrefetchL(offset + length);
+    prefetchOffset = mPrefetchOffset;
+    prefetchLength = mPrefetchLength;
+    generation = mGeneration;
+  }
+
+  // the prefetch runs while the rest of this read is done synchronously
+  if (prefetch) {
+    try {
+      mPool.Submit([spThis = shared_from_this(), prefetchOffset, prefetchLength, generation]() {
+        spThis->Prefetch(prefetchOffset, prefetchLength, generation);
+      });
+    } catch (...) {
+      {
+        std::lock_guard lock(mMutex);
+        mPrefetching = false;
+        mBudget.Release(prefetchLength);
+      }
+      mCv.notify_all();
+    }
+  }
+
+  if (copied == length || (endOfFile && copied)) {
+    *readLength = copied;
+    return STATUS_SUCCESS;
+  }
+
+  DWORD restReadLength = 0;
+  if (const auto status = readFunction(charBuffer + copied, length - copied, &restReadLength, offset + copied); status != STATUS_SUCCESS) {
+    if (copied && status == STATUS_END_OF_FILE) {
+      *readLength = copied;
+      return STATUS_SUCCESS;
+    }
+    return status;
+  }
+  *readLength = copied + restReadLength;
+  return STATUS_SUCCESS;
+}
+
+
+void ReadAheadStream::Close() noexcept {
+  std::unique_lock lock(mMutex);
+  mClosed = true;
+  mCv.notify_all();
+  mCv.wait(lock, [this]() {
+    return !mPrefetching;
+  });
+  ResetL();
+}
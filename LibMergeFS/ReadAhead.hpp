@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include <Windows.h>
+
+
+// memory limit of prefetched data shared by all read-ahead streams of a mount
+class ReadAheadBudget {
+  const std::size_t mLimit;
+  std::atomic<std::size_t> mUsed;
+
+public:
+  ReadAheadBudget(const ReadAheadBudget&) = delete;
+
+  explicit ReadAheadBudget(std::size_t limit);
+
+  bool TryAcquire(std::size_t size) noexcept;
+  void Release(std::size_t size) noexcept;
+};
+
+
+// per file context detector of sequential reads which prefetches the data ahead of the reader in the background
+// the window starts at ReadAheadConfig::InitialWindowSize once reads become sequential and doubles on each prefetch
+// up to the maximum window size; a read outside of the expected range drops the prefetched data and stops prefetching
+class ReadAheadStream : public std::enable_shared_from_this<ReadAheadStream> {
+public:
+  // reads up to length bytes at offset; *readLength is less than length at the end of the file
+  using ReadFunction = std::function<NTSTATUS(void* buffer, DWORD length, DWORD* readLength, ULONGLONG offset)>;
+
+private:
+  struct Chunk {
+    ULONGLONG offset;
+    std::size_t length;     // bytes read
+    std::size_t capacity;   // bytes charged to the budget
+    std::unique_ptr<char[]> data;
+  };
+
+  ReadAheadBudget& mBudget;
+  ThreadPool& mPool;
+  const std::size_t mMaxWindowSize;
+  const ReadFunction mPrefetchFunction;   // called on mPool; must be usable until Close returns
+
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  ULONGLONG mNextOffset;                  // offset right after the furthest read
+  unsigned int mSequentialCount;
+  std::size_t mWindowSize;                // 0 while the access is not sequential
+  std::deque<Chunk> mChunks;              // contiguous and in ascending order of offset
+  std::optional<ULONGLONG> mEndOffsetN;   // end of the file if a prefetch has reached it
+  unsigned int mGeneration;               // incremented when the prefetched data is dropped
+  bool mPrefetching;
+  ULONGLONG mPrefetchOffset;
+  std::size_t mPrefetchLength;
+  bool mClosed;
+
+  void DropChunksL(ULONGLONG offset) noexcept;
+  void ResetL() noexcept;
+  bool IsExpectedL(ULONGLONG offset) const noexcept;
+  DWORD CopyFromChunksL(char* buffer, DWORD length, ULONGLONG offset) const noexcept;
+  bool SchedulePrefetchL(ULONGLONG readEnd);
+  void Prefetch(ULONGLONG offset, std::size_t length, unsigned int generation) noexcept;
+
+public:
+  ReadAheadStream(const ReadAheadStream&) = delete;
+
+  ReadAheadStream(ReadAheadBudget& budget, ThreadPool& pool, std::size_t maxWindowSize, ReadFunction prefetchFunction);
+  ~ReadAheadStream();
+
+  // serves the read from the prefetched data as far as possible and reads the rest with readFunction
+  NTSTATUS Read(void* buffer, DWORD length, DWORD* readLength, ULONGLONG offset, const ReadFunction& readFunction);
+  // waits for the running prefetch and releases the prefetched data; later reads are passed through to readFunction
+  void Close() noexcept;
+};
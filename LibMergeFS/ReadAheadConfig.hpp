@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace ReadAheadConfig {
+  // Mount::DReadFile; defaults of READ_AHEAD_OPTIONS (per mount)
+  constexpr std::size_t DefaultMaxWindowSize = 4 * 1024 * 1024;
+  constexpr std::size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+  // the first prefetch of a sequential reader; doubled on each following prefetch up to the maximum window size
+  constexpr std::size_t InitialWindowSize = 128 * 1024;
+  // number of consecutive sequential reads after which prefetching starts
+  constexpr unsigned int SequentialThreshold = 2;
+
+  // number of threads per mount which prefetch data
+  constexpr std::size_t Threads = 2;
+}
@@ -164,6 +164,9 @@ bool RenameStore::PathTrieTree::Match(std::wstring_view key) const {
     // child not found
     return false;
   }
+  if (firstDelimiterPos == std::wstring_view::npos) {
+    return itrChild->second.mValid;
+  }
   return itrChild->second.Match(key.substr(firstDelimiterPos + 1));
 }
 
@@ -173,7 +176,12 @@ std::optional<std::pair<std::wstring, std::wstring>> RenameStore::PathTrieTree::
   const std::wstring childKey(key.substr(0, firstDelimiterPos));
   const auto itrChild = mChildren.find(childKey);
   if (itrChild != mChildren.end()) {
-    auto result = itrChild->second.FindLongestMatch(key.substr(firstDelimiterPos + 1));
+    std::optional<std::pair<std::wstring, std::wstring>> result;
+    if (firstDelimiterPos != std::wstring_view::npos) {
+      result = itrChild->second.FindLongestMatch(key.substr(firstDelimiterPos + 1));
+    } else if (itrChild->second.mValid) {
+      result = std::make_pair(L""s, itrChild->second.mFilepath);
+    }
     if (result) {
       result.value().first = result.value().first.empty() ? childKey : childKey + StrDelimiter + result.value().first;
       return result;
@@ -233,7 +241,7 @@ std::pair<RenameStore::PathTrieTree&, bool> RenameStore::PathTrieTree::InsertRec
   bool emplaced = false;
   auto itrChild = mChildren.find(childKey);
   if (itrChild == mChildren.end()) {
-    itrChild = mChildren.emplace(childKey, PathTrieTree(this)).first;
+    itrChild = mChildren.emplace(childKey, PathTrieTree(mCaseSensitive)).first;
     emplaced = true;
   }
   if (firstDelimiterPos == std::wstring_view::npos) {
@@ -248,7 +256,7 @@ std::pair<RenameStore::PathTrieTree&, bool> RenameStore::PathTrieTree::InsertRec
   const std::wstring childKey(key.substr(0, firstDelimiterPos));
   auto itrChild = mChildren.find(childKey);
   if (itrChild == mChildren.end()) {
-    itrChild = mChildren.emplace(childKey, PathTrieTree(this)).first;
+    itrChild = mChildren.emplace(childKey, PathTrieTree(mCaseSensitive)).first;
   }
   if (firstDelimiterPos == std::wstring_view::npos) {
     if (itrChild->second.mValid) {
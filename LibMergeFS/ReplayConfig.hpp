@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace ReplayConfig {
+  // OperationReplay; bytes read from the head and the tail of every file by ReplayWorkload::MediaScan (tags and container indexes)
+  constexpr std::size_t MediaHeadBytes = 64 * 1024;
+  constexpr std::size_t MediaTailBytes = 128 * 1024;
+
+  // size and alignment of the writes of ReplayWorkload::RandomWrites
+  constexpr std::size_t WriteSize = 4096;
+  // writes or touches per iteration (reads per thread and iteration for ReplayWorkload::HandleReads, copy-ups per
+  // iteration for ReplayWorkload::CopyUps) if REPLAY_OPTIONS::numOperations is 0
+  constexpr std::size_t DefaultNumOperations = 10000;
+
+  // size and alignment of the reads of ReplayWorkload::HandleReads, and the number of files each thread keeps open
+  constexpr std::size_t ReadSize = 4096;
+  constexpr std::size_t HandlesPerThread = 16;
+
+  // smallest file copied up by ReplayWorkload::CopyUps, large enough that the transfer size dominates the time of a copy-up
+  constexpr unsigned long long MinCopyUpFileSize = 16 * 1024 * 1024;
+
+  constexpr std::size_t MaxThreads = 256;
+  // largest read or write of a trace line
+  constexpr std::size_t MaxTransferSize = 16 * 1024 * 1024;
+}
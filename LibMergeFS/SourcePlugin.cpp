@@ -26,7 +26,9 @@ SourcePlugin::SourcePlugin(std::wstring_view pluginFilePath) :
   _Mount(dll.GetProc<PMount>("Mount")),
   _Unmount(dll.GetProc<PUnmount>("Unmount")),
   _ListFiles(dll.GetProc<PListFiles>("ListFiles")),
+  _ListFilesWithPattern(dll.GetProcN<PListFilesWithPattern>("ListFilesWithPattern")),
   _ListStreams(dll.GetProc<PListStreams>("ListStreams")),
+  _GetFileInfoBatch(dll.GetProcN<PGetFileInfoBatch>("GetFileInfoBatch")),
   SIsSupported(dll.GetProc<PSIsSupported>("SIsSupported")),
   GetSourceInfo(dll.GetProc<PGetSourceInfo>("GetSourceInfo")),
   GetFileInfo(dll.GetProc<PGetFileInfo>("GetFileInfo")),
@@ -124,6 +126,20 @@ NTSTATUS SourcePlugin::ListFiles(LPCWSTR FileName, ListFilesUserCallback Callbac
 }
 
 
+NTSTATUS SourcePlugin::ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, ListFilesUserCallback Callback, SOURCE_CONTEXT_ID SourceContextId) noexcept {
+  if (!_ListFilesWithPattern) {
+    return STATUS_NOT_IMPLEMENTED;
+  }
+  try {
+    return _ListFilesWithPattern(FileName, SearchPattern, ListFilesCallback, &Callback, SourceContextId);
+  } catch (std::bad_alloc&) {
+    return STATUS_NO_MEMORY;
+  } catch (...) {
+    return STATUS_UNSUCCESSFUL;
+  }
+}
+
+
 NTSTATUS SourcePlugin::ListStreams(LPCWSTR FileName, ListStreamsUserCallback Callback, SOURCE_CONTEXT_ID SourceContextId) noexcept {
   try {
     return _ListStreams(FileName, ListStreamsCallback, &Callback, SourceContextId);
@@ -133,3 +149,22 @@ NTSTATUS SourcePlugin::ListStreams(LPCWSTR FileName, ListStreamsUserCallback Cal
     return STATUS_UNSUCCESSFUL;
   }
 }
+
+
+NTSTATUS SourcePlugin::GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData, SOURCE_CONTEXT_ID SourceContextId) noexcept {
+  try {
+    if (_GetFileInfoBatch) {
+      if (const auto status = _GetFileInfoBatch(FileNames, Count, Statuses, Win32FileAttributeData, SourceContextId); status != STATUS_NOT_IMPLEMENTED) {
+        return status;
+      }
+    }
+    for (DWORD i = 0; i < Count; i++) {
+      Statuses[i] = GetFileInfo(FileNames[i], Win32FileAttributeData ? &Win32FileAttributeData[i] : nullptr, SourceContextId);
+    }
+    return STATUS_SUCCESS;
+  } catch (std::bad_alloc&) {
+    return STATUS_NO_MEMORY;
+  } catch (...) {
+    return STATUS_UNSUCCESSFUL;
+  }
+}
@@ -53,7 +53,9 @@ private:
   using PListStreamsCallback = ::PListStreamsCallback;
 
   using PListFiles = decltype(&External::Plugin::Source::ListFiles);
+  using PListFilesWithPattern = decltype(&External::Plugin::Source::ListFilesWithPattern);
   using PListStreams = decltype(&External::Plugin::Source::ListStreams);
+  using PGetFileInfoBatch = decltype(&External::Plugin::Source::GetFileInfoBatch);
 
 public:
   using PSIsSupported = decltype(&External::Plugin::Source::SIsSupported);
@@ -105,7 +107,9 @@ private:
   const PMount _Mount;
   const PUnmount _Unmount;
   const PListFiles _ListFiles;
+  const PListFilesWithPattern _ListFilesWithPattern;   // optional; maybe nullptr
   const PListStreams _ListStreams;
+  const PGetFileInfoBatch _GetFileInfoBatch;   // optional; maybe nullptr
 
   SOURCE_CONTEXT_ID AllocateSourceContextId();
   bool ReleaseSourceContextId(SOURCE_CONTEXT_ID sourceContextId);
@@ -153,5 +157,8 @@ public:
   NTSTATUS Mount(const PLUGIN_INITIALIZE_MOUNT_INFO* InitializeMountInfo, SOURCE_CONTEXT_ID& sourceContextId) noexcept;
   BOOL Unmount(SOURCE_CONTEXT_ID sourceContextId) noexcept;
   NTSTATUS ListFiles(LPCWSTR FileName, ListFilesUserCallback Callback, SOURCE_CONTEXT_ID SourceContextId) noexcept;
+  NTSTATUS ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, ListFilesUserCallback Callback, SOURCE_CONTEXT_ID SourceContextId) noexcept;
   NTSTATUS ListStreams(LPCWSTR FileName, ListStreamsUserCallback Callback, SOURCE_CONTEXT_ID SourceContextId) noexcept;
+  // calls GetFileInfo for each file if the plugin does not implement GetFileInfoBatch
+  NTSTATUS GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData, SOURCE_CONTEXT_ID SourceContextId) noexcept;
 };
@@ -0,0 +1,83 @@
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+
+
+void ThreadPool::WorkerMain() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(mMutex);
+      mCv.wait(lock, [this]() {
+        return mStopping || !mQueue.empty();
+      });
+      if (mQueue.empty()) {
+        // stopping
+        return;
+      }
+      task = std::move(mQueue.front());
+      mQueue.pop_front();
+    }
+    task();
+  }
+}
+
+
+ThreadPool::ThreadPool(std::size_t numThreads) :
+  mMutex(),
+  mCv(),
+  mQueue(),
+  mStopping(false),
+  mThreads()
+{
+  mThreads.reserve(numThreads);
+  for (std::size_t i = 0; i < numThreads; i++) {
+    mThreads.emplace_back(&ThreadPool::WorkerMain, this);
+  }
+}
+
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mMutex);
+    mStopping = true;
+  }
+  mCv.notify_all();
+  for (auto& thread : mThreads) {
+    thread.join();
+  }
+}
+
+
+std::size_t ThreadPool::GetNumThreads() const noexcept {
+  return mThreads.size();
+}
+
+
+std::future<void> ThreadPool::Submit(std::function<void()> task) {
+  // std::function requires copyable objects
+  auto packagedTask = std::make_shared<std::packaged_task<void()>>(std::move(task));
+  auto future = packagedTask->get_future();
+
+  if (mThreads.empty()) {
+    (*packagedTask)();
+    return future;
+  }
+
+  {
+    std::lock_guard lock(mMutex);
+    mQueue.emplace_back([packagedTask]() {
+      (*packagedTask)();
+    });
+  }
+  mCv.notify_one();
+
+  return future;
+}
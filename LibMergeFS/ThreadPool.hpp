@@ -0,0 +1,33 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// fixed size worker pool
+// tasks submitted when the pool has no threads are executed on the calling thread
+class ThreadPool {
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::deque<std::function<void()>> mQueue;
+  bool mStopping;
+  std::vector<std::thread> mThreads;
+
+  void WorkerMain();
+
+public:
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ThreadPool(std::size_t numThreads);
+  ~ThreadPool();
+
+  std::size_t GetNumThreads() const noexcept;
+  std::future<void> Submit(std::function<void()> task);
+};
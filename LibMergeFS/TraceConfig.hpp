@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace TraceConfig {
+  // TraceRecorder; number of events kept in the ring buffer of a mount (an event takes 48 bytes)
+  constexpr std::size_t DefaultMaxEvents = 256 * 1024;
+  constexpr std::size_t MaxMaxEvents = 16 * 1024 * 1024;
+}
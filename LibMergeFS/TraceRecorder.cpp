@@ -0,0 +1,190 @@
+#include "TraceRecorder.hpp"
+#include "TraceConfig.hpp"
+#include "NsError.hpp"
+#include "../Util/Common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Windows.h>
+
+
+
+namespace {
+  const char* GetCategoryName(TraceCategory category) noexcept {
+    switch (category) {
+      case TraceCategory::Mount:
+        return "mount";
+
+      case TraceCategory::Source:
+        return "source";
+
+      case TraceCategory::Internal:
+        return "internal";
+    }
+    return "";
+  }
+
+
+  // non-ASCII characters are written as \u escapes, so the output is plain ASCII (and thus UTF-8)
+  void AppendJsonString(std::string& json, std::wstring_view string) {
+    json += '"';
+    for (const auto c : string) {
+      if (c == L'"' || c == L'\\') {
+        json += '\\';
+        json += static_cast<char>(c);
+      } else if (c >= 0x20 && c < 0x7F) {
+        json += static_cast<char>(c);
+      } else {
+        char buffer[8];
+        std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned int>(static_cast<std::uint16_t>(c)));
+        json += buffer;
+      }
+    }
+    json += '"';
+  }
+
+
+  // Chrome traces count in microseconds
+  void AppendMicroseconds(std::string& json, std::int64_t nanoseconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%lld.%03lld", static_cast<long long>(nanoseconds / 1000), static_cast<long long>(nanoseconds % 1000));
+    json += buffer;
+  }
+}
+
+
+
+// FNV-1a over the path with ASCII letters folded, so that the same file gets the same hash on case-insensitive mounts
+std::uint64_t TraceRecorder::HashPath(std::wstring_view path) noexcept {
+  std::uint64_t hash = 0xCBF29CE484222325ull;
+  for (auto c : path) {
+    if (c >= L'A' && c <= L'Z') {
+      c += L'a' - L'A';
+    }
+    hash ^= static_cast<std::uint16_t>(c);
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+
+TraceRecorder::TraceRecorder() :
+  mEnabled(false),
+  mMutex(),
+  mEpoch(Clock::now()),
+  mEvents(),
+  mNumEvents(0)
+{}
+
+
+void TraceRecorder::Record(TraceCategory category, const wchar_t* name, std::uint32_t sourceIndex, std::wstring_view path, NTSTATUS status, Clock::time_point begin, Clock::time_point end) noexcept {
+  const auto pathHash = path.empty() ? 0 : HashPath(path);
+  const auto threadId = GetCurrentThreadId();
+
+  std::lock_guard lock(mMutex);
+  if (mEvents.empty()) {
+    return;
+  }
+  // an event which began before Start would get a negative timestamp; it is partial anyway
+  if (begin < mEpoch) {
+    return;
+  }
+  mEvents[mNumEvents % mEvents.size()] = Event{
+    name,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(begin - mEpoch).count(),
+    std::chrono::duration_cast<std::chrono::nanoseconds>(end - mEpoch).count(),
+    pathHash,
+    threadId,
+    status,
+    sourceIndex,
+    category,
+  };
+  mNumEvents++;
+}
+
+
+void TraceRecorder::Start(std::size_t maxEvents) {
+  if (maxEvents == 0) {
+    maxEvents = TraceConfig::DefaultMaxEvents;
+  }
+  maxEvents = std::min(maxEvents, TraceConfig::MaxMaxEvents);
+
+  {
+    // allocate outside of the lock so that the running operations are not blocked meanwhile
+    std::vector<Event> events(maxEvents);
+    std::lock_guard lock(mMutex);
+    mEvents.swap(events);
+    mNumEvents = 0;
+    mEpoch = Clock::now();
+  }
+  mEnabled.store(true, std::memory_order_relaxed);
+}
+
+
+void TraceRecorder::Stop() {
+  mEnabled.store(false, std::memory_order_relaxed);
+}
+
+
+void TraceRecorder::SaveChromeTrace(std::wstring_view filepath, std::wstring_view processName) const {
+  std::string json;
+  {
+    std::lock_guard lock(mMutex);
+
+    const std::size_t numEvents = static_cast<std::size_t>(std::min<std::uint64_t>(mNumEvents, mEvents.size()));
+    const std::size_t firstIndex = mNumEvents > mEvents.size() ? static_cast<std::size_t>(mNumEvents % mEvents.size()) : 0;
+
+    json.reserve(256 + numEvents * 192);
+    json += "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedEvents\":";
+    json += std::to_string(mNumEvents - numEvents);
+    json += "},\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":";
+    AppendJsonString(json, processName);
+    json += "}}";
+
+    for (std::size_t i = 0; i < numEvents; i++) {
+      const auto& event = mEvents[(firstIndex + i) % mEvents.size()];
+      char buffer[128];
+
+      json += ",\n{\"name\":";
+      AppendJsonString(json, event.name);
+      json += ",\"cat\":\"";
+      json += GetCategoryName(event.category);
+      json += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+      json += std::to_string(event.threadId);
+      json += ",\"ts\":";
+      AppendMicroseconds(json, event.beginNanoseconds);
+      json += ",\"dur\":";
+      AppendMicroseconds(json, std::max<std::int64_t>(event.endNanoseconds - event.beginNanoseconds, 0));
+      std::snprintf(buffer, sizeof(buffer), ",\"args\":{\"status\":\"0x%08lX\",\"path\":\"%016llX\"", static_cast<unsigned long>(event.status), static_cast<unsigned long long>(event.pathHash));
+      json += buffer;
+      if (event.sourceIndex != NoSourceIndex) {
+        json += ",\"source\":";
+        json += std::to_string(event.sourceIndex);
+      }
+      json += "}}";
+    }
+    json += "\n]}\n";
+  }
+
+  const std::wstring sFilepath(filepath);
+  const HANDLE hFile = CreateFileW(sFilepath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (!util::IsValidHandle(hFile)) {
+    throw W32Error();
+  }
+
+  DWORD written = 0;
+  const BOOL result = WriteFile(hFile, json.data(), static_cast<DWORD>(json.size()), &written, NULL);
+  const DWORD error = GetLastError();
+  CloseHandle(hFile);
+  if (!result || written != json.size()) {
+    throw W32Error(result ? ERROR_WRITE_FAULT : error);
+  }
+}
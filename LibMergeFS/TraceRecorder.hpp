@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <Windows.h>
+
+
+enum class TraceCategory : std::uint8_t {
+  Mount,      // Dokan callbacks
+  Source,     // source plugin calls
+  Internal,   // steps of Mount which call into several sources (TransportR, GetFileTypeR)
+};
+
+
+// timeline of the operations of a mount, kept in a bounded ring buffer and saved in the Chrome trace event format
+// (loadable by chrome://tracing and Perfetto); calls which are nested on a thread show up nested in the timeline
+// while stopped, Trace only costs a relaxed load; while started, each call takes the mutex once to store its event
+class TraceRecorder {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::uint32_t NoSourceIndex = 0xFFFFFFFF;
+
+private:
+  struct Event {
+    const wchar_t* name;              // a static string
+    std::int64_t beginNanoseconds;    // since mEpoch
+    std::int64_t endNanoseconds;
+    std::uint64_t pathHash;
+    DWORD threadId;
+    NTSTATUS status;
+    std::uint32_t sourceIndex;
+    TraceCategory category;
+  };
+
+  std::atomic<bool> mEnabled;
+  mutable std::mutex mMutex;
+  Clock::time_point mEpoch;
+  std::vector<Event> mEvents;       // ring buffer
+  std::uint64_t mNumEvents;         // recorded since Start, including overwritten ones
+
+  static std::uint64_t HashPath(std::wstring_view path) noexcept;
+
+  static std::wstring_view ToPath(LPCWSTR path) noexcept {
+    return path ? std::wstring_view(path) : std::wstring_view();
+  }
+
+  static std::wstring_view ToPath(std::wstring_view path) noexcept {
+    return path;
+  }
+
+  void Record(TraceCategory category, const wchar_t* name, std::uint32_t sourceIndex, std::wstring_view path, NTSTATUS status, Clock::time_point begin, Clock::time_point end) noexcept;
+
+public:
+  TraceRecorder(const TraceRecorder&) = delete;
+
+  TraceRecorder();
+
+  bool IsEnabled() const noexcept {
+    return mEnabled.load(std::memory_order_relaxed);
+  }
+
+  // discards the previous events; maxEvents == 0 selects TraceConfig::DefaultMaxEvents
+  void Start(std::size_t maxEvents);
+  // keeps the events so that they can still be saved
+  void Stop();
+  // may be called while started; the events recorded meanwhile may or may not be included
+  void SaveChromeTrace(std::wstring_view filepath, std::wstring_view processName) const;
+
+  // calls function and records an event for it if started; functions which do not return NTSTATUS count as successful
+  // path is a (nullable) LPCWSTR or a std::wstring_view; it is only looked at while started
+  template<typename Path, typename F>
+  auto Trace(TraceCategory category, const wchar_t* name, std::uint32_t sourceIndex, const Path& rawPath, F&& function) {
+    if (!IsEnabled()) {
+      return std::forward<F>(function)();
+    }
+    const std::wstring_view path = ToPath(rawPath);
+    const auto begin = Clock::now();
+    try {
+      if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+        std::forward<F>(function)();
+        Record(category, name, sourceIndex, path, STATUS_SUCCESS, begin, Clock::now());
+      } else {
+        auto result = std::forward<F>(function)();
+        if constexpr (std::is_same_v<decltype(result), NTSTATUS>) {
+          Record(category, name, sourceIndex, path, result, begin, Clock::now());
+        } else {
+          Record(category, name, sourceIndex, path, STATUS_SUCCESS, begin, Clock::now());
+        }
+        return result;
+      }
+    } catch (...) {
+      Record(category, name, sourceIndex, path, STATUS_UNSUCCESSFUL, begin, Clock::now());
+      throw;
+    }
+  }
+};
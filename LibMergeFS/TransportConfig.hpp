@@ -0,0 +1,13 @@
+#pragma once
+
+#include <Windows.h>
+
+
+namespace TransportConfig {
+  // Mount::TransportR; preferred size of each chunk passed from an exporter to an importer (PORTATION_INFO::bufferSize)
+  // plugins align it and limit it to 16 MiB (see GetPortationBufferSize in SDK/Plugin/SourceCpp.hpp)
+  constexpr DWORD BufferSize = 4 * 1024 * 1024;
+  // pass the native file handle of the exporter to the importer so that it can copy the data by itself
+  // (e.g. MFPSFileSystem clones the clusters when both sides are on the same ReFS volume)
+  constexpr bool NativeCopyEnabled = true;
+}
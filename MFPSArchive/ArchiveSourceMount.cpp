@@ -48,10 +48,7 @@ ArchiveSourceMount::ExportPortation::ExportPortation(ArchiveSourceMount& sourceM
 
   directory = ptrDirectoryTree->type != DirectoryTree::Type::File;
 
-  // allocate buffer
-  if (!directory) {
-    buffer = std::make_unique<char[]>(BufferSize);
-  }
+  bufferSize = 0;
 
   portationInfo->directory = directory ? TRUE : FALSE;
   portationInfo->fileAttributes = DirectoryTree::FilterArchiveFileAttributes(*ptrDirectoryTree);
@@ -64,6 +61,12 @@ ArchiveSourceMount::ExportPortation::ExportPortation(ArchiveSourceMount& sourceM
   portationInfo->securitySize = 0;
   portationInfo->securityData = nullptr;
 
+  // allocate buffer
+  if (!directory) {
+    bufferSize = GetPortationBufferSize(portationInfo);
+    buffer = std::make_unique<char[]>(bufferSize);
+  }
+
   portationInfo->currentData = buffer.get();
   portationInfo->currentOffset.QuadPart = 0;
   portationInfo->currentSize = 0;
@@ -77,7 +80,7 @@ NTSTATUS ArchiveSourceMount::ExportPortation::Export(PORTATION_INFO* portationIn
 
   portationInfo->currentOffset.QuadPart += lastNumberOfBytesWritten;
 
-  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, BufferSize));
+  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, bufferSize));
   if (size == 0) {
     return STATUS_ALREADY_COMPLETE;
   }
@@ -281,6 +284,7 @@ BOOL ArchiveSourceMount::GetSourceInfo(SOURCE_INFO* sourceInfo) {
   if (sourceInfo) {
     *sourceInfo = {
       FALSE,
+      TRUE,
     };
   }
   return TRUE;
@@ -322,6 +326,12 @@ NTSTATUS ArchiveSourceMount::GetDirectoryInfo(LPCWSTR FileName) {
 
 
 NTSTATUS ArchiveSourceMount::ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  return ListFilesWithPattern(FileName, L"*", Callback, CallbackContext);
+}
+
+
+NTSTATUS ArchiveSourceMount::ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  const std::wstring_view searchPattern = SearchPattern ? SearchPattern : L"*"sv;
   auto& archive = this->archiveN.value();
   const auto realPath = GetRealPath(FileName);
   const auto ptrDirectoryTree = archive.Get(realPath);
@@ -332,6 +342,9 @@ NTSTATUS ArchiveSourceMount::ListFiles(LPCWSTR FileName, PListFilesCallback Call
     return STATUS_NOT_A_DIRECTORY;
   }
   for (auto& [key, childDirectoryTree] : ptrDirectoryTree->children) {
+    if (!util::vfs::IsNameInExpression(searchPattern, key, caseSensitive)) {
+      continue;
+    }
     WIN32_FIND_DATAW win32FindDataW{
       DirectoryTree::FilterArchiveFileAttributes(childDirectoryTree),
       childDirectoryTree.creationTime,
@@ -401,7 +414,10 @@ NTSTATUS ArchiveSourceMount::DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWOR
 NTSTATUS ArchiveSourceMount::ExportStartImpl(PORTATION_INFO* PortationInfo) {
   auto upPortation = std::make_unique<ExportPortation>(*this, PortationInfo);
   auto ptrPortation = upPortation.get();
-  portationMap.emplace(ptrPortation, std::move(upPortation));
+  {
+    std::lock_guard lock(subMutex);
+    portationMap.emplace(ptrPortation, std::move(upPortation));
+  }
   PortationInfo->exporterContext = ptrPortation;
   return STATUS_SUCCESS;
 }
@@ -416,6 +432,7 @@ NTSTATUS ArchiveSourceMount::ExportDataImpl(PORTATION_INFO* PortationInfo) {
 NTSTATUS ArchiveSourceMount::ExportFinishImpl(PORTATION_INFO* PortationInfo, BOOL Success) {
   auto ptrPortation = static_cast<ExportPortation*>(PortationInfo->exporterContext);
   const auto status = ptrPortation->Finish(PortationInfo, Success);
+  std::lock_guard lock(subMutex);
   portationMap.erase(ptrPortation);
   return status;
 }
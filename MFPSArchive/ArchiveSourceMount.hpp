@@ -22,8 +22,6 @@ class ArchiveSourceMountFile;
 
 class ArchiveSourceMount : public ReadonlySourceMountBase {
   class ExportPortation {
-    static constexpr std::size_t BufferSize = 4096;
-
   protected:
     ArchiveSourceMount& sourceMount;
     const std::wstring filepath;
@@ -35,6 +33,7 @@ class ArchiveSourceMount : public ReadonlySourceMountBase {
 
     UInt32 lastNumberOfBytesWritten;
     bool directory;
+    std::size_t bufferSize;
     std::unique_ptr<char[]> buffer;
 
   public:
@@ -81,6 +80,7 @@ public:
   NTSTATUS GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) override;
   NTSTATUS GetDirectoryInfo(LPCWSTR FileName) override;
   NTSTATUS ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
+  NTSTATUS ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
   NTSTATUS ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
   NTSTATUS DGetDiskFreeSpace(PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes, PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) override;
   NTSTATUS DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber, LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize, PDOKAN_FILE_INFO DokanFileInfo) override;
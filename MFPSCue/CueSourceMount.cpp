@@ -92,11 +92,8 @@ CueSourceMount::ExportPortation::ExportPortation(CueSourceMount& sourceMount, PO
     throw NtstatusError(sourceMount.ReturnPathOrNameNotFoundError(portationInfo->filepath));
   }
 
-
-  // allocate buffer
-  if (!ptrDirectoryTree->directory) {
-    buffer = std::make_unique<std::byte[]>(BufferSize);
-  }
+  directory = ptrDirectoryTree->directory;
+  bufferSize = 0;
 
   portationInfo->directory = ptrDirectoryTree->directory ? TRUE : FALSE;
   portationInfo->fileAttributes = ptrDirectoryTree->directory ? DirectoryTree::DirectoryFileAttributes : DirectoryTree::FileFileAttributes;
@@ -109,6 +106,12 @@ CueSourceMount::ExportPortation::ExportPortation(CueSourceMount& sourceMount, PO
   portationInfo->securitySize = 0;
   portationInfo->securityData = nullptr;
 
+  // allocate buffer
+  if (!ptrDirectoryTree->directory) {
+    bufferSize = GetPortationBufferSize(portationInfo);
+    buffer = std::make_unique<std::byte[]>(bufferSize);
+  }
+
   portationInfo->currentData = reinterpret_cast<const char*>(buffer.get());
   portationInfo->currentOffset.QuadPart = 0;
   portationInfo->currentSize = 0;
@@ -122,7 +125,7 @@ NTSTATUS CueSourceMount::ExportPortation::Export(PORTATION_INFO* portationInfo)
 
   portationInfo->currentOffset.QuadPart += lastNumberOfBytesWritten;
 
-  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, BufferSize));
+  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, bufferSize));
   if (size == 0) {
     return STATUS_ALREADY_COMPLETE;
   }
@@ -314,6 +317,7 @@ BOOL CueSourceMount::GetSourceInfo(SOURCE_INFO* sourceInfo) {
   if (sourceInfo) {
     *sourceInfo = {
       FALSE,
+      TRUE,
     };
   }
   return TRUE;
@@ -430,7 +434,10 @@ NTSTATUS CueSourceMount::DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD Vo
 NTSTATUS CueSourceMount::ExportStartImpl(PORTATION_INFO* PortationInfo) {
   auto upPortation = std::make_unique<ExportPortation>(*this, PortationInfo);
   auto ptrPortation = upPortation.get();
-  portationMap.emplace(ptrPortation, std::move(upPortation));
+  {
+    std::lock_guard lock(subMutex);
+    portationMap.emplace(ptrPortation, std::move(upPortation));
+  }
   PortationInfo->exporterContext = ptrPortation;
   return STATUS_SUCCESS;
 }
@@ -445,6 +452,7 @@ NTSTATUS CueSourceMount::ExportDataImpl(PORTATION_INFO* PortationInfo) {
 NTSTATUS CueSourceMount::ExportFinishImpl(PORTATION_INFO* PortationInfo, BOOL Success) {
   auto ptrPortation = static_cast<ExportPortation*>(PortationInfo->exporterContext);
   const auto status = ptrPortation->Finish(PortationInfo, Success);
+  std::lock_guard lock(subMutex);
   portationMap.erase(ptrPortation);
   return status;
 }
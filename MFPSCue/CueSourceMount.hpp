@@ -22,8 +22,6 @@ class CueSourceMountFile;
 
 class CueSourceMount : public ReadonlySourceMountBase {
   class ExportPortation {
-    static constexpr std::size_t BufferSize = 4096;
-
   protected:
     CueSourceMount& sourceMount;
     const std::wstring filepath;
@@ -34,6 +32,7 @@ class CueSourceMount : public ReadonlySourceMountBase {
 
     std::size_t lastNumberOfBytesWritten;
     bool directory;
+    std::size_t bufferSize;
     std::unique_ptr<std::byte[]> buffer;
 
   public:
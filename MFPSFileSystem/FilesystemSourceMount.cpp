@@ -5,10 +5,12 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <utility>
 
 #include <Windows.h>
 #include <Shlwapi.h>
+#include <winioctl.h>
 
 #include "../Util/Common.hpp"
 #include "../Util/RealFs.hpp"
@@ -64,11 +66,7 @@ FilesystemSourceMount::ExportPortation::ExportPortation(FilesystemSourceMount& s
   }
 
   directory = fileAttributes != FILE_ATTRIBUTE_NORMAL && (fileAttributes & FILE_ATTRIBUTE_DIRECTORY);
-
-  // allocate buffer
-  if (!directory) {
-    buffer = std::make_unique<char[]>(BufferSize);
-  }
+  bufferSize = 0;
 
   // create file handle if needed
   if (!util::IsValidHandle(hFile)) {
@@ -104,6 +102,15 @@ FilesystemSourceMount::ExportPortation::ExportPortation(FilesystemSourceMount& s
   portationInfo->securitySize = 0;
   portationInfo->securityData = nullptr;
 
+  // allocate buffer
+  if (!directory) {
+    bufferSize = GetPortationBufferSize(portationInfo);
+    buffer = std::make_unique<char[]>(bufferSize);
+  }
+
+  // the importer may copy the data directly from the handle
+  portationInfo->nativeHandle = directory ? NULL : hFile;
+
   portationInfo->currentData = buffer.get();
   portationInfo->currentOffset.QuadPart = 0;
   portationInfo->currentSize = 0;
@@ -117,12 +124,14 @@ NTSTATUS FilesystemSourceMount::ExportPortation::Export(PORTATION_INFO* portatio
 
   portationInfo->currentOffset.QuadPart += lastNumberOfBytesWritten;
 
-  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, BufferSize));
+  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, bufferSize));
   if (size == 0) {
     return STATUS_ALREADY_COMPLETE;
   }
 
-  if (!ReadFile(hFile, buffer.get(), static_cast<DWORD>(size), &lastNumberOfBytesWritten, NULL)) {
+  // positional read; the handle may be shared with a file context which is being read concurrently
+  OVERLAPPED overlapped = util::CreateOverlapped(portationInfo->currentOffset.QuadPart);
+  if (!ReadFile(hFile, buffer.get(), static_cast<DWORD>(size), &lastNumberOfBytesWritten, &overlapped)) {
     lastNumberOfBytesWritten = 0;
     return NtstatusFromWin32();
   }
@@ -200,6 +209,80 @@ FilesystemSourceMount::ImportPortation::ImportPortation(FilesystemSourceMount& s
   }
 
   // TODO: Set Security Information
+
+  // copy the whole data here if the exporter is backed by a file on the same volume which supports block cloning
+  portationInfo->dataImported = FALSE;
+  if (!directory && !empty && fileSize.QuadPart > 0 && util::IsValidHandle(portationInfo->nativeHandle)) {
+    portationInfo->dataImported = CloneFrom(portationInfo->nativeHandle) ? TRUE : FALSE;
+  }
+}
+
+
+// shares the clusters of hSourceFile with hFile by FSCTL_DUPLICATE_EXTENTS_TO_FILE (ReFS block cloning)
+// returns false without modifying the file if block cloning is not available, so that the data is copied in chunks instead
+bool FilesystemSourceMount::ImportPortation::CloneFrom(HANDLE hSourceFile) {
+  // both files must be on the same volume
+  BY_HANDLE_FILE_INFORMATION sourceFileInformation;
+  BY_HANDLE_FILE_INFORMATION destinationFileInformation;
+  if (!GetFileInformationByHandle(hSourceFile, &sourceFileInformation) || !GetFileInformationByHandle(hFile, &destinationFileInformation)) {
+    return false;
+  }
+  if (sourceFileInformation.dwVolumeSerialNumber != destinationFileInformation.dwVolumeSerialNumber) {
+    return false;
+  }
+
+  // fails on file systems other than ReFS
+  FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrityInformation;
+  DWORD returnedBytes;
+  if (!DeviceIoControl(hSourceFile, FSCTL_GET_INTEGRITY_INFORMATION, NULL, 0, &integrityInformation, sizeof(integrityInformation), &returnedBytes, NULL)) {
+    return false;
+  }
+  const ULONGLONG clusterSize = integrityInformation.ClusterSizeInBytes;
+  if (!clusterSize) {
+    return false;
+  }
+
+  // the cloned ranges must be cluster-aligned, so the file is extended to the cluster boundary and truncated afterward
+  const ULONGLONG alignedSize = (fileSize.QuadPart + clusterSize - 1) / clusterSize * clusterSize;
+  const auto setEndOfFile = [this](ULONGLONG size) -> bool {
+    FILE_END_OF_FILE_INFO fileEndOfFileInfo;
+    fileEndOfFileInfo.EndOfFile.QuadPart = size;
+    return SetFileInformationByHandle(hFile, FileEndOfFileInfo, &fileEndOfFileInfo, sizeof(fileEndOfFileInfo));
+  };
+
+  if (sourceFileInformation.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) {
+    // the destination must be sparse if the source is
+    if (!DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returnedBytes, NULL)) {
+      return false;
+    }
+  }
+
+  if (!setEndOfFile(alignedSize)) {
+    return false;
+  }
+
+  // a single request must be smaller than 4 GiB
+  const ULONGLONG maxChunkSize = (0x80000000ULL / clusterSize) * clusterSize;
+  for (ULONGLONG offset = 0; offset < alignedSize; ) {
+    const ULONGLONG chunkSize = std::min(alignedSize - offset, maxChunkSize);
+    DUPLICATE_EXTENTS_DATA duplicateExtentsData;
+    duplicateExtentsData.FileHandle = hSourceFile;
+    duplicateExtentsData.SourceFileOffset.QuadPart = offset;
+    duplicateExtentsData.TargetFileOffset.QuadPart = offset;
+    duplicateExtentsData.ByteCount.QuadPart = chunkSize;
+    if (!DeviceIoControl(hFile, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &duplicateExtentsData, sizeof(duplicateExtentsData), NULL, 0, &returnedBytes, NULL)) {
+      setEndOfFile(0);
+      return false;
+    }
+    offset += chunkSize;
+  }
+
+  if (!setEndOfFile(fileSize.QuadPart)) {
+    setEndOfFile(0);
+    return false;
+  }
+
+  return true;
 }
 
 
@@ -208,8 +291,10 @@ NTSTATUS FilesystemSourceMount::ImportPortation::Import(PORTATION_INFO* portatio
     return STATUS_SUCCESS;
   }
 
+  // positional write; the handle may be shared with a file context which is being written concurrently
   DWORD numberOfBytesWritten;
-  if (!WriteFile(hFile, portationInfo->currentData, portationInfo->currentSize, &numberOfBytesWritten, NULL)) {
+  OVERLAPPED overlapped = util::CreateOverlapped(portationInfo->currentOffset.QuadPart);
+  if (!WriteFile(hFile, portationInfo->currentData, portationInfo->currentSize, &numberOfBytesWritten, &overlapped)) {
     return NtstatusFromWin32();
   }
 
@@ -328,6 +413,7 @@ BOOL FilesystemSourceMount::GetSourceInfo(SOURCE_INFO* sourceInfo) {
   if (sourceInfo) {
     *sourceInfo = {
       TRUE,
+      FALSE,
     };
   }
   return TRUE;
@@ -381,6 +467,29 @@ NTSTATUS FilesystemSourceMount::ListFiles(LPCWSTR FileName, PListFilesCallback C
 }
 
 
+NTSTATUS FilesystemSourceMount::ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  // FindFirstFileW does not accept DOS_STAR, DOS_QM and DOS_DOT; let libmergefs filter the result of ListFiles
+  if (!SearchPattern || std::wstring_view(SearchPattern).find_first_of(L"<>\"") != std::wstring_view::npos) {
+    return STATUS_NOT_IMPLEMENTED;
+  }
+  const std::wstring realPath = GetRealPath(FileName);
+  const std::wstring filter = realPath + L"\\"s + SearchPattern;
+  WIN32_FIND_DATAW win32FindData;
+  HANDLE hFind = FindFirstFileExW(filter.c_str(), FindExInfoBasic, &win32FindData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+  if (hFind == INVALID_HANDLE_VALUE) {
+    const DWORD error = GetLastError();
+    // the directory exists but nothing matched
+    return error == ERROR_FILE_NOT_FOUND ? STATUS_SUCCESS : NtstatusFromWin32(error);
+  }
+  do {
+    Callback(&win32FindData, CallbackContext);
+  } while (FindNextFileW(hFind, &win32FindData));
+  const DWORD error = GetLastError();
+  FindClose(hFind);
+  return error == ERROR_SUCCESS || error == ERROR_NO_MORE_FILES ? STATUS_SUCCESS : NtstatusFromWin32(error);
+}
+
+
 NTSTATUS FilesystemSourceMount::ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext) {
   const std::wstring realPath = GetRealPath(FileName);
   WIN32_FIND_STREAM_DATA win32FindStreamData;
@@ -521,7 +630,10 @@ NTSTATUS FilesystemSourceMount::DGetVolumeInformation(LPWSTR VolumeNameBuffer, D
 NTSTATUS FilesystemSourceMount::ExportStartImpl(PORTATION_INFO* PortationInfo) {
   auto upPortation = std::make_unique<ExportPortation>(*this, PortationInfo);
   auto ptrPortation = upPortation.get();
-  portationMap.emplace(ptrPortation, std::move(upPortation));
+  {
+    std::lock_guard lock(subMutex);
+    portationMap.emplace(ptrPortation, std::move(upPortation));
+  }
   PortationInfo->exporterContext = ptrPortation;
   return STATUS_SUCCESS;
 }
@@ -536,6 +648,7 @@ NTSTATUS FilesystemSourceMount::ExportDataImpl(PORTATION_INFO* PortationInfo) {
 NTSTATUS FilesystemSourceMount::ExportFinishImpl(PORTATION_INFO* PortationInfo, BOOL Success) {
   auto ptrPortation = static_cast<ExportPortation*>(PortationInfo->exporterContext);
   const auto status = ptrPortation->Finish(PortationInfo, Success);
+  std::lock_guard lock(subMutex);
   portationMap.erase(ptrPortation);
   return status;
 }
@@ -544,7 +657,10 @@ NTSTATUS FilesystemSourceMount::ExportFinishImpl(PORTATION_INFO* PortationInfo,
 NTSTATUS FilesystemSourceMount::ImportStartImpl(PORTATION_INFO* PortationInfo) {
   auto upPortation = std::make_unique<ImportPortation>(*this, PortationInfo);
   auto ptrPortation = upPortation.get();
-  portationMap.emplace(ptrPortation, std::move(upPortation));
+  {
+    std::lock_guard lock(subMutex);
+    portationMap.emplace(ptrPortation, std::move(upPortation));
+  }
   PortationInfo->importerContext = ptrPortation;
   return STATUS_SUCCESS;
 }
@@ -559,6 +675,7 @@ NTSTATUS FilesystemSourceMount::ImportDataImpl(PORTATION_INFO* PortationInfo) {
 NTSTATUS FilesystemSourceMount::ImportFinishImpl(PORTATION_INFO* PortationInfo, BOOL Success) {
   auto ptrPortation = static_cast<ImportPortation*>(PortationInfo->importerContext);
   const auto status = ptrPortation->Finish(PortationInfo, Success);
+  std::lock_guard lock(subMutex);
   portationMap.erase(ptrPortation);
   return status;
 }
@@ -38,10 +38,9 @@ class FilesystemSourceMount : public SourceMountBase {
 
 
   class ExportPortation : public Portation {
-    static constexpr std::size_t BufferSize = 4096;
-
     bool directory;
     BY_HANDLE_FILE_INFORMATION byHandleFileInformation;
+    std::size_t bufferSize;
     std::unique_ptr<char[]> buffer;
     DWORD lastNumberOfBytesWritten;
 
@@ -63,6 +62,8 @@ class FilesystemSourceMount : public SourceMountBase {
     std::unique_ptr<char[]> securityData;
     const LARGE_INTEGER fileSize;
 
+    bool CloneFrom(HANDLE hSourceFile);
+
   public:
     ImportPortation(FilesystemSourceMount& sourceMount, PORTATION_INFO* portationInfo);
 
@@ -102,6 +103,7 @@ public:
   NTSTATUS GetDirectoryInfo(LPCWSTR FileName) override;
   NTSTATUS RemoveFile(LPCWSTR FileName) override;
   NTSTATUS ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
+  NTSTATUS ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
   NTSTATUS ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
   NTSTATUS SwitchDestinationPrepareImpl(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) override;
   NTSTATUS SwitchDestinationCleanupImpl(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) override;
@@ -181,10 +181,17 @@ NTSTATUS FilesystemSourceMountFile::DReadFile(LPVOID Buffer, DWORD BufferLength,
   if (!util::IsValidHandle(hFile)) {
     return STATUS_INVALID_HANDLE;
   }
-  if (!SetFilePointerEx(hFile, util::CreateLargeInteger(Offset), NULL, FILE_BEGIN)) {
-    return NtstatusFromWin32();
+  // positional read; the handle may be read concurrently (e.g. by a background export during copy-up)
+  OVERLAPPED overlapped = util::CreateOverlapped(Offset);
+  if (!ReadFile(hFile, Buffer, BufferLength, ReadLength, &overlapped)) {
+    const DWORD error = GetLastError();
+    if (error == ERROR_HANDLE_EOF) {
+      *ReadLength = 0;
+      return STATUS_SUCCESS;
+    }
+    return NtstatusFromWin32(error);
   }
-  return NtstatusFromWin32Api(ReadFile(hFile, Buffer, BufferLength, ReadLength, NULL));
+  return STATUS_SUCCESS;
 }
 
 
@@ -192,11 +199,11 @@ NTSTATUS FilesystemSourceMountFile::DWriteFile(LPCVOID Buffer, DWORD NumberOfByt
   if (!util::IsValidHandle(hFile)) {
     return STATUS_INVALID_HANDLE;
   }
-  // seek
+  // positional write; the handle may be written concurrently (e.g. by a background import during copy-up)
+  OVERLAPPED overlapped = util::CreateOverlapped(Offset);
   if (DokanFileInfo->WriteToEndOfFile) {
-    if (!SetFilePointerEx(hFile, util::CreateLargeInteger(0), NULL, FILE_END)) {
-      return NtstatusFromWin32();
-    }
+    overlapped.Offset = 0xFFFFFFFF;
+    overlapped.OffsetHigh = 0xFFFFFFFF;
   } else {
     LARGE_INTEGER fileSize;
     if (!GetFileSizeEx(hFile, &fileSize)) {
@@ -215,12 +222,9 @@ NTSTATUS FilesystemSourceMountFile::DWriteFile(LPCVOID Buffer, DWORD NumberOfByt
         NumberOfBytesToWrite = static_cast<DWORD>(std::min<ULONGLONG>(writableBytes, static_cast<ULONGLONG>(std::numeric_limits<DWORD>::max())));
       }
     }
-    if (!SetFilePointerEx(hFile, util::CreateLargeInteger(Offset), NULL, FILE_BEGIN)) {
-      return NtstatusFromWin32();
-    }
   }
   // write
-  return NtstatusFromWin32Api(WriteFile(hFile, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, NULL));
+  return NtstatusFromWin32Api(WriteFile(hFile, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten, &overlapped));
 }
 
 
@@ -32,6 +32,7 @@ namespace {
   constexpr wchar_t DFileSystemName[] = L"NULLFS";
   constexpr SOURCE_INFO DSourceInfo = {
     FALSE,
+    FALSE,
   };
 
   const PLUGIN_INFO gPluginInfo = {
@@ -117,6 +118,17 @@ NTSTATUS WINAPI GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32Fi
 }
 
 
+NTSTATUS WINAPI GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
+  if (Count && (!FileNames || !Statuses)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  for (DWORD i = 0; i < Count; i++) {
+    Statuses[i] = GetFileInfo(FileNames[i], Win32FileAttributeData ? &Win32FileAttributeData[i] : nullptr, sourceContextId);
+  }
+  return STATUS_SUCCESS;
+}
+
+
 NTSTATUS WINAPI GetDirectoryInfo(LPCWSTR FileName, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
   if (IsRootDirectory(FileName)) {
     return STATUS_SUCCESS;
@@ -202,6 +214,11 @@ NTSTATUS WINAPI ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBAC
 }
 
 
+NTSTATUS WINAPI ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
+  return STATUS_NOT_IMPLEMENTED;
+}
+
+
 NTSTATUS WINAPI ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
   if (IsRootDirectory(FileName)) {
     return STATUS_SUCCESS;
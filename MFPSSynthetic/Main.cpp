@@ -0,0 +1,64 @@
+#define NOMINMAX
+
+#include <dokan/dokan.h>
+
+#include "../SDK/Plugin/SourceCpp.hpp"
+
+#include <memory>
+#include <string_view>
+
+#include <Windows.h>
+
+#include "SyntheticSourceMount.hpp"
+
+using namespace std::literals;
+
+
+
+namespace {
+  // {8F3ACF43-D9DD-0000-1010-600000000000}
+  constexpr GUID DPluginGUID = {0x8F3ACF43, 0xD9DD, 0x0000, {0x10, 0x10, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+  const PLUGIN_INFO gPluginInfo = {
+    MERGEFS_PLUGIN_INTERFACE_VERSION,
+    PLUGIN_TYPE::Source,
+    DPluginGUID,
+    L"Synthetic",
+    L"Synthetic source plugin for load testing",
+    0x00000001,
+    L"0.0.1",
+  };
+
+  PLUGIN_INITIALIZE_INFO gPluginInitializeInfo{};
+}
+
+
+
+BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
+  return TRUE;
+}
+
+
+
+const PLUGIN_INFO* SGetPluginInfoImpl() noexcept {
+  return &gPluginInfo;
+}
+
+
+PLUGIN_INITCODE SInitializeImpl(const PLUGIN_INITIALIZE_INFO* InitializeInfo) noexcept {
+  gPluginInitializeInfo = *InitializeInfo;
+  return PLUGIN_INITCODE::Success;
+}
+
+
+// "SYNTHETIC" or "SYNTHETIC:<volume name>"; the tree is described by the options
+BOOL SIsSupportedImpl(const PLUGIN_INITIALIZE_MOUNT_INFO* InitializeMountInfo) noexcept {
+  const std::wstring_view filename(InitializeMountInfo->FileName);
+  return filename == L"SYNTHETIC"sv || filename.substr(0, 10) == L"SYNTHETIC:"sv ? TRUE : FALSE;
+}
+
+
+
+std::unique_ptr<SourceMountBase> MountImpl(const PLUGIN_INITIALIZE_MOUNT_INFO* InitializeMountInfo, SOURCE_CONTEXT_ID sourceContextId) {
+  return std::make_unique<SyntheticSourceMount>(InitializeMountInfo, sourceContextId);
+}
@@ -0,0 +1,495 @@
+#define NOMINMAX
+
+#include <dokan/dokan.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <Windows.h>
+
+#include "../Util/Common.hpp"
+#include "../Util/VirtualFs.hpp"
+
+#include "SyntheticSourceMount.hpp"
+#include "SyntheticSourceMountFile.hpp"
+
+using namespace std::literals;
+using json = nlohmann::json;
+
+
+
+namespace {
+  constexpr DWORD DVolumeSerialNumber = 0x60000001;
+  constexpr DWORD DMaximumComponentLength = MAX_PATH;
+  constexpr auto DFileSystemName = L"SYNTHETIC";
+  // prefix of SOURCE_INFO::FileName; "SYNTHETIC" or "SYNTHETIC:<volume name>"
+  constexpr auto DSourceName = L"SYNTHETIC"sv;
+
+  // Sleep has the granularity of the system timer (1 ms or more), so shorter latencies are spun
+  constexpr auto SleepThreshold = std::chrono::microseconds(2000);
+
+  constexpr std::size_t DefaultDepth = 3;
+  constexpr std::uint64_t DefaultFanOut = 10;
+  constexpr std::uint64_t DefaultFilesPerDirectory = 10;
+  constexpr std::uint64_t DefaultFileSize = 4096;
+  constexpr auto DefaultExtension = L"bin";
+
+
+  std::chrono::microseconds ParseLatency(const json& jsonLatency) {
+    return std::chrono::microseconds(jsonLatency.get<unsigned long long>());
+  }
+}
+
+
+
+SyntheticSourceMount::ExportPortation::ExportPortation(SyntheticSourceMount& sourceMount, const SyntheticTree::Node& node, PORTATION_INFO* portationInfo) :
+  sourceMount(sourceMount),
+  node(node),
+  directory(node.directory),
+  lastNumberOfBytesWritten(0),
+  bufferSize(0)
+{
+  const auto& tree = sourceMount.GetTree();
+  const auto time = tree.GetTime(node);
+
+  portationInfo->directory = directory ? TRUE : FALSE;
+  portationInfo->fileAttributes = sourceMount.GetNodeAttributes(node);
+  portationInfo->creationTime = time;
+  portationInfo->lastAccessTime = time;
+  portationInfo->lastWriteTime = time;
+  portationInfo->fileSize.QuadPart = tree.GetFileSize(node);
+
+  portationInfo->securitySize = 0;
+  portationInfo->securityData = nullptr;
+
+  // allocate buffer
+  if (!directory) {
+    bufferSize = GetPortationBufferSize(portationInfo);
+    buffer = std::make_unique<char[]>(bufferSize);
+  }
+
+  portationInfo->currentData = buffer.get();
+  portationInfo->currentOffset.QuadPart = 0;
+  portationInfo->currentSize = 0;
+}
+
+
+NTSTATUS SyntheticSourceMount::ExportPortation::Export(PORTATION_INFO* portationInfo) {
+  if (directory) {
+    return STATUS_ALREADY_COMPLETE;
+  }
+
+  portationInfo->currentOffset.QuadPart += lastNumberOfBytesWritten;
+
+  const std::size_t size = static_cast<std::size_t>(std::min<ULONGLONG>(portationInfo->fileSize.QuadPart - portationInfo->currentOffset.QuadPart, bufferSize));
+  if (size == 0) {
+    return STATUS_ALREADY_COMPLETE;
+  }
+
+  sourceMount.InjectReadLatency();
+  sourceMount.GetTree().Read(node, portationInfo->currentOffset.QuadPart, buffer.get(), size);
+  lastNumberOfBytesWritten = static_cast<DWORD>(size);
+
+  portationInfo->currentData = buffer.get();
+  portationInfo->currentSize = lastNumberOfBytesWritten;
+
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::ExportPortation::Finish(PORTATION_INFO* portationInfo, bool success) {
+  return STATUS_SUCCESS;
+}
+
+
+
+SyntheticSourceMount::SyntheticSourceMount(const PLUGIN_INITIALIZE_MOUNT_INFO* initializeMountInfo, SOURCE_CONTEXT_ID sourceContextId) :
+  ReadonlySourceMountBase(initializeMountInfo, sourceContextId),
+  subMutex(),
+  portationMap(),
+  metadataLatency(0),
+  readLatency(0)
+{
+  // parse options
+  SyntheticTree::Options options{
+    DefaultDepth,
+    DefaultFanOut,
+    DefaultFilesPerDirectory,
+    std::nullopt,
+    SyntheticTree::SizeDistribution::Fixed,
+    DefaultFileSize,
+    DefaultFileSize,
+    SyntheticTree::ContentPattern::Pattern,
+    0,
+    DefaultExtension,
+  };
+
+  if (initializeMountInfo->OptionsJSON && initializeMountInfo->OptionsJSON[0] == '{') {
+    try {
+      const auto jsonOptions = json::parse(initializeMountInfo->OptionsJSON);
+
+      try {
+        options.depth = jsonOptions.at("depth"s).get<std::size_t>();
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      try {
+        options.fanOut = jsonOptions.at("fanOut"s).get<unsigned long long>();
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      // with fileCount alone, files are spread evenly over the directories
+      try {
+        options.fileCount = jsonOptions.at("fileCount"s).get<unsigned long long>();
+        options.filesPerDirectory = 0;
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      try {
+        options.filesPerDirectory = jsonOptions.at("filesPerDirectory"s).get<unsigned long long>();
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      // "fileSize": 4096 or "fileSize": {"distribution": "logUniform", "min": 0, "max": 1073741824}
+      try {
+        const auto& jsonFileSize = jsonOptions.at("fileSize"s);
+        if (jsonFileSize.is_number()) {
+          options.minFileSize = options.maxFileSize = jsonFileSize.get<unsigned long long>();
+        } else {
+          const auto& strDistribution = util::ToLowerString(jsonFileSize.value("distribution"s, "fixed"s));
+          if (strDistribution == "fixed"sv) {
+            options.sizeDistribution = SyntheticTree::SizeDistribution::Fixed;
+          } else if (strDistribution == "uniform"sv) {
+            options.sizeDistribution = SyntheticTree::SizeDistribution::Uniform;
+          } else if (strDistribution == "loguniform"sv) {
+            options.sizeDistribution = SyntheticTree::SizeDistribution::LogUniform;
+          }
+          options.minFileSize = jsonFileSize.value("min"s, 0ull);
+          options.maxFileSize = jsonFileSize.value("max"s, options.minFileSize);
+        }
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      try {
+        const auto& strContent = util::ToLowerString(jsonOptions.at("content"s).get<std::string>());
+        if (strContent == "zero"sv) {
+          options.contentPattern = SyntheticTree::ContentPattern::Zero;
+        } else if (strContent == "pattern"sv) {
+          options.contentPattern = SyntheticTree::ContentPattern::Pattern;
+        } else if (strContent == "random"sv) {
+          options.contentPattern = SyntheticTree::ContentPattern::Random;
+        }
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      try {
+        options.seed = jsonOptions.at("seed"s).get<unsigned long long>();
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      try {
+        options.extension = jsonOptions.at("extension"s).get<std::wstring>();
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      // "latency": 500 or "latency": {"metadata": 500, "read": 2000}, in microseconds per call
+      try {
+        const auto& jsonLatency = jsonOptions.at("latency"s);
+        if (jsonLatency.is_number()) {
+          metadataLatency = readLatency = ParseLatency(jsonLatency);
+        } else {
+          if (jsonLatency.contains("metadata"s)) {
+            metadataLatency = ParseLatency(jsonLatency.at("metadata"s));
+          }
+          if (jsonLatency.contains("read"s)) {
+            readLatency = ParseLatency(jsonLatency.at("read"s));
+          }
+        }
+      } catch (json::type_error) {
+      } catch (json::out_of_range) {}
+
+      //
+    } catch (json::type_error) {
+    } catch (json::out_of_range) {}
+  }
+
+  treeN.emplace(options);
+
+  const std::wstring_view sourceName(filename);
+  volumeName = sourceName.size() > DSourceName.size() + 1 ? std::wstring(sourceName.substr(DSourceName.size() + 1, MAX_PATH)) : std::wstring(DSourceName);
+  volumeSerialNumber = DVolumeSerialNumber ^ static_cast<DWORD>(options.seed & 0xFFFFFFFF);
+  maximumComponentLength = DMaximumComponentLength;
+  fileSystemFlags = FILE_CASE_PRESERVED_NAMES | FILE_READ_ONLY_VOLUME | FILE_UNICODE_ON_DISK | (caseSensitive ? FILE_CASE_SENSITIVE_SEARCH : 0);
+  fileSystemName = DFileSystemName;
+}
+
+
+void SyntheticSourceMount::InjectLatency(std::chrono::microseconds latency) {
+  if (latency.count() <= 0) {
+    return;
+  }
+  if (latency >= SleepThreshold) {
+    std::this_thread::sleep_for(latency);
+    return;
+  }
+  const auto end = std::chrono::steady_clock::now() + latency;
+  while (std::chrono::steady_clock::now() < end) {
+    YieldProcessor();
+  }
+}
+
+
+void SyntheticSourceMount::FillWin32FindData(const SyntheticTree::Node& node, WIN32_FIND_DATAW& win32FindData) const {
+  const auto& tree = GetTree();
+  const auto time = tree.GetTime(node);
+  const auto fileSize = tree.GetFileSize(node);
+  const auto name = tree.GetName(node);
+  win32FindData = WIN32_FIND_DATAW{
+    GetNodeAttributes(node),
+    time,
+    time,
+    time,
+    static_cast<DWORD>((fileSize >> 32) & 0xFFFFFFFF),
+    static_cast<DWORD>(fileSize & 0xFFFFFFFF),
+    0,
+    0,
+  };
+  std::size_t copyLength = std::min<std::size_t>(name.size(), MAX_PATH - 1);
+  std::memcpy(win32FindData.cFileName, name.c_str(), copyLength * sizeof(wchar_t));
+  win32FindData.cFileName[copyLength] = L'\0';
+}
+
+
+const SyntheticTree& SyntheticSourceMount::GetTree() const {
+  return treeN.value();
+}
+
+
+NTSTATUS SyntheticSourceMount::Resolve(LPCWSTR filepath, SyntheticTree::Node& node) const {
+  return GetTree().Resolve(filepath, caseSensitive, node);
+}
+
+
+DWORD SyntheticSourceMount::GetNodeAttributes(const SyntheticTree::Node& node) const {
+  return node.directory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+
+DWORD SyntheticSourceMount::GetVolumeSerialNumber() const {
+  return volumeSerialNumber;
+}
+
+
+void SyntheticSourceMount::InjectMetadataLatency() const {
+  InjectLatency(metadataLatency);
+}
+
+
+void SyntheticSourceMount::InjectReadLatency() const {
+  InjectLatency(readLatency);
+}
+
+
+BOOL SyntheticSourceMount::GetSourceInfo(SOURCE_INFO* sourceInfo) {
+  if (sourceInfo) {
+    *sourceInfo = {
+      FALSE,
+      TRUE,
+    };
+  }
+  return TRUE;
+}
+
+
+NTSTATUS SyntheticSourceMount::GetFileInfoNoLatency(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) const {
+  SyntheticTree::Node node;
+  if (const auto status = Resolve(FileName, node); status != STATUS_SUCCESS) {
+    return status;
+  }
+  if (!Win32FileAttributeData) {
+    return STATUS_SUCCESS;
+  }
+  const auto& tree = GetTree();
+  const auto time = tree.GetTime(node);
+  const auto fileSize = tree.GetFileSize(node);
+  Win32FileAttributeData->dwFileAttributes = GetNodeAttributes(node);
+  Win32FileAttributeData->ftCreationTime = time;
+  Win32FileAttributeData->ftLastAccessTime = time;
+  Win32FileAttributeData->ftLastWriteTime = time;
+  Win32FileAttributeData->nFileSizeHigh = (fileSize >> 32) & 0xFFFFFFFF;
+  Win32FileAttributeData->nFileSizeLow = fileSize & 0xFFFFFFFF;
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) {
+  InjectMetadataLatency();
+  return GetFileInfoNoLatency(FileName, Win32FileAttributeData);
+}
+
+
+// a batch is one request to the lower layer, so the latency is paid once
+NTSTATUS SyntheticSourceMount::GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) {
+  if (Count && (!FileNames || !Statuses)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  InjectMetadataLatency();
+  for (DWORD i = 0; i < Count; i++) {
+    Statuses[i] = GetFileInfoNoLatency(FileNames[i], Win32FileAttributeData ? &Win32FileAttributeData[i] : nullptr);
+  }
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::GetDirectoryInfo(LPCWSTR FileName) {
+  InjectMetadataLatency();
+  SyntheticTree::Node node;
+  if (const auto status = Resolve(FileName, node); status != STATUS_SUCCESS) {
+    return status;
+  }
+  if (!node.directory) {
+    return STATUS_NOT_A_DIRECTORY;
+  }
+  const auto& tree = GetTree();
+  return tree.GetNumSubdirectories(node) || tree.GetNumFiles(node) ? STATUS_DIRECTORY_NOT_EMPTY : STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  return ListFilesWithPattern(FileName, L"*", Callback, CallbackContext);
+}
+
+
+NTSTATUS SyntheticSourceMount::ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  InjectMetadataLatency();
+  const std::wstring_view searchPattern = SearchPattern ? SearchPattern : L"*"sv;
+  const auto& tree = GetTree();
+  SyntheticTree::Node directory;
+  if (const auto status = Resolve(FileName, directory); status != STATUS_SUCCESS) {
+    return status;
+  }
+  if (!directory.directory) {
+    return STATUS_NOT_A_DIRECTORY;
+  }
+
+  WIN32_FIND_DATAW win32FindDataW;
+
+  // a pattern without wildcards names a single entry; look it up instead of generating the whole directory
+  if (searchPattern.find_first_of(L"*?<>\""sv) == std::wstring_view::npos) {
+    if (const auto childN = tree.GetChild(directory, searchPattern, caseSensitive)) {
+      FillWin32FindData(childN.value(), win32FindDataW);
+      Callback(&win32FindDataW, CallbackContext);
+    }
+    return STATUS_SUCCESS;
+  }
+
+  const bool matchAll = util::vfs::IsMatchAllExpression(searchPattern);
+  const auto emit = [&](const SyntheticTree::Node& node) {
+    if (!matchAll && !util::vfs::IsNameInExpression(searchPattern, tree.GetName(node), caseSensitive)) {
+      return;
+    }
+    FillWin32FindData(node, win32FindDataW);
+    Callback(&win32FindDataW, CallbackContext);
+  };
+  const auto numSubdirectories = tree.GetNumSubdirectories(directory);
+  for (std::uint64_t index = 0; index < numSubdirectories; index++) {
+    emit(tree.GetSubdirectory(directory, index));
+  }
+  const auto numFiles = tree.GetNumFiles(directory);
+  for (std::uint64_t index = 0; index < numFiles; index++) {
+    emit(tree.GetFile(directory, index));
+  }
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::DGetDiskFreeSpace(PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes, PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (FreeBytesAvailable) {
+    *FreeBytesAvailable = 0;
+  }
+  if (TotalNumberOfBytes) {
+    // summing the real sizes would visit every file
+    *TotalNumberOfBytes = GetTree().GetExpectedTotalFileSize();
+  }
+  if (TotalNumberOfFreeBytes) {
+    *TotalNumberOfFreeBytes = 0;
+  }
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber, LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (VolumeNameBuffer) {
+    if (VolumeNameSize < volumeName.size() + 1) {
+      return STATUS_BUFFER_TOO_SMALL;
+    }
+    std::memcpy(VolumeNameBuffer, volumeName.c_str(), (volumeName.size() + 1) * sizeof(wchar_t));
+  }
+  if (VolumeSerialNumber) {
+    *VolumeSerialNumber = volumeSerialNumber;
+  }
+  if (MaximumComponentLength) {
+    *MaximumComponentLength = maximumComponentLength;
+  }
+  if (FileSystemFlags) {
+    *FileSystemFlags = fileSystemFlags;
+  }
+  if (FileSystemNameBuffer) {
+    if (FileSystemNameSize < fileSystemName.size() + 1) {
+      return STATUS_BUFFER_TOO_SMALL;
+    }
+    std::memcpy(FileSystemNameBuffer, fileSystemName.c_str(), (fileSystemName.size() + 1) * sizeof(wchar_t));
+  }
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::ExportStartImpl(PORTATION_INFO* PortationInfo) {
+  InjectMetadataLatency();
+  SyntheticTree::Node node;
+  if (const auto status = Resolve(PortationInfo->filepath, node); status != STATUS_SUCCESS) {
+    return status;
+  }
+  auto upPortation = std::make_unique<ExportPortation>(*this, node, PortationInfo);
+  auto ptrPortation = upPortation.get();
+  {
+    std::lock_guard lock(subMutex);
+    portationMap.emplace(ptrPortation, std::move(upPortation));
+  }
+  PortationInfo->exporterContext = ptrPortation;
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMount::ExportDataImpl(PORTATION_INFO* PortationInfo) {
+  auto ptrPortation = static_cast<ExportPortation*>(PortationInfo->exporterContext);
+  return ptrPortation->Export(PortationInfo);
+}
+
+
+NTSTATUS SyntheticSourceMount::ExportFinishImpl(PORTATION_INFO* PortationInfo, BOOL Success) {
+  auto ptrPortation = static_cast<ExportPortation*>(PortationInfo->exporterContext);
+  const auto status = ptrPortation->Finish(PortationInfo, Success);
+  std::lock_guard lock(subMutex);
+  portationMap.erase(ptrPortation);
+  return status;
+}
+
+
+std::unique_ptr<SourceMountFileBase> SyntheticSourceMount::DZwCreateFileImpl(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, BOOL MaybeSwitched, FILE_CONTEXT_ID FileContextId) {
+  InjectMetadataLatency();
+  return std::make_unique<SyntheticSourceMountFile>(*this, FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, MaybeSwitched, FileContextId);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <dokan/dokan.h>
+
+#include "../SDK/Plugin/SourceCppReadonly.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <Windows.h>
+
+#include "SyntheticTree.hpp"
+
+
+class SyntheticSourceMountFile;
+
+
+class SyntheticSourceMount : public ReadonlySourceMountBase {
+  class ExportPortation {
+  protected:
+    SyntheticSourceMount& sourceMount;
+    const SyntheticTree::Node node;
+    const bool directory;
+
+    DWORD lastNumberOfBytesWritten;
+    std::size_t bufferSize;
+    std::unique_ptr<char[]> buffer;
+
+  public:
+    ExportPortation(SyntheticSourceMount& sourceMount, const SyntheticTree::Node& node, PORTATION_INFO* portationInfo);
+
+    NTSTATUS Export(PORTATION_INFO* portationInfo);
+    NTSTATUS Finish(PORTATION_INFO* portationInfo, bool success);
+  };
+
+
+  std::mutex subMutex;
+  std::unordered_map<ExportPortation*, std::unique_ptr<ExportPortation>> portationMap;
+  std::optional<SyntheticTree> treeN;
+  std::chrono::microseconds metadataLatency;
+  std::chrono::microseconds readLatency;
+  std::wstring volumeName;
+  DWORD volumeSerialNumber;
+  DWORD maximumComponentLength;
+  DWORD fileSystemFlags;
+  std::wstring fileSystemName;
+
+  static void InjectLatency(std::chrono::microseconds latency);
+
+  void FillWin32FindData(const SyntheticTree::Node& node, WIN32_FIND_DATAW& win32FindData) const;
+  NTSTATUS GetFileInfoNoLatency(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) const;
+
+public:
+  SyntheticSourceMount(const PLUGIN_INITIALIZE_MOUNT_INFO* InitializeMountInfo, SOURCE_CONTEXT_ID sourceContextId);
+
+  const SyntheticTree& GetTree() const;
+  NTSTATUS Resolve(LPCWSTR filepath, SyntheticTree::Node& node) const;
+  DWORD GetNodeAttributes(const SyntheticTree::Node& node) const;
+  DWORD GetVolumeSerialNumber() const;
+  // emulate a slow lower layer; called at the start of every metadata request (once per batch) and of every read
+  void InjectMetadataLatency() const;
+  void InjectReadLatency() const;
+
+  BOOL GetSourceInfo(SOURCE_INFO* sourceInfo) override;
+  NTSTATUS GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) override;
+  NTSTATUS GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) override;
+  NTSTATUS GetDirectoryInfo(LPCWSTR FileName) override;
+  NTSTATUS ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
+  NTSTATUS ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
+  NTSTATUS ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext) override;
+  NTSTATUS DGetDiskFreeSpace(PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes, PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) override;
+  NTSTATUS DGetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber, LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize, PDOKAN_FILE_INFO DokanFileInfo) override;
+  NTSTATUS ExportStartImpl(PORTATION_INFO* PortationInfo) override;
+  NTSTATUS ExportDataImpl(PORTATION_INFO* PortationInfo) override;
+  NTSTATUS ExportFinishImpl(PORTATION_INFO* PortationInfo, BOOL Success) override;
+  std::unique_ptr<SourceMountFileBase> DZwCreateFileImpl(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, BOOL MaybeSwitched, FILE_CONTEXT_ID FileContextId) override;
+};
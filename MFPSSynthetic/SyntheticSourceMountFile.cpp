@@ -0,0 +1,72 @@
+#define NOMINMAX
+
+#include <dokan/dokan.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include <Windows.h>
+
+#include "SyntheticSourceMountFile.hpp"
+#include "SyntheticSourceMount.hpp"
+
+
+
+SyntheticSourceMountFile::SyntheticSourceMountFile(SyntheticSourceMount& sourceMount, LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, BOOL MaybeSwitched, FILE_CONTEXT_ID FileContextId) :
+  ReadonlySourceMountFileBase(sourceMount, FileName, SecurityContext, DesiredAccess, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, DokanFileInfo, MaybeSwitched, FileContextId),
+  sourceMount(sourceMount)
+{
+  if (const auto status = sourceMount.Resolve(FileName, node); status != STATUS_SUCCESS) {
+    throw NtstatusError(status);
+  }
+
+  fileSize = sourceMount.GetTree().GetFileSize(node);
+  fileAttributes = sourceMount.GetNodeAttributes(node);
+  volumeSerialNumber = sourceMount.GetVolumeSerialNumber();
+}
+
+
+NTSTATUS SyntheticSourceMountFile::DReadFile(LPVOID Buffer, DWORD BufferLength, LPDWORD ReadLength, LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (Offset < 0) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  sourceMount.InjectReadLatency();
+  if (static_cast<ULONGLONG>(Offset) >= fileSize) {
+    if (ReadLength) {
+      *ReadLength = 0;
+    }
+    return STATUS_SUCCESS;
+  }
+  const DWORD sizeToRead = static_cast<DWORD>(std::min<ULONGLONG>(BufferLength, fileSize - Offset));
+  sourceMount.GetTree().Read(node, Offset, Buffer, sizeToRead);
+  if (ReadLength) {
+    *ReadLength = sizeToRead;
+  }
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMountFile::DGetFileInformation(LPBY_HANDLE_FILE_INFORMATION Buffer, PDOKAN_FILE_INFO DokanFileInfo) {
+  if (!Buffer) {
+    return STATUS_SUCCESS;
+  }
+  const auto& tree = sourceMount.GetTree();
+  const auto time = tree.GetTime(node);
+  const auto fileIndex = tree.GetFileIndex(node);
+  Buffer->dwFileAttributes = fileAttributes;
+  Buffer->ftCreationTime = time;
+  Buffer->ftLastAccessTime = time;
+  Buffer->ftLastWriteTime = time;
+  Buffer->dwVolumeSerialNumber = volumeSerialNumber;
+  Buffer->nFileSizeHigh = (fileSize >> 32) & 0xFFFFFFFF;
+  Buffer->nFileSizeLow = fileSize & 0xFFFFFFFF;
+  Buffer->nNumberOfLinks = 1;
+  Buffer->nFileIndexHigh = (fileIndex >> 32) & 0xFFFFFFFF;
+  Buffer->nFileIndexLow = fileIndex & 0xFFFFFFFF;
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SyntheticSourceMountFile::DGetFileSecurity(PSECURITY_INFORMATION SecurityInformation, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG BufferLength, PULONG LengthNeeded, PDOKAN_FILE_INFO DokanFileInfo) {
+  return STATUS_NOT_IMPLEMENTED;
+}
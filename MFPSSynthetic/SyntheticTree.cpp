@@ -0,0 +1,376 @@
+#define NOMINMAX
+
+#include <dokan/dokan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwctype>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <Windows.h>
+
+#include "SyntheticTree.hpp"
+
+using namespace std::literals;
+
+
+
+namespace {
+  constexpr std::size_t MaxDepth = 64;
+  // keeps the arithmetic of the size distributions away from overflow (256 TiB)
+  constexpr std::uint64_t MaxFileSize = 1ull << 48;
+
+  // 2020-01-01T00:00:00Z; times are spread over the year before it
+  constexpr std::uint64_t BaseTime = 132223104000000000ull;
+  constexpr std::uint64_t TimeSpread = 365ull * 24 * 60 * 60 * 10000000;
+
+
+  bool MultiplyOverflows(std::uint64_t a, std::uint64_t b, std::uint64_t& result) noexcept {
+    if (a != 0 && b > std::numeric_limits<std::uint64_t>::max() / a) {
+      return true;
+    }
+    result = a * b;
+    return false;
+  }
+
+
+  bool AddOverflows(std::uint64_t a, std::uint64_t b, std::uint64_t& result) noexcept {
+    if (b > std::numeric_limits<std::uint64_t>::max() - a) {
+      return true;
+    }
+    result = a + b;
+    return false;
+  }
+
+
+  std::size_t CountDigits(std::uint64_t value) noexcept {
+    std::size_t digits = 1;
+    while (value >= 10) {
+      value /= 10;
+      digits++;
+    }
+    return digits;
+  }
+
+
+  std::wstring ToPaddedString(std::uint64_t value, std::size_t width) {
+    std::wstring str = std::to_wstring(value);
+    if (str.size() < width) {
+      str.insert(0, width - str.size(), L'0');
+    }
+    return str;
+  }
+
+
+  bool ParseIndex(std::wstring_view digits, std::size_t width, std::uint64_t& index) noexcept {
+    if (digits.size() != width) {
+      return false;
+    }
+    std::uint64_t value = 0;
+    for (const auto c : digits) {
+      if (c < L'0' || c > L'9') {
+        return false;
+      }
+      const std::uint64_t digit = c - L'0';
+      if (value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10) {
+        return false;
+      }
+      value = value * 10 + digit;
+    }
+    index = value;
+    return true;
+  }
+}
+
+
+
+std::uint64_t SyntheticTree::Mix(std::uint64_t value) noexcept {
+  // splitmix64
+  value += 0x9E3779B97F4A7C15ull;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+  return value ^ (value >> 31);
+}
+
+
+SyntheticTree::SyntheticTree(const Options& options) :
+  options(options),
+  levelStarts(),
+  numDirectories(0),
+  numFiles(0)
+{
+  if (this->options.fanOut == 0) {
+    this->options.depth = 0;
+  }
+  if (this->options.depth > MaxDepth) {
+    throw std::runtime_error("depth too large");
+  }
+  if (this->options.minFileSize > this->options.maxFileSize) {
+    throw std::runtime_error("minFileSize exceeds maxFileSize");
+  }
+  if (this->options.maxFileSize > MaxFileSize) {
+    throw std::runtime_error("maxFileSize too large");
+  }
+
+  std::uint64_t levelSize = 1;
+  for (std::size_t level = 0; level <= this->options.depth; level++) {
+    levelStarts.push_back(numDirectories);
+    if (AddOverflows(numDirectories, levelSize, numDirectories)) {
+      throw std::runtime_error("too many directories");
+    }
+    if (level != this->options.depth && MultiplyOverflows(levelSize, this->options.fanOut, levelSize)) {
+      throw std::runtime_error("too many directories");
+    }
+  }
+
+  if (this->options.filesPerDirectory == 0 && this->options.fileCount) {
+    const auto fileCount = this->options.fileCount.value();
+    this->options.filesPerDirectory = fileCount / numDirectories + (fileCount % numDirectories ? 1 : 0);
+  }
+
+  std::uint64_t capacity;
+  if (MultiplyOverflows(numDirectories, this->options.filesPerDirectory, capacity)) {
+    throw std::runtime_error("too many files");
+  }
+  numFiles = this->options.fileCount ? std::min(this->options.fileCount.value(), capacity) : capacity;
+
+  directoryNameWidth = CountDigits(this->options.fanOut ? this->options.fanOut - 1 : 0);
+  fileNameWidth = CountDigits(this->options.filesPerDirectory ? this->options.filesPerDirectory - 1 : 0);
+}
+
+
+std::uint64_t SyntheticTree::GetDirectoryOrdinal(const Node& node) const noexcept {
+  return levelStarts[node.level] + node.position;
+}
+
+
+std::uint64_t SyntheticTree::GetGlobalFileIndex(const Node& node) const noexcept {
+  return GetDirectoryOrdinal(node) * options.filesPerDirectory + node.fileIndex;
+}
+
+
+std::uint64_t SyntheticTree::GetHash(const Node& node) const noexcept {
+  return Mix(options.seed ^ Mix(GetFileIndex(node)));
+}
+
+
+const SyntheticTree::Options& SyntheticTree::GetOptions() const noexcept {
+  return options;
+}
+
+
+std::uint64_t SyntheticTree::GetNumDirectories() const noexcept {
+  return numDirectories;
+}
+
+
+std::uint64_t SyntheticTree::GetNumFiles() const noexcept {
+  return numFiles;
+}
+
+
+std::uint64_t SyntheticTree::GetExpectedTotalFileSize() const noexcept {
+  const double minFileSize = static_cast<double>(options.minFileSize);
+  const double maxFileSize = static_cast<double>(options.maxFileSize);
+  double meanFileSize = maxFileSize;
+  switch (options.sizeDistribution) {
+    case SizeDistribution::Fixed:
+      break;
+
+    case SizeDistribution::Uniform:
+      meanFileSize = (minFileSize + maxFileSize) / 2;
+      break;
+
+    case SizeDistribution::LogUniform:
+      if (options.minFileSize != options.maxFileSize) {
+        meanFileSize = (maxFileSize - minFileSize) / (std::log1p(maxFileSize) - std::log1p(minFileSize)) - 1;
+      }
+      break;
+  }
+  return static_cast<std::uint64_t>(meanFileSize * static_cast<double>(numFiles));
+}
+
+
+SyntheticTree::Node SyntheticTree::GetRoot() const noexcept {
+  return Node{
+    true,
+    0,
+    0,
+    0,
+  };
+}
+
+
+NTSTATUS SyntheticTree::Resolve(std::wstring_view filepath, bool caseSensitive, Node& node) const {
+  Node current = GetRoot();
+  std::size_t pos = 0;
+  while (pos < filepath.size()) {
+    if (filepath[pos] == L'\\') {
+      pos++;
+      continue;
+    }
+    const std::size_t end = std::min(filepath.find(L'\\', pos), filepath.size());
+    // nothing exists below a file
+    const auto childN = current.directory ? GetChild(current, filepath.substr(pos, end - pos), caseSensitive) : std::nullopt;
+    if (!childN) {
+      return filepath.find_first_not_of(L'\\', end) == std::wstring_view::npos ? STATUS_OBJECT_NAME_NOT_FOUND : STATUS_OBJECT_PATH_NOT_FOUND;
+    }
+    current = childN.value();
+    pos = end;
+  }
+  node = current;
+  return STATUS_SUCCESS;
+}
+
+
+std::optional<SyntheticTree::Node> SyntheticTree::GetChild(const Node& directory, std::wstring_view name, bool caseSensitive) const {
+  const auto equals = [caseSensitive](wchar_t a, wchar_t b) {
+    return caseSensitive ? a == b : std::towupper(a) == std::towupper(b);
+  };
+
+  if (name.size() < 2) {
+    return std::nullopt;
+  }
+
+  std::uint64_t index;
+
+  if (equals(name[0], L'd')) {
+    if (!ParseIndex(name.substr(1), directoryNameWidth, index) || index >= GetNumSubdirectories(directory)) {
+      return std::nullopt;
+    }
+    return GetSubdirectory(directory, index);
+  }
+
+  if (equals(name[0], L'f')) {
+    const std::wstring_view extension = options.extension;
+    const std::size_t extensionLength = extension.empty() ? 0 : extension.size() + 1;
+    if (name.size() != 1 + fileNameWidth + extensionLength) {
+      return std::nullopt;
+    }
+    if (extensionLength) {
+      const auto nameExtension = name.substr(1 + fileNameWidth);
+      if (nameExtension[0] != L'.' || !std::equal(extension.cbegin(), extension.cend(), nameExtension.cbegin() + 1, equals)) {
+        return std::nullopt;
+      }
+    }
+    if (!ParseIndex(name.substr(1, fileNameWidth), fileNameWidth, index) || index >= GetNumFiles(directory)) {
+      return std::nullopt;
+    }
+    return GetFile(directory, index);
+  }
+
+  return std::nullopt;
+}
+
+
+std::uint64_t SyntheticTree::GetNumSubdirectories(const Node& directory) const noexcept {
+  return directory.level < options.depth ? options.fanOut : 0;
+}
+
+
+std::uint64_t SyntheticTree::GetNumFiles(const Node& directory) const noexcept {
+  const std::uint64_t first = GetDirectoryOrdinal(directory) * options.filesPerDirectory;
+  return first >= numFiles ? 0 : std::min(options.filesPerDirectory, numFiles - first);
+}
+
+
+SyntheticTree::Node SyntheticTree::GetSubdirectory(const Node& directory, std::uint64_t index) const noexcept {
+  return Node{
+    true,
+    directory.level + 1,
+    directory.position * options.fanOut + index,
+    0,
+  };
+}
+
+
+SyntheticTree::Node SyntheticTree::GetFile(const Node& directory, std::uint64_t index) const noexcept {
+  return Node{
+    false,
+    directory.level,
+    directory.position,
+    index,
+  };
+}
+
+
+std::wstring SyntheticTree::GetName(const Node& node) const {
+  if (!node.directory) {
+    return L"f"s + ToPaddedString(node.fileIndex, fileNameWidth) + (options.extension.empty() ? L""s : L"."s + options.extension);
+  }
+  if (node.level == 0) {
+    return L""s;
+  }
+  return L"d"s + ToPaddedString(node.position % options.fanOut, directoryNameWidth);
+}
+
+
+std::uint64_t SyntheticTree::GetFileSize(const Node& node) const noexcept {
+  if (node.directory) {
+    return 0;
+  }
+
+  const std::uint64_t hash = GetHash(node);
+  switch (options.sizeDistribution) {
+    case SizeDistribution::Fixed:
+      return options.maxFileSize;
+
+    case SizeDistribution::Uniform:
+      return options.minFileSize + hash % (options.maxFileSize - options.minFileSize + 1);
+
+    case SizeDistribution::LogUniform:
+    {
+      const double min = std::log1p(static_cast<double>(options.minFileSize));
+      const double max = std::log1p(static_cast<double>(options.maxFileSize));
+      const double unit = static_cast<double>(hash >> 11) / static_cast<double>(1ull << 53);
+      const auto size = static_cast<std::uint64_t>(std::expm1(min + (max - min) * unit));
+      return std::clamp(size, options.minFileSize, options.maxFileSize);
+    }
+  }
+
+  return options.maxFileSize;
+}
+
+
+FILETIME SyntheticTree::GetTime(const Node& node) const noexcept {
+  const std::uint64_t time = BaseTime - Mix(GetHash(node)) % TimeSpread;
+  return FILETIME{
+    static_cast<DWORD>(time & 0xFFFFFFFF),
+    static_cast<DWORD>((time >> 32) & 0xFFFFFFFF),
+  };
+}
+
+
+std::uint64_t SyntheticTree::GetFileIndex(const Node& node) const noexcept {
+  return node.directory ? GetDirectoryOrdinal(node) : numDirectories + GetGlobalFileIndex(node);
+}
+
+
+void SyntheticTree::Read(const Node& node, std::uint64_t offset, void* buffer, std::size_t size) const noexcept {
+  auto out = static_cast<std::byte*>(buffer);
+
+  if (options.contentPattern == ContentPattern::Zero) {
+    std::memset(out, 0, size);
+    return;
+  }
+
+  // contents are a sequence of 8-byte words computed from their offsets, so any range is generated without state
+  const std::uint64_t hash = GetHash(node);
+  while (size) {
+    const std::uint64_t wordOffset = offset & ~std::uint64_t{7};
+    const std::uint64_t word = options.contentPattern == ContentPattern::Pattern ? wordOffset : Mix(hash ^ (wordOffset >> 3));
+    const std::size_t skip = static_cast<std::size_t>(offset - wordOffset);
+    const std::size_t count = std::min<std::size_t>(sizeof(word) - skip, size);
+    std::memcpy(out, reinterpret_cast<const std::byte*>(&word) + skip, count);
+    out += count;
+    offset += count;
+    size -= count;
+  }
+}
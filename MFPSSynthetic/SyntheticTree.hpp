@@ -0,0 +1,98 @@
+#pragma once
+
+#include <dokan/dokan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Windows.h>
+
+
+
+// a directory tree which is never materialized
+// every directory above the deepest level has the same number of subdirectories, so a directory is identified by its
+// level and its position within the level, and a file by its directory and its index in it;
+// names, sizes, times and contents are computed from these on demand, so memory does not grow with the tree
+//
+// names are "d<index>" for directories and "f<index>.<extension>" for files, zero-padded to the width of the largest index
+class SyntheticTree {
+public:
+  enum class SizeDistribution {
+    Fixed,        // maxFileSize
+    Uniform,      // [minFileSize, maxFileSize]
+    LogUniform,   // [minFileSize, maxFileSize], small files are as common as large ones per order of magnitude
+  };
+
+  enum class ContentPattern {
+    Zero,
+    Pattern,      // every 8-byte word holds its own offset (little-endian), so misplaced data is easy to spot
+    Random,       // pseudorandom per file, incompressible
+  };
+
+  struct Options {
+    std::size_t depth;                          // levels of subdirectories below the root
+    std::uint64_t fanOut;                       // subdirectories per directory
+    std::uint64_t filesPerDirectory;            // 0 to derive from fileCount
+    std::optional<std::uint64_t> fileCount;     // total; directories are filled in level order until it is reached
+    SizeDistribution sizeDistribution;
+    std::uint64_t minFileSize;
+    std::uint64_t maxFileSize;
+    ContentPattern contentPattern;
+    std::uint64_t seed;                         // sizes, times and contents; names do not depend on it
+    std::wstring extension;
+  };
+
+  struct Node {
+    bool directory;
+    std::size_t level;            // of the directory, or of the parent directory for a file
+    std::uint64_t position;       // within the level, of the directory or of the parent directory for a file
+    std::uint64_t fileIndex;      // within the parent directory; files only
+  };
+
+private:
+  Options options;
+  std::vector<std::uint64_t> levelStarts;     // level-order ordinal of the first directory of each level
+  std::uint64_t numDirectories;
+  std::uint64_t numFiles;
+  std::size_t directoryNameWidth;
+  std::size_t fileNameWidth;
+
+  static std::uint64_t Mix(std::uint64_t value) noexcept;
+
+  std::uint64_t GetDirectoryOrdinal(const Node& node) const noexcept;
+  std::uint64_t GetGlobalFileIndex(const Node& node) const noexcept;
+  std::uint64_t GetHash(const Node& node) const noexcept;
+
+public:
+  // throws std::runtime_error if the options are inconsistent or the tree would have more than 2^64 nodes
+  SyntheticTree(const Options& options);
+
+  const Options& GetOptions() const noexcept;
+  std::uint64_t GetNumDirectories() const noexcept;
+  std::uint64_t GetNumFiles() const noexcept;
+  std::uint64_t GetExpectedTotalFileSize() const noexcept;
+
+  Node GetRoot() const noexcept;
+  // filepath is like "\\d03\\f0012.bin"; returns STATUS_OBJECT_PATH_NOT_FOUND or STATUS_OBJECT_NAME_NOT_FOUND if it does not exist
+  NTSTATUS Resolve(std::wstring_view filepath, bool caseSensitive, Node& node) const;
+  // for the single-name searches of FindFilesWithPattern; std::nullopt if there is no such child
+  std::optional<Node> GetChild(const Node& directory, std::wstring_view name, bool caseSensitive) const;
+
+  std::uint64_t GetNumSubdirectories(const Node& directory) const noexcept;
+  std::uint64_t GetNumFiles(const Node& directory) const noexcept;
+  Node GetSubdirectory(const Node& directory, std::uint64_t index) const noexcept;
+  Node GetFile(const Node& directory, std::uint64_t index) const noexcept;
+
+  std::wstring GetName(const Node& node) const;
+  std::uint64_t GetFileSize(const Node& node) const noexcept;
+  FILETIME GetTime(const Node& node) const noexcept;
+  // unique among all nodes of the tree
+  std::uint64_t GetFileIndex(const Node& node) const noexcept;
+
+  // fills buffer with size bytes of the file from offset; the caller clamps the range to the file size
+  void Read(const Node& node, std::uint64_t offset, void* buffer, std::size_t size) const noexcept;
+};
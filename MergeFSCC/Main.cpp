@@ -6,13 +6,19 @@
 
 #include "IdGenerator.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <deque>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <optional>
 #include <regex>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -56,6 +62,11 @@ int CommandHelp(const std::deque<std::wstring>& args) {
     std::wcout << L"remove source" << std::endl;
     std::wcout << L"mount" << std::endl;
     std::wcout << L"unmount" << std::endl;
+    std::wcout << L"stats" << std::endl;
+    std::wcout << L"trace" << std::endl;
+    std::wcout << L"bench" << std::endl;
+    std::wcout << L"replay" << std::endl;
+    std::wcout << L"mdbench" << std::endl;
     return 0;
   }
   return 0;
@@ -170,13 +181,16 @@ int CommandReorder(const std::deque<std::wstring>& args) {
 }
 
 
+// mount <configId> <mountPoint> [headless]
+// a headless mount serves no volume; mountPoint only names it and the replay command drives it
 int CommandMount(const std::deque<std::wstring>& args) {
-  if (args.size() != 2) {
+  if (args.size() != 2 && !(args.size() == 3 && args[2] == L"headless"sv)) {
     std::wcout << L"error: invalid arguments"sv << std::endl;
     return 0;
   }
   const auto configId = stoi(args[0]);
   const auto mountPoint = args[1];
+  const bool headless = args.size() == 3;
 
   if (!gConfigMap.count(configId)) {
     std::wcout << L"error: no such config"sv << std::endl;
@@ -215,6 +229,7 @@ int CommandMount(const std::deque<std::wstring>& args) {
       0,
     },
   };
+  mountInitializeInfo.headless = headless ? TRUE : FALSE;
   MOUNT_ID mountId;
   if (!LMF_Mount(&mountInitializeInfo, [](MOUNT_ID mountId, const MOUNT_INFO* mountInfo, int dokanMainResult) noexcept -> void {
     std::wcout << L"info: dokanMainResult = "sv << dokanMainResult << L" at mountId "sv << mountId << std::endl;
@@ -253,6 +268,475 @@ int CommandUnmount(const std::deque<std::wstring>& args) {
 }
 
 
+// lower bound of the latency bucket in microseconds, see OPERATION_STATISTICS
+double GetLatencyBucketMicroseconds(std::size_t bucket) {
+  if (bucket == 0) {
+    return 0.0;
+  }
+  return static_cast<double>((4ULL + (bucket - 1) % 4) << ((bucket - 1) / 4 + 8)) / 1000.0;
+}
+
+
+double GetLatencyPercentileMicroseconds(const OPERATION_STATISTICS& statistics, double percentile) {
+  const ULONGLONG threshold = static_cast<ULONGLONG>(statistics.count * percentile / 100.0);
+  ULONGLONG accumulated = 0;
+  for (std::size_t bucket = 0; bucket < MERGEFS_NUM_LATENCY_BUCKETS; bucket++) {
+    accumulated += statistics.latencyBuckets[bucket];
+    if (accumulated > threshold) {
+      return GetLatencyBucketMicroseconds(bucket);
+    }
+  }
+  return GetLatencyBucketMicroseconds(MERGEFS_NUM_LATENCY_BUCKETS - 1);
+}
+
+
+void PrintStatisticsTable(const OPERATION_STATISTICS* statistics, std::size_t numStatistics) {
+  std::wcout << std::left << std::setw(26) << L"  operation"sv << std::right << std::setw(12) << L"count"sv << std::setw(10) << L"failures"sv << std::setw(12) << L"avg us"sv << std::setw(12) << L"p50 us"sv << std::setw(12) << L"p99 us"sv << std::setw(12) << L"max us"sv << std::endl;
+  std::wcout << std::fixed << std::setprecision(1);
+  for (std::size_t i = 0; i < numStatistics; i++) {
+    const auto& entry = statistics[i];
+    if (!entry.count) {
+      continue;
+    }
+    std::wcout << L"  "sv << std::left << std::setw(24) << entry.operationName << std::right
+      << std::setw(12) << entry.count
+      << std::setw(10) << entry.failures
+      << std::setw(12) << static_cast<double>(entry.totalNanoseconds) / entry.count / 1000.0
+      << std::setw(12) << GetLatencyPercentileMicroseconds(entry, 50.0)
+      << std::setw(12) << GetLatencyPercentileMicroseconds(entry, 99.0)
+      << std::setw(12) << static_cast<double>(entry.maxNanoseconds) / 1000.0
+      << std::endl;
+  }
+  std::wcout << std::defaultfloat;
+}
+
+
+void PrintStatistics(MOUNT_ID mountId, DWORD sourceIndex) {
+  DWORD numOperations = 0;
+  if (!LMF_GetMountStatistics(mountId, sourceIndex, &numOperations, nullptr, 0)) {
+    std::wcout << L"error: failed to get statistics"sv << std::endl;
+    return;
+  }
+  std::vector<OPERATION_STATISTICS> statistics(numOperations);
+  if (!LMF_GetMountStatistics(mountId, sourceIndex, &numOperations, statistics.data(), static_cast<DWORD>(statistics.size()))) {
+    std::wcout << L"error: failed to get statistics"sv << std::endl;
+    return;
+  }
+
+  if (sourceIndex == MERGEFS_STATISTICS_MOUNT) {
+    std::wcout << L"mount "sv << mountId << std::endl;
+  } else {
+    std::wcout << L"source "sv << sourceIndex << std::endl;
+    PRESENCE_FILTER_STATISTICS presenceFilterStatistics;
+    if (LMF_GetPresenceFilterStatistics(mountId, sourceIndex, &presenceFilterStatistics) && presenceFilterStatistics.ready) {
+      std::wcout << L"  presence filter: "sv << presenceFilterStatistics.numDirectories << L" directories, "sv << presenceFilterStatistics.numBytes << L" bytes, estimated false positives "sv
+        << std::fixed << std::setprecision(4) << static_cast<double>(presenceFilterStatistics.falsePositivesPerMillion) / 10000.0 << L"%"sv << std::defaultfloat
+        << L", "sv << presenceFilterStatistics.queries << L" queries, "sv << presenceFilterStatistics.negatives << L" skipped, "sv << presenceFilterStatistics.passedInexistent << L" passed but missing"sv << std::endl;
+    }
+  }
+  PrintStatisticsTable(statistics.data(), statistics.size());
+}
+
+
+int CommandStats(const std::deque<std::wstring>& args) {
+  if (args.size() != 1 && args.size() != 2) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  const MOUNT_ID mountId = std::stoi(args[0]);
+
+  MOUNT_INFO mountInfo;
+  if (!LMF_GetMountInfo(mountId, &mountInfo)) {
+    std::wcout << L"error: no such mount"sv << std::endl;
+    return 0;
+  }
+
+  if (args.size() == 2) {
+    PrintStatistics(mountId, static_cast<DWORD>(std::stoul(args[1])));
+    return 0;
+  }
+
+  PrintStatistics(mountId, MERGEFS_STATISTICS_MOUNT);
+  for (DWORD sourceIndex = 0; sourceIndex < mountInfo.numSources; sourceIndex++) {
+    PrintStatistics(mountId, sourceIndex);
+  }
+  return 0;
+}
+
+
+// trace <mountId> start [maxEvents] | stop | save <filepath>
+int CommandTrace(const std::deque<std::wstring>& args) {
+  if (args.size() < 2) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  const MOUNT_ID mountId = std::stoi(args[0]);
+  const auto& subcommand = args[1];
+
+  if (subcommand == L"start"sv && args.size() <= 3) {
+    const DWORD maxEvents = args.size() == 3 ? static_cast<DWORD>(std::stoul(args[2])) : 0;
+    if (!LMF_StartMountTrace(mountId, maxEvents)) {
+      std::wcout << L"error: failed to start trace"sv << std::endl;
+      return 0;
+    }
+    std::wcout << L"started trace of "sv << mountId << std::endl;
+    return 0;
+  }
+
+  if (subcommand == L"stop"sv && args.size() == 2) {
+    if (!LMF_StopMountTrace(mountId)) {
+      std::wcout << L"error: failed to stop trace"sv << std::endl;
+      return 0;
+    }
+    std::wcout << L"stopped trace of "sv << mountId << std::endl;
+    return 0;
+  }
+
+  if (subcommand == L"save"sv && args.size() == 3) {
+    if (!LMF_SaveMountTrace(mountId, args[2].c_str())) {
+      std::wcout << L"error: failed to save trace"sv << std::endl;
+      return 0;
+    }
+    std::wcout << L"saved trace of "sv << mountId << L" to "sv << args[2] << std::endl;
+    return 0;
+  }
+
+  std::wcout << L"error: invalid arguments"sv << std::endl;
+  return 0;
+}
+
+
+constexpr DWORD BenchBufferSize = 1024 * 1024;
+constexpr DWORD DefaultBenchMaxThreads = 32;
+constexpr DWORD DefaultReplayCopyUpFiles = 4;
+constexpr DWORD DefaultMetadataBenchEntries = 1000000;
+
+
+void ListFilesRecursively(const std::wstring& directory, std::vector<std::wstring>& filepaths) {
+  WIN32_FIND_DATAW findData;
+  const HANDLE hFind = FindFirstFileW((directory + L"\\*"s).c_str(), &findData);
+  if (hFind == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  do {
+    const std::wstring_view filename(findData.cFileName);
+    if (filename == L"."sv || filename == L".."sv) {
+      continue;
+    }
+    const std::wstring filepath = directory + L"\\"s + findData.cFileName;
+    if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        ListFilesRecursively(filepath, filepaths);
+      }
+    } else {
+      filepaths.push_back(filepath);
+    }
+  } while (FindNextFileW(hFind, &findData));
+  FindClose(hFind);
+}
+
+
+// reads files unbuffered so that every run goes through the mount instead of the system cache
+// returns the number of bytes read
+ULONGLONG ReadFileToEnd(const std::wstring& filepath, LPVOID buffer) {
+  const HANDLE hFile = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return 0;
+  }
+  ULONGLONG totalRead = 0;
+  DWORD read = 0;
+  while (ReadFile(hFile, buffer, BenchBufferSize, &read, NULL) && read) {
+    totalRead += read;
+  }
+  CloseHandle(hFile);
+  return totalRead;
+}
+
+
+// bench <directory> [maxThreads]
+// reads every file under directory with 1, 2, 4, ... threads and prints the throughput of each run,
+// e.g. to pick the threadCount and maxConcurrency of a mount
+int CommandBench(const std::deque<std::wstring>& args) {
+  if (args.size() != 1 && args.size() != 2) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  const DWORD maxThreads = args.size() == 2 ? static_cast<DWORD>(std::stoul(args[1])) : DefaultBenchMaxThreads;
+  if (maxThreads == 0) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  std::vector<std::wstring> filepaths;
+  ListFilesRecursively(args[0], filepaths);
+  if (filepaths.empty()) {
+    std::wcout << L"error: no files found"sv << std::endl;
+    return 0;
+  }
+  std::wcout << filepaths.size() << L" files"sv << std::endl;
+
+  std::wcout << std::setw(8) << L"threads"sv << std::setw(12) << L"seconds"sv << std::setw(12) << L"MB/s"sv << std::setw(12) << L"files/s"sv << std::endl;
+  std::wcout << std::fixed << std::setprecision(1);
+  for (DWORD numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads)) {
+    std::atomic<std::size_t> nextIndex(0);
+    std::atomic<ULONGLONG> totalRead(0);
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (DWORD i = 0; i < numThreads; i++) {
+      threads.emplace_back([&]() {
+        // FILE_FLAG_NO_BUFFERING requires a sector aligned buffer
+        const LPVOID buffer = VirtualAlloc(NULL, BenchBufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!buffer) {
+          return;
+        }
+        for (std::size_t index; (index = nextIndex++) < filepaths.size();) {
+          totalRead += ReadFileToEnd(filepaths[index], buffer);
+        }
+        VirtualFree(buffer, 0, MEM_RELEASE);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    const double seconds = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(), 1e-9);
+
+    std::wcout << std::setw(8) << numThreads
+      << std::setw(12) << seconds
+      << std::setw(12) << static_cast<double>(totalRead.load()) / seconds / 1e6
+      << std::setw(12) << static_cast<double>(filepaths.size()) / seconds
+      << std::endl;
+
+    if (numThreads == maxThreads) {
+      break;
+    }
+  }
+  std::wcout << std::defaultfloat;
+  return 0;
+}
+
+
+// replays reads through open handles with 1, 2, 4, ... threads; every thread issues the same number of reads,
+// so the reads per second grow linearly with the threads as long as nothing on the read path is shared among them
+int ReplayHandleReads(MOUNT_ID mountId, DWORD maxThreads, DWORD iterations, DWORD numReads, ULONGLONG seed) {
+  if (maxThreads == 0) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  std::wcout << std::setw(8) << L"threads"sv << std::setw(12) << L"seconds"sv << std::setw(14) << L"reads/s"sv << std::setw(14) << L"per thread"sv << std::setw(10) << L"scaling"sv << std::setw(10) << L"failures"sv << std::endl;
+  std::wcout << std::fixed << std::setprecision(1);
+  double singleThreadRate = 0.0;
+  for (DWORD numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads)) {
+    REPLAY_OPTIONS replayOptions{};
+    replayOptions.workload = MERGEFS_REPLAY_HANDLE_READS;
+    replayOptions.numThreads = numThreads;
+    replayOptions.iterations = iterations;
+    replayOptions.numOperations = numReads;
+    replayOptions.seed = seed;
+
+    REPLAY_RESULT replayResult;
+    if (!LMF_ReplayOperations(mountId, &replayOptions, &replayResult)) {
+      std::wcout << std::defaultfloat;
+      std::wcout << L"error: failed to replay"sv << std::endl;
+      return 0;
+    }
+
+    const double seconds = std::max(static_cast<double>(replayResult.elapsedNanoseconds) / 1e9, 1e-9);
+    const double rate = static_cast<double>(replayResult.numRequests) / seconds;
+    if (numThreads == 1) {
+      singleThreadRate = rate;
+    }
+    std::wcout << std::setw(8) << numThreads
+      << std::setw(12) << seconds
+      << std::setw(14) << rate
+      << std::setw(14) << rate / numThreads
+      << std::setw(10) << (singleThreadRate > 0.0 ? rate / singleThreadRate : 0.0)
+      << std::setw(10) << replayResult.numFailures
+      << std::endl;
+
+    if (numThreads == maxThreads) {
+      break;
+    }
+  }
+  std::wcout << std::defaultfloat;
+  return 0;
+}
+
+
+// copies up numFiles lower-layer files with 4 KiB transfers, with the default transfers and with the native-handle copy;
+// a copied file stays in the top source, so every mode takes the next files and the mount needs 3 * numFiles large files
+int ReplayCopyUps(MOUNT_ID mountId, DWORD numThreads, DWORD numFiles) {
+  struct Mode {
+    std::wstring_view name;
+    DWORD transferSize;
+    BOOL nativeCopy;
+  };
+  constexpr Mode Modes[] = {
+    {L"4 KiB"sv, 4 * 1024, FALSE},
+    {L"default"sv, 0, FALSE},
+    {L"native"sv, 0, TRUE},
+  };
+
+  std::wcout << std::setw(10) << L"mode"sv << std::setw(8) << L"files"sv << std::setw(12) << L"MB"sv << std::setw(12) << L"seconds"sv << std::setw(12) << L"MB/s"sv << std::setw(10) << L"failures"sv << std::endl;
+  std::wcout << std::fixed << std::setprecision(1);
+  for (const auto& mode : Modes) {
+    REPLAY_OPTIONS replayOptions{};
+    replayOptions.workload = MERGEFS_REPLAY_COPY_UPS;
+    replayOptions.numThreads = numThreads;
+    replayOptions.numOperations = numFiles;
+    replayOptions.transferSize = mode.transferSize;
+    replayOptions.nativeCopy = mode.nativeCopy;
+
+    REPLAY_RESULT replayResult;
+    if (!LMF_ReplayOperations(mountId, &replayOptions, &replayResult)) {
+      std::wcout << std::defaultfloat;
+      std::wcout << L"error: failed to replay"sv << std::endl;
+      return 0;
+    }
+
+    const double seconds = std::max(static_cast<double>(replayResult.elapsedNanoseconds) / 1e9, 1e-9);
+    std::wcout << std::setw(10) << mode.name
+      << std::setw(8) << replayResult.numRequests
+      << std::setw(12) << static_cast<double>(replayResult.numBytes) / 1e6
+      << std::setw(12) << seconds
+      << std::setw(12) << static_cast<double>(replayResult.numBytes) / seconds / 1e6
+      << std::setw(10) << replayResult.numFailures
+      << std::endl;
+  }
+  std::wcout << std::defaultfloat;
+  return 0;
+}
+
+
+// replay <mountId> walk|media [threads] [iterations]
+// replay <mountId> writes [threads] [iterations] [numWrites] [seed]
+// replay <mountId> touch [threads] [iterations] [numTouches] [seed]
+// replay <mountId> reads [maxThreads] [iterations] [numReadsPerThread] [seed]
+// replay <mountId> copyups [threads] [numFilesPerMode]
+// replay <mountId> trace <traceFile> [threads] [iterations]
+// drives the mount in-process, without going through the driver; best used on a headless mount (see mount)
+// the Dokan callbacks of the run show up in stats as well
+int CommandReplay(const std::deque<std::wstring>& args) {
+  if (args.size() < 2) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  const MOUNT_ID mountId = std::stoi(args[0]);
+  const auto& workload = args[1];
+
+  REPLAY_OPTIONS replayOptions{};
+  std::size_t index = 2;
+  std::size_t maxArgs = 4;
+  if (workload == L"walk"sv) {
+    replayOptions.workload = MERGEFS_REPLAY_TREE_WALK;
+  } else if (workload == L"media"sv) {
+    replayOptions.workload = MERGEFS_REPLAY_MEDIA_SCAN;
+  } else if (workload == L"writes"sv) {
+    replayOptions.workload = MERGEFS_REPLAY_RANDOM_WRITES;
+    maxArgs = 6;
+  } else if (workload == L"touch"sv) {
+    replayOptions.workload = MERGEFS_REPLAY_TOUCH;
+    maxArgs = 6;
+  } else if (workload == L"reads"sv) {
+    replayOptions.workload = MERGEFS_REPLAY_HANDLE_READS;
+    replayOptions.numThreads = DefaultBenchMaxThreads;
+    maxArgs = 6;
+  } else if (workload == L"copyups"sv) {
+    if (args.size() > 4) {
+      std::wcout << L"error: invalid arguments"sv << std::endl;
+      return 0;
+    }
+    const DWORD numThreads = args.size() > 2 ? static_cast<DWORD>(std::stoul(args[2])) : 0;
+    const DWORD numFiles = args.size() > 3 ? static_cast<DWORD>(std::stoul(args[3])) : DefaultReplayCopyUpFiles;
+    return ReplayCopyUps(mountId, numThreads, numFiles);
+  } else if (workload == L"trace"sv && args.size() >= 3) {
+    replayOptions.workload = MERGEFS_REPLAY_TRACE_FILE;
+    replayOptions.traceFilename = args[2].c_str();
+    index = 3;
+    maxArgs = 5;
+  } else {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+  if (args.size() > maxArgs) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+  if (index < args.size()) {
+    replayOptions.numThreads = static_cast<DWORD>(std::stoul(args[index++]));
+  }
+  if (index < args.size()) {
+    replayOptions.iterations = static_cast<DWORD>(std::stoul(args[index++]));
+  }
+  if (index < args.size()) {
+    replayOptions.numOperations = static_cast<DWORD>(std::stoul(args[index++]));
+  }
+  if (index < args.size()) {
+    replayOptions.seed = std::stoull(args[index++]);
+  }
+
+  if (replayOptions.workload == MERGEFS_REPLAY_HANDLE_READS) {
+    return ReplayHandleReads(mountId, replayOptions.numThreads, replayOptions.iterations, replayOptions.numOperations, replayOptions.seed);
+  }
+
+  REPLAY_RESULT replayResult;
+  if (!LMF_ReplayOperations(mountId, &replayOptions, &replayResult)) {
+    std::wcout << L"error: failed to replay"sv << std::endl;
+    return 0;
+  }
+
+  const double seconds = std::max(static_cast<double>(replayResult.elapsedNanoseconds) / 1e9, 1e-9);
+  std::wcout << std::fixed << std::setprecision(1);
+  std::wcout << replayResult.numRequests << L" requests in "sv << seconds << L" s: "sv
+    << static_cast<double>(replayResult.numRequests) / seconds << L" requests/s, "sv
+    << replayResult.numFailures << L" failures"sv << std::endl;
+  std::wcout << std::defaultfloat;
+  PrintStatisticsTable(replayResult.requests, MERGEFS_NUM_REPLAY_REQUESTS);
+  return 0;
+}
+
+
+// mdbench <directory> [numEntries]
+// writes a V2 metadata file of synthetic entries to directory, converts it to V4 and prints the size, load time and
+// lookup times of each format
+int CommandMetadataBench(const std::deque<std::wstring>& args) {
+  if (args.size() != 1 && args.size() != 2) {
+    std::wcout << L"error: invalid arguments"sv << std::endl;
+    return 0;
+  }
+
+  const DWORD numEntries = args.size() == 2 ? static_cast<DWORD>(std::stoul(args[1])) : DefaultMetadataBenchEntries;
+
+  METADATA_BENCHMARK_RESULT result;
+  if (!LMF_BenchmarkMetadataFormats(args[0].c_str(), numEntries, &result)) {
+    std::wcout << L"error: failed to benchmark"sv << std::endl;
+    return 0;
+  }
+
+  std::wcout << numEntries << L" entries"sv << std::endl;
+  std::wcout << std::setw(8) << L"format"sv << std::setw(12) << L"MB"sv << std::setw(12) << L"load ms"sv << std::setw(10) << L"hit ns"sv << std::setw(10) << L"miss ns"sv << std::endl;
+  std::wcout << std::fixed << std::setprecision(1);
+  const auto printFormat = [](std::wstring_view name, const METADATA_FORMAT_STATISTICS& statistics) {
+    std::wcout << std::setw(8) << name
+      << std::setw(12) << static_cast<double>(statistics.fileBytes) / 1e6
+      << std::setw(12) << static_cast<double>(statistics.loadNanoseconds) / 1e6
+      << std::setw(10) << statistics.hitNanoseconds
+      << std::setw(10) << statistics.missNanoseconds
+      << std::endl;
+  };
+  printFormat(L"V2"sv, result.v2);
+  printFormat(L"V4"sv, result.v4);
+  std::wcout << L"migration from V2: "sv << static_cast<double>(result.migrationNanoseconds) / 1e6 << L" ms"sv << std::endl;
+  std::wcout << std::defaultfloat;
+  return 0;
+}
+
+
 std::unordered_map<std::wstring, std::function<int(const std::deque<std::wstring>& args)>> gCommandMap{
   {L"help"s, CommandHelp},
   {L"?"s, CommandHelp},
@@ -262,6 +746,11 @@ std::unordered_map<std::wstring, std::function<int(const std::deque<std::wstring
   {L"reorder"s, CommandReorder},
   {L"mount"s, CommandMount},
   {L"unmount"s, CommandUnmount},
+  {L"stats"s, CommandStats},
+  {L"trace"s, CommandTrace},
+  {L"bench"s, CommandBench},
+  {L"replay"s, CommandReplay},
+  {L"mdbench"s, CommandMetadataBench},
 };
 
 
@@ -3,6 +3,7 @@
 #include <nlohmann/json.hpp>
 #include <yaml-cpp/yaml.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cassert>
@@ -12,6 +13,7 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <Windows.h>
 #include <Windowsx.h>
@@ -66,6 +68,40 @@ namespace {
 }
 
 
+namespace {
+  constexpr std::size_t MaxStatisticsLines = 8;
+
+
+  // lists the operations which took the longest in total; a message box has no room for all of them
+  std::wstring FormatStatistics(std::vector<OPERATION_STATISTICS> statistics) {
+    statistics.erase(std::remove_if(statistics.begin(), statistics.end(), [](const OPERATION_STATISTICS& entry) {
+      return entry.count == 0;
+    }), statistics.end());
+    if (statistics.empty()) {
+      return L"  (no operations)\n"s;
+    }
+
+    std::sort(statistics.begin(), statistics.end(), [](const OPERATION_STATISTICS& a, const OPERATION_STATISTICS& b) {
+      return a.totalNanoseconds > b.totalNanoseconds;
+    });
+    if (statistics.size() > MaxStatisticsLines) {
+      statistics.resize(MaxStatisticsLines);
+    }
+
+    std::wstring text;
+    for (const auto& entry : statistics) {
+      text +=
+        L"  "s + entry.operationName +
+        L": "s + std::to_wstring(entry.count) + L" calls, "s +
+        std::to_wstring(entry.failures) + L" failed, avg "s +
+        std::to_wstring(entry.totalNanoseconds / entry.count / 1000) + L" us, max "s +
+        std::to_wstring(entry.maxNanoseconds / 1000) + L" us\n"s;
+    }
+    return text;
+  }
+}
+
+
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
   if (gTaskbarCreatedMessage != 0 && uMsg == gTaskbarCreatedMessage) {
     // use if statement because gTaskbarCreatedMessage is not a constexpr
@@ -272,6 +308,22 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             case IDMB_CTX_MOUNT_UNMOUNT:
               gMountManager.RemoveMount(mountId, true);
               return 0;
+
+            case IDMB_CTX_MOUNT_STATISTICS:
+            {
+              const auto mountInfo = gMountManager.GetMountInfo(mountId);
+
+              std::wstring message = mountInfo.mountPoint + L"\n"s + FormatStatistics(gMountManager.GetMountStatistics(mountId, MERGEFS_STATISTICS_MOUNT));
+              for (DWORD sourceIndex = 0; sourceIndex < mountInfo.numSources; sourceIndex++) {
+                message += L"\nSource #"s + std::to_wstring(sourceIndex) + L"\n"s + FormatStatistics(gMountManager.GetMountStatistics(mountId, sourceIndex));
+              }
+
+              gDisableUserControls = true;
+              MessageBoxW(NULL, message.c_str(), L"MergeFSMC Statistics", MB_OK | MB_ICONINFORMATION | MB_SETFOREGROUND | MB_TASKMODAL);
+              gDisableUserControls = false;
+
+              return 0;
+            }
           }
         } catch (const MountManager::MergeFSError& mergefsError) {
           MessageBoxW(NULL, mergefsError.errorMessage.c_str(), L"MergeFSMC Error", MB_OK | MB_ICONERROR | MB_SETFOREGROUND);
@@ -459,9 +511,10 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
                 const UINT baseId = IDMB_CTX_MOUNT_BEGIN + IDMK_CTX_MOUNT_COEF * mountId;
 
-                constexpr std::array<std::pair<UINT, UINT>, 3> IdToIdDiffMap{{
+                constexpr std::array<std::pair<UINT, UINT>, 4> IdToIdDiffMap{{
                   {IDM_DUMMY_CTX_MOUNT_OPEN,        IDMB_CTX_MOUNT_OPEN},
                   {IDM_DUMMY_CTX_MOUNT_OPENCONFIG,  IDMB_CTX_MOUNT_OPENCONFIG},
+                  {IDM_DUMMY_CTX_MOUNT_STATISTICS,  IDMB_CTX_MOUNT_STATISTICS},
                   {IDM_DUMMY_CTX_MOUNT_UNMOUNT,     IDMB_CTX_MOUNT_UNMOUNT},
                 }};
                 for (const auto& [originalId, idDiff] : IdToIdDiffMap) {
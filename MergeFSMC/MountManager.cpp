@@ -330,6 +330,60 @@ MOUNT_ID MountManager::AddMount(const std::wstring& configFilepath, std::functio
 
   }
 
+  // load readAhead
+  READ_AHEAD_OPTIONS readAheadOptions{
+    FALSE,
+    0,
+    0,
+  };
+  const auto& yamlReadAhead = yaml["readAhead"];
+  if (yamlReadAhead) {
+    if (yamlReadAhead["enabled"]) {
+      readAheadOptions.disabled = yamlReadAhead["enabled"].as<bool>() ? FALSE : TRUE;
+    }
+    if (yamlReadAhead["maxWindowSize"]) {
+      readAheadOptions.maxWindowSize = yamlReadAhead["maxWindowSize"].as<DWORD>();
+    }
+    if (yamlReadAhead["memoryBudget"]) {
+      readAheadOptions.memoryBudget = yamlReadAhead["memoryBudget"].as<ULONGLONG>();
+    }
+  }
+
+  // load dokan
+  DOKAN_TUNING_OPTIONS dokanTuningOptions{
+    0,
+    0,
+    0,
+    0,
+    FALSE,
+    0,
+    0,
+  };
+  const auto& yamlDokan = yaml["dokan"];
+  if (yamlDokan) {
+    if (yamlDokan["threadCount"]) {
+      dokanTuningOptions.threadCount = yamlDokan["threadCount"].as<DWORD>();
+    }
+    if (yamlDokan["timeout"]) {
+      dokanTuningOptions.timeout = yamlDokan["timeout"].as<DWORD>();
+    }
+    if (yamlDokan["allocationUnitSize"]) {
+      dokanTuningOptions.allocationUnitSize = yamlDokan["allocationUnitSize"].as<DWORD>();
+    }
+    if (yamlDokan["sectorSize"]) {
+      dokanTuningOptions.sectorSize = yamlDokan["sectorSize"].as<DWORD>();
+    }
+    if (yamlDokan["autoConcurrency"]) {
+      dokanTuningOptions.autoConcurrency = yamlDokan["autoConcurrency"].as<bool>() ? TRUE : FALSE;
+    }
+    if (yamlDokan["minConcurrency"]) {
+      dokanTuningOptions.minConcurrency = yamlDokan["minConcurrency"].as<DWORD>();
+    }
+    if (yamlDokan["maxConcurrency"]) {
+      dokanTuningOptions.maxConcurrency = yamlDokan["maxConcurrency"].as<DWORD>();
+    }
+  }
+
   // TODO: error handling, restore current directory
   const std::wstring configFileDirectory = util::rfs::GetParentPath(configFilepath);
   SetCurrentDirectoryW(configFileDirectory.c_str());
@@ -350,6 +404,8 @@ MOUNT_ID MountManager::AddMount(const std::wstring& configFilepath, std::functio
     static_cast<DWORD>(sourceInitializeInfos.size()),
     sourceInitializeInfos.data(),
     volumeInfoOverride,
+    readAheadOptions,
+    dokanTuningOptions,
   };
 
   MOUNT_ID mountId = MOUNT_ID_NULL;
@@ -425,6 +481,15 @@ std::vector<std::pair<MOUNT_ID, MOUNT_INFO>> MountManager::ListMounts() const {
 }
 
 
+std::vector<OPERATION_STATISTICS> MountManager::GetMountStatistics(MOUNT_ID mountId, DWORD sourceIndex) const {
+  DWORD numOperations = 0;
+  CheckLibMergeFSResult(LMF_GetMountStatistics(mountId, sourceIndex, &numOperations, nullptr, 0));
+  std::vector<OPERATION_STATISTICS> statistics(numOperations);
+  CheckLibMergeFSResult(LMF_GetMountStatistics(mountId, sourceIndex, &numOperations, statistics.data(), static_cast<DWORD>(statistics.size())));
+  return statistics;
+}
+
+
 void MountManager::UnmountAll(bool safe) {
   if (safe) {
     CheckLibMergeFSResult(LMF_SafeUnmountAll());
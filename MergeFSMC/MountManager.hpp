@@ -82,6 +82,7 @@ public:
   std::size_t CountMounts() const;
   std::vector<MOUNT_ID> ListMountIds() const;
   std::vector<std::pair<MOUNT_ID, MOUNT_INFO>> ListMounts() const;
+  std::vector<OPERATION_STATISTICS> GetMountStatistics(MOUNT_ID mountId, DWORD sourceIndex) const;
   void UnmountAll(bool safe);
 
   void Uninit(bool safe);
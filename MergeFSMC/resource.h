@@ -14,6 +14,7 @@
 #define IDM_DUMMY_CTX_MOUNT_OPENCONFIG    2002
 #define IDM_DUMMY_CTX_MOUNT_UNMOUNT       2003
 #define IDM_DUMMY_CTX_MOUNT_CONFIGFILE    2004
+#define IDM_DUMMY_CTX_MOUNT_STATISTICS    2005
 
 #define IDMB_CTX_PLUGIN_BEGIN             10000
 #define IDMB_CTX_PLUGIN_END               20000
@@ -22,11 +23,12 @@
 
 #define IDMB_CTX_MOUNT_BEGIN              20000
 #define IDMB_CTX_MOUNT_END                60000
-#define IDMK_CTX_MOUNT_COEF               4
+#define IDMK_CTX_MOUNT_COEF               8
 #define IDMB_CTX_MOUNT_TOP                0
 #define IDMB_CTX_MOUNT_OPEN               1
 #define IDMB_CTX_MOUNT_OPENCONFIG         2
 #define IDMB_CTX_MOUNT_UNMOUNT            3
+#define IDMB_CTX_MOUNT_STATISTICS         4
 
 // Next default values for new objects
 // 
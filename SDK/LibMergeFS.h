@@ -62,6 +62,18 @@
 #define MERGEFS_VIOF_TOTALNUMBEROFBYTES       ((DWORD) 0x00000200)
 #define MERGEFS_VIOF_TOTALNUMBEROFFREEBYTES   ((DWORD) 0x00000400)
 
+#define MERGEFS_STATISTICS_MOUNT              ((DWORD) 0xFFFFFFFF)
+#define MERGEFS_NUM_LATENCY_BUCKETS           96
+
+#define MERGEFS_REPLAY_TREE_WALK              ((DWORD) 0)   // list every directory and query every entry
+#define MERGEFS_REPLAY_MEDIA_SCAN             ((DWORD) 1)   // list every directory and read the head and the tail of every file
+#define MERGEFS_REPLAY_RANDOM_WRITES          ((DWORD) 2)   // 4 KiB writes at random offsets of existing files (copies them up)
+#define MERGEFS_REPLAY_TRACE_FILE             ((DWORD) 3)   // requests read from REPLAY_OPTIONS::traceFilename
+#define MERGEFS_REPLAY_TOUCH                  ((DWORD) 4)   // sets the times of random existing files (metadata updates only for lower-layer files)
+#define MERGEFS_REPLAY_HANDLE_READS           ((DWORD) 5)   // 4 KiB reads at random offsets through files each thread opened beforehand (read scaling)
+#define MERGEFS_REPLAY_COPY_UPS               ((DWORD) 6)   // copies large lower-layer files up with REPLAY_OPTIONS::transferSize and nativeCopy (copy-up throughput)
+#define MERGEFS_NUM_REPLAY_REQUESTS           6
+
 
 # ifdef __cplusplus
 #  define MFEXTERNC extern "C"
@@ -156,6 +168,26 @@ typedef struct {
 } VOLUME_INFO_OVERRIDE;
 
 
+// prefetching of sequential reads from lower-layer sources
+typedef struct {
+  BOOL disabled;
+  DWORD maxWindowSize;      // maximum bytes prefetched at once for a file; set 0 to use the default
+  ULONGLONG memoryBudget;   // maximum bytes of prefetched data held by the mount; set 0 to use the default
+} READ_AHEAD_OPTIONS;
+
+
+// Dokan parameters and concurrency of a mount
+typedef struct {
+  DWORD threadCount;          // number of Dokan threads (up to 63); set 0 to let Dokan decide
+  DWORD timeout;              // milliseconds before Dokan gives up a request; set 0 to use Dokan's default
+  DWORD allocationUnitSize;   // set 0 to use Dokan's default
+  DWORD sectorSize;           // set 0 to use Dokan's default
+  BOOL autoConcurrency;       // limit the number of callbacks running at once, adjusting the limit from their queueing delay
+  DWORD minConcurrency;       // bounds of the limit; set 0 to use 1 and the number of Dokan threads respectively
+  DWORD maxConcurrency;
+} DOKAN_TUNING_OPTIONS;
+
+
 typedef struct {
   LPCWSTR mountPoint;
   BOOL writable;
@@ -165,6 +197,9 @@ typedef struct {
   DWORD numSources;
   MOUNT_SOURCE_INITIALIZE_INFO* sources;
   VOLUME_INFO_OVERRIDE volumeInfoOverride;
+  READ_AHEAD_OPTIONS readAheadOptions;
+  DOKAN_TUNING_OPTIONS dokanTuningOptions;
+  BOOL headless;              // serve no volume; the callbacks are only driven by LMF_ReplayOperations (benchmarks)
 } MOUNT_INITIALIZE_INFO;
 
 
@@ -187,13 +222,99 @@ typedef struct {
 } MOUNT_INFO;
 
 
+// background copy-up of deferred-copy files (see MOUNT_INITIALIZE_INFO::deferCopyEnabled)
+typedef struct {
+  DWORD numActive;
+  DWORD numCompleted;
+  DWORD numCancelled;
+  DWORD numFailed;
+  ULONGLONG activeCopiedBytes;    // bytes already copied by the active copy-ups
+  ULONGLONG activeTotalBytes;     // total size of the files being copied by the active copy-ups
+  ULONGLONG completedBytes;       // total size of the files copied by the completed copy-ups
+  ULONGLONG completedMicroseconds;  // total time spent by the completed copy-ups; completedBytes / completedMicroseconds is the copy-up throughput
+} COPY_UP_STATUS;
+
+
+// calls of an operation of a mount or one of its sources (see LMF_GetMountStatistics)
+// latencyBuckets[0] counts calls which took less than 1024 ns; from there each power of two is split into 4 buckets,
+// i.e. latencyBuckets[i] (i >= 1) counts calls which took at least ((4 + (i - 1) % 4) << ((i - 1) / 4 + 8)) ns; the last bucket has no upper bound
+typedef struct {
+  LPCWSTR operationName;          // static string owned by libmergefs
+  ULONGLONG count;
+  ULONGLONG failures;             // calls which returned an error or warning NTSTATUS (including STATUS_OBJECT_NAME_NOT_FOUND)
+  ULONGLONG totalNanoseconds;
+  ULONGLONG maxNanoseconds;
+  ULONGLONG latencyBuckets[MERGEFS_NUM_LATENCY_BUCKETS];
+} OPERATION_STATISTICS;
+
+
+// directory presence filter of a source, which lets lookups skip sources lacking the parent directory (see LMF_GetPresenceFilterStatistics)
+// only immutable sources and the top source of a writable mount are filtered, once the filter has been built in the background
+typedef struct {
+  BOOL ready;
+  DWORD numDirectories;
+  ULONGLONG numBytes;
+  ULONGLONG falsePositivesPerMillion;   // estimated from the filter parameters and numDirectories
+  ULONGLONG queries;
+  ULONGLONG negatives;          // lookups which skipped the source
+  ULONGLONG passedInexistent;   // lookups which passed the filter but found nothing in the source; an upper bound of the false positives
+} PRESENCE_FILTER_STATISTICS;
+
+
+// synthetic workload replayed in-process against a mount (see LMF_ReplayOperations)
+typedef struct {
+  DWORD workload;             // MERGEFS_REPLAY_*
+  LPCWSTR traceFilename;      // MERGEFS_REPLAY_TRACE_FILE only; one "stat|list <path>" or "read|write <offset> <length> <path>" per line
+  DWORD numThreads;           // set 0 to use 1
+  DWORD iterations;           // times the whole workload is replayed; set 0 to use 1
+  ULONGLONG seed;             // MERGEFS_REPLAY_RANDOM_WRITES, MERGEFS_REPLAY_TOUCH and MERGEFS_REPLAY_HANDLE_READS only
+  DWORD numOperations;        // writes or touches per iteration for MERGEFS_REPLAY_RANDOM_WRITES and MERGEFS_REPLAY_TOUCH, reads per thread and iteration for MERGEFS_REPLAY_HANDLE_READS, copy-ups per iteration for MERGEFS_REPLAY_COPY_UPS; set 0 to use the default
+  DWORD transferSize;         // MERGEFS_REPLAY_COPY_UPS only; bytes read and written at a time (PORTATION_INFO::bufferSize); set 0 to use the default
+  BOOL nativeCopy;            // MERGEFS_REPLAY_COPY_UPS only; lets the importer copy from the native handle of the exporter if both support it
+} REPLAY_OPTIONS;
+
+
+typedef struct {
+  ULONGLONG elapsedNanoseconds;
+  ULONGLONG numRequests;      // numRequests / elapsedNanoseconds is the throughput
+  ULONGLONG numFailures;
+  ULONGLONG numBytes;         // MERGEFS_REPLAY_COPY_UPS only; bytes copied up, numBytes / elapsedNanoseconds is the copy-up throughput
+  OPERATION_STATISTICS requests[MERGEFS_NUM_REPLAY_REQUESTS];   // stat, list, read, write, set-info and copy-up requests; each opens and closes a file except the reads of MERGEFS_REPLAY_HANDLE_READS and the copy-ups
+} REPLAY_RESULT;
+
+
+// a metadata file format measured by LMF_BenchmarkMetadataFormats
+typedef struct {
+  ULONGLONG fileBytes;
+  ULONGLONG loadNanoseconds;  // until the entries can be looked up
+  ULONGLONG hitNanoseconds;   // per lookup of an existing entry
+  ULONGLONG missNanoseconds;  // per lookup of a missing entry
+} METADATA_FORMAT_STATISTICS;
+
+
+typedef struct {
+  METADATA_FORMAT_STATISTICS v2;    // read into memory as V2 mounts did
+  METADATA_FORMAT_STATISTICS v4;    // memory-mapped (the current format)
+  ULONGLONG migrationNanoseconds;   // opening the V2 file, which converts it to V4
+} METADATA_BENCHMARK_RESULT;
+
+
 #ifdef FROMLIBMERGEFS
 static_assert(sizeof(PLUGIN_INFO) == 3 * 4 + 1 * 16 + 3 * sizeof(void*));
 static_assert(sizeof(PLUGIN_INFO_EX) == sizeof(PLUGIN_INFO) + 1 * sizeof(void*));
 static_assert(sizeof(MOUNT_SOURCE_INITIALIZE_INFO) == 1 * 16 + 3 * sizeof(void*));
 static_assert(sizeof(VOLUME_INFO_OVERRIDE) == 4 * 4 + 3 * 8 + 2 * sizeof(void*));
-static_assert(sizeof(MOUNT_INITIALIZE_INFO) == 4 * 4 + 3 * sizeof(void*) + sizeof(VOLUME_INFO_OVERRIDE));
-static_assert(sizeof(MOUNT_INFO) == sizeof(MOUNT_INITIALIZE_INFO) - sizeof(VOLUME_INFO_OVERRIDE));
+static_assert(sizeof(READ_AHEAD_OPTIONS) == 2 * 4 + 1 * 8);
+static_assert(sizeof(DOKAN_TUNING_OPTIONS) == 7 * 4);
+static_assert(sizeof(MOUNT_INITIALIZE_INFO) == 5 * 4 + 3 * sizeof(void*) + sizeof(VOLUME_INFO_OVERRIDE) + sizeof(READ_AHEAD_OPTIONS) + sizeof(DOKAN_TUNING_OPTIONS));
+static_assert(sizeof(MOUNT_INFO) == sizeof(MOUNT_INITIALIZE_INFO) - sizeof(VOLUME_INFO_OVERRIDE) - sizeof(READ_AHEAD_OPTIONS) - sizeof(DOKAN_TUNING_OPTIONS) - 1 * 4);
+static_assert(sizeof(COPY_UP_STATUS) == 4 * 4 + 4 * 8);
+static_assert(sizeof(OPERATION_STATISTICS) == (4 + MERGEFS_NUM_LATENCY_BUCKETS) * 8 + 1 * sizeof(void*));
+static_assert(sizeof(PRESENCE_FILTER_STATISTICS) == 2 * 4 + 5 * 8);
+static_assert(sizeof(REPLAY_OPTIONS) == 6 * 4 + 1 * 8 + 1 * sizeof(void*));
+static_assert(sizeof(REPLAY_RESULT) == 4 * 8 + MERGEFS_NUM_REPLAY_REQUESTS * sizeof(OPERATION_STATISTICS));
+static_assert(sizeof(METADATA_FORMAT_STATISTICS) == 4 * 8);
+static_assert(sizeof(METADATA_BENCHMARK_RESULT) == 2 * sizeof(METADATA_FORMAT_STATISTICS) + 1 * 8);
 #endif
 
 
@@ -221,6 +342,14 @@ MFEXTERNC MFCIMPORT BOOL WINAPI LMF_GetSourcePluginInfo(PLUGIN_ID pluginId, PLUG
 MFEXTERNC MFCIMPORT BOOL WINAPI LMF_Mount(const MOUNT_INITIALIZE_INFO* mountInitializeInfo, PMountCallback callback, MOUNT_ID* outMountId) MFNOEXCEPT;
 MFEXTERNC MFCIMPORT BOOL WINAPI LMF_GetMounts(DWORD* outNumMountIds, MOUNT_ID* outMountIds, DWORD maxMountIds) MFNOEXCEPT;
 MFEXTERNC MFCIMPORT BOOL WINAPI LMF_GetMountInfo(MOUNT_ID mountId, MOUNT_INFO* outMountInfo) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_GetCopyUpStatus(MOUNT_ID mountId, COPY_UP_STATUS* outCopyUpStatus) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_GetMountStatistics(MOUNT_ID mountId, DWORD sourceIndex, DWORD* outNumOperations, OPERATION_STATISTICS* outStatistics, DWORD maxOperations) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_GetPresenceFilterStatistics(MOUNT_ID mountId, DWORD sourceIndex, PRESENCE_FILTER_STATISTICS* outStatistics) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_StartMountTrace(MOUNT_ID mountId, DWORD maxEvents) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_StopMountTrace(MOUNT_ID mountId) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_SaveMountTrace(MOUNT_ID mountId, LPCWSTR filepath) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_ReplayOperations(MOUNT_ID mountId, const REPLAY_OPTIONS* replayOptions, REPLAY_RESULT* outReplayResult) MFNOEXCEPT;
+MFEXTERNC MFCIMPORT BOOL WINAPI LMF_BenchmarkMetadataFormats(LPCWSTR directory, DWORD numEntries, METADATA_BENCHMARK_RESULT* outResult) MFNOEXCEPT;
 MFEXTERNC MFCIMPORT BOOL WINAPI LMF_SafeUnmount(MOUNT_ID mountId) MFNOEXCEPT;
 MFEXTERNC MFCIMPORT BOOL WINAPI LMF_Unmount(MOUNT_ID mountId) MFNOEXCEPT;
 MFEXTERNC MFCIMPORT BOOL WINAPI LMF_SafeUnmountAll() MFNOEXCEPT;
@@ -35,6 +35,7 @@ typedef void(WINAPI *PListStreamsCallback)(PWIN32_FIND_STREAM_DATA FindStreamDat
 
 typedef struct {
   BOOL writable;
+  BOOL cacheable;   // file contents never change while mounted; libmergefs may cache data read from this source
 } SOURCE_INFO;
 
 
@@ -62,12 +63,21 @@ typedef struct {
   LARGE_INTEGER currentOffset;
   DWORD currentSize;
   LPCSTR currentData;
+
+  // set by libmergefs, read by exporter
+  DWORD bufferSize;     // preferred maximum size of each chunk; 0 to let the exporter decide (see GetPortationBufferSize in SourceCpp.hpp)
+
+  // set by exporter, read by importer
+  HANDLE nativeHandle;  // optional; a readable handle of the exported file if it is backed by a real file, otherwise NULL
+
+  // set by importer, read by libmergefs
+  BOOL dataImported;    // TRUE if the importer has already copied the whole data using nativeHandle in ImportStart; ExportData and ImportData are not called then
 } PORTATION_INFO;
 
 
 #ifdef FROMLIBMERGEFS
-static_assert(sizeof(SOURCE_INFO) == 1 * 4);
-static_assert(sizeof(PORTATION_INFO) == 6 * 4 + 5 * 8 + 5 * sizeof(void*));
+static_assert(sizeof(SOURCE_INFO) == 2 * 4);
+static_assert(sizeof(PORTATION_INFO) == 8 * 4 + 5 * 8 + 6 * sizeof(void*));
 #endif
 
 
@@ -85,6 +95,10 @@ MFEXTERNC MFPEXPORT BOOL WINAPI Unmount(SOURCE_CONTEXT_ID sourceContextId) MFNOE
 
 MFEXTERNC MFPEXPORT BOOL WINAPI GetSourceInfo(SOURCE_INFO* sourceInfo, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
+// optional; queries Count files at once, as if GetFileInfo were called for each of them
+// Statuses[i] and Win32FileAttributeData[i] (if Win32FileAttributeData is not NULL) receive the result for FileNames[i]
+// the return value is the status of the batch itself; return STATUS_NOT_IMPLEMENTED (or do not export) to let libmergefs call GetFileInfo for each file instead
+MFEXTERNC MFPEXPORT NTSTATUS WINAPI GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI GetDirectoryInfo(LPCWSTR FileName, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI RemoveFile(LPCWSTR FileName, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI ExportStart(PORTATION_INFO* PortationInfo, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
@@ -99,6 +113,9 @@ MFEXTERNC MFPEXPORT NTSTATUS WINAPI SwitchDestinationOpen(LPCWSTR FileName, PDOK
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI SwitchDestinationCleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI SwitchDestinationClose(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
+// optional; return STATUS_NOT_IMPLEMENTED (or do not export) to let libmergefs filter the result of ListFiles instead
+// SearchPattern is an MS-DOS style expression (see DokanIsNameInExpression); returning extra entries is allowed as libmergefs filters them again
+MFEXTERNC MFPEXPORT NTSTATUS WINAPI ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
 
 MFEXTERNC MFPEXPORT NTSTATUS WINAPI DZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, BOOL MaybeSwitched, FILE_CONTEXT_ID FileContextId, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT;
@@ -17,6 +17,7 @@
 #include "SourceCpp.hpp"
 #include "../CaseSensitivity.hpp"
 
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <ios>
@@ -194,6 +195,21 @@ Win32Error::Win32Error(const std::string& errorMessage) :
 
 
 
+std::size_t GetPortationBufferSize(const PORTATION_INFO* portationInfo) noexcept {
+  std::size_t size = portationInfo->bufferSize ? portationInfo->bufferSize : PortationDefaultBufferSize;
+  if (size > PortationMaxBufferSize) {
+    size = PortationMaxBufferSize;
+  }
+  // do not allocate a large buffer for a small file
+  if (portationInfo->fileSize.QuadPart >= 0 && static_cast<ULONGLONG>(portationInfo->fileSize.QuadPart) < size) {
+    size = static_cast<std::size_t>(portationInfo->fileSize.QuadPart);
+  }
+  size = (size + PortationBufferAlignment - 1) / PortationBufferAlignment * PortationBufferAlignment;
+  return size ? size : PortationBufferAlignment;
+}
+
+
+
 // SourceMountFileBase
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -387,6 +403,24 @@ std::shared_ptr<SourceMountFileBase> SourceMountBase::GetSourceMountFileBase(FIL
 }
 
 
+NTSTATUS SourceMountBase::GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) {
+  // override this to share the work among the files (e.g. one lock or one round trip for all of them)
+  if (Count && (!FileNames || !Statuses)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  for (DWORD i = 0; i < Count; i++) {
+    Statuses[i] = GetFileInfo(FileNames[i], Win32FileAttributeData ? &Win32FileAttributeData[i] : nullptr);
+  }
+  return STATUS_SUCCESS;
+}
+
+
+NTSTATUS SourceMountBase::ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) {
+  // libmergefs falls back to ListFiles
+  return STATUS_NOT_IMPLEMENTED;
+}
+
+
 NTSTATUS SourceMountBase::ExportStart(PORTATION_INFO* PortationInfo) {
   if (!PortationInfo) {
     return STATUS_INVALID_PARAMETER;
@@ -633,6 +667,13 @@ NTSTATUS WINAPI GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32Fi
 }
 
 
+NTSTATUS WINAPI GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
+  return WrapException([=]() -> NTSTATUS {
+    return GetSourceMountBase(sourceContextId).GetFileInfoBatch(FileNames, Count, Statuses, Win32FileAttributeData);
+  });
+}
+
+
 NTSTATUS WINAPI GetDirectoryInfo(LPCWSTR FileName, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
   return WrapException([=]() -> NTSTATUS {
     return GetSourceMountBase(sourceContextId).GetDirectoryInfo(FileName);
@@ -731,6 +772,13 @@ NTSTATUS WINAPI ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBAC
 }
 
 
+NTSTATUS WINAPI ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
+  return WrapException([=]() -> NTSTATUS {
+    return GetSourceMountBase(sourceContextId).ListFilesWithPattern(FileName, SearchPattern, Callback, CallbackContext);
+  });
+}
+
+
 NTSTATUS WINAPI ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext, SOURCE_CONTEXT_ID sourceContextId) MFNOEXCEPT {
   return WrapException([=]() -> NTSTATUS {
     return GetSourceMountBase(sourceContextId).ListStreams(FileName, Callback, CallbackContext);
@@ -17,6 +17,7 @@
 #include "Source.h"
 #include "../CaseSensitivity.hpp"
 
+#include <cstddef>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -66,6 +67,16 @@ public:
 };
 
 
+// the page size, so that a request for 4 KiB still gets the chunks of the former fixed-size buffers
+constexpr std::size_t PortationBufferAlignment = 4 * 1024;
+constexpr std::size_t PortationDefaultBufferSize = 1024 * 1024;
+constexpr std::size_t PortationMaxBufferSize = 16 * 1024 * 1024;
+
+// returns the size of the export buffer negotiated with libmergefs (PORTATION_INFO::bufferSize)
+// the result is aligned to PortationBufferAlignment, at most PortationMaxBufferSize, and not much larger than the file
+std::size_t GetPortationBufferSize(const PORTATION_INFO* portationInfo) noexcept;
+
+
 class SourceMountFileBase {
   bool privateCleanuped;
   bool privateClosed;
@@ -150,9 +161,11 @@ public:
 
   virtual BOOL GetSourceInfo(SOURCE_INFO* sourceInfo) = 0;
   virtual NTSTATUS GetFileInfo(LPCWSTR FileName, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData) = 0;
+  virtual NTSTATUS GetFileInfoBatch(const LPCWSTR* FileNames, DWORD Count, NTSTATUS* Statuses, WIN32_FILE_ATTRIBUTE_DATA* Win32FileAttributeData);
   virtual NTSTATUS GetDirectoryInfo(LPCWSTR FileName) = 0;
   virtual NTSTATUS RemoveFile(LPCWSTR FileName) = 0;
   virtual NTSTATUS ListFiles(LPCWSTR FileName, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext) = 0;
+  virtual NTSTATUS ListFilesWithPattern(LPCWSTR FileName, LPCWSTR SearchPattern, PListFilesCallback Callback, CALLBACK_CONTEXT CallbackContext);
   virtual NTSTATUS ListStreams(LPCWSTR FileName, PListStreamsCallback Callback, CALLBACK_CONTEXT CallbackContext) = 0;
   virtual NTSTATUS SwitchDestinationPrepareImpl(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext, ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) = 0;
   virtual NTSTATUS SwitchDestinationCleanupImpl(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo, FILE_CONTEXT_ID FileContextId) = 0;
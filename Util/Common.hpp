@@ -15,5 +15,13 @@ namespace util {
     return li;
   }
 
+  // for positional I/O on synchronous handles (does not depend on the file pointer)
+  inline OVERLAPPED CreateOverlapped(ULONGLONG offset) noexcept {
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    return overlapped;
+  }
+
   std::string ToLowerString(std::string_view string);
 }
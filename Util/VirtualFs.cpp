@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cwctype>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <Windows.h>
 
@@ -52,4 +56,86 @@ namespace util::vfs {
     }
     return filepath.substr(lastBackslashPos + 1);
   }
+
+
+  bool IsMatchAllExpression(std::wstring_view expression) noexcept {
+    return expression.empty() || expression == L"*"sv;
+  }
+
+
+  bool IsNameInExpression(std::wstring_view expression, std::wstring_view name, bool caseSensitive) {
+    constexpr wchar_t DosStar = L'<';
+    constexpr wchar_t DosQm = L'>';
+    constexpr wchar_t DosDot = L'"';
+
+    if (IsMatchAllExpression(expression)) {
+      return true;
+    }
+
+    const auto lastDotPos = name.find_last_of(L'.');
+    const auto equals = [caseSensitive](wchar_t a, wchar_t b) {
+      return caseSensitive ? a == b : std::towupper(a) == std::towupper(b);
+    };
+
+    // reachable[n]: the expression consumed so far can match name.substr(0, n)
+    std::vector<bool> reachable(name.size() + 1, false);
+    std::vector<bool> next(name.size() + 1, false);
+    reachable[0] = true;
+    for (const auto e : expression) {
+      std::fill(next.begin(), next.end(), false);
+      for (std::size_t n = 0; n <= name.size(); n++) {
+        if (!reachable[n]) {
+          continue;
+        }
+        switch (e) {
+          case L'*':
+            // matches zero or more characters
+            for (std::size_t m = n; m <= name.size(); m++) {
+              next[m] = true;
+            }
+            break;
+
+          case DosStar:
+            // matches zero or more characters until the final dot
+            next[n] = true;
+            for (std::size_t m = n; m < name.size() && (lastDotPos == std::wstring_view::npos || m < lastDotPos); m++) {
+              next[m + 1] = true;
+            }
+            break;
+
+          case L'?':
+            if (n < name.size()) {
+              next[n + 1] = true;
+            }
+            break;
+
+          case DosQm:
+            // matches any single character, or nothing at a dot or at the end of the name
+            if (n < name.size() && name[n] != L'.') {
+              next[n + 1] = true;
+            } else {
+              next[n] = true;
+            }
+            break;
+
+          case DosDot:
+            // matches a dot, or nothing at the end of the name
+            if (n < name.size() && name[n] == L'.') {
+              next[n + 1] = true;
+            } else if (n == name.size()) {
+              next[n] = true;
+            }
+            break;
+
+          default:
+            if (n < name.size() && equals(e, name[n])) {
+              next[n + 1] = true;
+            }
+            break;
+        }
+      }
+      reachable.swap(next);
+    }
+    return reachable[name.size()];
+  }
 }
@@ -14,4 +14,8 @@ namespace util::vfs {
   std::wstring_view GetParentPath(std::wstring_view filepath);
   std::wstring_view GetParentPathTs(std::wstring_view filepath);
   std::wstring_view GetBaseName(std::wstring_view filepath);
+
+  // MS-DOS style expression matching (same rules as FsRtlIsNameInExpression / DokanIsNameInExpression)
+  bool IsMatchAllExpression(std::wstring_view expression) noexcept;
+  bool IsNameInExpression(std::wstring_view expression, std::wstring_view name, bool caseSensitive);
 }